@@ -0,0 +1,30 @@
+/**
+ *	Tempesta kernel emulation unit testing framework.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __CPUFEATURE_H__
+#define __CPUFEATURE_H__
+
+#define X86_FEATURE_SSE4_2	"sse4.2"
+#define X86_FEATURE_SSSE3	"ssse3"
+#define X86_FEATURE_AVX2	"avx2"
+
+#define static_cpu_has(f)	__builtin_cpu_supports(f)
+#define boot_cpu_has(f)		__builtin_cpu_supports(f)
+
+#endif /* __CPUFEATURE_H__ */
@@ -20,12 +20,25 @@
 #ifndef __BITOPS_H__
 #define __BITOPS_H__
 
+#include <string.h>
+
+#include "compiler.h"
+
 #define IS_IMMEDIATE(nr)		(__builtin_constant_p(nr))
 #define BITOP_ADDR(x)			"+m" (*(volatile long *) (x))
 #define CONST_MASK_ADDR(nr, addr)	BITOP_ADDR((void *)(addr) + ((nr)>>3))
 #define CONST_MASK(nr)			(1 << ((nr) & 7))
 #define LOCK_PREFIX "\n\tlock; "
 
+#define BITS_TO_LONGS(nr)		(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits)	unsigned long name[BITS_TO_LONGS(bits)]
+
+/* linux/bitmap.h */
+#define bitmap_zero(dst, nbits)						\
+	memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(long))
+#define bitmap_copy(dst, src, nbits)					\
+	memcpy(dst, src, BITS_TO_LONGS(nbits) * sizeof(long))
+
 static inline void
 set_bit(unsigned int nr, volatile unsigned long *addr)
 {
@@ -40,6 +53,29 @@ set_bit(unsigned int nr, volatile unsigned long *addr)
 	}
 }
 
+static inline int
+test_bit(unsigned int nr, const volatile unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline int
+test_and_set_bit(unsigned int nr, volatile unsigned long *addr)
+{
+	unsigned long m = 1UL << (nr % BITS_PER_LONG);
+
+	return !!(__atomic_fetch_or(&addr[nr / BITS_PER_LONG], m, __ATOMIC_SEQ_CST) & m);
+}
+
+static inline unsigned long
+__ffs(unsigned long word)
+{
+	asm("rep; bsf %1,%0"
+		: "=r" (word)
+		: "rm" (word));
+	return word;
+}
+
 static inline unsigned long
 ffz(unsigned long word)
 {
@@ -0,0 +1,38 @@
+/**
+ *	Tempesta kernel emulation unit testing framework.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __BUG_H__
+#define __BUG_H__
+
+#include <stdio.h>
+
+#include "compiler.h"
+
+#define BUILD_BUG_ON(c)	_Static_assert(!(c), #c)
+
+#define __WARN()	fprintf(stderr, "WARNING at %s:%d\n", __FILE__, __LINE__)
+#define WARN_ON(c)							\
+({									\
+	int __r = !!(c);						\
+	if (unlikely(__r))						\
+		__WARN();						\
+	__r;								\
+})
+
+#endif /* __BUG_H__ */
@@ -25,12 +25,26 @@
 /* asm/types.h */
 #define BITS_PER_LONG	64
 
-#define likely(e)	__builtin_expect((e), 1)
-#define unlikely(e)	__builtin_expect((e), 0)
+#define likely(e)	__builtin_expect(!!(e), 1)
+#define unlikely(e)	__builtin_expect(!!(e), 0)
 
 #define BUG_ON(c)	assert(!(c))
 #define BUG()		abort()
 
 #define __percpu
 
+#define __aligned(x)		__attribute__((aligned(x)))
+#define __maybe_unused		__attribute__((unused))
+
+/* linux/init.h */
+#define __init
+#define __exit
+
+/* x86-64 doesn't reorder stores with other stores. */
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+#define smp_wmb()	barrier()
+
+#define READ_ONCE(x)		(*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile typeof(x) *)&(x) = (v))
+
 #endif /* __COMPILER_H__ */
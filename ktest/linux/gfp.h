@@ -0,0 +1,56 @@
+/**
+ *	Tempesta kernel emulation unit testing framework.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __GFP_H__
+#define __GFP_H__
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+#define MAX_ORDER	11
+
+#define GFP_ATOMIC	0
+#define GFP_KERNEL	0
+#define __GFP_ZERO	0x8000
+
+static inline int
+get_order(unsigned long size)
+{
+	int order = 0;
+
+	for (size = (size - 1) / PAGE_SIZE; size; size >>= 1)
+		++order;
+	return order;
+}
+
+static inline unsigned long
+__get_free_pages(int gfp_mask, unsigned int order)
+{
+	void *p = aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+
+	if (p && (gfp_mask & __GFP_ZERO))
+		memset(p, 0, PAGE_SIZE << order);
+	return (unsigned long)p;
+}
+
+#define free_pages(addr, order)		free((void *)(addr))
+
+#endif /* __GFP_H__ */
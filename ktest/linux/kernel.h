@@ -20,8 +20,11 @@
 #ifndef __KERNEL_H__
 #define __KERNEL_H__
 
+#include <limits.h>
 #include <stdio.h>
+#include <time.h>
 
+#include "bitops.h"
 #include "compiler.h"
 
 #ifndef NDEBUG
@@ -31,9 +34,60 @@
 #ifndef ENOMEM
 #define ENOMEM		1
 #endif
+#ifndef EINVAL
+#define EINVAL		22
+#endif
+#ifndef EAGAIN
+#define EAGAIN		11
+#endif
+#ifndef EBUSY
+#define EBUSY		16
+#endif
+
+#ifndef ENOSPC
+#define ENOSPC		28
+#endif
+
+#define KERN_ERR		""
+#define KERN_WARNING		""
 
+#define printk(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
 #define pr_err(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
 #define pr_warn(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)	fprintf(stdout, fmt, ##__VA_ARGS__)
 #define pr_debug(fmt, ...)	fprintf(stdout, fmt, ##__VA_ARGS__)
 
+#define ARRAY_SIZE(x)		(sizeof(x) / sizeof(*(x)))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+#define min(x, y)							\
+({									\
+	typeof(x) __x = (x);						\
+	typeof(y) __y = (y);						\
+	__x < __y ? __x : __y;						\
+})
+#define max(x, y)							\
+({									\
+	typeof(x) __x = (x);						\
+	typeof(y) __y = (y);						\
+	__x > __y ? __x : __y;						\
+})
+#define min_t(t, x, y)		min((t)(x), (t)(y))
+#define max_t(t, x, y)		max((t)(x), (t)(y))
+
+/* linux/export.h */
+#define EXPORT_SYMBOL(sym)
+
+static inline unsigned long
+get_seconds(void)
+{
+	return time(NULL);
+}
+
+static inline void
+getnstimeofday(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
 #endif /* __KERNEL_H__ */
@@ -0,0 +1,29 @@
+/**
+ *	Tempesta kernel emulation unit testing framework.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __NET_H__
+#define __NET_H__
+
+#include "kernel.h"
+
+#define net_err_ratelimited(fmt, ...)	pr_err(fmt, ##__VA_ARGS__)
+#define net_warn_ratelimited(fmt, ...)	pr_warn(fmt, ##__VA_ARGS__)
+#define net_info_ratelimited(fmt, ...)	pr_info(fmt, ##__VA_ARGS__)
+
+#endif /* __NET_H__ */
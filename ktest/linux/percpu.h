@@ -30,5 +30,12 @@
 #define for_each_possible_cpu(c)	for (c = 0; c < NR_CPUS; ++c)
 #define per_cpu_ptr(a, c)		&(a)[c]
 #define this_cpu_ptr(a)			(&(a)[__thr_id])
+#define raw_cpu_ptr(a)			this_cpu_ptr(a)
+
+/*
+ * Static per-CPU variables are plain variables, so this_cpu_ptr() works
+ * for them in the main thread only. Use them in single threaded tests.
+ */
+#define DEFINE_PER_CPU(type, name)	__typeof__(type) name
 
 #endif /* __PERCPU_H__ */
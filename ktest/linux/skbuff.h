@@ -0,0 +1,112 @@
+/**
+ *	Tempesta kernel emulation unit testing framework.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __SKBUFF_H__
+#define __SKBUFF_H__
+
+#include <stdlib.h>
+
+#include "gfp.h"
+#include "list.h"
+
+#define MAX_SKB_FRAGS		17
+#define MAX_TCP_HEADER		320
+
+/* Page fragments are plain page-sized buffers. */
+struct page;
+
+typedef struct skb_frag_struct {
+	struct page	*page;
+	unsigned int	page_offset;
+	unsigned int	size;
+} skb_frag_t;
+
+struct skb_shared_info {
+	unsigned char	nr_frags;
+	skb_frag_t	frags[MAX_SKB_FRAGS];
+};
+
+/*
+ * Linear data only, paged data lives in skb_shared_info which is placed
+ * right after the SKB descriptor rather than at the end of the data.
+ */
+struct sk_buff {
+	unsigned int	len;
+	unsigned int	data_len;
+	unsigned int	truesize;
+	unsigned char	*head;
+	unsigned char	*data;
+	unsigned int	tail;
+	unsigned int	end;
+	char		cb[48] __attribute__((aligned(8)));
+};
+
+/* Sync sockets control block, as Tempesta's kernel patch defines it. */
+typedef struct {
+	struct sk_buff	*next;
+	struct sk_buff	*prev;
+} SsSkbCb;
+
+#define TFW_SKB_CB(s)		((SsSkbCb *)(s)->cb)
+
+#define skb_shinfo(skb)		((struct skb_shared_info *)((skb) + 1))
+
+#define skb_frag_size(f)	((f)->size)
+#define skb_frag_size_add(f, d)	((f)->size += (d))
+#define skb_frag_address(f)	((void *)(f)->page + (f)->page_offset)
+
+static inline unsigned char *
+skb_tail_pointer(const struct sk_buff *skb)
+{
+	return skb->head + skb->tail;
+}
+
+static inline void
+skb_reserve(struct sk_buff *skb, int len)
+{
+	skb->data += len;
+	skb->tail += len;
+}
+
+static inline struct sk_buff *
+alloc_skb(unsigned int size, int gfp_mask)
+{
+	struct sk_buff *skb = calloc(1, sizeof(*skb)
+				       + sizeof(struct skb_shared_info) + size);
+
+	if (!skb)
+		return NULL;
+	skb->head = skb->data = (unsigned char *)(skb_shinfo(skb) + 1);
+	skb->end = size;
+	skb->truesize = size;
+
+	return skb;
+}
+
+static inline void
+kfree_skb(struct sk_buff *skb)
+{
+	int i;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; ++i)
+		free(skb_shinfo(skb)->frags[i].page);
+	free(skb);
+}
+
+#endif /* __SKBUFF_H__ */
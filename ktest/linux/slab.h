@@ -36,6 +36,7 @@
 
 /* asm/page.h */
 #define PAGE_SIZE	4096UL
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
 
 #define kfree(p)	free(p)
 
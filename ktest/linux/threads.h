@@ -30,6 +30,8 @@
  */
 #define local_bh_disable()
 #define local_bh_enable()
+#define preempt_disable()
+#define preempt_enable()
 
 static size_t __thr_max = 0;
 static size_t __thread __thr_id;
@@ -56,7 +58,7 @@ __thr_func_wrapper(void *data)
 	return ret;
 }
 
-static int
+static inline int
 spawn_thread(pthread_t *thr_id, void *(func)(void *), void *arg)
 {
 	__ThrData *d = malloc(sizeof(__ThrData));
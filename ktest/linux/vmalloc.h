@@ -0,0 +1,42 @@
+/**
+ *	Tempesta kernel emulation unit testing framework.
+ *
+ * Copyright (C) 2015 Tempesta Technologies.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __VMALLOC_H__
+#define __VMALLOC_H__
+
+#include <string.h>
+
+#include "slab.h"
+
+static inline void *
+vzalloc_node(unsigned long size, int node)
+{
+	void *p;
+
+	if (posix_memalign(&p, PAGE_SIZE, size))
+		return NULL;
+	memset(p, 0, size);
+
+	return p;
+}
+
+#define vzalloc(s)	vzalloc_node(s, 0)
+#define vfree(p)	free(p)
+
+#endif /* __VMALLOC_H__ */
@@ -0,0 +1,203 @@
+/**
+ *		Tempesta DB
+ *
+ * Negative lookup filter.
+ *
+ * The filter is a blocked counting Bloom filter: each key is mapped to one
+ * cache line of 8-bit counters and increments TDB_BLOOM_K counters in it, so
+ * a lookup of a key which isn't in the table costs one cache line instead of
+ * the index descend. Counters are decremented on records removal, so
+ * the filter doesn't degrade on tables with short living records like
+ * blocking rules. Counters are updated by compare-and-swap of the counters
+ * word, so inserts and removals don't need locks. Saturated counters are
+ * never changed, so they can only produce false positives.
+ *
+ * The filter must be updated before a record is inserted and after it's
+ * removed, so a lookup never misses a record visible in the index.
+ *
+ * A new filter is populated from the table records while the table is
+ * updated, so it doesn't filter lookups and isn't decremented until all the
+ * records are added: a record removed before it's added by the walk would
+ * decrement counters of other keys. Records inserted during the walk can be
+ * counted twice, which leads to false positives only.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/vmalloc.h>
+
+#include "bloom.h"
+
+/* Number of counters in a filter block, the block is one cache line. */
+#define TDB_BLOOM_BLK_CNT	64
+/* Number of counters updated for each key. */
+#define TDB_BLOOM_K		4
+/*
+ * Number of keys per block, gives about 1% of false positives
+ * for TDB_BLOOM_K counters per key.
+ */
+#define TDB_BLOOM_BLK_KEYS	6
+#define TDB_BLOOM_CNT_MAX	0xff
+
+typedef struct {
+	atomic_t	cnt[TDB_BLOOM_BLK_CNT / 4];
+} TdbBloomBlk;
+
+/**
+ * @shift	- right shift of key hash giving block index;
+ * @populating	- the filter is being populated from the table records;
+ * @blk		- the filter blocks, power of 2 number;
+ */
+struct tdb_bloom_t {
+	unsigned int	shift;
+	bool		populating;
+	TdbBloomBlk	blk[0] __attribute__((aligned(L1_CACHE_BYTES)));
+};
+
+/**
+ * Keys are typically hashes already, but they can have poor lower bits,
+ * e.g. IPv4 addresses, so mix them. Upper bits of the hash select the block
+ * and lower bits select the counters.
+ */
+static inline unsigned long
+tdb_bloom_hash(unsigned long key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdUL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53UL;
+	key ^= key >> 33;
+
+	return key;
+}
+
+static inline unsigned int
+tdb_bloom_cnt(unsigned int w, unsigned int c)
+{
+	return (w >> ((c & 3) * 8)) & TDB_BLOOM_CNT_MAX;
+}
+
+static void
+tdb_bloom_upd(TdbBloom *bf, unsigned long key, bool inc)
+{
+	int i;
+	unsigned long h = tdb_bloom_hash(key);
+	TdbBloomBlk *b = &bf->blk[h >> bf->shift];
+
+	for (i = 0; i < TDB_BLOOM_K; ++i, h >>= 6) {
+		unsigned int c = h & (TDB_BLOOM_BLK_CNT - 1);
+		atomic_t *w = &b->cnt[c / 4];
+		unsigned int old, new, d = 1U << ((c & 3) * 8);
+
+		do {
+			old = atomic_read(w);
+			/*
+			 * Saturated counters are sticky. Zero counters can't
+			 * be decremented if additions and removals match.
+			 */
+			if (tdb_bloom_cnt(old, c) == TDB_BLOOM_CNT_MAX
+			    || (!inc && !tdb_bloom_cnt(old, c)))
+				break;
+			new = inc ? old + d : old - d;
+		} while (atomic_cmpxchg(w, old, new) != old);
+	}
+}
+
+/**
+ * Add key @key to filter @bf, must be called before the record insertion.
+ */
+void
+tdb_bloom_add(TdbBloom *bf, unsigned long key)
+{
+	tdb_bloom_upd(bf, key, true);
+}
+
+/**
+ * Remove @n records with key @key from filter @bf, must be called after
+ * the records removal.
+ */
+void
+tdb_bloom_del(TdbBloom *bf, unsigned long key, int n)
+{
+	if (unlikely(READ_ONCE(bf->populating)))
+		return;
+	while (n-- > 0)
+		tdb_bloom_upd(bf, key, false);
+}
+
+/**
+ * @return false if there are no records with key @key in the table and true
+ * if there can be such records.
+ */
+bool
+tdb_bloom_test(const TdbBloom *bf, unsigned long key)
+{
+	int i;
+	unsigned long h = tdb_bloom_hash(key);
+	const TdbBloomBlk *b = &bf->blk[h >> bf->shift];
+
+	if (unlikely(READ_ONCE(bf->populating)))
+		return true;
+
+	for (i = 0; i < TDB_BLOOM_K; ++i, h >>= 6) {
+		unsigned int c = h & (TDB_BLOOM_BLK_CNT - 1);
+
+		if (!tdb_bloom_cnt(atomic_read(&b->cnt[c / 4]), c))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Allocate filter for @nkeys keys at NUMA node @node. The filter is in
+ * populating state until tdb_bloom_populated() is called.
+ */
+TdbBloom *
+tdb_bloom_alloc(unsigned long nkeys, int node)
+{
+	/* At least 2 blocks: right shift by BITS_PER_LONG is undefined. */
+	unsigned int order = 1;
+	TdbBloom *bf;
+
+	while ((1UL << order) * TDB_BLOOM_BLK_KEYS < nkeys)
+		++order;
+
+	bf = vzalloc_node(sizeof(*bf) + sizeof(TdbBloomBlk) * (1UL << order),
+			  node);
+	if (!bf)
+		return NULL;
+	bf->shift = BITS_PER_LONG - order;
+	bf->populating = true;
+
+	return bf;
+}
+
+/**
+ * All the table records are added to filter @bf, so start to filter lookups.
+ */
+void
+tdb_bloom_populated(TdbBloom *bf)
+{
+	smp_wmb();
+	WRITE_ONCE(bf->populating, false);
+}
+
+void
+tdb_bloom_free(TdbBloom *bf)
+{
+	vfree(bf);
+}
@@ -0,0 +1,34 @@
+/**
+ *		Tempesta DB
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#include "tdb.h"
+
+typedef struct tdb_bloom_t TdbBloom;
+
+TdbBloom *tdb_bloom_alloc(unsigned long nkeys, int node);
+void tdb_bloom_free(TdbBloom *bf);
+void tdb_bloom_populated(TdbBloom *bf);
+void tdb_bloom_add(TdbBloom *bf, unsigned long key);
+void tdb_bloom_del(TdbBloom *bf, unsigned long key, int n);
+bool tdb_bloom_test(const TdbBloom *bf, unsigned long key);
+
+#endif /* __BLOOM_H__ */
@@ -0,0 +1,162 @@
+/**
+ *		Tempesta DB
+ *
+ * Background compaction of variable-size records.
+ *
+ * Chunks of long-living records are scattered over many extents, which
+ * increases TLB pressure on reading the records. The compactor thread moves
+ * chunks of such records to currently used extent. Tables are scanned
+ * incrementally in the same way as by the expired records collector, and
+ * the number of moved bytes is limited for each pass, so the compactor
+ * doesn't hold bucket locks for long and doesn't eat memory bandwidth.
+ * Too large records aren't moved for the same reason.
+ *
+ * Freed space isn't reused by TDB, so tables with little free space aren't
+ * compacted.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/freezer.h>
+#include <linux/kthread.h>
+
+#include "compact.h"
+#include "htrie.h"
+#include "table.h"
+
+/* Number of keys collected by one walk over a table. */
+#define TDB_CMP_BATCH		64
+/* Maximum number of bytes moved in each table per pass. */
+#define TDB_CMP_RATE		(4 << 20)
+/* Maximum number of bytes moved under one bucket lock. */
+#define TDB_CMP_REC_MAX		(256 << 10)
+/* Interval between compactor passes. */
+#define TDB_CMP_INTERVAL	HZ
+/* Minimum free space in a table to compact it. */
+#define TDB_CMP_FREE_MIN(h)	((h)->dbsz / 4)
+
+static struct task_struct *tdb_cmp_thr;
+
+/**
+ * Compaction context.
+ *
+ * @dbh		- the table header;
+ * @ops		- the table owner callbacks;
+ * @n		- number of collected keys;
+ * @keys	- keys of fragmented records;
+ */
+typedef struct {
+	TdbHdr			*dbh;
+	const TdbRelocOps	*ops;
+	unsigned int		n;
+	unsigned long		keys[TDB_CMP_BATCH];
+} TdbCmpCtx;
+
+static int
+tdb_cmp_collect(void *data, TdbRec *rec)
+{
+	size_t n;
+	TdbCmpCtx *ctx = data;
+
+	if (tdb_rec_expired(rec, get_seconds()) || !ctx->ops->movable(rec))
+		return 0;
+	n = tdb_htrie_vrec_fragmented(ctx->dbh, (TdbVRec *)rec);
+	if (!n || n > TDB_CMP_REC_MAX)
+		return 0;
+	/* Full key collisions are compacted by one call. */
+	if (ctx->n && ctx->keys[ctx->n - 1] == rec->key)
+		return 0;
+
+	ctx->keys[ctx->n++] = rec->key;
+
+	return ctx->n == TDB_CMP_BATCH;
+}
+
+/**
+ * Collect fragmented records under bucket read locks and move them under
+ * write locks. Called under tables mutex, so @db can't be closed concurrently.
+ */
+static void
+tdb_cmp_table(TDB *db)
+{
+	int i, more;
+	long r, moved = 0;
+	TdbCmpCtx ctx = { .dbh = db->hdr, .ops = db->reloc };
+
+	if (!ctx.ops || !TDB_HTRIE_VARLENRECS(db->hdr))
+		return;
+
+	while (moved < TDB_CMP_RATE) {
+		if (db->hdr->dbsz - atomic64_read(&db->hdr->nwb)
+		    < TDB_CMP_FREE_MIN(db->hdr))
+			break;
+
+		ctx.n = 0;
+		more = tdb_htrie_walk_from(db->hdr, &db->cmp_cursor,
+					   tdb_cmp_collect, &ctx);
+
+		for (i = 0; i < ctx.n; ++i) {
+			r = tdb_htrie_compact(db->hdr, ctx.keys[i],
+					      TDB_CMP_REC_MAX, ctx.ops);
+			if (r < 0)
+				return;
+			moved += r;
+			cond_resched();
+		}
+
+		if (!more)
+			break;
+	}
+
+	if (moved)
+		TDB_DBG("Moved %ld bytes in table %s\n", moved, db->tbl_name);
+}
+
+static int
+tdb_cmp_thread(void *arg)
+{
+	set_freezable();
+	set_user_nice(current, MAX_NICE);
+
+	do {
+		tdb_tbl_foreach(tdb_cmp_table);
+
+		if (!freezing(current))
+			schedule_timeout_interruptible(TDB_CMP_INTERVAL);
+		else
+			try_to_freeze();
+	} while (!kthread_should_stop());
+
+	return 0;
+}
+
+int __init
+tdb_compact_init(void)
+{
+	tdb_cmp_thr = kthread_run(tdb_cmp_thread, NULL, "tdb_compact");
+	if (IS_ERR(tdb_cmp_thr)) {
+		TDB_ERR("Cannot start records compactor\n");
+		return PTR_ERR(tdb_cmp_thr);
+	}
+
+	return 0;
+}
+
+void __exit
+tdb_compact_exit(void)
+{
+	kthread_stop(tdb_cmp_thr);
+}
@@ -0,0 +1,145 @@
+/**
+ *		Tempesta DB
+ *
+ * Background removal of expired records.
+ *
+ * Expired records are invisible for lookups as soon as their expiration time
+ * passes, but they still occupy space in buckets. The collector thread walks
+ * tables with expiring records in small portions, so each table is scanned
+ * incrementally starting from the position where previous pass stopped.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/freezer.h>
+#include <linux/kthread.h>
+
+#include "expire.h"
+#include "htrie.h"
+#include "table.h"
+
+/* Number of keys collected by one walk over a table. */
+#define TDB_EXP_BATCH		64
+/* Maximum number of walks over each table per pass. */
+#define TDB_EXP_WALKS		16
+/* Interval between collector passes. */
+#define TDB_EXP_INTERVAL	HZ
+
+static struct task_struct *tdb_exp_thr;
+
+/**
+ * Expired records collection context.
+ *
+ * @now		- time at which the records are considered as expired;
+ * @n		- number of collected keys;
+ * @keys	- keys of expired records;
+ */
+typedef struct {
+	unsigned long	now;
+	unsigned int	n;
+	unsigned long	keys[TDB_EXP_BATCH];
+} TdbExpCtx;
+
+static int
+tdb_exp_collect(void *data, TdbRec *rec)
+{
+	TdbExpCtx *ctx = data;
+
+	if (!tdb_rec_expired(rec, ctx->now))
+		return 0;
+	/* Full key collisions are removed by one call. */
+	if (ctx->n && ctx->keys[ctx->n - 1] == rec->key)
+		return 0;
+
+	ctx->keys[ctx->n++] = rec->key;
+
+	return ctx->n == TDB_EXP_BATCH;
+}
+
+static bool
+tdb_exp_eq(TdbRec *rec, void *data)
+{
+	return tdb_rec_expired(rec, *(unsigned long *)data);
+}
+
+/**
+ * Collect expired records under bucket read locks and remove them under
+ * write locks, so buckets aren't write locked for a whole walk.
+ * Called under tables mutex, so @db can't be closed concurrently.
+ */
+static void
+tdb_exp_table(TDB *db)
+{
+	int i, w, more;
+	TdbExpCtx ctx;
+
+	if (!test_bit(TDB_HDR_F_EXPIRE_B, &db->hdr->flags))
+		return;
+
+	for (w = 0; w < TDB_EXP_WALKS; ++w) {
+		ctx.now = get_seconds();
+		ctx.n = 0;
+
+		more = tdb_htrie_walk_from(db->hdr, &db->exp_cursor,
+					   tdb_exp_collect, &ctx);
+
+		for (i = 0; i < ctx.n; ++i)
+			tdb_entry_remove(db, ctx.keys[i], tdb_exp_eq,
+					 &ctx.now);
+
+		TDB_DBG("Removed %u expired keys from table %s\n",
+			ctx.n, db->tbl_name);
+
+		if (!more)
+			break;
+		cond_resched();
+	}
+}
+
+static int
+tdb_exp_thread(void *arg)
+{
+	set_freezable();
+
+	do {
+		tdb_tbl_foreach(tdb_exp_table);
+
+		if (!freezing(current))
+			schedule_timeout_interruptible(TDB_EXP_INTERVAL);
+		else
+			try_to_freeze();
+	} while (!kthread_should_stop());
+
+	return 0;
+}
+
+int __init
+tdb_expire_init(void)
+{
+	tdb_exp_thr = kthread_run(tdb_exp_thread, NULL, "tdb_expire");
+	if (IS_ERR(tdb_exp_thr)) {
+		TDB_ERR("Cannot start expired records collector\n");
+		return PTR_ERR(tdb_exp_thr);
+	}
+
+	return 0;
+}
+
+void __exit
+tdb_expire_exit(void)
+{
+	kthread_stop(tdb_exp_thr);
+}
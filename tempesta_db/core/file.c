@@ -22,10 +22,12 @@
  */
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/tempesta.h>
 #include <linux/topology.h>
 #include <linux/writeback.h>
+#include <asm/pgtable.h>
 
 #include "file.h"
 
@@ -57,7 +59,7 @@ ma_get_best_fit(unsigned long len, int node)
 
 	for (ma = &mas[node]; ma; ma = ma->next) {
 		if (MA_FREE(ma)
-		    && ma->pages > req_pages
+		    && ma->pages >= req_pages
 		    && (!best_fit || best_fit->pages > ma->pages))
 			best_fit = ma;
 	}
@@ -72,7 +74,7 @@ static MArea *
 ma_split(MArea *ma, unsigned long len)
 {
 	unsigned long req_pages = len / PAGE_SIZE;
-	MArea *ret;
+	MArea *tail;
 
 	BUG_ON(ma->pages < req_pages);
 	BUG_ON(!MA_FREE(ma));
@@ -83,23 +85,53 @@ ma_split(MArea *ma, unsigned long len)
 	}
 
 	/* ma is larger than we need, split it. */
-	ret = kmalloc(sizeof(MArea), GFP_KERNEL);
-	if (!ret)
+	tail = kmalloc(sizeof(MArea), GFP_KERNEL);
+	if (!tail)
 		return NULL;
 
-	ma->pages -= req_pages;
+	/*
+	 * Use the head of @ma and leave the free tail just after it,
+	 * so the table can grow in place.
+	 */
+	tail->pages = ma->pages - req_pages;
+	tail->flags = 0;
+	tail->start = ma->start + req_pages * PAGE_SIZE;
+	tail->prev = ma;
+	tail->next = ma->next;
+	if (tail->next)
+		tail->next->prev = tail;
+	ma->next = tail;
+
+	ma->pages = req_pages;
+	ma->flags |= MA_F_USED;
+
+	return ma;
+}
 
-	ret->pages = req_pages;
-	ret->flags = MA_F_USED;
-	/* @ret is the tail of @ma. */
-	ret->start = ma->start + ma->pages * PAGE_SIZE;
-	ret->prev = ma;
-	ret->next = ma->next;
-	if (ret->next)
-		ret->next->prev = ret;
-	ma->next = ret;
+/**
+ * Extend used memory area @ma to @len bytes by the free area just after it.
+ */
+static int
+ma_extend(MArea *ma, unsigned long len)
+{
+	unsigned long req_pages = len / PAGE_SIZE - ma->pages;
+	MArea *next = ma->next;
+
+	if (!next || !MA_FREE(next) || next->pages < req_pages)
+		return -ENOMEM;
+
+	ma->pages += req_pages;
+	next->start += req_pages * PAGE_SIZE;
+	next->pages -= req_pages;
+	if (!next->pages) {
+		/* The first area is never the next one. */
+		ma->next = next->next;
+		if (next->next)
+			next->next->prev = ma;
+		kfree(next);
+	}
 
-	return ret;
+	return 0;
 }
 
 static MArea *
@@ -216,18 +248,57 @@ err:
 	return addr;
 }
 
+/**
+ * Write @len bytes from @addr to @file at offset @off.
+ */
+static int
+__tdb_file_write(struct file *file, void *addr, size_t len, loff_t off)
+{
+	mm_segment_t oldfs;
+	ssize_t r;
+
+	oldfs = get_fs();
+	set_fs(get_ds());
+
+	r = vfs_write(file, (char *)addr, len, &off);
+
+	set_fs(oldfs);
+
+	return r == len ? 0 : -EIO;
+}
+
+/**
+ * Write the table state @state to disk. The state is written separately
+ * from the table image and is ordered against the image writes by fsync().
+ */
+static int
+__tdb_file_set_state(struct file *file, TdbHdr *hdr, unsigned int state)
+{
+	int r;
+
+	hdr->state = state;
+
+	r = __tdb_file_write(file, &hdr->state, sizeof(hdr->state),
+			     offsetof(TdbHdr, state));
+	if (r)
+		return r;
+	return vfs_fsync(file, 1);
+}
+
 /**
  * Syncronize memory mapping with the file.
  * Called from process context.
+ *
+ * The image is written in place, so it's marked as being synced before
+ * the write and as clean only after the whole image reached the disk.
+ * If a crash happens in between, then the image is checked on next open.
  */
 static void
 tempesta_unmap_file(struct file *file, unsigned long addr, unsigned long len,
 		    int node)
 {
-	mm_segment_t oldfs;
 	MArea *ma;
-	loff_t off = 0;
-	ssize_t r;
+	TdbHdr *hdr = (TdbHdr *)addr;
 
 	mutex_lock(&map_mtx);
 
@@ -238,18 +309,31 @@ tempesta_unmap_file(struct file *file, unsigned long addr, unsigned long len,
 		goto err;
 	}
 
-	oldfs = get_fs();
-	set_fs(get_ds());
-
-	r = vfs_write(file, (void *)ma->start, len, &off);
-	if (r != len) {
+	if (__tdb_file_set_state(file, hdr, TDB_ST_SYNC)) {
+		TDB_ERR("Cannot start sync of mapping %lx\n", ma->start);
+		goto err;
+	}
+	/*
+	 * User-space readers of the file check the generation before and
+	 * after reading the image, see libtdb/map.c.
+	 */
+	++hdr->sync_gen;
+	if (__tdb_file_write(file, &hdr->sync_gen, sizeof(hdr->sync_gen),
+			     offsetof(TdbHdr, sync_gen)))
+	{
+		TDB_ERR("Cannot start sync of mapping %lx\n", ma->start);
+		goto err;
+	}
+	if (__tdb_file_write(file, (void *)ma->start, len, 0)
+	    || vfs_fsync(file, 0))
+	{
 		TDB_ERR("Cannot sync mapping %lx of size %lu pages\n",
 			ma->start, ma->pages);
-		goto err_fs;
+		goto err;
 	}
+	if (__tdb_file_set_state(file, hdr, TDB_ST_CLEAN))
+		TDB_ERR("Cannot finish sync of mapping %lx\n", ma->start);
 
-err_fs:
-	set_fs(oldfs);
 err:
 	fput(file);
 	ma_free(addr, node);
@@ -257,6 +341,55 @@ err:
 	mutex_unlock(&map_mtx);
 }
 
+/**
+ * Count pages of each size backing the kernel mapping of the table.
+ * Tables are placed at 2MB boundaries, so the table memory is mapped by
+ * huge pages if the kernel maps reserved memory by them.
+ */
+static void
+tdb_file_map_stat(TDB *db, unsigned long addr, unsigned long len)
+{
+	unsigned int level;
+	unsigned long step, end = addr + len;
+
+	memset(db->map_pages, 0, sizeof(db->map_pages));
+
+	for ( ; addr < end; addr = (addr & ~(step - 1)) + step) {
+		if (!lookup_address(addr, &level)) {
+			TDB_WARN("Table %s area %#lx is not mapped\n",
+				 db->tbl_name, addr);
+			return;
+		}
+		switch (level) {
+		case PG_LEVEL_1G:
+			step = PUD_SIZE;
+			++db->map_pages[2];
+			break;
+		case PG_LEVEL_2M:
+			step = PMD_SIZE;
+			++db->map_pages[1];
+			break;
+		default:
+			step = PAGE_SIZE;
+			++db->map_pages[0];
+		}
+	}
+
+	if (db->map_pages[0])
+		TDB_WARN("Table %s is mapped by %lu small pages\n",
+			 db->tbl_name, db->map_pages[0]);
+}
+
+/**
+ * Mark the table as used on disk, so if the system crashes before the table
+ * is closed, then we know that data written after the open is lost.
+ */
+int
+tdb_file_set_open(TDB *db)
+{
+	return __tdb_file_set_state(db->filp, db->hdr, TDB_ST_OPEN);
+}
+
 /**
  * Open, mmap and mlock the specified file to be able to read and
  * write to it in softirqs.
@@ -284,8 +417,15 @@ tdb_file_open(TDB *db, unsigned long size)
 		return -EBADF;
 	}
 
-	/* Allocate continous extents. */
+	/* The table could grow since it was opened last time. */
 	inode = file_inode(filp);
+	if (inode->i_size > size) {
+		TDB_LOG("Use file size %lld for table %s instead of %lu\n",
+			inode->i_size, db->path, size);
+		size = inode->i_size;
+	}
+
+	/* Allocate continous extents. */
 	sb_start_write(inode->i_sb);
 	ret = filp->f_op->fallocate(filp, 0, 0, size);
 	sb_end_write(inode->i_sb);
@@ -305,11 +445,56 @@ tdb_file_open(TDB *db, unsigned long size)
 	db->filp = filp;
 	db->hdr = (TdbHdr *)addr;
 
+	tdb_file_map_stat(db, addr, size);
+
 	file_accessed(filp);
 
 	return 0;
 }
 
+/**
+ * Extend the table file and its mapping to @size bytes. The new memory is
+ * taken from the free memory area just after the table, so the table
+ * isn't moved and can be used concurrently.
+ *
+ * The function must not be called from softirq!
+ */
+int
+tdb_file_extend(TDB *db, unsigned long size)
+{
+	int r;
+	MArea *ma;
+	struct file *filp = db->filp;
+	struct inode *inode = file_inode(filp);
+	unsigned long addr = (unsigned long)db->hdr;
+
+	sb_start_write(inode->i_sb);
+	r = filp->f_op->fallocate(filp, 0, 0, size);
+	sb_end_write(inode->i_sb);
+	if (r) {
+		TDB_ERR("Cannot fallocate file %s, %d\n", db->path, r);
+		return r;
+	}
+
+	mutex_lock(&map_mtx);
+
+	ma = ma_lookup(addr, db->node);
+	BUG_ON(!ma || MA_FREE(ma));
+	r = ma_extend(ma, size);
+
+	mutex_unlock(&map_mtx);
+
+	if (r) {
+		TDB_ERR("No free memory after table %s to extend it to %lu"
+			" bytes\n", db->path, size);
+		return r;
+	}
+
+	tdb_file_map_stat(db, addr, size);
+
+	return 0;
+}
+
 void
 tdb_file_close(TDB *db)
 {
@@ -329,12 +514,34 @@ tdb_init_mappings(void)
 	TempestaMapping *tm;
 
 	for_each_node_with_cpus(node) {
+		unsigned long start, end;
+
 		if (tempesta_get_mapping(node, &tm)) {
 			TDB_ERR("Cannot get mapping for node %d\n", node);
 			return -ENOMEM;
 		}
-		mas[node].start = tm->addr;
-		mas[node].pages = tm->pages;
+		/*
+		 * Use only extent aligned part of the area, so all the tables
+		 * are aligned to huge pages: areas are split by extent sized
+		 * chunks only.
+		 */
+		start = ALIGN(tm->addr, TDB_EXT_SZ);
+		end = (tm->addr + tm->pages * PAGE_SIZE) & TDB_EXT_MASK;
+		if (start >= end) {
+			TDB_ERR("Too small memory area (%lu pages) at node %d\n",
+				tm->pages, node);
+			return -ENOMEM;
+		}
+		if (virt_addr_valid(start)
+		    && page_to_nid(virt_to_page(start)) != node)
+		{
+			TDB_ERR("Memory area %#lx reserved for node %d is at"
+				" node %d\n", start, node,
+				page_to_nid(virt_to_page(start)));
+			return -EINVAL;
+		}
+		mas[node].start = start;
+		mas[node].pages = (end - start) / PAGE_SIZE;
 	}
 	return 0;
 }
@@ -25,6 +25,8 @@
 
 int tdb_file_open(TDB *db, unsigned long size);
 void tdb_file_close(TDB *db);
+int tdb_file_set_open(TDB *db);
+int tdb_file_extend(TDB *db, unsigned long size);
 int tdb_init_mappings(void);
 
 #endif /* __FILE_H__ */
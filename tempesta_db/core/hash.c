@@ -18,8 +18,10 @@
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <asm/i387.h>
+#include <linux/module.h>
 
 #include "hash.h"
+#include "tdb.h"
 
 /**
  * The function is used from process context only, so don't care about
@@ -38,3 +40,34 @@ tdb_hash_calc(const char *data, size_t len)
 
 	return (crc1 << 32) | crc0;
 }
+
+/**
+ * Compute hash of @data with hash function of table @db, so the hash can be
+ * used as a key of the table. Process context only, as tdb_hash_calc().
+ */
+unsigned long
+tdb_hash(TDB *db, const char *data, size_t len)
+{
+	unsigned long h;
+
+	kernel_fpu_begin();
+
+	h = __tdb_hash(db->hdr->hash, db->hdr->hash_key, data, len);
+
+	kernel_fpu_end();
+
+	return h;
+}
+EXPORT_SYMBOL(tdb_hash);
+
+/**
+ * Start computation of hash of chunked data with hash function of table @db.
+ * The data is hashed by __tdb_hash_update() and __tdb_hash_final(). CRC32C
+ * uses SSE 4.2, so the caller must care about FPU context.
+ */
+void
+tdb_hash_init(TDB *db, TdbHashCtx *ctx)
+{
+	__tdb_hash_init(ctx, db->hdr->hash, db->hdr->hash_key);
+}
+EXPORT_SYMBOL(tdb_hash_init);
@@ -1,6 +1,21 @@
 /**
  *		Tempesta DB
  *
+ * Hash functions for table keys. A table uses one of the functions chosen on
+ * the table creation, so keys of records inserted by the kernel can be
+ * computed by user-space applications reading the table files. All the
+ * functions can be computed over chunked data by the init/update/final
+ * interface with the same results as over contiguous data:
+ *
+ * TDB_HASH_CRC32C - two interleaved lanes of CRC32C by SSE 4.2, the fastest
+ *	one, but the hash is linear, so an attacker can easily generate keys
+ *	with the same hash;
+ * TDB_HASH_XXH64 - XXH64 processing 4 independent 64-bit lanes, so it's as
+ *	fast as CRC32C on long keys and has good distribution on short keys,
+ *	but it isn't keyed either;
+ * TDB_HASH_SIPHASH - SipHash-2-4 keyed by random key of the table, use it
+ *	for keys controlled by clients, e.g. URIs.
+ *
  * Copyright (C) 2015 Tempesta Technologies.
  *
  * This program is free software; you can redistribute it and/or modify it
@@ -22,12 +37,37 @@
 
 #include <linux/kernel.h>
 
+#include "tdb_if.h"
+
 #define CRCQ(crc, data64) \
 	asm volatile("crc32q %2, %0" : "=r"(crc) : "0"(crc), "r"(data64))
 
 #define CRCB(crc, data8) \
 	asm volatile("crc32b %2, %0" : "=r"(crc) : "0"(crc), "r"(data8))
 
+static inline const char *
+tdb_hash_name(unsigned int fn)
+{
+	static const char *names[] = { "crc32c", "xxh64", "siphash" };
+
+	return fn < __TDB_HASH_NUM ? names[fn] : "unknown";
+}
+
+/**
+ * State of hash computation over chunked data.
+ *
+ * @v		- CRC32C lanes, XXH64 accumulators or SipHash state;
+ * @len	- number of hashed bytes;
+ * @fn		- the hash function, see TDB_HASH_*;
+ * @buf	- bytes of incomplete XXH64 stripe or SipHash word;
+ */
+typedef struct {
+	unsigned long	v[4];
+	unsigned long	len;
+	unsigned int	fn;
+	unsigned char	buf[32];
+} TdbHashCtx;
+
 static inline void
 __tdb_hash_calc(unsigned long *crc0, unsigned long *crc1, const char *data,
 		size_t len)
@@ -50,4 +90,272 @@ __tdb_hash_calc(unsigned long *crc0, unsigned long *crc1, const char *data,
 	}
 }
 
+static inline unsigned long
+__tdb_rotl(unsigned long v, int s)
+{
+	return (v << s) | (v >> (64 - s));
+}
+
+/* Copy short data to the stripe buffer w/o string.h dependencies. */
+static inline void
+__tdb_hash_buf(TdbHashCtx *ctx, size_t off, const char *data, size_t len)
+{
+	while (len--)
+		ctx->buf[off++] = *data++;
+}
+
+/*
+ * Two-lane CRC32C sends each 8 bytes to the lanes in turn and the tail of
+ * less than 8 bytes to the lane of its position, so the lane of a byte is
+ * defined by its position only.
+ */
+static inline void
+__tdb_crc_update(TdbHashCtx *ctx, const char *data, size_t len)
+{
+	const char *end = data + len;
+
+	for ( ; (ctx->len & 7) && data < end; ++data, ++ctx->len)
+		CRCB(ctx->v[(ctx->len >> 3) & 1], *data);
+	for ( ; data + 16 <= end; data += 16, ctx->len += 16) {
+		CRCQ(ctx->v[(ctx->len >> 3) & 1], *(unsigned long *)data);
+		CRCQ(ctx->v[((ctx->len >> 3) & 1) ^ 1],
+		     *(unsigned long *)(data + 8));
+	}
+	if (data + 8 <= end) {
+		CRCQ(ctx->v[(ctx->len >> 3) & 1], *(unsigned long *)data);
+		data += 8;
+		ctx->len += 8;
+	}
+	for ( ; data < end; ++data, ++ctx->len)
+		CRCB(ctx->v[(ctx->len >> 3) & 1], *data);
+}
+
+#define XXH_P1	0x9e3779b185ebca87UL
+#define XXH_P2	0xc2b2ae3d27d4eb4fUL
+#define XXH_P3	0x165667b19e3779f9UL
+#define XXH_P4	0x85ebca77c2b2ae63UL
+#define XXH_P5	0x27d4eb2f165667c5UL
+
+static inline unsigned long
+__tdb_xxh_round(unsigned long acc, unsigned long v)
+{
+	return __tdb_rotl(acc + v * XXH_P2, 31) * XXH_P1;
+}
+
+static inline void
+__tdb_xxh_stripe(TdbHashCtx *ctx, const char *data)
+{
+	const unsigned long *d = (const unsigned long *)data;
+
+	ctx->v[0] = __tdb_xxh_round(ctx->v[0], d[0]);
+	ctx->v[1] = __tdb_xxh_round(ctx->v[1], d[1]);
+	ctx->v[2] = __tdb_xxh_round(ctx->v[2], d[2]);
+	ctx->v[3] = __tdb_xxh_round(ctx->v[3], d[3]);
+}
+
+static inline void
+__tdb_xxh_update(TdbHashCtx *ctx, const char *data, size_t len)
+{
+	size_t n = ctx->len & 31;
+
+	ctx->len += len;
+	if (n) {
+		size_t c = len < 32 - n ? len : 32 - n;
+
+		__tdb_hash_buf(ctx, n, data, c);
+		if (n + c < 32)
+			return;
+		__tdb_xxh_stripe(ctx, (const char *)ctx->buf);
+		data += c;
+		len -= c;
+	}
+	for ( ; len >= 32; data += 32, len -= 32)
+		__tdb_xxh_stripe(ctx, data);
+	__tdb_hash_buf(ctx, 0, data, len);
+}
+
+static inline unsigned long
+__tdb_xxh_merge(unsigned long h, unsigned long v)
+{
+	return (h ^ __tdb_xxh_round(0, v)) * XXH_P1 + XXH_P4;
+}
+
+static inline unsigned long
+__tdb_xxh_final(TdbHashCtx *ctx)
+{
+	unsigned long h;
+	size_t i = 0, n = ctx->len & 31;
+
+	if (ctx->len >= 32) {
+		h = __tdb_rotl(ctx->v[0], 1) + __tdb_rotl(ctx->v[1], 7)
+		    + __tdb_rotl(ctx->v[2], 12) + __tdb_rotl(ctx->v[3], 18);
+		h = __tdb_xxh_merge(h, ctx->v[0]);
+		h = __tdb_xxh_merge(h, ctx->v[1]);
+		h = __tdb_xxh_merge(h, ctx->v[2]);
+		h = __tdb_xxh_merge(h, ctx->v[3]);
+	} else {
+		h = XXH_P5;
+	}
+	h += ctx->len;
+
+	for ( ; i + 8 <= n; i += 8) {
+		h ^= __tdb_xxh_round(0, *(unsigned long *)(ctx->buf + i));
+		h = __tdb_rotl(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (i + 4 <= n) {
+		h ^= *(unsigned int *)(ctx->buf + i) * XXH_P1;
+		h = __tdb_rotl(h, 23) * XXH_P2 + XXH_P3;
+		i += 4;
+	}
+	for ( ; i < n; ++i) {
+		h ^= ctx->buf[i] * XXH_P5;
+		h = __tdb_rotl(h, 11) * XXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+#define SIPROUND(v)							\
+do {									\
+	v[0] += v[1]; v[1] = __tdb_rotl(v[1], 13); v[1] ^= v[0];	\
+	v[0] = __tdb_rotl(v[0], 32);					\
+	v[2] += v[3]; v[3] = __tdb_rotl(v[3], 16); v[3] ^= v[2];	\
+	v[0] += v[3]; v[3] = __tdb_rotl(v[3], 21); v[3] ^= v[0];	\
+	v[2] += v[1]; v[1] = __tdb_rotl(v[1], 17); v[1] ^= v[2];	\
+	v[2] = __tdb_rotl(v[2], 32);					\
+} while (0)
+
+static inline void
+__tdb_sip_word(TdbHashCtx *ctx, unsigned long m)
+{
+	ctx->v[3] ^= m;
+	SIPROUND(ctx->v);
+	SIPROUND(ctx->v);
+	ctx->v[0] ^= m;
+}
+
+static inline void
+__tdb_sip_update(TdbHashCtx *ctx, const char *data, size_t len)
+{
+	size_t n = ctx->len & 7;
+
+	ctx->len += len;
+	if (n) {
+		size_t c = len < 8 - n ? len : 8 - n;
+
+		__tdb_hash_buf(ctx, n, data, c);
+		if (n + c < 8)
+			return;
+		__tdb_sip_word(ctx, *(unsigned long *)ctx->buf);
+		data += c;
+		len -= c;
+	}
+	for ( ; len >= 8; data += 8, len -= 8)
+		__tdb_sip_word(ctx, *(unsigned long *)data);
+	__tdb_hash_buf(ctx, 0, data, len);
+}
+
+static inline unsigned long
+__tdb_sip_final(TdbHashCtx *ctx)
+{
+	int i;
+	unsigned long b = ctx->len << 56;
+
+	for (i = 0; i < (ctx->len & 7); ++i)
+		b |= (unsigned long)ctx->buf[i] << (i * 8);
+
+	__tdb_sip_word(ctx, b);
+	ctx->v[2] ^= 0xff;
+	SIPROUND(ctx->v);
+	SIPROUND(ctx->v);
+	SIPROUND(ctx->v);
+	SIPROUND(ctx->v);
+
+	return ctx->v[0] ^ ctx->v[1] ^ ctx->v[2] ^ ctx->v[3];
+}
+
+/**
+ * Start computation of hash function @fn, @key is used by SipHash only.
+ */
+static inline void
+__tdb_hash_init(TdbHashCtx *ctx, unsigned int fn, const unsigned long *key)
+{
+	ctx->fn = fn;
+	ctx->len = 0;
+
+	switch (fn) {
+	case TDB_HASH_XXH64:
+		ctx->v[0] = XXH_P1 + XXH_P2;
+		ctx->v[1] = XXH_P2;
+		ctx->v[2] = 0;
+		ctx->v[3] = -XXH_P1;
+		break;
+	case TDB_HASH_SIPHASH:
+		ctx->v[0] = key[0] ^ 0x736f6d6570736575UL;
+		ctx->v[1] = key[1] ^ 0x646f72616e646f6dUL;
+		ctx->v[2] = key[0] ^ 0x6c7967656e657261UL;
+		ctx->v[3] = key[1] ^ 0x7465646279746573UL;
+		break;
+	default:
+		ctx->v[0] = ctx->v[1] = 0;
+	}
+}
+
+static inline void
+__tdb_hash_update(TdbHashCtx *ctx, const char *data, size_t len)
+{
+	switch (ctx->fn) {
+	case TDB_HASH_XXH64:
+		__tdb_xxh_update(ctx, data, len);
+		break;
+	case TDB_HASH_SIPHASH:
+		__tdb_sip_update(ctx, data, len);
+		break;
+	default:
+		__tdb_crc_update(ctx, data, len);
+	}
+}
+
+static inline unsigned long
+__tdb_hash_final(TdbHashCtx *ctx)
+{
+	switch (ctx->fn) {
+	case TDB_HASH_XXH64:
+		return __tdb_xxh_final(ctx);
+	case TDB_HASH_SIPHASH:
+		return __tdb_sip_final(ctx);
+	default:
+		return (ctx->v[1] << 32) | ctx->v[0];
+	}
+}
+
+/**
+ * Compute hash function @fn over contiguous @data of @len bytes.
+ */
+static inline unsigned long
+__tdb_hash(unsigned int fn, const unsigned long *key, const char *data,
+	   size_t len)
+{
+	TdbHashCtx ctx;
+
+	if (fn == TDB_HASH_CRC32C) {
+		unsigned long crc0 = 0, crc1 = 0;
+
+		__tdb_hash_calc(&crc0, &crc1, data, len);
+
+		return (crc1 << 32) | crc0;
+	}
+
+	__tdb_hash_init(&ctx, fn, key);
+	__tdb_hash_update(&ctx, data, len);
+
+	return __tdb_hash_final(&ctx);
+}
+
 #endif /* __TDB_HASH_H__ */
@@ -24,11 +24,12 @@
  */
 #include <asm/sync_bitops.h>
 #include <linux/bitops.h>
+#include <linux/prefetch.h>
 #include <linux/slab.h>
 
 #include "htrie.h"
 
-#define TDB_MAGIC	0x434947414D424454UL /* "TDBMAGIC" */
+#define TDB_MAGIC	0x434947414D424448UL /* "HDBMAGIC", per-table hash */
 #define TDB_BLK_SZ	PAGE_SIZE
 #define TDB_BLK_MASK	(~(TDB_BLK_SZ - 1))
 
@@ -70,7 +71,7 @@ tdb_ext(TdbHdr *dbh, void *ptr)
 	unsigned long e = TDB_EXT_O(ptr);
 
 	if (e == (unsigned long)dbh)
-		e += TDB_HDR_SZ(dbh); /* first extent */
+		e += TDB_HDR_SZ; /* first extent */
 	return (TdbExt *)e;
 }
 
@@ -104,7 +105,7 @@ tdb_init_mapping(void *p, size_t db_size, unsigned int rec_len)
 	hdr->rec_len = rec_len;
 
 	/* Set next block to just after block with root index node. */
-	hdr_sz = TDB_BLK_ALIGN(TDB_HDR_SZ(hdr) + sizeof(TdbExt)
+	hdr_sz = TDB_BLK_ALIGN(TDB_HDR_SZ + sizeof(TdbExt)
 			       + sizeof(TdbHtrieNode));
 	atomic64_set(&hdr->nwb, hdr_sz);
 
@@ -171,7 +172,7 @@ repeat:
 		r = sizeof(*e);
 		if (unlikely(TDB_EXT_O(e) == TDB_EXT_O(dbh)))
 			/* First extent in the database. */
-			return r + TDB_HDR_SZ(dbh);
+			return r + TDB_HDR_SZ;
 		return r + TDB_EXT_BASE(dbh, e);
 	}
 
@@ -217,6 +218,7 @@ retry:
 	 */
 	if (unlikely(TDB_HTRIE_OFF(dbh, e) == dbh->dbsz)) {
 		TDB_ERR("out of free space\n");
+		++raw_cpu_ptr(dbh->pcpu)->os.alloc_fails;
 		return 0;
 	}
 	BUG_ON(TDB_HTRIE_OFF(dbh, e) > dbh->dbsz);
@@ -252,6 +254,16 @@ tdb_htrie_init_bucket(TdbBucket *b)
 #endif
 }
 
+/**
+ * Change version of collision chain of write locked bucket @b.
+ */
+static inline void
+tdb_htrie_bckt_update(TdbBucket *b)
+{
+	b->flags = (b->flags & TDB_HTRIE_VRFREED)
+		   | ((b->flags + 1) & TDB_HTRIE_VER_MASK);
+}
+
 /**
  * @return byte offset of the allocated data block and sets @len to actually
  * available room for writting if @len doesn't fit to block.
@@ -388,14 +400,27 @@ tdb_htrie_smallrec_link(TdbHdr *dbh, size_t len, TdbBucket *bckt)
 		}
 	} else {
 		TdbFRec *r;
+		unsigned long now = get_seconds();
 		TDB_HTRIE_FOREACH_REC_UNLOCKED(dbh, bckt, r) {
 			n = (char *)r - (char *)bckt
 			    + TDB_HTRIE_RALIGN(sizeof(*r) + len);
-			if (!tdb_live_fsrec(dbh, r) && n <= TDB_HTRIE_MINDREC) {
+			if (n > TDB_HTRIE_MINDREC)
+				continue;
+			if (!tdb_live_fsrec(dbh, r)) {
 				/* Already freed record - just reuse. */
 				o = TDB_HTRIE_OFF(dbh, r);
 				goto done;
 			}
+			/*
+			 * All fixed-size records have the same length,
+			 * so expired record can be safely replaced in place.
+			 * Variable-length records are freed by the collector.
+			 */
+			if (tdb_rec_expired((TdbRec *)r, now)) {
+				tdb_free_fsrec(dbh, r);
+				o = TDB_HTRIE_OFF(dbh, r);
+				goto done;
+			}
 		}
 	}
 
@@ -450,7 +475,8 @@ do {									\
 	n = TDB_HTRIE_RECLEN(dbh, r);					\
 	nb[k].b = TDB_HTRIE_OFF(dbh, bckt);				\
 	nb[k].off = sizeof(*b) + n;					\
-	free_nb = -(long)k; /* remember which block we save & copy */	\
+	/* Remember which block we save & copy, @k can be zero. */	\
+	free_nb = -(long)k - 1;						\
 	r = (Type *)((char *)r + n);					\
 	for ( ; ; r = (Type *)((char *)r + n)) {			\
 		unsigned long copied = (char *)r - (char *)bckt;	\
@@ -474,7 +500,7 @@ do {									\
 			nb[k].off = sizeof(*b) + n;			\
 			new_in->shifts[k] = TDB_O2DI(nb[k].b) | TDB_HTRIE_DBIT;\
 			/* We copied a record, clear its orignal place. */\
-			free_nb = free_nb > 0 ? free_nb : -free_nb;	\
+			free_nb = free_nb >= 0 ? free_nb : -free_nb - 1;\
 			TDB_DBG("burst: copied rec=%p (len=%lu key=%#lx)"\
 				" to new dblk=%#lx w/ idx=%#lx\n",	\
 				r, n, r->key, nb[k].b, k);		\
@@ -507,16 +533,17 @@ do {									\
 	*node = new_in;
 
 	/* Now we can safely remove all copied records. */
-	if (free_nb > 0) {
+	if (free_nb >= 0) {
 		TDB_DBG("clear dblk=%#lx from %#x\n",
 			nb[free_nb].b, nb[free_nb].off);
 		memset(TDB_PTR(dbh, nb[free_nb].b + nb[free_nb].off),
 		       0, TDB_HTRIE_MINDREC - nb[free_nb].off);
 	}
+	++raw_cpu_ptr(dbh->pcpu)->os.bursts;
 
 	return 0;
 err_cleanup:
-	if (free_nb > 0)
+	if (free_nb >= 0)
 		for (i = 0; i < TDB_HTRIE_FANOUT; ++i)
 			if (i != free_nb && nb[i].b)
 				tdb_free_data_blk(TDB_PTR(dbh, nb[i].b));
@@ -540,6 +567,12 @@ static unsigned long
 tdb_htrie_descend(TdbHdr *dbh, TdbHtrieNode **node, unsigned long key,
 		  int *bits)
 {
+	/* Statistics only, so don't care about migration. */
+	TdbWalkStat *ws = &raw_cpu_ptr(dbh->pcpu)->ws;
+	unsigned long ext = TDB_EXT_O(*node);
+
+	++ws->descends;
+
 	while (1) {
 		unsigned long o;
 
@@ -550,22 +583,27 @@ tdb_htrie_descend(TdbHdr *dbh, TdbHtrieNode **node, unsigned long key,
 		TDB_DBG("Descend iblk=%p key=%#lx bits=%d -> %#lx\n",
 			*node, key, *bits, o);
 		BUG_ON(o
-		       && (TDB_DI2O(o & ~TDB_HTRIE_DBIT)
-				< TDB_HDR_SZ(dbh) + sizeof(TdbExt)
-			   || TDB_DI2O(o & ~TDB_HTRIE_DBIT)
-				> dbh->dbsz));
+		       && (TDB_HTRIE_SHIFT_O(o) < TDB_HDR_SZ + sizeof(TdbExt)
+			   || TDB_HTRIE_SHIFT_O(o) > dbh->dbsz));
 
 		if (o & TDB_HTRIE_DBIT) {
 			/* We're at a data pointer - resolve it. */
 			*bits += TDB_HTRIE_BITS;
 			o ^= TDB_HTRIE_DBIT;
 			BUG_ON(!o);
-			return TDB_DI2O(o);
+			o = TDB_DI2O(o);
+			ws->ext_jumps += TDB_EXT_O(TDB_PTR(dbh, o)) != ext;
+			return o;
 		} else {
 			if (!o)
 				return 0; /* cannot descend deeper */
 			*node = TDB_PTR(dbh, TDB_II2O(o));
 			*bits += TDB_HTRIE_BITS;
+			++ws->inodes;
+			if (TDB_EXT_O(*node) != ext) {
+				++ws->ext_jumps;
+				ext = TDB_EXT_O(*node);
+			}
 		}
 	}
 }
@@ -579,6 +617,7 @@ tdb_htrie_create_rec(TdbHdr *dbh, unsigned long off, unsigned long key,
 
 	BUG_ON(r->key);
 	r->key = key;
+	r->expires = 0;
 	if (TDB_HTRIE_VARLENRECS(dbh)) {
 		TdbVRec *vr = (TdbVRec *)r;
 		BUG_ON(vr->len || vr->chunk_next);
@@ -614,6 +653,7 @@ tdb_htrie_extend_rec(TdbHdr *dbh, TdbVRec *rec, size_t size)
 
 	chunk = TDB_PTR(dbh, o);
 	chunk->key = rec->key;
+	chunk->expires = 0;
 	chunk->chunk_next = 0;
 	chunk->len = size;
 
@@ -641,8 +681,8 @@ retry:
  * and do CAS on it with comparing the location with zero.
  * If competing context helps the current trx owner, then we get true lock-free.
  */
-TdbRec *
-tdb_htrie_insert(TdbHdr *dbh, unsigned long key, void *data, size_t *len)
+static TdbRec *
+__tdb_htrie_insert(TdbHdr *dbh, unsigned long key, void *data, size_t *len)
 {
 	int bits = 0;
 	unsigned long o;
@@ -707,6 +747,9 @@ retry:
 		}
 	}
 
+	/* The chain is changed by any of the paths below. */
+	tdb_htrie_bckt_update(bckt);
+
 	/*
 	 * Try to place the small record in preallocated room for
 	 * small records. There could be full or partial key match.
@@ -780,6 +823,18 @@ retry:
 	goto retry;
 }
 
+TdbRec *
+tdb_htrie_insert(TdbHdr *dbh, unsigned long key, void *data, size_t *len)
+{
+	TdbRec *r = __tdb_htrie_insert(dbh, key, data, len);
+
+	/* Statistics only, so don't care about migration. */
+	if (r)
+		++raw_cpu_ptr(dbh->pcpu)->os.inserts;
+
+	return r;
+}
+
 TdbBucket *
 tdb_htrie_lookup(TdbHdr *dbh, unsigned long key)
 {
@@ -787,6 +842,8 @@ tdb_htrie_lookup(TdbHdr *dbh, unsigned long key)
 	unsigned long o;
 	TdbHtrieNode *root = TDB_HTRIE_ROOT(dbh);
 
+	++raw_cpu_ptr(dbh->pcpu)->os.lookups;
+
 	o = tdb_htrie_descend(dbh, &root, key, &bits);
 	if (!o) {
 		TDB_DBG("...not found\n");
@@ -796,6 +853,127 @@ tdb_htrie_lookup(TdbHdr *dbh, unsigned long key)
 	return TDB_PTR(dbh, o);
 }
 
+/**
+ * Lookup buckets for @n independent keys @keys at once.
+ * Each index level is a dependent cache miss, so descends for all the keys
+ * are advanced level by level in round-robin fashion and next index node
+ * of each descend is prefetched while other descends are processed
+ * (asynchronous memory access chaining). Found buckets are prefetched
+ * as well.
+ *
+ * @bckts[i] is set to the bucket for @keys[i] or NULL if there is no one.
+ */
+void
+tdb_htrie_lookup_batch(TdbHdr *dbh, const unsigned long *keys,
+		       TdbBucket **bckts, int n)
+{
+	int i, active = n;
+	int bits[TDB_BATCH_MAX];
+	TdbHtrieNode *node[TDB_BATCH_MAX];
+	TdbWalkStat *ws = &raw_cpu_ptr(dbh->pcpu)->ws;
+
+	BUG_ON(n > TDB_BATCH_MAX);
+
+	for (i = 0; i < n; ++i) {
+		node[i] = TDB_HTRIE_ROOT(dbh);
+		bits[i] = 0;
+		bckts[i] = NULL;
+	}
+	ws->descends += n;
+	raw_cpu_ptr(dbh->pcpu)->os.lookups += n;
+
+	while (active) {
+		for (i = 0; i < n; ++i) {
+			unsigned long o;
+			TdbHtrieNode *in = node[i];
+
+			if (!in)
+				continue;
+
+			BUG_ON(TDB_HTRIE_RESOLVED(bits[i]));
+			o = in->shifts[TDB_HTRIE_IDX(keys[i], bits[i])];
+			bits[i] += TDB_HTRIE_BITS;
+
+			if (o & TDB_HTRIE_DBIT) {
+				o = TDB_DI2O(o ^ TDB_HTRIE_DBIT);
+				bckts[i] = TDB_PTR(dbh, o);
+				/* Small records occupy two cache lines. */
+				prefetch(bckts[i]);
+				prefetch((char *)bckts[i] + L1_CACHE_BYTES);
+				ws->ext_jumps += TDB_EXT_O(bckts[i])
+						 != TDB_EXT_O(in);
+			} else if (o) {
+				node[i] = TDB_PTR(dbh, TDB_II2O(o));
+				prefetch(node[i]);
+				++ws->inodes;
+				ws->ext_jumps += TDB_EXT_O(node[i])
+						 != TDB_EXT_O(in);
+				continue;
+			}
+
+			/* The descend is finished. */
+			node[i] = NULL;
+			--active;
+		}
+	}
+}
+
+/**
+ * Number of fixed-size records of aligned length @rlen in a bucket.
+ * Records larger than a bucket occupy the bucket alone.
+ */
+static inline int
+tdb_htrie_fsrec_n(size_t rlen)
+{
+	int n = (TDB_HTRIE_MINDREC - sizeof(TdbBucket)) / rlen;
+
+	return n ? : 1;
+}
+
+/**
+ * Fast path of tdb_htrie_bscan_for_rec() and tdb_htrie_next_rec() for tables
+ * with fixed-size records. The records are placed in a bucket with constant
+ * stride, so keys of all the records starting from @slot are compared at once
+ * w/o length arithmetic and branches, and only matching records are inspected.
+ * Freed records are zeroed, so a matching non-zero key always belongs to live
+ * record.
+ *
+ * Called with locked bucket @b, unlocks it if no record is found.
+ */
+static TdbRec *
+tdb_htrie_fsrec_scan(TdbHdr *dbh, TdbBucket **b, int slot, unsigned long key)
+{
+	size_t rlen = TDB_HTRIE_RALIGN(sizeof(TdbFRec) + dbh->rec_len);
+	int i, n = tdb_htrie_fsrec_n(rlen);
+	unsigned long now = get_seconds();
+	TdbBucket *b_tmp;
+
+	do {
+		char *recs = TDB_HTRIE_BCKT_1ST_REC(*b);
+		unsigned int m = 0;
+
+		for (i = slot; i < n; ++i)
+			m |= (((TdbFRec *)(recs + i * rlen))->key == key) << i;
+
+		for ( ; m; m &= m - 1) {
+			TdbRec *r = (TdbRec *)(recs + __ffs(m) * rlen);
+			if ((key || tdb_live_fsrec(dbh, r))
+			    && !tdb_rec_expired(r, now))
+				/* Unlock the bucket by tdb_rec_put(). */
+				return r;
+		}
+
+		slot = 0;
+		b_tmp = TDB_HTRIE_BUCKET_NEXT(dbh, *b);
+		if (b_tmp)
+			read_lock_bh(&b_tmp->lock);
+		read_unlock_bh(&(*b)->lock);
+		*b = b_tmp;
+	} while (*b);
+
+	return NULL;
+}
+
 /**
  * Iterate over all records in collision chain with locked buckets.
  * Buckets are inspected according to following rules:
@@ -810,9 +988,13 @@ tdb_htrie_bscan_for_rec(TdbHdr *dbh, TdbBucket **b, unsigned long key)
 {
 	TdbBucket *b_tmp;
 	TdbRec *r;
+	unsigned long now = get_seconds();
 
 	read_lock_bh(&(*b)->lock);
 
+	if (!TDB_HTRIE_VARLENRECS(dbh))
+		return tdb_htrie_fsrec_scan(dbh, b, 0, key);
+
 	do {
 		r = TDB_HTRIE_BCKT_1ST_REC(*b);
 		do {
@@ -821,7 +1003,8 @@ tdb_htrie_bscan_for_rec(TdbHdr *dbh, TdbBucket **b, unsigned long key)
 			if ((char *)r + rlen - (char *)*b > TDB_HTRIE_MINDREC
 			    && r != TDB_HTRIE_BCKT_1ST_REC(*b))
 				break;
-			if (tdb_live_rec(dbh, r) && r->key == key)
+			if (tdb_live_rec(dbh, r) && r->key == key
+			    && !tdb_rec_expired(r, now))
 				/* Unlock the bucket by tdb_rec_put(). */
 				return r;
 			r = (TdbRec *)((char *)r + rlen);
@@ -846,26 +1029,35 @@ TdbRec *
 tdb_htrie_next_rec(TdbHdr *dbh, TdbRec *r, TdbBucket **b, unsigned long key)
 {
 	TdbBucket *_b = *b;
+	unsigned long now;
 
-	do {
-		size_t rlen = TDB_HTRIE_RALIGN(sizeof(*r)
-					       + TDB_HTRIE_RBODYLEN(dbh, r));
-		if ((char *)r + rlen - (char *)_b > TDB_HTRIE_MINDREC)
-			goto next_bckt;
-		r = (TdbRec *)((char *)r + rlen);
+	if (!TDB_HTRIE_VARLENRECS(dbh)) {
+		size_t rlen = TDB_HTRIE_RALIGN(sizeof(TdbFRec) + dbh->rec_len);
+		int slot = ((char *)r - (char *)TDB_HTRIE_BCKT_1ST_REC(_b))
+			   / rlen;
+		return tdb_htrie_fsrec_scan(dbh, b, slot + 1, key);
+	}
 
-		do {
-			rlen = TDB_HTRIE_RALIGN(sizeof(*r)
+	now = get_seconds();
+	r = (TdbRec *)((char *)r + TDB_HTRIE_RALIGN(sizeof(*r)
+					+ TDB_HTRIE_RBODYLEN(dbh, r)));
+	do {
+		/* The first record in the bucket can be large. */
+		while ((char *)r + sizeof(*r) - (char *)_b
+		       <= TDB_HTRIE_MINDREC)
+		{
+			size_t rlen = TDB_HTRIE_RALIGN(sizeof(*r)
 						+ TDB_HTRIE_RBODYLEN(dbh, r));
-			if ((char *)r + rlen - (char *)_b > TDB_HTRIE_MINDREC)
+			if ((char *)r + rlen - (char *)_b > TDB_HTRIE_MINDREC
+			    && r != TDB_HTRIE_BCKT_1ST_REC(_b))
 				break;
-			if (tdb_live_rec(dbh, r) && r->key == key)
+			if (tdb_live_rec(dbh, r) && r->key == key
+			    && !tdb_rec_expired(r, now))
 				/* Unlock the bucket by tdb_rec_put(). */
 				return r;
 			r = (TdbRec *)((char *)r + rlen);
-		} while ((char *)r + sizeof(*r) - (char *)_b
-			 <= TDB_HTRIE_MINDREC);
-next_bckt:
+		}
+
 		*b = TDB_HTRIE_BUCKET_NEXT(dbh, _b);
 		if (*b) {
 			read_lock_bh(&(*b)->lock);
@@ -878,6 +1070,949 @@ next_bckt:
 	return NULL;
 }
 
+/**
+ * Call @fn for each live record in collision chain started by bucket @b.
+ * The bucket is read locked while @fn is running, so @fn must not sleep.
+ */
+static int
+tdb_htrie_bucket_walk(TdbHdr *dbh, TdbBucket *b,
+		      int (*fn)(void *data, TdbRec *rec), void *data)
+{
+	int res;
+	TdbBucket *b_tmp;
+	TdbRec *r;
+
+	read_lock_bh(&b->lock);
+
+	do {
+		r = TDB_HTRIE_BCKT_1ST_REC(b);
+		do {
+			size_t rlen = TDB_HTRIE_RALIGN(sizeof(*r)
+						+ TDB_HTRIE_RBODYLEN(dbh, r));
+			if ((char *)r + rlen - (char *)b > TDB_HTRIE_MINDREC
+			    && r != TDB_HTRIE_BCKT_1ST_REC(b))
+				break;
+			if (tdb_live_rec(dbh, r) && (res = fn(data, r))) {
+				read_unlock_bh(&b->lock);
+				return res;
+			}
+			r = (TdbRec *)((char *)r + rlen);
+		} while ((char *)r + sizeof(*r) - (char *)b
+			 <= TDB_HTRIE_MINDREC);
+
+		b_tmp = TDB_HTRIE_BUCKET_NEXT(dbh, b);
+		if (b_tmp)
+			read_lock_bh(&b_tmp->lock);
+		read_unlock_bh(&b->lock);
+		b = b_tmp;
+	} while (b);
+
+	return 0;
+}
+
+/**
+ * Remove all live records with key @key for which @eq returns true from
+ * collision chain of write locked bucket @bckt. The bucket stays locked,
+ * next buckets of the chain are locked while they're inspected.
+ */
+static int
+tdb_htrie_bucket_remove(TdbHdr *dbh, TdbBucket *bckt, unsigned long key,
+			bool (*eq)(TdbRec *rec, void *data), void *data)
+{
+	int n = 0;
+	TdbBucket *b = bckt, *b_tmp;
+	TdbRec *r;
+
+	do {
+		r = TDB_HTRIE_BCKT_1ST_REC(b);
+		do {
+			size_t rlen = TDB_HTRIE_RALIGN(sizeof(*r)
+						+ TDB_HTRIE_RBODYLEN(dbh, r));
+			if ((char *)r + rlen - (char *)b > TDB_HTRIE_MINDREC
+			    && r != TDB_HTRIE_BCKT_1ST_REC(b))
+				break;
+			if (tdb_live_rec(dbh, r) && r->key == key
+			    && (!eq || eq(r, data)))
+			{
+				TDB_DBG("Remove record %p with key=%#lx\n",
+					r, key);
+				if (TDB_HTRIE_VARLENRECS(dbh))
+					tdb_free_vsrec((TdbVRec *)r);
+				else
+					tdb_free_fsrec(dbh, (TdbFRec *)r);
+				++n;
+			}
+			r = (TdbRec *)((char *)r + rlen);
+		} while ((char *)r + sizeof(*r) - (char *)b
+			 <= TDB_HTRIE_MINDREC);
+
+		b_tmp = TDB_HTRIE_BUCKET_NEXT(dbh, b);
+		if (b_tmp)
+			write_lock_bh(&b_tmp->lock);
+		if (b != bckt)
+			write_unlock_bh(&b->lock);
+		b = b_tmp;
+	} while (b);
+
+	return n;
+}
+
+/**
+ * Remove all live records with key @key for which @eq returns true
+ * (all the records with the key if @eq is NULL).
+ * Buckets are write locked while @eq is running, so it must not sleep.
+ * @return number of removed records.
+ *
+ * Records moved by concurrent burst of the bucket can be missed,
+ * so callers which must remove a record for sure should retry.
+ */
+int
+tdb_htrie_remove(TdbHdr *dbh, unsigned long key,
+		 bool (*eq)(TdbRec *rec, void *data), void *data)
+{
+	int n;
+	TdbBucket *b;
+
+	b = tdb_htrie_lookup(dbh, key);
+	if (!b)
+		return 0;
+
+	write_lock_bh(&b->lock);
+
+	n = tdb_htrie_bucket_remove(dbh, b, key, eq, data);
+	if (n)
+		tdb_htrie_bckt_update(b);
+
+	write_unlock_bh(&b->lock);
+
+	raw_cpu_ptr(dbh->pcpu)->os.removes += n;
+
+	return n;
+}
+
+/**
+ * Add operation @type on records with key @key to transaction @trx and
+ * remember the current version of the key bucket. Keys without buckets
+ * get empty buckets, so the commit can check that there are still no records
+ * with the keys and place inserted records to existing buckets.
+ *
+ * Inserted @data of @len bytes and @data for removal filter @eq must be
+ * valid until the commit.
+ */
+int
+tdb_htrie_trx_add(TdbHdr *dbh, TdbTrx *trx, unsigned int type,
+		  unsigned long key, void *data, size_t len,
+		  bool (*eq)(TdbRec *rec, void *data))
+{
+	int bits;
+	size_t blen;
+	unsigned long o;
+	TdbHtrieNode *node;
+	TdbTrxOp *op;
+
+	if (trx->n == TDB_TRX_MAX || (type == TDB_TRX_INSERT && !len))
+		return -EINVAL;
+
+	while (1) {
+		bits = 0;
+		node = TDB_HTRIE_ROOT(dbh);
+		o = tdb_htrie_descend(dbh, &node, key, &bits);
+		if (o)
+			break;
+
+		blen = 0;
+		o = tdb_alloc_data(dbh, &blen, 1);
+		if (!o)
+			return -ENOMEM;
+		/* Leave the block for concurrently created bucket, if any. */
+		atomic_cmpxchg((atomic_t *)&node->shifts[TDB_HTRIE_IDX(key,
+								       bits)],
+			       0, TDB_O2DI(o) | TDB_HTRIE_DBIT);
+	}
+
+	op = &trx->ops[trx->n++];
+	op->key = key;
+	op->bckt = TDB_PTR(dbh, o);
+	op->ver = TDB_HTRIE_VER((TdbBucket *)op->bckt);
+	op->type = type;
+	op->data = data;
+	op->len = len;
+	op->eq = eq;
+	op->rec = NULL;
+
+	return 0;
+}
+
+/**
+ * Place record of insert operation @op of a transaction to the write locked
+ * bucket of the operation. @bits is number of the key bits resolved by the
+ * index to the bucket.
+ *
+ * @return NULL if the bucket must be burst or the table is full.
+ */
+static TdbRec *
+tdb_htrie_trx_insert(TdbHdr *dbh, TdbTrxOp *op, int bits)
+{
+	unsigned long o = 0;
+	TdbBucket *b = op->bckt, *next;
+	TdbRec *rec = NULL;
+
+	if (op->len < TDB_HTRIE_MINDREC)
+		o = tdb_htrie_smallrec_link(dbh, TDB_HTRIE_RALIGN(op->len), b);
+	if (o)
+		return tdb_htrie_create_rec(dbh, o, op->key, op->data,
+					    op->len);
+	if (!TDB_HTRIE_RESOLVED(bits))
+		return NULL;
+
+	/* Full key collision, add the record to the collision chain. */
+	while (b->coll_next && !(b->flags & TDB_HTRIE_VRFREED)) {
+		next = TDB_HTRIE_BUCKET_NEXT(dbh, b);
+		write_lock_bh(&next->lock);
+		if (b != op->bckt)
+			write_unlock_bh(&b->lock);
+		b = next;
+	}
+
+	o = tdb_alloc_data(dbh, &op->len, 1);
+	if (o) {
+		rec = tdb_htrie_create_rec(dbh, o, op->key, op->data, op->len);
+		b->coll_next = TDB_O2DI(o);
+	}
+	if (b != op->bckt)
+		write_unlock_bh(&b->lock);
+
+	return rec;
+}
+
+/**
+ * Transaction removal context.
+ *
+ * @trx	- the transaction;
+ * @op	- the removal operation;
+ */
+typedef struct {
+	TdbTrx		*trx;
+	TdbTrxOp	*op;
+} TdbTrxRmCtx;
+
+static bool
+tdb_htrie_trx_rm_eq(TdbRec *rec, void *data)
+{
+	TdbTrxRmCtx *ctx = data;
+	TdbTrxOp *op;
+
+	/* Inserts are applied first, keep records inserted after removal. */
+	for (op = ctx->op + 1; op < ctx->trx->ops + ctx->trx->n; ++op)
+		if (op->rec == rec)
+			return false;
+
+	return !ctx->op->eq || ctx->op->eq(rec, ctx->op->data);
+}
+
+/**
+ * Apply operations of transaction @trx if none of buckets of the transaction
+ * keys was changed since the operations were added.
+ *
+ * The buckets are write locked in order of their addresses while the
+ * operations are applied, so lookups see either all or none of the changes.
+ * All the inserts are applied before removals, because only inserts can fail
+ * and they're easily reverted, while a removal doesn't remove records
+ * inserted by later operations of the transaction. If an inserted record
+ * doesn't fit its bucket, then the bucket is burst and the transaction is
+ * aborted, so repeated transaction finds some room for the record.
+ *
+ * The caller must not hold records of the table.
+ *
+ * @return 0 on success, -EAGAIN if the transaction conflicts with concurrent
+ * updates and must be repeated from the beginning or -ENOMEM if there is no
+ * free space in the table.
+ */
+int
+tdb_htrie_trx_commit(TdbHdr *dbh, TdbTrx *trx)
+{
+	int i, j, r = 0, n = 0, ins = 0, rm = 0;
+	int bits[TDB_TRX_MAX];
+	TdbHtrieNode *node[TDB_TRX_MAX];
+	TdbBucket *bckts[TDB_TRX_MAX];
+	TdbTrxOp *op;
+
+	/* Check for bursts of the buckets and sort them by address. */
+	for (i = 0; i < trx->n; ++i) {
+		op = &trx->ops[i];
+		bits[i] = 0;
+		node[i] = TDB_HTRIE_ROOT(dbh);
+		if (TDB_PTR(dbh, tdb_htrie_descend(dbh, &node[i], op->key,
+						   &bits[i])) != op->bckt)
+			return -EAGAIN;
+
+		for (j = n; j && (unsigned long)bckts[j - 1]
+				 > (unsigned long)op->bckt; --j)
+			;
+		if (j && bckts[j - 1] == op->bckt)
+			continue;
+		memmove(&bckts[j + 1], &bckts[j], (n - j) * sizeof(*bckts));
+		bckts[j] = op->bckt;
+		++n;
+	}
+
+	for (j = 0; j < n; ++j)
+		write_lock_bh(&bckts[j]->lock);
+
+	for (i = 0; i < trx->n; ++i)
+		if (TDB_HTRIE_VER((TdbBucket *)trx->ops[i].bckt)
+		    != trx->ops[i].ver)
+		{
+			r = -EAGAIN;
+			goto unlock;
+		}
+
+	for (i = 0; i < trx->n; ++i) {
+		op = &trx->ops[i];
+		if (op->type != TDB_TRX_INSERT)
+			continue;
+		if ((op->rec = tdb_htrie_trx_insert(dbh, op, bits[i]))) {
+			++ins;
+			continue;
+		}
+
+		/* Revert the inserts, nobody has seen them. */
+		for (j = 0; j < i; ++j) {
+			if (!trx->ops[j].rec)
+				continue;
+			if (TDB_HTRIE_VARLENRECS(dbh))
+				tdb_free_vsrec((TdbVRec *)trx->ops[j].rec);
+			else
+				tdb_free_fsrec(dbh, (TdbFRec *)trx->ops[j].rec);
+			trx->ops[j].rec = NULL;
+		}
+		if (TDB_HTRIE_RESOLVED(bits[i])
+		    || tdb_htrie_burst(dbh, &node[i], op->bckt, op->key,
+				       bits[i]))
+		{
+			TDB_ERR("Cannot insert record with key %#lx by"
+				" transaction\n", op->key);
+			++raw_cpu_ptr(dbh->pcpu)->os.alloc_fails;
+			r = -ENOMEM;
+		} else {
+			tdb_htrie_bckt_update(op->bckt);
+			r = -EAGAIN;
+		}
+		goto unlock;
+	}
+
+	for (i = 0; i < trx->n; ++i) {
+		op = &trx->ops[i];
+		if (op->type == TDB_TRX_REMOVE) {
+			TdbTrxRmCtx ctx = { .trx = trx, .op = op };
+
+			op->len = tdb_htrie_bucket_remove(dbh, op->bckt,
+							  op->key,
+							  tdb_htrie_trx_rm_eq,
+							  &ctx);
+			rm += op->len;
+			if (op->len)
+				tdb_htrie_bckt_update(op->bckt);
+		} else if (op->type == TDB_TRX_INSERT) {
+			tdb_htrie_bckt_update(op->bckt);
+		}
+	}
+
+	raw_cpu_ptr(dbh->pcpu)->os.inserts += ins;
+	raw_cpu_ptr(dbh->pcpu)->os.removes += rm;
+unlock:
+	while (--n >= 0)
+		write_unlock_bh(&bckts[n]->lock);
+
+	return r;
+}
+
+/**
+ * Check whether chunks of variable-size record @rec span more extents than
+ * necessary: the head chunk is never moved, so its extent is accounted
+ * separately from extents for the rest of the record data.
+ * @return data length of the chunks to move or zero if the record isn't
+ * fragmented.
+ */
+size_t
+tdb_htrie_vrec_fragmented(TdbHdr *dbh, TdbVRec *rec)
+{
+	unsigned long ext = TDB_EXT_BASE(dbh, rec), n = 1, len = 0;
+
+	while (rec->chunk_next) {
+		rec = TDB_PTR(dbh, TDB_DI2O(rec->chunk_next));
+		len += TDB_HTRIE_VRLEN(rec);
+		if (TDB_EXT_BASE(dbh, rec) != ext) {
+			ext = TDB_EXT_BASE(dbh, rec);
+			++n;
+		}
+	}
+
+	return n > 2 + len / TDB_EXT_SZ ? len : 0;
+}
+
+/**
+ * Move all the chunks, except the head, of record @rec to newly allocated
+ * space, which is placed in currently used extent. Chunk lengths aren't
+ * changed since the record owner can rely on the chunk boundaries.
+ * The record chain is valid after each moved chunk, so we can stop at any
+ * time.
+ *
+ * The old chunks are only marked as freed and TDB doesn't reuse freed space,
+ * so the data can still be referenced by the record users, e.g. by skbs
+ * being transmitted.
+ */
+static long
+tdb_htrie_move_chunks(TdbHdr *dbh, TdbVRec *rec, const TdbRelocOps *ops)
+{
+	long moved = 0;
+	TdbVRec *prev = rec;
+
+	while (prev->chunk_next) {
+		TdbVRec *c, *r = TDB_PTR(dbh, TDB_DI2O(prev->chunk_next));
+		size_t len = TDB_HTRIE_VRLEN(r);
+		unsigned long o;
+
+		o = tdb_alloc_data(dbh, &len, 0);
+		if (!o)
+			return moved ? : -ENOMEM;
+		c = TDB_PTR(dbh, o);
+		if (len < TDB_HTRIE_VRLEN(r)) {
+			/* Start of an extent, the room is lost. */
+			c->len = len | TDB_HTRIE_VRFREED;
+			return moved;
+		}
+
+		memcpy(c, r, sizeof(*r) + len);
+		ops->moved((TdbRec *)rec, TDB_HTRIE_OFF(dbh, r->data),
+			   TDB_HTRIE_OFF(dbh, c->data), len);
+		prev->chunk_next = TDB_O2DI(o);
+		tdb_free_vsrec(r);
+
+		prev = c;
+		moved += len;
+	}
+
+	return moved;
+}
+
+/**
+ * Move chunks of fragmented records with key @key to currently used extent.
+ * Buckets are write locked while a record is moved, so lookups of keys from
+ * the same buckets wait for the move. Records with more than @max bytes of
+ * data to move aren't moved to keep the waiting short.
+ * @return number of moved bytes or negative value on error.
+ */
+long
+tdb_htrie_compact(TdbHdr *dbh, unsigned long key, size_t max,
+		  const TdbRelocOps *ops)
+{
+	size_t n;
+	long r, moved = 0;
+	unsigned long now = get_seconds();
+	TdbBucket *b, *b_tmp;
+	TdbVRec *rec;
+
+	BUG_ON(!TDB_HTRIE_VARLENRECS(dbh));
+
+	b = tdb_htrie_lookup(dbh, key);
+	if (!b)
+		return 0;
+
+	write_lock_bh(&b->lock);
+
+	do {
+		rec = TDB_HTRIE_BCKT_1ST_REC(b);
+		do {
+			size_t rlen = TDB_HTRIE_RALIGN(sizeof(*rec)
+						+ TDB_HTRIE_VRLEN(rec));
+			if ((char *)rec + rlen - (char *)b > TDB_HTRIE_MINDREC
+			    && rec != TDB_HTRIE_BCKT_1ST_REC(b))
+				break;
+			if (tdb_live_vsrec(rec) && rec->key == key
+			    && !tdb_rec_expired((TdbRec *)rec, now)
+			    && ops->movable((TdbRec *)rec)
+			    && (n = tdb_htrie_vrec_fragmented(dbh, rec))
+			    && n <= max)
+			{
+				r = tdb_htrie_move_chunks(dbh, rec, ops);
+				if (r < 0) {
+					write_unlock_bh(&b->lock);
+					return moved ? : r;
+				}
+				moved += r;
+			}
+			rec = (TdbVRec *)((char *)rec + rlen);
+		} while ((char *)rec + sizeof(*rec) - (char *)b
+			 <= TDB_HTRIE_MINDREC);
+
+		b_tmp = TDB_HTRIE_BUCKET_NEXT(dbh, b);
+		if (b_tmp)
+			write_lock_bh(&b_tmp->lock);
+		write_unlock_bh(&b->lock);
+		b = b_tmp;
+	} while (b);
+
+	return moved;
+}
+
+/**
+ * Walk index node @node at level @bits starting from the branch stored
+ * in the cursor @cur. The cursor keeps the branch indexes on the path
+ * to current bucket, so the next walk resumes from the bucket.
+ */
+static int
+__htrie_walk(TdbHdr *dbh, TdbHtrieNode *node, int bits, unsigned long *cur,
+	     int (*fn)(void *data, TdbRec *rec), void *data)
+{
+	int i, res;
+
+	for (i = TDB_HTRIE_IDX(*cur, bits); i < TDB_HTRIE_FANOUT; ) {
+		unsigned long o = node->shifts[i];
+
+		if (!o) {
+			res = 0;
+		} else if (o & TDB_HTRIE_DBIT) {
+			o = TDB_DI2O(o & ~TDB_HTRIE_DBIT);
+			res = tdb_htrie_bucket_walk(dbh, TDB_PTR(dbh, o),
+						    fn, data);
+		} else {
+			res = __htrie_walk(dbh, TDB_PTR(dbh, TDB_II2O(o)),
+					   bits + TDB_HTRIE_BITS, cur, fn, data);
+		}
+		if (res)
+			return res;
+
+		/* Move to the next branch, deeper levels start from zero. */
+		if (++i < TDB_HTRIE_FANOUT)
+			*cur = (*cur & ((1UL << bits) - 1))
+			       | ((unsigned long)i << bits);
+	}
+
+	return 0;
+}
+
+/**
+ * Depth-first traversal of whole the tree calling @fn for each live record,
+ * including expired records which aren't removed yet.
+ * The traversal stops if @fn returns non-zero value, which is returned.
+ *
+ * The order of records is determined by their keys only, so a caller can
+ * resume the walk by skipping already observed records. Records inserted
+ * or moved by concurrent bursts can be missed or observed twice.
+ */
+int
+tdb_htrie_walk(TdbHdr *dbh, int (*fn)(void *data, TdbRec *rec), void *data)
+{
+	unsigned long cur = 0;
+
+	return tdb_htrie_walk_from(dbh, &cur, fn, data);
+}
+
+/**
+ * The same as tdb_htrie_walk(), but starts from the bucket saved in @cursor
+ * by previous call and updates it. The whole bucket is walked again if
+ * previous walk was stopped in it. @cursor is reset to zero, i.e. to the
+ * beginning of the tree, when the walk is finished.
+ */
+int
+tdb_htrie_walk_from(TdbHdr *dbh, unsigned long *cursor,
+		    int (*fn)(void *data, TdbRec *rec), void *data)
+{
+	int r = __htrie_walk(dbh, TDB_HTRIE_ROOT(dbh), 0, cursor, fn, data);
+
+	if (!r)
+		*cursor = 0;
+	return r;
+}
+
+/* Number of distinct keys of a collision chain to count full collisions. */
+#define TDB_STAT_KEYS		32
+
+static void
+tdb_stat_bucket(TdbHdr *dbh, TdbBucket *b, TdbHtrieStat *st)
+{
+	int i, nk = 0;
+	unsigned long n = 0, keys[TDB_STAT_KEYS];
+	TdbBucket *b_tmp;
+	TdbRec *r;
+
+	read_lock_bh(&b->lock);
+
+	do {
+		++n;
+		r = TDB_HTRIE_BCKT_1ST_REC(b);
+		do {
+			size_t rlen = TDB_HTRIE_RALIGN(sizeof(*r)
+						+ TDB_HTRIE_RBODYLEN(dbh, r));
+			if ((char *)r + rlen - (char *)b > TDB_HTRIE_MINDREC
+			    && r != TDB_HTRIE_BCKT_1ST_REC(b))
+				break;
+			if (tdb_live_rec(dbh, r)) {
+				TdbVRec *vr = (TdbVRec *)r;
+
+				for (i = 0; i < nk && keys[i] != r->key; ++i)
+					;
+				if (i < nk)
+					++st->key_colls;
+				else if (nk < TDB_STAT_KEYS)
+					keys[nk++] = r->key;
+
+				++st->records;
+				if (!TDB_HTRIE_VARLENRECS(dbh)) {
+					st->rec_bytes += dbh->rec_len;
+				} else {
+					st->rec_bytes += TDB_HTRIE_VRLEN(vr);
+					while (vr->chunk_next) {
+						vr = TDB_PTR(dbh, TDB_DI2O(
+							vr->chunk_next));
+						st->rec_bytes +=
+							TDB_HTRIE_VRLEN(vr);
+					}
+				}
+			}
+			r = (TdbRec *)((char *)r + rlen);
+		} while ((char *)r + sizeof(*r) - (char *)b
+			 <= TDB_HTRIE_MINDREC);
+
+		b_tmp = TDB_HTRIE_BUCKET_NEXT(dbh, b);
+		if (b_tmp)
+			read_lock_bh(&b_tmp->lock);
+		read_unlock_bh(&b->lock);
+		b = b_tmp;
+	} while (b);
+
+	++st->chains;
+	st->buckets += n;
+	if (n > st->max_chain)
+		st->max_chain = n;
+	if (n <= 4)
+		++st->chain_hist[n - 1];
+	else
+		++st->chain_hist[n <= 8 ? 4 : n <= 16 ? 5 : 6];
+}
+
+static void
+tdb_stat_node(TdbHdr *dbh, TdbHtrieNode *node, TdbHtrieStat *st)
+{
+	int i;
+
+	++st->inodes;
+
+	for (i = 0; i < TDB_HTRIE_FANOUT; ++i) {
+		unsigned long o = node->shifts[i];
+
+		if (!o)
+			continue;
+		if (o & TDB_HTRIE_DBIT)
+			tdb_stat_bucket(dbh, TDB_PTR(dbh, TDB_DI2O(o
+						& ~TDB_HTRIE_DBIT)), st);
+		else
+			tdb_stat_node(dbh, TDB_PTR(dbh, TDB_II2O(o)), st);
+	}
+}
+
+/**
+ * Collect structure statistics of the table by walking the whole tree, so
+ * the call is expensive for large tables. Buckets are read locked as by
+ * tdb_htrie_walk(), so the statistics are approximate if the table is
+ * concurrently updated.
+ */
+void
+tdb_htrie_stat(TdbHdr *dbh, TdbHtrieStat *st)
+{
+	unsigned long e;
+
+	memset(st, 0, sizeof(*st));
+
+	tdb_stat_node(dbh, TDB_HTRIE_ROOT(dbh), st);
+
+	st->exts = dbh->dbsz / TDB_EXT_SZ;
+	for (e = 0; e < st->exts; ++e)
+		if (!(dbh->ext_bmp[e / BITS_PER_LONG]
+		      & (1UL << (e % BITS_PER_LONG))))
+			++st->free_exts;
+}
+
+/**
+ * Set hash function @fn with key @key (used by keyed functions only) for
+ * keys of the table. Keys of stored records are computed by the current
+ * function, so it can be changed only while the table is empty.
+ */
+int
+tdb_htrie_set_hash(TdbHdr *dbh, unsigned int fn, const unsigned long *key)
+{
+	int i;
+	TdbHtrieNode *root = TDB_HTRIE_ROOT(dbh);
+
+	if (fn >= __TDB_HASH_NUM)
+		return -EINVAL;
+	if (dbh->hash == fn)
+		return 0;
+
+	for (i = 0; i < TDB_HTRIE_FANOUT; ++i)
+		if (root->shifts[i])
+			return -EBUSY;
+
+	dbh->hash_key[0] = key[0];
+	dbh->hash_key[1] = key[1];
+	dbh->hash = fn;
+
+	return 0;
+}
+
+/**
+ * True if area [@o, @o + @len) is within used extents of the table.
+ */
+static bool
+tdb_check_off(TdbHdr *dbh, unsigned long o, size_t len)
+{
+	unsigned long e = TDB_EXT_ID(o);
+
+	if (o < TDB_HDR_SZ + sizeof(TdbExt) || o + len > dbh->dbsz)
+		return false;
+	return dbh->ext_bmp[e / BITS_PER_LONG] & (1UL << (e % BITS_PER_LONG));
+}
+
+static long
+tdb_check_vrec(TdbHdr *dbh, TdbVRec *r)
+{
+	unsigned long n, max = dbh->dbsz / TDB_HTRIE_MINDREC;
+
+	for (n = 0; r->chunk_next; ++n) {
+		unsigned long o = TDB_DI2O(r->chunk_next);
+
+		if (n > max || !tdb_check_off(dbh, o, sizeof(*r))) {
+			TDB_ERR("bad chunk %#lx of record %#lx\n",
+				o, TDB_HTRIE_OFF(dbh, r));
+			return 1;
+		}
+		r = TDB_PTR(dbh, o);
+		if (!tdb_check_off(dbh, o, sizeof(*r) + TDB_HTRIE_VRLEN(r))) {
+			TDB_ERR("bad length %u of chunk %#lx\n",
+				TDB_HTRIE_VRLEN(r), o);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check records of collision chain starting at bucket with offset @o and
+ * call @fn, if specified, for the live records with valid chunks.
+ */
+static long
+tdb_check_bucket(TdbHdr *dbh, unsigned long o,
+		 void (*fn)(void *data, TdbRec *rec), void *data)
+{
+	long err = 0;
+	unsigned long n, max = dbh->dbsz / TDB_HTRIE_MINDREC;
+
+	for (n = 0; ; ++n) {
+		TdbBucket *b = TDB_PTR(dbh, o);
+		TdbRec *r = TDB_HTRIE_BCKT_1ST_REC(b);
+
+		do {
+			size_t rlen = TDB_HTRIE_RALIGN(sizeof(*r)
+						+ TDB_HTRIE_RBODYLEN(dbh, r));
+			if ((char *)r + rlen - (char *)b > TDB_HTRIE_MINDREC
+			    && r != TDB_HTRIE_BCKT_1ST_REC(b))
+				break;
+			if (!tdb_check_off(dbh, TDB_HTRIE_OFF(dbh, r), rlen)) {
+				TDB_ERR("bad length of record %#lx\n",
+					TDB_HTRIE_OFF(dbh, r));
+				return err + 1;
+			}
+			if (tdb_live_rec(dbh, r)) {
+				long e = TDB_HTRIE_VARLENRECS(dbh)
+					 ? tdb_check_vrec(dbh, (TdbVRec *)r)
+					 : 0;
+				if (!e && fn)
+					fn(data, r);
+				err += e;
+			}
+			r = (TdbRec *)((char *)r + rlen);
+		} while ((char *)r + sizeof(*r) - (char *)b
+			 <= TDB_HTRIE_MINDREC);
+
+		if (!b->coll_next)
+			return err;
+		o = TDB_DI2O(b->coll_next);
+		if (n > max || !tdb_check_off(dbh, o, TDB_HTRIE_MINDREC)) {
+			TDB_ERR("bad collision chain %#lx of bucket %#lx\n",
+				o, TDB_HTRIE_OFF(dbh, b));
+			return err + 1;
+		}
+	}
+}
+
+static long
+tdb_check_node(TdbHdr *dbh, TdbHtrieNode *node, int bits,
+	       void (*fn)(void *data, TdbRec *rec), void *data)
+{
+	int i;
+	long err = 0;
+
+	for (i = 0; i < TDB_HTRIE_FANOUT; ++i) {
+		unsigned long o = node->shifts[i];
+
+		if (!o)
+			continue;
+		if (o & TDB_HTRIE_DBIT) {
+			o = TDB_DI2O(o & ~TDB_HTRIE_DBIT);
+			if (!tdb_check_off(dbh, o, TDB_HTRIE_MINDREC)) {
+				TDB_ERR("bad bucket %#lx at index node %#lx\n",
+					o, TDB_HTRIE_OFF(dbh, node));
+				++err;
+				continue;
+			}
+			err += tdb_check_bucket(dbh, o, fn, data);
+		} else {
+			o = TDB_II2O(o);
+			if (TDB_HTRIE_RESOLVED(bits + TDB_HTRIE_BITS)
+			    || !tdb_check_off(dbh, o, sizeof(*node)))
+			{
+				TDB_ERR("bad index node %#lx at index node"
+					" %#lx\n", o, TDB_HTRIE_OFF(dbh, node));
+				++err;
+				continue;
+			}
+			err += tdb_check_node(dbh, TDB_PTR(dbh, o),
+					      bits + TDB_HTRIE_BITS, fn, data);
+		}
+	}
+
+	return err;
+}
+
+static long
+tdb_check_hdr(TdbHdr *dbh, size_t size)
+{
+	if (dbh->magic != TDB_MAGIC)
+		return -1;
+
+	if (dbh->dbsz > size || (dbh->dbsz & ~TDB_EXT_MASK)
+	    || dbh->dbsz > TDB_MAX_DB_SZ)
+	{
+		TDB_ERR("bad table size %lu, file size %lu\n", dbh->dbsz, size);
+		return 1;
+	}
+	if (dbh->rec_len > TDB_BLK_SZ / 2) {
+		TDB_ERR("bad record length %u\n", dbh->rec_len);
+		return 1;
+	}
+	if (atomic64_read(&dbh->nwb) > dbh->dbsz || !(dbh->ext_bmp[0] & 1)) {
+		TDB_ERR("bad allocation state, nwb=%lu\n",
+			(unsigned long)atomic64_read(&dbh->nwb));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Check structure of table image @dbh of @size bytes, e.g. one which could be
+ * torn by a crash during the table synchronization with disk. All the index
+ * and data offsets must point to used extents of the table and collision
+ * chains and record chunks must not leave the table.
+ * The image isn't modified, so the check also runs in user space for
+ * mapped table files.
+ *
+ * @return number of found inconsistencies or -1 if @dbh isn't a table image.
+ */
+long
+tdb_htrie_check(TdbHdr *dbh, size_t size)
+{
+	return tdb_htrie_image_walk(dbh, size, NULL, NULL);
+}
+
+/**
+ * Walk table image @dbh of @size bytes without locking and call @fn for each
+ * live record. The image is checked on the way as by tdb_htrie_check(), so
+ * the walk never leaves the image even if it's being modified concurrently,
+ * e.g. by the kernel writing a table file which is mapped by a user-space
+ * reader. Records with broken chunks aren't passed to @fn.
+ *
+ * @return number of found inconsistencies or -1 if @dbh isn't a table image.
+ */
+long
+tdb_htrie_image_walk(TdbHdr *dbh, size_t size,
+		     void (*fn)(void *data, TdbRec *rec), void *data)
+{
+	long r = tdb_check_hdr(dbh, size);
+
+	if (r)
+		return r;
+
+	return tdb_check_node(dbh, TDB_HTRIE_ROOT(dbh), 0, fn, data);
+}
+
+/**
+ * The same as tdb_htrie_image_walk(), but walks only the collision chain for
+ * @key, so @fn also gets records with other keys sharing the buckets.
+ */
+long
+tdb_htrie_image_lookup(TdbHdr *dbh, size_t size, unsigned long key,
+		       void (*fn)(void *data, TdbRec *rec), void *data)
+{
+	int bits;
+	long r = tdb_check_hdr(dbh, size);
+	TdbHtrieNode *node = TDB_HTRIE_ROOT(dbh);
+
+	if (r)
+		return r;
+
+	for (bits = 0; ; bits += TDB_HTRIE_BITS) {
+		unsigned long o = node->shifts[TDB_HTRIE_IDX(key, bits)];
+
+		if (!o)
+			return 0;
+		if (o & TDB_HTRIE_DBIT) {
+			o = TDB_DI2O(o & ~TDB_HTRIE_DBIT);
+			if (!tdb_check_off(dbh, o, TDB_HTRIE_MINDREC)) {
+				TDB_ERR("bad bucket %#lx at index node %#lx\n",
+					o, TDB_HTRIE_OFF(dbh, node));
+				return 1;
+			}
+			return tdb_check_bucket(dbh, o, fn, data);
+		}
+		o = TDB_II2O(o);
+		if (TDB_HTRIE_RESOLVED(bits + TDB_HTRIE_BITS)
+		    || !tdb_check_off(dbh, o, sizeof(*node)))
+		{
+			TDB_ERR("bad index node %#lx at index node %#lx\n",
+				o, TDB_HTRIE_OFF(dbh, node));
+			return 1;
+		}
+		node = TDB_PTR(dbh, o);
+	}
+}
+
+/**
+ * Extend the table to @db_size bytes. The new memory must be already mapped
+ * after the table. Lookups and inserts can run concurrently: the new extents
+ * are zeroed before they become visible for the allocator by the new size.
+ * Concurrent calls for the same table must be serialized by the caller.
+ */
+int
+tdb_htrie_grow(TdbHdr *dbh, size_t db_size)
+{
+	if (db_size <= dbh->dbsz || (db_size & ~TDB_EXT_MASK)
+	    || db_size > TDB_MAX_DB_SZ)
+	{
+		TDB_ERR("bad new table size %lu, current size is %lu\n",
+			db_size, dbh->dbsz);
+		return -EINVAL;
+	}
+
+	memset(TDB_PTR(dbh, dbh->dbsz), 0, db_size - dbh->dbsz);
+	smp_wmb();
+	dbh->dbsz = db_size;
+
+	return 0;
+}
+
 TdbHdr *
 tdb_htrie_init(void *p, size_t db_size, unsigned int rec_len)
 {
@@ -890,6 +2025,10 @@ tdb_htrie_init(void *p, size_t db_size, unsigned int rec_len)
 			TDB_ERR("cannot init db mapping\n");
 			return NULL;
 		}
+	} else if (hdr->dbsz < db_size) {
+		/* The table file was extended since the table was closed. */
+		if (tdb_htrie_grow(hdr, db_size))
+			return NULL;
 	}
 
 	/* Set per-CPU pointers. */
@@ -59,9 +59,16 @@
 #define TDB_HTRIE_DBIT		(1U << (sizeof(int) * 8 - 1))
 #define TDB_HTRIE_OMASK		(TDB_HTRIE_DBIT - 1) /* offset mask */
 #define TDB_HTRIE_IDX(k, b)	(((k) >> (b)) & TDB_HTRIE_KMASK)
-#define TDB_EXT_BMP_2L(h)	(((h)->dbsz / TDB_EXT_SZ + BITS_PER_LONG - 1)\
-				 / BITS_PER_LONG)
+/* Byte offset of index node or data block referenced by index node slot. */
+#define TDB_HTRIE_SHIFT_O(s)	((s) & TDB_HTRIE_DBIT			\
+				 ? TDB_DI2O((s) & ~TDB_HTRIE_DBIT)	\
+				 : TDB_II2O(s))
 #define TDB_MAX_DB_SZ		((1UL << 31) * L1_CACHE_BYTES)
+/*
+ * Extents bitmap is sized for the maximum table size, so tables can grow
+ * online without moving the root index node.
+ */
+#define TDB_EXT_BMP_2L		(TDB_MAX_DB_SZ / TDB_EXT_SZ / BITS_PER_LONG)
 /* Get internal offset from a pointer. */
 #define TDB_HTRIE_OFF(h, p)	((unsigned long)(p) - (unsigned long)(h))
 /* Base offset of extent containing pointer @p. */
@@ -71,6 +78,10 @@
  * Header for bucket of small records.
  *
  * @coll_next	- next record offset (in data blocks) in collision chain;
+ * @flags	- TDB_HTRIE_VRFREED and version of the collision chain, which
+ *		  is changed under the bucket lock on each update of the chain
+ *		  records, so transactions can check that the records weren't
+ *		  changed since they were read;
  */
 typedef struct {
 	unsigned int 	coll_next;
@@ -79,6 +90,9 @@ typedef struct {
 } __attribute__((packed)) TdbBucket;
 
 #define TDB_HTRIE_VRFREED	TDB_HTRIE_DBIT
+#define TDB_HTRIE_VER_MASK	(~TDB_HTRIE_VRFREED)
+#define TDB_HTRIE_VER(b)	(*(volatile unsigned int *)&(b)->flags	\
+				 & TDB_HTRIE_VER_MASK)
 #define TDB_HTRIE_VRLEN(r)	((r)->len & ~TDB_HTRIE_VRFREED)
 #define TDB_HTRIE_RBODYLEN(h, r)	((h)->rec_len ? : 		\
 					 TDB_HTRIE_VRLEN((TdbVRec *)r))
@@ -99,10 +113,9 @@ typedef struct {
 				     ? TDB_PTR(h, TDB_DI2O((b)->coll_next))\
 				     : NULL)				\
 
-#define TDB_HDR_SZ(h)							\
-	(sizeof(TdbHdr) + TDB_EXT_BMP_2L(h) * sizeof(long))
+#define TDB_HDR_SZ		(sizeof(TdbHdr) + TDB_EXT_BMP_2L * sizeof(long))
 #define TDB_HTRIE_ROOT(h)						\
-	(TdbHtrieNode *)((char *)(h) + TDB_HDR_SZ(h) + sizeof(TdbExt))
+	(TdbHtrieNode *)((char *)(h) + TDB_HDR_SZ + sizeof(TdbExt))
 
 /* FIXME we can't store zero bytes by zero key. */
 static inline int
@@ -131,13 +144,79 @@ tdb_live_rec(TdbHdr *dbh, TdbRec *r)
 	       : tdb_live_fsrec(dbh, (TdbFRec *)r);
 }
 
+/**
+ * True if record @r has expiration time and it's already passed by @now.
+ * Expired records are still in the tree until the expiration collector
+ * removes them, but they're invisible for lookups.
+ */
+static inline int
+tdb_rec_expired(TdbRec *r, unsigned long now)
+{
+	return r->expires && now >= r->expires;
+}
+
+/* Number of collision chain length ranges in statistics. */
+#define TDB_STAT_CHAIN_HIST	7
+
+/**
+ * Structure statistics of a table.
+ *
+ * @records	- number of live records, including expired ones;
+ * @rec_bytes	- data length of the live records;
+ * @inodes	- number of index nodes;
+ * @chains	- number of collision chains, i.e. buckets referenced by index;
+ * @buckets	- number of buckets in all the collision chains;
+ * @max_chain	- number of buckets in the longest collision chain;
+ * @chain_hist	- number of collision chains of 1, 2, 3, 4, 5-8, 9-16 and more
+ *		  buckets;
+ * @key_colls	- number of records with the same key as another record,
+ *		  i.e. full key collisions resolved by the table owner;
+ * @exts	- number of extents of the table;
+ * @free_exts	- number of free extents;
+ */
+typedef struct {
+	unsigned long	records;
+	unsigned long	rec_bytes;
+	unsigned long	inodes;
+	unsigned long	chains;
+	unsigned long	buckets;
+	unsigned long	max_chain;
+	unsigned long	chain_hist[TDB_STAT_CHAIN_HIST];
+	unsigned long	key_colls;
+	unsigned long	exts;
+	unsigned long	free_exts;
+} TdbHtrieStat;
+
 TdbVRec *tdb_htrie_extend_rec(TdbHdr *dbh, TdbVRec *rec, size_t size);
 TdbRec *tdb_htrie_insert(TdbHdr *dbh, unsigned long key, void *data,
 			 size_t *len);
 TdbBucket *tdb_htrie_lookup(TdbHdr *dbh, unsigned long key);
+void tdb_htrie_lookup_batch(TdbHdr *dbh, const unsigned long *keys,
+			    TdbBucket **bckts, int n);
 TdbRec *tdb_htrie_bscan_for_rec(TdbHdr *dbh, TdbBucket **b, unsigned long key);
 TdbRec *tdb_htrie_next_rec(TdbHdr *dbh, TdbRec *r, TdbBucket **b,
 			   unsigned long key);
+int tdb_htrie_remove(TdbHdr *dbh, unsigned long key,
+		     bool (*eq)(TdbRec *rec, void *data), void *data);
+int tdb_htrie_trx_add(TdbHdr *dbh, TdbTrx *trx, unsigned int type,
+		      unsigned long key, void *data, size_t len,
+		      bool (*eq)(TdbRec *rec, void *data));
+int tdb_htrie_trx_commit(TdbHdr *dbh, TdbTrx *trx);
+size_t tdb_htrie_vrec_fragmented(TdbHdr *dbh, TdbVRec *rec);
+long tdb_htrie_compact(TdbHdr *dbh, unsigned long key, size_t max,
+		       const TdbRelocOps *ops);
+int tdb_htrie_walk(TdbHdr *dbh, int (*fn)(void *data, TdbRec *rec),
+		   void *data);
+int tdb_htrie_walk_from(TdbHdr *dbh, unsigned long *cursor,
+			int (*fn)(void *data, TdbRec *rec), void *data);
+void tdb_htrie_stat(TdbHdr *dbh, TdbHtrieStat *st);
+int tdb_htrie_set_hash(TdbHdr *dbh, unsigned int fn, const unsigned long *key);
+long tdb_htrie_check(TdbHdr *dbh, size_t size);
+long tdb_htrie_image_walk(TdbHdr *dbh, size_t size,
+			 void (*fn)(void *data, TdbRec *rec), void *data);
+long tdb_htrie_image_lookup(TdbHdr *dbh, size_t size, unsigned long key,
+			   void (*fn)(void *data, TdbRec *rec), void *data);
+int tdb_htrie_grow(TdbHdr *dbh, size_t db_size);
 TdbHdr *tdb_htrie_init(void *p, size_t db_size, unsigned int rec_len);
 void tdb_htrie_exit(TdbHdr *dbh);
 
@@ -24,6 +24,7 @@
 #include <net/net_namespace.h>
 
 #include "htrie.h"
+#include "replog.h"
 #include "table.h"
 #include "tdb_if.h"
 
@@ -32,6 +33,8 @@ static DEFINE_MUTEX(tdb_if_mtx);
 
 #define TDB_NLMSG_MAXSZ		(NL_FR_SZ / 2 - NLMSG_HDRLEN - sizeof(TdbMsg) \
 				 - sizeof(TdbMsgRec))
+/* Number of changed keys read from a change log at once. */
+#define TDB_IF_REPL_BATCH	32
 
 static int
 tdb_if_info(struct sk_buff *skb, struct netlink_callback *cb)
@@ -63,6 +66,7 @@ tdb_if_info(struct sk_buff *skb, struct netlink_callback *cb)
 static int
 tdb_if_open_close(struct sk_buff *skb, struct netlink_callback *cb)
 {
+	TDB *db;
 	TdbMsg *resp_m, *m = cb->data;
 	TdbCrTblRec *ct = (TdbCrTblRec *)(m->recs + 1);
 	struct nlmsghdr *nlh;
@@ -78,11 +82,14 @@ tdb_if_open_close(struct sk_buff *skb, struct netlink_callback *cb)
 
 	if (m->type == TDB_MSG_OPEN) {
 		resp_m->type = TDB_MSG_OPEN;
-		if (tdb_open(ct->path, ct->tbl_size, ct->rec_size, numa_node_id()))
+		db = tdb_open(ct->path, ct->tbl_size, ct->rec_size,
+			      numa_node_id());
+		if (db) {
+			/* Existing tables keep their hash functions. */
+			tdb_set_hash(db, ct->hash);
 			resp_m->type |= TDB_NLF_RESP_OK;
+		}
 	} else {
-		TDB *db;
-
 		resp_m->type = TDB_MSG_CLOSE;
 
 		db = tdb_tbl_lookup(m->t_name, TDB_TBLNAME_LEN);
@@ -99,6 +106,52 @@ tdb_if_open_close(struct sk_buff *skb, struct netlink_callback *cb)
 	return 0;
 }
 
+static int
+tdb_if_resize(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	TDB *db;
+	TdbMsg *resp_m, *m = cb->data;
+	TdbCrTblRec *ct = (TdbCrTblRec *)(m->recs + 1);
+	struct nlmsghdr *nlh;
+
+	nlh = nlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			cb->nlh->nlmsg_type, sizeof(TdbMsg), 0);
+	if (!nlh)
+		return -EMSGSIZE;
+
+	resp_m = nlmsg_data(nlh);
+	resp_m->type = TDB_MSG_RESIZE;
+	resp_m->rec_n = 0;
+
+	db = tdb_tbl_lookup(m->t_name, TDB_TBLNAME_LEN);
+	if (!db) {
+		TDB_WARN("Tried to resize non existent table '%s'\n",
+			 m->t_name);
+		return 0;
+	}
+
+	if (!tdb_resize(db, ct->tbl_size))
+		resp_m->type |= TDB_NLF_RESP_OK;
+
+	tdb_put(db);
+
+	return 0;
+}
+
+/**
+ * Remove all the records with the key hash specified by removal record @r.
+ * @return false if @r isn't a removal record.
+ */
+static bool
+tdb_if_remove(TDB *db, TdbMsgRec *r)
+{
+	if (r->klen || r->dlen != sizeof(unsigned long))
+		return false;
+
+	tdb_entry_remove(db, *(unsigned long *)r->data, NULL, NULL);
+	return true;
+}
+
 static int
 tdb_if_insert(struct sk_buff *skb, struct netlink_callback *cb)
 {
@@ -130,15 +183,22 @@ tdb_if_insert(struct sk_buff *skb, struct netlink_callback *cb)
 
 	if (TDB_HTRIE_VARLENRECS(db->hdr)) {
 		for (i = 0, off = 0; i < m->rec_n; ++i) {
+			TdbRec *rec;
+
 			r = (TdbMsgRec *)((char *)m->recs + off);
-			key = tdb_hash_calc(r->data, r->klen);
+			if (tdb_if_remove(db, r)) {
+				off += TDB_MSGREC_LEN(r);
+				continue;
+			}
+			key = tdb_hash(db, r->data, r->klen);
 			len = TDB_MSGREC_LEN(r);
-			vr = (TdbVRec *)tdb_entry_create(db, key, r, &len);
-			if (!vr) {
+			rec = tdb_entry_create(db, key, r, &len);
+			if (!rec) {
 				TDB_ERR("Cannot create variable-size record\n");
 				break;
 			}
-			for ( ; len < TDB_MSGREC_LEN(r); ) {
+			vr = (TdbVRec *)rec;
+			while (len < TDB_MSGREC_LEN(r)) {
 				vr = tdb_entry_add(db, vr,
 						   TDB_MSGREC_LEN(r) - len);
 				if (!vr) {
@@ -149,18 +209,28 @@ tdb_if_insert(struct sk_buff *skb, struct netlink_callback *cb)
 				memcpy(vr + 1, r->data + len, vr->len);
 				len += vr->len;
 			}
+			/* Only complete records are added to indexes. */
+			if (len < TDB_MSGREC_LEN(r)
+			    || tdb_entry_commit(db, rec))
+				break;
 			off += TDB_MSGREC_LEN(r);
 		}
 	} else {
 		for (i = 0, off = 0; i < m->rec_n; ++i) {
 			r = (TdbMsgRec *)((char *)m->recs + off);
-			key = tdb_hash_calc(r->data, r->klen);
+			if (tdb_if_remove(db, r)) {
+				off += TDB_MSGREC_LEN(r);
+				continue;
+			}
+			key = tdb_hash(db, r->data, r->klen);
 			len = TDB_MSGREC_LEN(r);
 			fr = (TdbFRec *)tdb_entry_create(db, key, r, &len);
 			if (!fr || len != r->dlen) {
 				TDB_ERR("Cannot create fixed-size record\n");
 				break;
 			}
+			if (tdb_entry_commit(db, (TdbRec *)fr))
+				break;
 			off += TDB_MSGREC_LEN(r);
 		}
 	}
@@ -173,6 +243,404 @@ tdb_if_insert(struct sk_buff *skb, struct netlink_callback *cb)
 	return 0;
 }
 
+/**
+ * State of full table scan.
+ *
+ * @db		- the table being scanned;
+ * @resp_m	- response message to place the records to;
+ * @off		- current offset in @resp_m records;
+ * @cursor	- the table walk cursor or NULL if the records aren't walked;
+ * @bckt	- the cursor value of current bucket;
+ * @skip	- number of records of current bucket already observed in
+ *		  previous frame;
+ * @seen	- number of records of current bucket observed;
+ * @now		- current time to skip expired records;
+ */
+typedef struct {
+	TDB		*db;
+	TdbMsg		*resp_m;
+	size_t		off;
+	unsigned long	*cursor;
+	unsigned long	bckt;
+	unsigned long	skip;
+	unsigned long	seen;
+	unsigned long	now;
+} TdbScanCtx;
+
+/**
+ * Copy record @rec, which is TdbMsgRec placed by tdb_if_insert(), to current
+ * response frame. Records of other formats (e.g. stored by kernel users of
+ * the table) are silently skipped.
+ * @return non-zero if there is no room in the frame for the record.
+ */
+static int
+tdb_if_scan_rec(void *data, TdbRec *rec)
+{
+	TdbScanCtx *ctx = data;
+	TdbHdr *dbh = ctx->db->hdr;
+	char *dst = (char *)ctx->resp_m->recs + ctx->off;
+	TdbMsgRec *mr;
+	size_t len, n;
+
+	/* The walk has moved to the next bucket. */
+	if (ctx->cursor && *ctx->cursor != ctx->bckt) {
+		ctx->bckt = *ctx->cursor;
+		ctx->skip = ctx->seen = 0;
+	}
+	if (ctx->skip) {
+		--ctx->skip;
+		++ctx->seen;
+		return 0;
+	}
+	if (tdb_rec_expired(rec, ctx->now)) {
+		++ctx->seen;
+		return 0;
+	}
+
+	if (TDB_HTRIE_VARLENRECS(dbh)) {
+		TdbVRec *vr = (TdbVRec *)rec;
+
+		if (vr->len < sizeof(TdbMsgRec))
+			goto skip;
+		mr = (TdbMsgRec *)vr->data;
+		len = TDB_MSGREC_LEN(mr);
+		if (ctx->off + len > TDB_NLMSG_MAXSZ)
+			goto full;
+		for (n = 0; vr && n < len; ) {
+			size_t c = min_t(size_t, vr->len, len - n);
+			memcpy(dst + n, vr->data, c);
+			n += c;
+			vr = tdb_next_rec_chunk(ctx->db, vr);
+		}
+		if (n < len)
+			goto skip;
+	} else {
+		mr = (TdbMsgRec *)rec->data;
+		len = TDB_MSGREC_LEN(mr);
+		if (len > dbh->rec_len)
+			goto skip;
+		if (ctx->off + len > TDB_NLMSG_MAXSZ)
+			goto full;
+		memcpy(dst, mr, len);
+	}
+
+	ctx->off += len;
+	++ctx->resp_m->rec_n;
+	++ctx->seen;
+	return 0;
+skip:
+	TDB_DBG("skip foreign record %p in scan of %s\n", rec,
+		ctx->db->tbl_name);
+	++ctx->seen;
+	return 0;
+full:
+	if (!ctx->resp_m->rec_n) {
+		TDB_WARN("Too large record %p in table %s, skip it\n",
+			 rec, ctx->db->tbl_name);
+		ctx->resp_m->type |= TDB_NLF_RESP_TRUNC;
+		++ctx->seen;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Send all the table records in many netlink frames.
+ * Each frame continues the table walk from the bucket where the previous
+ * frame stopped (@cb->args[0]) skipping the bucket records already observed
+ * (@cb->args[1]). The scan isn't an atomic snapshot of the table: records
+ * inserted to or removed from the bucket between the frames can be missed
+ * or sent twice.
+ */
+static int
+tdb_if_scan(struct sk_buff *skb, struct netlink_callback *cb,
+	    struct nlmsghdr *nlh, TDB *db)
+{
+	int more;
+	unsigned long cursor = cb->args[0];
+	TdbScanCtx ctx = {
+		.db	= db,
+		.resp_m	= nlmsg_data(nlh),
+		.off	= 0,
+		.cursor	= &cursor,
+		.bckt	= cursor,
+		.skip	= cb->args[1],
+		.seen	= 0,
+		.now	= get_seconds(),
+	};
+
+	more = tdb_htrie_walk_from(db->hdr, &cursor, tdb_if_scan_rec, &ctx);
+	tdb_put(db);
+
+	ctx.resp_m->type |= TDB_NLF_RESP_OK;
+	cb->args[0] = cursor;
+	cb->args[1] = cursor == ctx.bckt ? ctx.seen : 0;
+	if (more)
+		return skb->len; /* call us again for the next frame */
+
+	ctx.resp_m->type |= TDB_NLF_RESP_END;
+	return 0;
+}
+
+/**
+ * Get TdbMsgRec placed by tdb_if_insert() from record @rec.
+ * @return NULL if there is no room for the message header and @plen bytes
+ * of the key in the first chunk of the record.
+ */
+static TdbMsgRec *
+tdb_if_msgrec(TDB *db, TdbRec *rec, unsigned int plen)
+{
+	TdbMsgRec *mr;
+	size_t len;
+
+	if (TDB_HTRIE_VARLENRECS(db->hdr)) {
+		mr = (TdbMsgRec *)((TdbVRec *)rec)->data;
+		len = ((TdbVRec *)rec)->len;
+	} else {
+		mr = (TdbMsgRec *)rec->data;
+		len = db->hdr->rec_len;
+	}
+	if (len < sizeof(*mr) + plen || mr->klen < plen)
+		return NULL;
+
+	return mr;
+}
+
+/**
+ * Secondary key of user-space records: hash of first @data bytes of the key.
+ */
+static bool
+tdb_if_prefix_key(TDB *db, TdbRec *rec, void *data, unsigned long *skey)
+{
+	unsigned int plen = (unsigned long)data;
+	TdbMsgRec *mr = tdb_if_msgrec(db, rec, plen);
+
+	if (!mr)
+		return false;
+	*skey = tdb_hash(db, mr->data, plen);
+
+	return true;
+}
+
+static const TdbIndexOps tdb_if_idx_ops = {
+	.key	= tdb_if_prefix_key,
+};
+
+static int
+tdb_if_index(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	TDB *db;
+	TdbMsg *resp_m, *m = cb->data;
+	TdbIdxRec *ir = (TdbIdxRec *)(m->recs + 1);
+	struct nlmsghdr *nlh;
+
+	nlh = nlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			cb->nlh->nlmsg_type, sizeof(TdbMsg), 0);
+	if (!nlh)
+		return -EMSGSIZE;
+
+	resp_m = nlmsg_data(nlh);
+	resp_m->type = TDB_MSG_INDEX;
+	resp_m->rec_n = 0;
+
+	db = tdb_tbl_lookup(m->t_name, TDB_TBLNAME_LEN);
+	if (!db) {
+		TDB_WARN("Tried to index non existent table '%s'\n",
+			 m->t_name);
+		return 0;
+	}
+
+	if (!tdb_index_create(db, ir->name, ir->tbl_size, &tdb_if_idx_ops,
+			      (void *)(unsigned long)ir->plen))
+		resp_m->type |= TDB_NLF_RESP_OK;
+
+	tdb_put(db);
+
+	return 0;
+}
+
+/**
+ * State of select by secondary index.
+ *
+ * @sc		- the records copying state, no records are skipped;
+ * @key		- the key prefix to select the records by;
+ * @klen	- length of @key;
+ */
+typedef struct {
+	TdbScanCtx	sc;
+	const char	*key;
+	unsigned int	klen;
+} TdbIdxSelCtx;
+
+static int
+tdb_if_idx_rec(TdbRec *rec, void *data)
+{
+	TdbIdxSelCtx *ctx = data;
+	TdbMsgRec *mr = tdb_if_msgrec(ctx->sc.db, rec, ctx->klen);
+
+	/* Filter out secondary keys collisions. */
+	if (!mr || memcmp(mr->data, ctx->key, ctx->klen))
+		return 0;
+
+	if (!tdb_if_scan_rec(&ctx->sc, rec))
+		return 0;
+	ctx->sc.resp_m->type |= TDB_NLF_RESP_TRUNC;
+	return 1;
+}
+
+/**
+ * Send all the records with keys starting with the requested key, which must
+ * be of the index prefix length, in one netlink frame. The response is
+ * truncated if the frame can't fit all the records.
+ */
+static int
+tdb_if_select_idx(struct nlmsghdr *nlh, TDB *db, TdbMsgRec *r)
+{
+	long n;
+	char name[TDB_TBLNAME_LEN + 1];
+	TdbIdxSelCtx ctx = {
+		.sc = {
+			.db	= db,
+			.resp_m	= nlmsg_data(nlh),
+			.now	= get_seconds(),
+		},
+		.key	= r->data,
+		.klen	= r->klen,
+	};
+
+	memcpy(name, TDB_MSGREC_DATA(r), r->dlen);
+	name[r->dlen] = 0;
+
+	n = tdb_index_lookup(db, name, tdb_hash(db, r->data, r->klen),
+			     tdb_if_idx_rec, &ctx);
+	if (n < 0)
+		TDB_WARN("Tried to select by non existent index '%s' of"
+			 " table '%s'\n", name, db->tbl_name);
+	else
+		ctx.sc.resp_m->type |= TDB_NLF_RESP_OK | TDB_NLF_RESP_END;
+	tdb_put(db);
+
+	return 0;
+}
+
+/**
+ * Copy a removal record for key @key followed by current records with the key
+ * to the response frame, so the receiver replaces its records with the key.
+ * Records of one key are never split between frames.
+ * @return false if there is no room in the frame for the records.
+ */
+static bool
+tdb_if_repl_key(TdbScanCtx *ctx, unsigned long key)
+{
+	size_t off = ctx->off;
+	unsigned int rec_n = ctx->resp_m->rec_n;
+	TdbMsgRec *r = (TdbMsgRec *)((char *)ctx->resp_m->recs + off);
+	TdbIter iter;
+
+	if (off + sizeof(*r) + sizeof(key) > TDB_NLMSG_MAXSZ)
+		return false;
+	r->klen = 0;
+	r->dlen = sizeof(key);
+	memcpy(r->data, &key, sizeof(key));
+	ctx->off += TDB_MSGREC_LEN(r);
+	++ctx->resp_m->rec_n;
+
+	iter = tdb_rec_get(ctx->db, key);
+	while (!TDB_ITER_BAD(iter)) {
+		if (tdb_if_scan_rec(ctx, iter.rec)) {
+			tdb_rec_put(iter.rec);
+			if (rec_n > 1) {
+				ctx->off = off;
+				ctx->resp_m->rec_n = rec_n;
+				return false;
+			}
+			/* The records don't fit an empty frame. */
+			TDB_WARN("Too many records with key %#lx in table %s,"
+				 " replicate them partially\n", key,
+				 ctx->db->tbl_name);
+			ctx->resp_m->type |= TDB_NLF_RESP_TRUNC;
+			return true;
+		}
+		tdb_rec_next(ctx->db, &iter);
+	}
+
+	return true;
+}
+
+/**
+ * Send keys changed since the requested sequence number with current records
+ * with the keys in one netlink frame. The first request starts the table
+ * change log, so the requester should copy the whole table after it.
+ */
+static int
+tdb_if_changes(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	int i, n;
+	unsigned long seq, keys[TDB_IF_REPL_BATCH];
+	TdbMsg *m = cb->data;
+	TdbReplRec *rr, *req = (TdbReplRec *)(m->recs + 1);
+	struct nlmsghdr *nlh;
+	TdbScanCtx ctx = { .now = get_seconds() };
+
+	nlh = nlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			cb->nlh->nlmsg_type, TDB_NLMSG_MAXSZ, 0);
+	if (!nlh)
+		return -EMSGSIZE;
+
+	ctx.resp_m = nlmsg_data(nlh);
+	ctx.resp_m->rec_n = 0;
+	ctx.resp_m->type = TDB_MSG_CHANGES | TDB_NLF_RESP_END;
+
+	ctx.db = tdb_tbl_lookup(m->t_name, TDB_TBLNAME_LEN);
+	if (!ctx.db) {
+		TDB_WARN("Tried to replicate non existent table '%s'\n",
+			 m->t_name);
+		return 0;
+	}
+
+	/* The response starts from the replication record. */
+	ctx.resp_m->recs[0].klen = 0;
+	ctx.resp_m->recs[0].dlen = sizeof(*rr);
+	ctx.resp_m->rec_n = 1;
+	ctx.off = TDB_MSGREC_LEN(ctx.resp_m->recs);
+	rr = (TdbReplRec *)(ctx.resp_m->recs + 1);
+	rr->lost = 0;
+
+	seq = req->seq;
+	if (seq == TDB_REPL_START) {
+		if (tdb_replog_start(ctx.db, &seq))
+			goto out;
+		goto done;
+	}
+
+	while ((n = tdb_replog_read(ctx.db, &seq, keys, TDB_IF_REPL_BATCH))
+	       > 0)
+	{
+		for (i = 0; i < n; ++i)
+			if (!tdb_if_repl_key(&ctx, keys[i]))
+				break;
+		if (i < n) {
+			/* Send the rest of the keys next time. */
+			seq -= n - i;
+			break;
+		}
+	}
+	if (n < 0) {
+		TDB_WARN("Changes of table %s since %lu are lost\n",
+			 ctx.db->tbl_name, req->seq);
+		ctx.resp_m->rec_n = 1;
+		rr->lost = 1;
+		seq = req->seq;
+	}
+done:
+	rr->seq = seq;
+	ctx.resp_m->type |= TDB_NLF_RESP_OK;
+out:
+	tdb_put(ctx.db);
+
+	return 0;
+}
+
 static int
 tdb_if_select(struct sk_buff *skb, struct netlink_callback *cb)
 {
@@ -199,12 +667,13 @@ tdb_if_select(struct sk_buff *skb, struct netlink_callback *cb)
 		return 0;
 	}
 
-	/*
-	 * FIXME implement select of all records:
-	 * 1. full HTrie iterator is required;
-	 * 2. use many netlink frames to send probably large data set.
-	 */
-	key = tdb_hash_calc(m->recs[0].data, m->recs[0].klen);
+	/* Empty key selects all the records. */
+	if (!m->recs[0].klen)
+		return tdb_if_scan(skb, cb, nlh, db);
+	if (m->recs[0].dlen)
+		return tdb_if_select_idx(nlh, db, m->recs);
+
+	key = tdb_hash(db, m->recs[0].data, m->recs[0].klen);
 	iter = tdb_rec_get(db, key);
 	res = iter.rec;
 	if (res) {
@@ -247,6 +716,9 @@ static const struct {
 	[TDB_MSG_CLOSE - __TDB_MSG_BASE]	= { .dump = tdb_if_open_close },
 	[TDB_MSG_INSERT - __TDB_MSG_BASE]	= { .dump = tdb_if_insert },
 	[TDB_MSG_SELECT - __TDB_MSG_BASE]	= { .dump = tdb_if_select },
+	[TDB_MSG_RESIZE - __TDB_MSG_BASE]	= { .dump = tdb_if_resize },
+	[TDB_MSG_INDEX - __TDB_MSG_BASE]	= { .dump = tdb_if_index },
+	[TDB_MSG_CHANGES - __TDB_MSG_BASE]	= { .dump = tdb_if_changes },
 };
 
 static int
@@ -299,11 +771,12 @@ tdb_if_proc_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
 		}
 		{
 			TdbCrTblRec *ct = (TdbCrTblRec *)(m->recs + 1);
-			if (!ct->tbl_size || ct->path_len < sizeof(TDB_SUFFIX))
+			if (!ct->tbl_size || ct->path_len < sizeof(TDB_SUFFIX)
+			    || ct->hash >= __TDB_HASH_NUM)
 			{
 				TDB_ERR("malformed create table msg:"
-					" tbl_size=%lu path_len=%u\n",
-					ct->tbl_size, ct->path_len);
+					" tbl_size=%lu path_len=%u hash=%u\n",
+					ct->tbl_size, ct->path_len, ct->hash);
 				return -EINVAL;
 			}
 		}
@@ -329,6 +802,46 @@ tdb_if_proc_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
 			TDB_ERR("empty select msg\n");
 			return -EINVAL;
 		}
+		if (m->recs[0].dlen > TDB_TBLNAME_LEN) {
+			TDB_ERR("Bad index name length %u in select msg\n",
+				m->recs[0].dlen);
+			return -EINVAL;
+		}
+		if (!tdb_if_check_tblname(m))
+			return -EINVAL;
+		break;
+	case TDB_MSG_RESIZE:
+		if (m->rec_n != 1 || m->recs[0].dlen < sizeof(TdbCrTblRec)) {
+			TDB_ERR("empty resize table msg\n");
+			return -EINVAL;
+		}
+		if (!tdb_if_check_tblname(m))
+			return -EINVAL;
+		break;
+	case TDB_MSG_INDEX:
+		if (m->rec_n != 1 || m->recs[0].dlen < sizeof(TdbIdxRec)) {
+			TDB_ERR("empty create index msg\n");
+			return -EINVAL;
+		}
+		if (!tdb_if_check_tblname(m))
+			return -EINVAL;
+		{
+			TdbIdxRec *ir = (TdbIdxRec *)(m->recs + 1);
+			if (!ir->tbl_size || !ir->plen
+			    || ir->name[TDB_TBLNAME_LEN])
+			{
+				TDB_ERR("malformed create index msg:"
+					" tbl_size=%lu plen=%u\n",
+					ir->tbl_size, ir->plen);
+				return -EINVAL;
+			}
+		}
+		break;
+	case TDB_MSG_CHANGES:
+		if (m->rec_n != 1 || m->recs[0].dlen < sizeof(TdbReplRec)) {
+			TDB_ERR("empty table changes msg\n");
+			return -EINVAL;
+		}
 		if (!tdb_if_check_tblname(m))
 			return -EINVAL;
 		break;
@@ -0,0 +1,381 @@
+/**
+ *		Tempesta DB
+ *
+ * Secondary indexes.
+ *
+ * A secondary index is a separate table of fixed-size records mapping
+ * secondary keys, extracted from records of the indexed table by the index
+ * owner, to primary keys of the records. Index records inherit expiration
+ * time of the indexed records, so they're collected together.
+ *
+ * Records are added to the indexes when they're completely written and
+ * committed by tdb_entry_commit(), and removed from the indexes together with
+ * the records by tdb_entry_remove() and the expired records collector. Index
+ * buckets are always locked after buckets of the indexed table, so lookups
+ * collect primary keys from an index and only after that look them up in
+ * the indexed table.
+ *
+ * Index tables aren't trusted after restart: an index table is reinitialized
+ * and built from the indexed table on the index creation.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/module.h>
+
+#include "bloom.h"
+#include "htrie.h"
+#include "index.h"
+
+/* Number of primary keys collected from an index at once. */
+#define TDB_IDX_BATCH		32
+
+/**
+ * Secondary index descriptor.
+ *
+ * @db		- the index table;
+ * @ops		- the index owner callbacks;
+ * @data	- the index owner data for @ops;
+ * @name	- the index name;
+ */
+struct tdb_index_t {
+	TDB			*db;
+	const TdbIndexOps	*ops;
+	void			*data;
+	char			name[TDB_TBLNAME_LEN + 1];
+};
+
+typedef struct tdb_index_t TdbIndex;
+
+/**
+ * Index build context.
+ *
+ * @db		- the indexed table;
+ * @idx		- the index being built;
+ */
+typedef struct {
+	TDB		*db;
+	TdbIndex	*idx;
+} TdbIdxBuildCtx;
+
+/**
+ * State of removal of one index record.
+ *
+ * @pkey	- primary key stored in the index record;
+ * @done	- the record is already removed;
+ */
+typedef struct {
+	unsigned long	pkey;
+	bool		done;
+} TdbIdxRmCtx;
+
+static DEFINE_MUTEX(idx_mtx);
+
+static int
+tdb_idx_insert(TdbIndex *idx, TDB *db, TdbRec *rec)
+{
+	unsigned long skey;
+	size_t len = sizeof(rec->key);
+	TdbHdr *dbh = idx->db->hdr;
+	TdbRec *r;
+
+	if (!idx->ops->key(db, rec, idx->data, &skey))
+		return 0;
+
+	r = tdb_htrie_insert(dbh, skey, &rec->key, &len);
+	if (!r)
+		return -ENOMEM;
+	if (rec->expires) {
+		if (!test_bit(TDB_HDR_F_EXPIRE_B, &dbh->flags))
+			set_bit(TDB_HDR_F_EXPIRE_B, &dbh->flags);
+		r->expires = rec->expires;
+	}
+
+	return 0;
+}
+
+/**
+ * Remove only one index record for each removed record: full key collisions
+ * of the indexed table can share index records.
+ */
+static bool
+tdb_idx_rm_eq(TdbRec *rec, void *data)
+{
+	TdbIdxRmCtx *ctx = data;
+
+	if (ctx->done || *(unsigned long *)rec->data != ctx->pkey)
+		return false;
+
+	return ctx->done = true;
+}
+
+static void
+tdb_idx_remove(TdbIndex *idx, TDB *db, TdbRec *rec)
+{
+	unsigned long skey;
+	TdbIdxRmCtx ctx = { .pkey = rec->key };
+
+	if (idx->ops->key(db, rec, idx->data, &skey))
+		tdb_htrie_remove(idx->db->hdr, skey, tdb_idx_rm_eq, &ctx);
+}
+
+/**
+ * Remove record @rec of table @db from all the table indexes.
+ * Called under the record bucket write lock.
+ */
+void
+tdb_index_remove_rec(TDB *db, TdbRec *rec)
+{
+	int i;
+
+	for (i = 0; i < TDB_IDX_MAX; ++i)
+		if (db->idx[i])
+			tdb_idx_remove(db->idx[i], db, rec);
+}
+
+static bool
+tdb_idx_rec_eq(TdbRec *rec, void *data)
+{
+	return rec == data;
+}
+
+/**
+ * Add completely written record @rec to all the secondary indexes of table
+ * @db. If any of the indexes can't be updated, then the record is removed
+ * from the table and the indexes, so the record is either visible through
+ * all the indexes or it's lost. The caller must not use @rec on failure.
+ */
+int
+tdb_entry_commit(TDB *db, TdbRec *rec)
+{
+	int i, r = 0;
+
+	for (i = 0; i < TDB_IDX_MAX; ++i)
+		if (db->idx[i] && (r = tdb_idx_insert(db->idx[i], db, rec)))
+			break;
+	if (!r)
+		return 0;
+
+	TDB_ERR("Cannot add record %#lx of table %s to index %s\n",
+		rec->key, db->tbl_name, db->idx[i]->name);
+
+	while (--i >= 0)
+		if (db->idx[i])
+			tdb_idx_remove(db->idx[i], db, rec);
+	if (tdb_htrie_remove(db->hdr, rec->key, tdb_idx_rec_eq, rec)
+	    && db->bloom)
+		tdb_bloom_del(db->bloom, rec->key, 1);
+
+	return r;
+}
+EXPORT_SYMBOL(tdb_entry_commit);
+
+static int
+tdb_idx_build_rec(void *data, TdbRec *rec)
+{
+	TdbIdxBuildCtx *ctx = data;
+
+	return tdb_idx_insert(ctx->idx, ctx->db, rec);
+}
+
+/**
+ * Create secondary index @name of table @db with index table of @size bytes.
+ * The index table is placed in the same directory as the indexed table and
+ * is built from the records of the indexed table, so indexes must be created
+ * before the table is concurrently updated.
+ *
+ * The function must not be called from softirq!
+ */
+int
+tdb_index_create(TDB *db, const char *name, size_t size,
+		 const TdbIndexOps *ops, void *data)
+{
+	int i, slot = -1, r = 0;
+	char path[TDB_PATH_LEN];
+	TdbIdxBuildCtx ctx = { .db = db };
+	TdbIndex *idx;
+
+	if (!*name || strlen(name) > TDB_TBLNAME_LEN) {
+		TDB_ERR("Bad index name '%s' for table %s\n",
+			name, db->tbl_name);
+		return -EINVAL;
+	}
+
+	mutex_lock(&idx_mtx);
+
+	for (i = 0; i < TDB_IDX_MAX; ++i) {
+		if (!db->idx[i]) {
+			if (slot < 0)
+				slot = i;
+		} else if (!strcmp(db->idx[i]->name, name)) {
+			TDB_ERR("Index %s of table %s already exists\n",
+				name, db->tbl_name);
+			r = -EEXIST;
+			goto out;
+		}
+	}
+	if (slot < 0) {
+		TDB_ERR("Too many indexes of table %s\n", db->tbl_name);
+		r = -ENOSPC;
+		goto out;
+	}
+
+	idx = kzalloc(sizeof(*idx), GFP_KERNEL);
+	if (!idx) {
+		r = -ENOMEM;
+		goto out;
+	}
+	idx->ops = ops;
+	idx->data = data;
+	strcpy(idx->name, name);
+
+	snprintf(path, sizeof(path), "%.*s_%s" TDB_SUFFIX,
+		 (int)(strlen(db->path) - sizeof(TDB_SUFFIX) + 1), db->path,
+		 name);
+	idx->db = tdb_open_empty(path, size, sizeof(unsigned long), db->node);
+	if (!idx->db) {
+		r = -EINVAL;
+		goto err_free;
+	}
+
+	ctx.idx = idx;
+	r = tdb_htrie_walk(db->hdr, tdb_idx_build_rec, &ctx);
+	if (r) {
+		TDB_ERR("Cannot build index %s of table %s\n",
+			name, db->tbl_name);
+		goto err_close;
+	}
+
+	db->idx[slot] = idx;
+	TDB_LOG("Created index %s of table %s\n", name, db->tbl_name);
+out:
+	mutex_unlock(&idx_mtx);
+	return r;
+err_close:
+	tdb_close(idx->db);
+err_free:
+	kfree(idx);
+	goto out;
+}
+EXPORT_SYMBOL(tdb_index_create);
+
+static TdbIndex *
+tdb_idx_find(TDB *db, const char *name)
+{
+	int i;
+
+	for (i = 0; i < TDB_IDX_MAX; ++i)
+		if (db->idx[i] && !strcmp(db->idx[i]->name, name))
+			return db->idx[i];
+	return NULL;
+}
+
+static bool
+tdb_idx_key_seen(const unsigned long *keys, int n, unsigned long key)
+{
+	while (--n >= 0)
+		if (keys[n] == key)
+			return true;
+	return false;
+}
+
+/**
+ * Call @fn for each record of table @db with secondary key @skey in index
+ * @name. @fn runs under the record bucket lock, so it must not sleep, and
+ * stops the lookup by non-zero return value. A record with a primary key
+ * stored in many index records can be passed to @fn more than once.
+ * @return number of found records or negative value on error.
+ */
+long
+tdb_index_lookup(TDB *db, const char *name, unsigned long skey,
+		 int (*fn)(TdbRec *rec, void *data), void *data)
+{
+	int i, n;
+	long found = 0;
+	unsigned long sk, seen = 0, keys[TDB_IDX_BATCH];
+	TdbIndex *idx = tdb_idx_find(db, name);
+
+	if (!idx)
+		return -ENOENT;
+
+	do {
+		unsigned long pos = 0;
+		TdbIter iter = tdb_rec_get(idx->db, skey);
+
+		for (n = 0; !TDB_ITER_BAD(iter) && n < TDB_IDX_BATCH; ) {
+			unsigned long k = *(unsigned long *)iter.rec->data;
+
+			if (pos++ >= seen && !tdb_idx_key_seen(keys, n, k))
+				keys[n++] = k;
+			tdb_rec_next(idx->db, &iter);
+		}
+		if (!TDB_ITER_BAD(iter))
+			tdb_rec_put(iter.rec);
+		seen = pos;
+
+		/* The index buckets are unlocked, lookup the records. */
+		for (i = 0; i < n; ++i) {
+			iter = tdb_rec_get(db, keys[i]);
+			while (!TDB_ITER_BAD(iter)) {
+				if (idx->ops->key(db, iter.rec, idx->data, &sk)
+				    && sk == skey)
+				{
+					++found;
+					if (fn(iter.rec, data)) {
+						tdb_rec_put(iter.rec);
+						return found;
+					}
+				}
+				tdb_rec_next(db, &iter);
+			}
+		}
+	} while (n == TDB_IDX_BATCH);
+
+	return found;
+}
+EXPORT_SYMBOL(tdb_index_lookup);
+
+/**
+ * Close all the indexes of table @db.
+ */
+void
+tdb_index_close(TDB *db)
+{
+	int i;
+
+	for (i = 0; i < TDB_IDX_MAX; ++i) {
+		if (!db->idx[i])
+			continue;
+		tdb_close(db->idx[i]->db);
+		kfree(db->idx[i]);
+		db->idx[i] = NULL;
+	}
+}
+
+/**
+ * Free index descriptors of table @db, the index tables are closed by
+ * the caller.
+ */
+void
+tdb_index_free(TDB *db)
+{
+	int i;
+
+	for (i = 0; i < TDB_IDX_MAX; ++i) {
+		kfree(db->idx[i]);
+		db->idx[i] = NULL;
+	}
+}
@@ -0,0 +1,33 @@
+/**
+ *		Tempesta DB
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include "tdb.h"
+
+/* Defined in main.c. */
+TDB *tdb_open_empty(const char *path, size_t fsize, unsigned int rec_size,
+		    int node);
+
+void tdb_index_remove_rec(TDB *db, TdbRec *rec);
+void tdb_index_close(TDB *db);
+void tdb_index_free(TDB *db);
+
+#endif /* __INDEX_H__ */
@@ -21,14 +21,22 @@
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <linux/module.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 
+#include "bloom.h"
+#include "compact.h"
+#include "expire.h"
 #include "file.h"
 #include "htrie.h"
+#include "index.h"
+#include "procfs.h"
+#include "replog.h"
 #include "table.h"
 #include "tdb_if.h"
 
-#define TDB_VERSION	"0.1.15"
+#define TDB_VERSION	"0.1.17"
 
 MODULE_AUTHOR("Tempesta Technologies");
 MODULE_DESCRIPTION("Tempesta DB");
@@ -38,10 +46,27 @@ MODULE_LICENSE("GPL");
 TdbRec *
 tdb_entry_create(TDB *db, unsigned long key, void *data, size_t *len)
 {
-	TdbRec *r = tdb_htrie_insert(db->hdr, key, data, len);
-	if (!r)
+	TdbRec *r;
+	TdbBloom *bf;
+
+	/* See tdb_bloom_create() for the read-side section. */
+	rcu_read_lock_bh();
+
+	bf = rcu_dereference_bh(db->bloom);
+	if (bf)
+		tdb_bloom_add(bf, key);
+
+	r = tdb_htrie_insert(db->hdr, key, data, len);
+	if (!r) {
+		if (bf)
+			tdb_bloom_del(bf, key, 1);
 		TDB_ERR("Cannot create cache entry for %.*s, key=%#lx\n",
 			(int)*len, (char *)data, key);
+	} else if (unlikely(db->replog)) {
+		tdb_replog_add(db->replog, key);
+	}
+
+	rcu_read_unlock_bh();
 
 	return r;
 }
@@ -99,6 +124,9 @@ tdb_rec_get(TDB *db, unsigned long key)
 {
 	TdbIter iter = { NULL };
 
+	if (db->bloom && !tdb_bloom_test(db->bloom, key))
+		goto out;
+
 	iter.bckt = tdb_htrie_lookup(db->hdr, key);
 	if (!iter.bckt)
 		goto out;
@@ -138,6 +166,416 @@ tdb_rec_put(void *rec)
 }
 EXPORT_SYMBOL(tdb_rec_put);
 
+/**
+ * Lookup records for @n (not more than TDB_BATCH_MAX) keys @keys at once.
+ * Index descends for all the keys are interleaved with prefetching, so cache
+ * misses of independent lookups overlap.
+ *
+ * @fn is called for each key in order of @keys with iterator pointing to
+ * the first found record with the key, or bad iterator if there is no such
+ * record. The record is locked only while @fn is running, so locks of only
+ * one bucket are held at each time. @fn can move the iterator by
+ * tdb_rec_next(), but must not call tdb_rec_put() or sleep.
+ *
+ * Keys rejected by the negative lookup filter of the table don't take part in
+ * the batched descend.
+ */
+void
+tdb_rec_get_batch(TDB *db, const unsigned long *keys, int n,
+		  void (*fn)(TdbIter *iter, int i, void *data), void *data)
+{
+	int i, j, m = n;
+	unsigned long fkeys[TDB_BATCH_MAX], miss = 0;
+	const unsigned long *lkeys = keys;
+	TdbBucket *bckts[TDB_BATCH_MAX];
+
+	BUILD_BUG_ON(TDB_BATCH_MAX > BITS_PER_LONG);
+
+	if (db->bloom) {
+		for (i = m = 0; i < n; ++i) {
+			if (tdb_bloom_test(db->bloom, keys[i]))
+				fkeys[m++] = keys[i];
+			else
+				miss |= 1UL << i;
+		}
+		lkeys = fkeys;
+	}
+
+	tdb_htrie_lookup_batch(db->hdr, lkeys, bckts, m);
+
+	for (i = j = 0; i < n; ++i) {
+		TdbIter iter = { NULL };
+
+		if (miss & (1UL << i)) {
+			fn(&iter, i, data);
+			continue;
+		}
+		iter.bckt = bckts[j++];
+
+		if (iter.bckt)
+			iter.rec = tdb_htrie_bscan_for_rec(db->hdr,
+						(TdbBucket **)&iter.bckt,
+						keys[i]);
+		/*
+		 * The bucket could be burst by concurrent insertion after
+		 * the batched descend, so recheck a miss. The index nodes
+		 * are already in the cache.
+		 */
+		if (!iter.rec
+		    && tdb_htrie_lookup(db->hdr, keys[i]) != bckts[j - 1])
+			iter = tdb_rec_get(db, keys[i]);
+
+		fn(&iter, i, data);
+
+		if (iter.rec)
+			tdb_rec_put(iter.rec);
+	}
+}
+EXPORT_SYMBOL(tdb_rec_get_batch);
+
+/**
+ * Records removal context for tables with secondary indexes.
+ *
+ * @db		- the table;
+ * @eq		- the caller records filter;
+ * @data	- the caller data for @eq;
+ */
+typedef struct {
+	TDB	*db;
+	bool	(*eq)(TdbRec *rec, void *data);
+	void	*data;
+} TdbRmCtx;
+
+static bool
+tdb_rm_eq(TdbRec *rec, void *data)
+{
+	TdbRmCtx *ctx = data;
+
+	if (ctx->eq && !ctx->eq(rec, ctx->data))
+		return false;
+
+	tdb_index_remove_rec(ctx->db, rec);
+	return true;
+}
+
+/**
+ * Remove records with key @key matching @eq (or all the records with the key
+ * if @eq is NULL). The records must not be referenced by the caller.
+ * The records are also removed from secondary indexes of the table.
+ * @return number of removed records.
+ */
+int
+tdb_entry_remove(TDB *db, unsigned long key,
+		 bool (*eq)(TdbRec *rec, void *data), void *data)
+{
+	int i, n;
+	TdbRmCtx ctx = { .db = db, .eq = eq, .data = data };
+
+	for (i = 0; i < TDB_IDX_MAX; ++i)
+		if (db->idx[i])
+			break;
+	if (i < TDB_IDX_MAX)
+		n = tdb_htrie_remove(db->hdr, key, tdb_rm_eq, &ctx);
+	else
+		n = tdb_htrie_remove(db->hdr, key, eq, data);
+
+	if (n && db->bloom)
+		tdb_bloom_del(db->bloom, key, n);
+	if (n && unlikely(db->replog))
+		tdb_replog_add(db->replog, key);
+
+	return n;
+}
+EXPORT_SYMBOL(tdb_entry_remove);
+
+/**
+ * Add lookup of records with key @key to transaction @trx. The transaction
+ * can be committed only if the records weren't changed since the call, so
+ * add the key to the transaction before the records are read.
+ */
+int
+tdb_trx_read(TdbTrx *trx, unsigned long key)
+{
+	return tdb_htrie_trx_add(trx->db->hdr, trx, TDB_TRX_READ, key, NULL, 0,
+				 NULL);
+}
+EXPORT_SYMBOL(tdb_trx_read);
+
+/**
+ * Add insertion of record with key @key and @len bytes of @data, which must
+ * be valid until the commit, to transaction @trx.
+ */
+int
+tdb_trx_insert(TdbTrx *trx, unsigned long key, void *data, size_t len)
+{
+	return tdb_htrie_trx_add(trx->db->hdr, trx, TDB_TRX_INSERT, key, data,
+				 len, NULL);
+}
+EXPORT_SYMBOL(tdb_trx_insert);
+
+/**
+ * Add removal of records with key @key matching @eq, or all the records with
+ * the key if @eq is NULL, to transaction @trx. Records inserted by later
+ * operations of the transaction aren't removed.
+ */
+int
+tdb_trx_remove(TdbTrx *trx, unsigned long key,
+	       bool (*eq)(TdbRec *rec, void *data), void *data)
+{
+	return tdb_htrie_trx_add(trx->db->hdr, trx, TDB_TRX_REMOVE, key, data,
+				 0, eq);
+}
+EXPORT_SYMBOL(tdb_trx_remove);
+
+/**
+ * Atomically apply operations of transaction @trx if records with keys of
+ * the operations weren't changed by others since the operations were added.
+ * Removed records are also removed from secondary indexes of the table, while
+ * inserted records must be added to the indexes by tdb_entry_commit() as
+ * records created by tdb_entry_create(). The transaction can't be committed
+ * twice. The caller must not hold any records of the table.
+ *
+ * @return 0 on success or -EAGAIN if the transaction conflicts with concurrent
+ * updates and must be repeated from tdb_trx_begin(), negative error code on
+ * other failures.
+ */
+int
+tdb_trx_commit(TdbTrx *trx)
+{
+	int i, r;
+	TDB *db = trx->db;
+	TdbTrxOp *op;
+	TdbRmCtx rm[TDB_TRX_MAX];
+	TdbBloom *bf;
+
+	for (i = 0; i < TDB_IDX_MAX; ++i)
+		if (db->idx[i])
+			break;
+
+	/* See tdb_bloom_create() for the read-side section. */
+	rcu_read_lock_bh();
+	bf = rcu_dereference_bh(db->bloom);
+
+	for (op = trx->ops; op < trx->ops + trx->n; ++op) {
+		if (op->type == TDB_TRX_INSERT && bf) {
+			tdb_bloom_add(bf, op->key);
+		} else if (op->type == TDB_TRX_REMOVE && i < TDB_IDX_MAX) {
+			TdbRmCtx *ctx = &rm[op - trx->ops];
+
+			ctx->db = db;
+			ctx->eq = op->eq;
+			ctx->data = op->data;
+			op->eq = tdb_rm_eq;
+			op->data = ctx;
+		}
+	}
+
+	r = tdb_htrie_trx_commit(db->hdr, trx);
+
+	for (op = trx->ops; op < trx->ops + trx->n; ++op) {
+		if (op->type == TDB_TRX_INSERT) {
+			if (r && bf)
+				tdb_bloom_del(bf, op->key, 1);
+			else if (!r && unlikely(db->replog))
+				tdb_replog_add(db->replog, op->key);
+		} else if (op->type == TDB_TRX_REMOVE && !r && op->len) {
+			if (bf)
+				tdb_bloom_del(bf, op->key, op->len);
+			if (unlikely(db->replog))
+				tdb_replog_add(db->replog, op->key);
+		}
+	}
+
+	rcu_read_unlock_bh();
+
+	return r;
+}
+EXPORT_SYMBOL(tdb_trx_commit);
+
+/**
+ * Call @fn for each live record of table @db, non-zero return value of @fn
+ * stops the walk. Bucket locks are held during @fn calls, so @fn must not
+ * sleep. The walk isn't an atomic snapshot: use tdb_replog_start() before
+ * the walk to get changes done during it.
+ */
+int
+tdb_entry_walk(TDB *db, int (*fn)(void *data, TdbRec *rec), void *data)
+{
+	return tdb_htrie_walk(db->hdr, fn, data);
+}
+EXPORT_SYMBOL(tdb_entry_walk);
+
+/**
+ * Set time to live of record @rec to @ttl seconds from now or make the record
+ * persistent if @ttl is zero. Expired records aren't returned by lookups and
+ * are removed by background collector.
+ *
+ * The caller must own the record, i.e. it's called for just created record
+ * or for a record returned by tdb_rec_get().
+ */
+void
+tdb_rec_set_ttl(TDB *db, TdbRec *rec, unsigned long ttl)
+{
+	if (!ttl) {
+		rec->expires = 0;
+		return;
+	}
+
+	if (!test_bit(TDB_HDR_F_EXPIRE_B, &db->hdr->flags))
+		set_bit(TDB_HDR_F_EXPIRE_B, &db->hdr->flags);
+	rec->expires = get_seconds() + ttl;
+}
+EXPORT_SYMBOL(tdb_rec_set_ttl);
+
+/**
+ * Enable background compaction of the table. The table owner must be able
+ * to update offsets stored in moved records by @ops.
+ */
+void
+tdb_set_reloc(TDB *db, const TdbRelocOps *ops)
+{
+	BUG_ON(!TDB_HTRIE_VARLENRECS(db->hdr));
+	db->reloc = ops;
+}
+EXPORT_SYMBOL(tdb_set_reloc);
+
+/**
+ * Use hash function @fn, see TDB_HASH_*, for keys of table @db. Keyed
+ * functions get a random key stored in the table. The function can be
+ * changed only for an empty table before it's used, the table keeps its
+ * function otherwise, so the owner must compute keys by tdb_hash().
+ */
+int
+tdb_set_hash(TDB *db, unsigned int fn)
+{
+	int r;
+	unsigned long key[2];
+
+	get_random_bytes(key, sizeof(key));
+
+	r = tdb_htrie_set_hash(db->hdr, fn, key);
+	if (r == -EBUSY)
+		TDB_WARN("Table %s isn't empty, keep %s hash\n",
+			 db->tbl_name, tdb_hash_name(db->hdr->hash));
+	else if (r)
+		TDB_ERR("Bad hash function %u for table %s\n",
+			fn, db->tbl_name);
+
+	return r;
+}
+EXPORT_SYMBOL(tdb_set_hash);
+
+static int
+tdb_bloom_add_rec(void *data, TdbRec *rec)
+{
+	tdb_bloom_add(data, rec->key);
+	return 0;
+}
+
+/**
+ * Create negative lookup filter of table @db for about @nkeys keys, so
+ * lookups of keys which aren't in the table don't descend the index. The
+ * filter is useful for tables with mostly missing keys, e.g. blocking rules.
+ * The filter isn't persistent and is built from current records of the
+ * table, which can be concurrently updated.
+ *
+ * Inserts check for the filter and add keys to it in RCU-bh read-side
+ * sections, so after the grace period all the inserts see the filter and
+ * records inserted into buckets already passed by the walk are added to
+ * the filter by the inserts. The filter doesn't filter lookups until the
+ * walk finishes.
+ *
+ * The function must not be called from softirq!
+ */
+int
+tdb_bloom_create(TDB *db, unsigned long nkeys)
+{
+	TdbBloom *bf;
+
+	if (db->bloom)
+		return 0;
+
+	bf = tdb_bloom_alloc(nkeys, db->node);
+	if (!bf) {
+		TDB_ERR("Cannot allocate lookup filter for table %s\n",
+			db->tbl_name);
+		return -ENOMEM;
+	}
+	rcu_assign_pointer(db->bloom, bf);
+	synchronize_rcu_bh();
+
+	tdb_htrie_walk(db->hdr, tdb_bloom_add_rec, bf);
+	tdb_bloom_populated(bf);
+
+	TDB_LOG("Created lookup filter of table %s for %lu keys\n",
+		db->tbl_name, nkeys);
+
+	return 0;
+}
+EXPORT_SYMBOL(tdb_bloom_create);
+
+/**
+ * Print memory mapping, index traversal, structure and operations statistics
+ * of table @db. Operation rates are computed for the time since the previous
+ * print, the function is called under the tables mutex.
+ */
+static int
+tdb_print_tbl_stat(TDB *db, char *buf, size_t len)
+{
+	int cpu;
+	unsigned long dt, lookup_rate, insert_rate, chain_avg = 0;
+	TdbWalkStat ws = { 0 };
+	TdbOpStat os = { 0 };
+	TdbHtrieStat hs;
+
+	for_each_possible_cpu(cpu) {
+		TdbWalkStat *s = &per_cpu_ptr(db->hdr->pcpu, cpu)->ws;
+		TdbOpStat *o = &per_cpu_ptr(db->hdr->pcpu, cpu)->os;
+		ws.descends += s->descends;
+		ws.inodes += s->inodes;
+		ws.ext_jumps += s->ext_jumps;
+		os.lookups += o->lookups;
+		os.inserts += o->inserts;
+		os.removes += o->removes;
+		os.bursts += o->bursts;
+		os.alloc_fails += o->alloc_fails;
+	}
+
+	tdb_htrie_stat(db->hdr, &hs);
+	if (hs.chains)
+		chain_avg = hs.buckets * 100 / hs.chains;
+
+	dt = jiffies_to_msecs(jiffies - db->stat_ts) ? : 1;
+	lookup_rate = (os.lookups - db->stat_ops[0]) * 1000 / dt;
+	insert_rate = (os.inserts - db->stat_ops[1]) * 1000 / dt;
+	db->stat_ts = jiffies;
+	db->stat_ops[0] = os.lookups;
+	db->stat_ops[1] = os.inserts;
+
+	return snprintf(buf, len,
+			"  %s: node=%d pages(4K/2M/1G)=%lu/%lu/%lu"
+			" descends=%lu index_nodes=%lu extent_jumps=%lu\n"
+			"    records=%lu data_bytes=%lu free_extents=%lu/%lu"
+			" index_nodes=%lu buckets=%lu chain_avg=%lu.%02lu"
+			" chain_max=%lu\n"
+			"    hash=%s chains(1/2/3/4/5-8/9-16/17+)="
+			"%lu/%lu/%lu/%lu/%lu/%lu/%lu key_collisions=%lu\n"
+			"    lookups=%lu (%lu/s) inserts=%lu (%lu/s) removes=%lu"
+			" bursts=%lu alloc_failures=%lu\n",
+			db->tbl_name, db->node, db->map_pages[0],
+			db->map_pages[1], db->map_pages[2], ws.descends,
+			ws.inodes, ws.ext_jumps,
+			hs.records, hs.rec_bytes, hs.free_exts, hs.exts,
+			hs.inodes, hs.buckets, chain_avg / 100, chain_avg % 100,
+			hs.max_chain,
+			tdb_hash_name(db->hdr->hash), hs.chain_hist[0],
+			hs.chain_hist[1], hs.chain_hist[2], hs.chain_hist[3],
+			hs.chain_hist[4], hs.chain_hist[5], hs.chain_hist[6],
+			hs.key_colls,
+			os.lookups, lookup_rate, os.inserts, insert_rate,
+			os.removes, os.bursts, os.alloc_fails);
+}
+
 int
 tdb_info(char *buf, size_t len)
 {
@@ -154,6 +592,8 @@ tdb_info(char *buf, size_t len)
 
 	buf[n - 1] = '\n';
 
+	n += tdb_tbl_print_each(buf + n, len - n, tdb_print_tbl_stat);
+
 	return n;
 }
 
@@ -206,13 +646,38 @@ tdb_get_db(const char *path, int node)
 }
 
 /**
- * Open database file and @return its descriptor.
- * If the database is already opened, then returns the handler.
- *
- * The function must not be called from softirq!
+ * Tables are written to disk on close only, so a table which wasn't closed
+ * properly has consistent image of its last close. However, a crash during
+ * the write leaves torn image, so check it and reinitialize the table
+ * if it's broken.
  */
-TDB *
-tdb_open(const char *path, size_t fsize, unsigned int rec_size, int node)
+static void
+tdb_recover(TDB *db, size_t size)
+{
+	long r;
+
+	switch (db->hdr->state) {
+	case TDB_ST_CLEAN:
+		return;
+	case TDB_ST_OPEN:
+		TDB_WARN("Table %s wasn't properly closed, data since its last"
+			 " close is lost\n", db->path);
+		return;
+	}
+
+	TDB_WARN("Table %s wasn't completely synced, check it\n", db->path);
+	r = tdb_htrie_check(db->hdr, size);
+	if (r > 0) {
+		TDB_ERR("Table %s is broken (%ld errors), reinitialize it\n",
+			db->path, r);
+		/* Force tdb_htrie_init() to create a new table. */
+		db->hdr->magic = 0;
+	}
+}
+
+static TDB *
+__tdb_open(const char *path, size_t fsize, unsigned int rec_size, int node,
+	   bool empty)
 {
 	TDB *db;
 
@@ -226,18 +691,28 @@ tdb_open(const char *path, size_t fsize, unsigned int rec_size, int node)
 		return NULL;
 
 	db->node = node;
+	db->stat_ts = jiffies;
 
 	if (tdb_file_open(db, fsize)) {
 		TDB_ERR("Cannot open db\n");
 		goto err;
 	}
 
+	if (empty)
+		/* Force tdb_htrie_init() to create a new table. */
+		db->hdr->magic = 0;
+	else
+		tdb_recover(db, db->filp->f_inode->i_size);
+
 	db->hdr = tdb_htrie_init(db->hdr, db->filp->f_inode->i_size, rec_size);
 	if (!db->hdr) {
 		TDB_ERR("Cannot initialize db header\n");
 		goto err_init;
 	}
 
+	if (tdb_file_set_open(db))
+		TDB_WARN("Cannot mark table %s as open\n", db->path);
+
 	tdb_tbl_enumerate(db);
 
 	TDB_LOG("Opened table %s: size=%lu rec_size=%u base=%p\n",
@@ -250,8 +725,64 @@ err:
 	tdb_put(db);
 	return NULL;
 }
+
+/**
+ * Open database file and @return its descriptor.
+ * If the database is already opened, then returns the handler.
+ *
+ * The function must not be called from softirq!
+ */
+TDB *
+tdb_open(const char *path, size_t fsize, unsigned int rec_size, int node)
+{
+	return __tdb_open(path, fsize, rec_size, node, false);
+}
 EXPORT_SYMBOL(tdb_open);
 
+/**
+ * The same as tdb_open(), but the table file content is dropped.
+ */
+TDB *
+tdb_open_empty(const char *path, size_t fsize, unsigned int rec_size, int node)
+{
+	return __tdb_open(path, fsize, rec_size, node, true);
+}
+
+/**
+ * Grow the table to @size bytes w/o stopping its users.
+ * Tables can't be shrunk.
+ *
+ * The function must not be called from softirq!
+ */
+int
+tdb_resize(TDB *db, size_t size)
+{
+	static DEFINE_MUTEX(resize_mtx);
+	int r = -EINVAL;
+
+	mutex_lock(&resize_mtx);
+
+	if ((size & ~TDB_EXT_MASK) || size <= db->hdr->dbsz
+	    || size > TDB_MAX_DB_SZ)
+	{
+		TDB_ERR("Bad new size %lu for table %s of size %lu\n",
+			size, db->path, db->hdr->dbsz);
+		goto out;
+	}
+
+	r = tdb_file_extend(db, size);
+	if (!r)
+		r = tdb_htrie_grow(db->hdr, size);
+out:
+	mutex_unlock(&resize_mtx);
+
+	if (!r)
+		TDB_LOG("Resized table %s to %lu bytes\n", db->path, size);
+
+	return r;
+}
+EXPORT_SYMBOL(tdb_resize);
+
 static void
 __do_close_table(TDB *db)
 {
@@ -259,6 +790,9 @@ __do_close_table(TDB *db)
 	tdb_file_close(db);
 
 	tdb_htrie_exit(db->hdr);
+	tdb_index_free(db);
+	tdb_replog_free(db);
+	tdb_bloom_free(db->bloom);
 
 	TDB_LOG("Close table '%s'\n", db->tbl_name);
 
@@ -276,6 +810,7 @@ tdb_close(TDB *db)
 
 	tdb_tbl_forget(db);
 
+	tdb_index_close(db);
 	__do_close_table(db);
 }
 EXPORT_SYMBOL(tdb_close);
@@ -295,6 +830,27 @@ tdb_init(void)
 	if (r)
 		return r;
 
+	r = tdb_expire_init();
+	if (r) {
+		tdb_if_exit();
+		return r;
+	}
+
+	r = tdb_compact_init();
+	if (r) {
+		tdb_expire_exit();
+		tdb_if_exit();
+		return r;
+	}
+
+	r = tdb_procfs_init();
+	if (r) {
+		tdb_compact_exit();
+		tdb_expire_exit();
+		tdb_if_exit();
+		return r;
+	}
+
 	return 0;
 }
 
@@ -303,6 +859,9 @@ tdb_exit(void)
 {
 	TDB_LOG("Shutdown Tempesta DB\n");
 
+	tdb_procfs_exit();
+	tdb_compact_exit();
+	tdb_expire_exit();
 	tdb_if_exit();
 
 	/*
@@ -0,0 +1,94 @@
+/**
+ *		Tempesta DB
+ *
+ * /proc/tempesta_db/tables shows the same tables statistics as the netlink
+ * INFO message, so the statistics are available without libtdb.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#include "procfs.h"
+#include "tdb.h"
+
+/* Buffer size for statistics of all the tables. */
+#define TDB_PROCFS_BUFSZ	(PAGE_SIZE * 16)
+
+static struct proc_dir_entry *tdb_procfs_dir;
+static struct proc_dir_entry *tdb_procfs_tables;
+
+static int
+tdb_tables_seq_show(struct seq_file *seq, void *off)
+{
+	int n;
+	char *buf = kmalloc(TDB_PROCFS_BUFSZ, GFP_KERNEL);
+
+	if (!buf)
+		return -ENOMEM;
+
+	n = tdb_info(buf, TDB_PROCFS_BUFSZ);
+	if (n > 0)
+		seq_write(seq, buf, n);
+
+	kfree(buf);
+
+	return n < 0 ? n : 0;
+}
+
+static int
+tdb_tables_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tdb_tables_seq_show, PDE_DATA(inode));
+}
+
+static struct file_operations tdb_tables_fops = {
+	.owner		= THIS_MODULE,
+	.open		= tdb_tables_seq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int
+tdb_procfs_init(void)
+{
+	tdb_procfs_dir = proc_mkdir("tempesta_db", NULL);
+	if (!tdb_procfs_dir)
+		goto out;
+
+	tdb_procfs_tables = proc_create("tables", S_IRUGO, tdb_procfs_dir,
+					&tdb_tables_fops);
+	if (!tdb_procfs_tables)
+		goto out_dir;
+
+	return 0;
+
+out:
+	return -ENOMEM;
+out_dir:
+	remove_proc_entry("tempesta_db", NULL);
+	goto out;
+}
+
+void
+tdb_procfs_exit(void)
+{
+	remove_proc_entry("tables", tdb_procfs_dir);
+	remove_proc_entry("tempesta_db", NULL);
+}
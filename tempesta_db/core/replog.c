@@ -0,0 +1,168 @@
+/**
+ *		Tempesta DB
+ *
+ * Change log for table replication.
+ *
+ * The log is a ring of keys of inserted and removed records numbered by
+ * sequence numbers. Replicators remember the sequence number of the last read
+ * change and read the keys changed since it, so they ship current records
+ * with the keys instead of the operations: replaying the keys many times or
+ * in different order gives the same result. Records with the same key are
+ * always shipped together, so full key collisions replace each other as
+ * a whole.
+ *
+ * Writers don't block each other and replicators: a writer reserves a slot by
+ * the atomic sequence counter and publishes the key by the slot sequence
+ * number, so the replicator sees either the key or that the slot isn't
+ * written yet or is overwritten. If a replicator is too slow and the changes
+ * it didn't read are overwritten, then it must take a new snapshot of
+ * the table.
+ *
+ * The log is allocated when a replicator starts and lives until the table is
+ * closed, so tables without replicators don't pay for it.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+
+#include "replog.h"
+
+/* Number of entries in the log, 1MB per table. */
+#define TDB_REPLOG_ORDER	16
+#define TDB_REPLOG_SZ		(1UL << TDB_REPLOG_ORDER)
+/* Sequence number of a slot being written. */
+#define TDB_REPLOG_BUSY		(~0UL)
+
+/**
+ * Change log entry.
+ *
+ * @seq		- sequence number of the change;
+ * @key		- key of the changed records;
+ */
+typedef struct {
+	unsigned long	seq;
+	unsigned long	key;
+} TdbRepEnt;
+
+/**
+ * @seq		- sequence number of the next change;
+ * @ents	- ring of the changes;
+ */
+struct tdb_replog_t {
+	atomic64_t	seq;
+	TdbRepEnt	ents[TDB_REPLOG_SZ];
+};
+
+/**
+ * Log change of records with key @key.
+ */
+void
+tdb_replog_add(TdbRepLog *log, unsigned long key)
+{
+	unsigned long seq = atomic64_inc_return(&log->seq) - 1;
+	TdbRepEnt *e = &log->ents[seq & (TDB_REPLOG_SZ - 1)];
+
+	e->seq = TDB_REPLOG_BUSY;
+	smp_wmb();
+	e->key = key;
+	smp_wmb();
+	e->seq = seq;
+}
+
+/**
+ * Start logging changes of table @db and set @seq to the sequence number of
+ * the next change. A table snapshot taken after the call and the changes read
+ * from @seq give the current table content.
+ *
+ * The function must not be called from softirq!
+ */
+int
+tdb_replog_start(TDB *db, unsigned long *seq)
+{
+	TdbRepLog *log = db->replog;
+
+	if (!log) {
+		log = vzalloc(sizeof(*log));
+		if (!log) {
+			TDB_ERR("Cannot allocate change log for table %s\n",
+				db->tbl_name);
+			return -ENOMEM;
+		}
+		if (cmpxchg(&db->replog, NULL, log)) {
+			vfree(log);
+			log = db->replog;
+		} else {
+			TDB_LOG("Start change log of table %s\n",
+				db->tbl_name);
+		}
+	}
+	*seq = atomic64_read(&log->seq);
+
+	return 0;
+}
+EXPORT_SYMBOL(tdb_replog_start);
+
+/**
+ * Read up to @n keys of records of table @db changed since sequence number
+ * @seq and move @seq after the read changes. The same key can be read many
+ * times.
+ * @return number of read keys or -ERANGE if some changes since @seq are lost
+ * and a new snapshot of the table must be taken.
+ */
+int
+tdb_replog_read(TDB *db, unsigned long *seq, unsigned long *keys, int n)
+{
+	int i;
+	unsigned long head;
+	TdbRepLog *log = db->replog;
+
+	if (!log)
+		return -ERANGE;
+
+	head = atomic64_read(&log->seq);
+	if (*seq > head || head - *seq > TDB_REPLOG_SZ)
+		return -ERANGE;
+
+	for (i = 0; i < n && *seq < head; ++i, ++*seq) {
+		TdbRepEnt *e = &log->ents[*seq & (TDB_REPLOG_SZ - 1)];
+		unsigned long s0, s1;
+
+		s0 = READ_ONCE(e->seq);
+		smp_rmb();
+		keys[i] = READ_ONCE(e->key);
+		smp_rmb();
+		s1 = READ_ONCE(e->seq);
+
+		if (s0 == *seq && s1 == *seq)
+			continue;
+		if (s0 != TDB_REPLOG_BUSY && s0 > *seq)
+			return -ERANGE;
+		/* The writer hasn't finished yet, read the key next time. */
+		break;
+	}
+
+	return i;
+}
+EXPORT_SYMBOL(tdb_replog_read);
+
+void
+tdb_replog_free(TDB *db)
+{
+	vfree(db->replog);
+	db->replog = NULL;
+}
@@ -96,6 +96,31 @@ tdb_tbl_print_all(char *buf, size_t len)
 	return n;
 }
 
+/**
+ * Print information about each open table by @print.
+ */
+int
+tdb_tbl_print_each(char *buf, size_t len,
+		   int (*print)(TDB *db, char *buf, size_t len))
+{
+	int i, n = 0;
+
+	mutex_lock(&tbl_mtx);
+
+	for (i = 0; i < tbl_last; ++i) {
+		int r = print(tdb_tbls[i].db, buf + n, len - n);
+		if (r <= 0 || r >= len - n) {
+			TDB_WARN("Not enough space to print all tables\n");
+			break;
+		}
+		n += r;
+	}
+
+	mutex_unlock(&tbl_mtx);
+
+	return n;
+}
+
 void
 tdb_tbl_foreach(void (*func)(TDB *db))
 {
@@ -25,6 +25,8 @@
 void tdb_tbl_enumerate(TDB *db);
 void tdb_tbl_forget(TDB *db);
 int tdb_tbl_print_all(char *buf, size_t len);
+int tdb_tbl_print_each(char *buf, size_t len,
+		       int (*print)(TDB *db, char *buf, size_t len));
 void tdb_tbl_foreach(void (*func)(TDB *db));
 TDB *tdb_tbl_lookup(char *table, size_t len);
 
@@ -26,8 +26,41 @@
 #include <linux/fs.h>
 #include <linux/slab.h>
 
+#include "hash.h"
 #include "tdb_if.h"
 
+/**
+ * Index traversal statistics to estimate TLB pressure of a table.
+ * The counters are updated w/o synchronization, so they're approximate.
+ *
+ * @descends	- number of index descends from the root;
+ * @inodes	- number of visited index nodes;
+ * @ext_jumps	- number of moves to a node or bucket in another extent,
+ *		  i.e. potential TLB misses if the table is backed by 2MB pages;
+ */
+typedef struct {
+	unsigned long	descends;
+	unsigned long	inodes;
+	unsigned long	ext_jumps;
+} TdbWalkStat;
+
+/**
+ * Table operations counters, approximate as well.
+ *
+ * @lookups	- number of index lookups, including lookups for removals;
+ * @inserts	- number of inserted records;
+ * @removes	- number of removed records;
+ * @bursts	- number of bucket bursts, i.e. new index nodes;
+ * @alloc_fails	- number of failed allocations due to lack of free space;
+ */
+typedef struct {
+	unsigned long	lookups;
+	unsigned long	inserts;
+	unsigned long	removes;
+	unsigned long	bursts;
+	unsigned long	alloc_fails;
+} TdbOpStat;
+
 /**
  * Per-CPU dynamically allocated data for TDB handler.
  * Access to the data must be with preemption disabled for reentrance between
@@ -37,10 +70,13 @@
  *		    TdbHdr->i_wcl and TdbHdr->d_wcl are the global values for
  *		    the variable. The variables are initialized in runtime,
  *		    so we lose some free space on system restart.
+ * @ws, @os	  - statistics of the table, see tdb_print_tbl_stat().
  */
 typedef struct {
 	unsigned long	i_wcl;
 	unsigned long	d_wcl;
+	TdbWalkStat	ws;
+	TdbOpStat	os;
 } TdbPerCpu;
 
 /**
@@ -53,6 +89,13 @@ typedef struct {
  * @nwb		- next to write block (byte offset);
  * @pcpu	- pointer to per-cpu dynamic data for the TDB handler;
  * @rec_len	- fixed-size records length or zero for variable-length records;
+ * @state	- state of the table image on disk, see TDB_ST_* values;
+ * @flags	- the table flags, see TDB_HDR_F_* bits;
+ * @sync_gen	- number of the table image writes to disk, it's incremented
+ *		  after TDB_ST_SYNC state is written, so user-space readers of
+ *		  the table file detect concurrent image writes;
+ * @hash	- hash function for keys of the table, see TDB_HASH_*;
+ * @hash_key	- random key of the hash function if it's keyed;
  ** @ext_bmp	- bitmap of used/free extents.
  * 		  Must be small and cache line aligned;
  */
@@ -62,44 +105,52 @@ typedef struct {
 	atomic64_t		nwb;
 	TdbPerCpu __percpu	*pcpu;
 	unsigned int		rec_len;
-	unsigned char		_padding[8 * 3 + 4];
+	unsigned int		state;
+	unsigned long		flags;
+	unsigned long		sync_gen;
+	unsigned int		hash;
+	unsigned char		_padding1[4];
+	unsigned long		hash_key[2];
+	unsigned char		_padding2[48];
 	unsigned long		ext_bmp[0];
 } __attribute__((packed)) TdbHdr;
 
-/**
- * Database handle descriptor.
- *
- * @filp	- mmap()'ed file;
- * @node	- NUMA node ID;
- * @count	- reference counter;
- * @tbl_name	- table name;
- * @path	- path to the table;
+/* The table contains (or contained) records with expiration time. */
+#define TDB_HDR_F_EXPIRE_B	0
+
+/*
+ * Table image states. The table is written to disk on close only, so the disk
+ * image of an open table is the image of its last close. The image is written
+ * in place, so it's marked as being synced before the write.
  */
-typedef struct {
-	TdbHdr		*hdr;
-	struct file	*filp;
-	int		node;
-	atomic_t	count;
-	char		tbl_name[TDB_TBLNAME_LEN + 1];
-	char		path[TDB_PATH_LEN];
-} TDB;
+enum {
+	TDB_ST_CLEAN	= 0,	/* the table was synced and closed */
+	TDB_ST_OPEN,		/* the table is in use */
+	TDB_ST_SYNC,		/* the image is being written to disk */
+};
 
 /**
  * Fixed-size (and typically small) records.
+ *
+ * @expires	- absolute expiration time of the record in seconds
+ *		  (see get_seconds()) or zero if the record never expires;
  */
 typedef struct {
 	unsigned long	key; /* must be the first */
+	unsigned long	expires; /* must be the second */
 	char		data[0];
 } __attribute__((packed)) TdbFRec;
 
 /**
  * Variable-size (typically large) record.
  *
+ * @expires	- expiration time, meaningful for the first chunk only;
  * @chunk_next	- index of next data chunk
  * @len		- data length of current chunk
  */
 typedef struct {
 	unsigned long	key; /* must be the first */
+	unsigned long	expires; /* must be the second */
 	unsigned int	chunk_next;
 	unsigned int	len;
 	char		data[0];
@@ -108,6 +159,73 @@ typedef struct {
 /* Common interface for database records of all kinds. */
 typedef TdbFRec TdbRec;
 
+/**
+ * Callbacks of a table owner to move records by the compactor.
+ *
+ * @movable	- true if record @rec is completely written and can be moved;
+ * @moved	- @len bytes of data of record @rec were moved from table offset
+ *		  @from to offset @to, so the owner must update the offsets in
+ *		  [@from, @from + @len] stored in the record. Called under
+ *		  the record bucket write lock, so must not sleep;
+ */
+typedef struct {
+	bool	(*movable)(TdbRec *rec);
+	void	(*moved)(TdbRec *rec, unsigned long from, unsigned long to,
+			 size_t len);
+} TdbRelocOps;
+
+/* Maximum number of secondary indexes of a table. */
+#define TDB_IDX_MAX		4
+
+/**
+ * Database handle descriptor.
+ *
+ * @filp	- mmap()'ed file;
+ * @node	- NUMA node ID;
+ * @count	- reference counter;
+ * @tbl_name	- table name;
+ * @path	- path to the table;
+ * @exp_cursor	- current position of expired records collector;
+ * @cmp_cursor	- current position of the compactor;
+ * @reloc	- owner callbacks for the compactor, the table isn't compacted
+ *		  if they aren't set;
+ * @idx	- secondary indexes of the table;
+ * @replog	- change log for replication, NULL if there are no replicators;
+ * @bloom	- negative lookup filter, NULL if the table doesn't have it;
+ * @map_pages	- number of 4KB, 2MB and 1GB pages backing the table;
+ * @stat_ts	- time of the last statistics print in jiffies;
+ * @stat_ops	- number of lookups and inserts at @stat_ts;
+ */
+typedef struct {
+	TdbHdr		*hdr;
+	struct file	*filp;
+	int		node;
+	atomic_t	count;
+	unsigned long	exp_cursor;
+	unsigned long	cmp_cursor;
+	const TdbRelocOps *reloc;
+	struct tdb_index_t *idx[TDB_IDX_MAX];
+	struct tdb_replog_t *replog;
+	struct tdb_bloom_t *bloom;
+	unsigned long	map_pages[3];
+	unsigned long	stat_ts;
+	unsigned long	stat_ops[2];
+	char		tbl_name[TDB_TBLNAME_LEN + 1];
+	char		path[TDB_PATH_LEN];
+} TDB;
+
+/**
+ * Secondary index callbacks.
+ *
+ * @key		- get secondary key @skey of completely written record @rec
+ *		  of table @db, @data is the index data specified on the index
+ *		  creation. Returns false if the record isn't indexed. Called
+ *		  under the record bucket lock, so must not sleep;
+ */
+typedef struct {
+	bool	(*key)(TDB *db, TdbRec *rec, void *data, unsigned long *skey);
+} TdbIndexOps;
+
 /**
  * Iterator for TDB full key collision chains.
  */
@@ -118,6 +236,58 @@ typedef struct {
 
 #define TDB_ITER_BAD(i)		(!(i).rec)
 
+/* Maximum number of keys in one batched lookup. */
+#define TDB_BATCH_MAX		16
+
+/* Maximum number of operations in one transaction. */
+#define TDB_TRX_MAX		8
+
+/* Transaction operations. */
+#define TDB_TRX_READ		0
+#define TDB_TRX_INSERT		1
+#define TDB_TRX_REMOVE		2
+
+/**
+ * Transaction operation.
+ *
+ * @key		- key of the records;
+ * @bckt	- bucket of the key when the operation was added;
+ * @ver		- version of @bckt when the operation was added;
+ * @type	- operation, TDB_TRX_*;
+ * @data	- data of inserted record or data for @eq of removal;
+ * @len		- length of inserted data, set to length of the actually
+ *		  written data on commit as for tdb_entry_create(), or number of
+ *		  removed records after commit;
+ * @eq		- filter of removed records, all the records with the key are
+ *		  removed if it's NULL;
+ * @rec		- inserted record after commit;
+ */
+typedef struct {
+	unsigned long	key;
+	void		*bckt;
+	unsigned int	ver;
+	unsigned int	type;
+	void		*data;
+	size_t		len;
+	bool		(*eq)(TdbRec *rec, void *data);
+	TdbRec		*rec;
+} TdbTrxOp;
+
+/**
+ * Transaction: operations on records of table @db which are applied
+ * atomically on commit if the records weren't changed since they were
+ * added to the transaction.
+ *
+ * @db	- the table;
+ * @n	- number of operations;
+ * @ops	- the operations in order they were added;
+ */
+typedef struct {
+	TDB		*db;
+	int		n;
+	TdbTrxOp	ops[TDB_TRX_MAX];
+} TdbTrx;
+
 /**
  * We use very small index nodes size of only one cache line.
  * So overall memory footprint of the index is mininal by a cost of more LLC
@@ -168,13 +338,43 @@ void *tdb_entry_get_room(TDB *db, TdbVRec **r, char *curr_ptr, size_t tail_len,
 TdbIter tdb_rec_get(TDB *db, unsigned long key);
 void tdb_rec_next(TDB *db, TdbIter *iter);
 void tdb_rec_put(void *rec);
+void tdb_rec_get_batch(TDB *db, const unsigned long *keys, int n,
+		       void (*fn)(TdbIter *iter, int i, void *data),
+		       void *data);
+int tdb_entry_remove(TDB *db, unsigned long key,
+		     bool (*eq)(TdbRec *rec, void *data), void *data);
+int tdb_entry_commit(TDB *db, TdbRec *rec);
+int tdb_trx_read(TdbTrx *trx, unsigned long key);
+int tdb_trx_insert(TdbTrx *trx, unsigned long key, void *data, size_t len);
+int tdb_trx_remove(TdbTrx *trx, unsigned long key,
+		   bool (*eq)(TdbRec *rec, void *data), void *data);
+int tdb_trx_commit(TdbTrx *trx);
+void tdb_rec_set_ttl(TDB *db, TdbRec *rec, unsigned long ttl);
+void tdb_set_reloc(TDB *db, const TdbRelocOps *ops);
+int tdb_bloom_create(TDB *db, unsigned long nkeys);
 int tdb_info(char *buf, size_t len);
 
 /* Open/close database handler. */
 TDB *tdb_open(const char *path, size_t fsize, unsigned int rec_size, int node);
 void tdb_close(TDB *db);
+int tdb_resize(TDB *db, size_t size);
+
+int tdb_entry_walk(TDB *db, int (*fn)(void *data, TdbRec *rec), void *data);
+
+/* Replication. */
+int tdb_replog_start(TDB *db, unsigned long *seq);
+int tdb_replog_read(TDB *db, unsigned long *seq, unsigned long *keys, int n);
+
+/* Secondary indexes. */
+int tdb_index_create(TDB *db, const char *name, size_t size,
+		     const TdbIndexOps *ops, void *data);
+long tdb_index_lookup(TDB *db, const char *name, unsigned long skey,
+		      int (*fn)(TdbRec *rec, void *data), void *data);
 
 unsigned long tdb_hash_calc(const char *data, size_t len);
+unsigned long tdb_hash(TDB *db, const char *data, size_t len);
+void tdb_hash_init(TDB *db, TdbHashCtx *ctx);
+int tdb_set_hash(TDB *db, unsigned int fn);
 
 static inline TDB *
 tdb_get(TDB *db)
@@ -190,6 +390,16 @@ tdb_put(TDB *db)
 		kfree(db);
 }
 
+/**
+ * Start transaction @trx on table @db.
+ */
+static inline void
+tdb_trx_begin(TDB *db, TdbTrx *trx)
+{
+	trx->db = db;
+	trx->n = 0;
+}
+
 static inline TdbVRec *
 tdb_next_rec_chunk(TDB *db, TdbVRec *r)
 {
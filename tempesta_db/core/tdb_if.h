@@ -44,6 +44,9 @@ enum tdb_msg_type {
 	TDB_MSG_CLOSE,
 	TDB_MSG_INSERT,
 	TDB_MSG_SELECT,
+	TDB_MSG_RESIZE,
+	TDB_MSG_INDEX,
+	TDB_MSG_CHANGES,
 	__TDB_MSG_TYPE_MAX
 };
 
@@ -52,18 +55,58 @@ enum tdb_msg_type {
 #define TDB_NLF_RESP_TRUNC	0x0200 /* response was truncated */
 #define TDB_NLF_RESP_END	0x0400 /* end of chunked response */
 
+/* Hash functions for table keys, see hash.h. */
+#define TDB_HASH_CRC32C		0
+#define TDB_HASH_XXH64		1
+#define TDB_HASH_SIPHASH	2
+#define __TDB_HASH_NUM		3
+
 /**
- * Record for create table command.
+ * Record for create and resize table commands.
+ * Only @tbl_size is used for resize, @path is empty.
+ * @hash is hash function for keys of a new table, see TDB_HASH_*.
  */
 typedef struct {
 	size_t		tbl_size;
 	unsigned int	rec_size;
 	unsigned int	path_len;
+	unsigned int	hash;
 	char		path[0];
 } TdbCrTblRec;
 
+/**
+ * Record for create index command: the index maps hash of first @plen bytes
+ * of record keys to the records, the index table has @tbl_size bytes.
+ */
+typedef struct {
+	size_t		tbl_size;
+	unsigned int	plen;
+	char		name[TDB_TBLNAME_LEN + 1];
+} TdbIdxRec;
+
+/**
+ * Record for table changes request and response: the request asks for keys
+ * changed since sequence number @seq or for the current sequence number if
+ * @seq is TDB_REPL_START, the response contains the sequence number to ask
+ * from next time and non-zero @lost if the changes since the requested @seq
+ * were lost, so the table must be copied again.
+ *
+ * The response record is followed by a removal record (see below) for each
+ * changed key followed by current records with the key.
+ */
+typedef struct {
+	unsigned long	seq;
+	unsigned int	lost;
+} TdbReplRec;
+
+#define TDB_REPL_START		(~0UL)
+
 /**
  * Record specification used for update and select queries.
+ * Insert queries use records with empty key and data of unsigned long size
+ * to remove all the records with the key hash specified in the data.
+ * Select queries use non-zero @dlen for the name of the index to search
+ * the key in, the name follows the key.
  *
  * @klen	- key length;
  * @dlen	- data length;
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <poll.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -63,6 +64,15 @@ TdbHndl::LastOpStatus::update(const TdbMsg *m) noexcept
 	case TDB_MSG_SELECT:
 		op = "SELECT";
 		break;
+	case TDB_MSG_RESIZE:
+		op = "RESIZE";
+		break;
+	case TDB_MSG_INDEX:
+		op = "INDEX";
+		break;
+	case TDB_MSG_CHANGES:
+		op = "CHANGES";
+		break;
 	default:
 		op = "[unspecified]";
 	}
@@ -103,20 +113,21 @@ TdbHndl::lazy_buffer_alloc()
 void
 TdbHndl::msg_recv(std::function<bool (nlmsghdr *)> msg_cb)
 {
-	// Call poll(2) just for internal netlink mmap flow control.
-	pollfd pfds[1];
-	do {
-		pfds[0].fd	= fd_;
-		pfds[0].events	= POLLIN | POLLERR;
-		pfds[0].revents	= 0;
-		if ((poll(pfds, 1, -1) < 0 && errno != -EINTR)
-		    || pfds[0].revents & POLLERR)
-			throw TdbExcept("poll failure");
-	} while (!(pfds[0].revents & POLLIN));
-
 	for (bool read_more = true; read_more; ) {
 		nlmsghdr *nlh;
 
+		// Call poll(2) for internal netlink mmap flow control:
+		// the kernel continues multi-frame dumps from poll().
+		pollfd pfds[1];
+		do {
+			pfds[0].fd	= fd_;
+			pfds[0].events	= POLLIN | POLLERR;
+			pfds[0].revents	= 0;
+			if ((poll(pfds, 1, -1) < 0 && errno != -EINTR)
+			    || pfds[0].revents & POLLERR)
+				throw TdbExcept("poll failure");
+		} while (!(pfds[0].revents & POLLIN));
+
 		// Get next frame header.
 		nl_mmap_hdr *hdr = (nl_mmap_hdr *)(rx_ring_ + rx_fr_off_);
 
@@ -288,7 +299,7 @@ TdbHndl::get_info(std::function<void (char *)> data_cb)
 
 void
 TdbHndl::open_table(std::string &db_path, std::string &tbl_name,
-		    size_t pages, unsigned int rec_size)
+		    size_t pages, unsigned int rec_size, unsigned int hash)
 {
 	if (trx_)
 		throw TdbExcept("cannot run the action inside transaction");
@@ -300,7 +311,7 @@ TdbHndl::open_table(std::string &db_path, std::string &tbl_name,
 	if (tbl_size & ~TDB_EXT_MASK)
 		throw TdbExcept("table size must be multiple of extent size");
 
-	msg_send([&db_path, &tbl_name, tbl_size, rec_size](nlmsghdr *nlh) {
+	msg_send([=, &db_path, &tbl_name](nlmsghdr *nlh) {
 		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
 		m->type = TDB_MSG_OPEN;
 		m->rec_n = 1;
@@ -312,6 +323,7 @@ TdbHndl::open_table(std::string &db_path, std::string &tbl_name,
 		TdbCrTblRec *ct = (TdbCrTblRec *)(m->recs + 1);
 		ct->tbl_size = tbl_size;
 		ct->rec_size = rec_size;
+		ct->hash = hash;
 		ct->path_len = p.length() + 1;
 		p.copy(ct->path, p.length());
 		ct->path[p.length()] = 0;
@@ -376,26 +388,135 @@ TdbHndl::close_table(std::string &tbl_name)
 	});
 }
 
+void
+TdbHndl::resize_table(std::string &tbl_name, size_t pages)
+{
+	if (trx_)
+		throw TdbExcept("cannot run the action inside transaction");
+
+	size_t tbl_size = pages * getpagesize();
+
+	if (tbl_name.length() > TDB_TBLNAME_LEN)
+		throw TdbExcept("too long table name");
+	if (tbl_size & ~TDB_EXT_MASK)
+		throw TdbExcept("table size must be multiple of extent size");
+
+	msg_send([&tbl_name, tbl_size](nlmsghdr *nlh) {
+		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
+		memset(m, 0, sizeof(*m));
+		m->type = TDB_MSG_RESIZE;
+		m->rec_n = 1;
+		tbl_name.copy(m->t_name, TDB_TBLNAME_LEN);
+		m->t_name[tbl_name.length()] = 0;
+
+		TdbCrTblRec *ct = (TdbCrTblRec *)(m->recs + 1);
+		memset(ct, 0, sizeof(*ct));
+		ct->tbl_size = tbl_size;
+
+		m->recs[0].klen = 0;
+		m->recs[0].dlen = sizeof(*ct);
+
+		nlh->nlmsg_len = sizeof(*nlh) + sizeof(*m)
+				 + TDB_MSGREC_LEN(&m->recs[0]);
+		nlh->nlmsg_type = NLMSG_MIN_TYPE + 1;
+		nlh->nlmsg_flags |= NLM_F_REQUEST;
+	});
+
+	// Just check for status message.
+	msg_recv([=](nlmsghdr *nlh) -> bool {
+		if (nlh->nlmsg_len < sizeof(*nlh) + sizeof(TdbMsg))
+			throw TdbExcept("bad resize table status msg");
+
+		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
+		if (m->type != (TDB_MSG_RESIZE | TDB_NLF_RESP_OK))
+			throw TdbExcept("cannot resize table, see dmesg");
+
+		last_status_.update(m);
+
+		return false;
+	});
+}
+
+/**
+ * Create index @idx_name of table @tbl_name by first @plen bytes of the table
+ * keys. The index is built from the current table records.
+ */
+void
+TdbHndl::create_index(std::string &tbl_name, std::string &idx_name,
+		      size_t pages, unsigned int plen)
+{
+	if (trx_)
+		throw TdbExcept("cannot run the action inside transaction");
+
+	size_t tbl_size = pages * getpagesize();
+
+	if (tbl_name.length() > TDB_TBLNAME_LEN)
+		throw TdbExcept("too long table name");
+	if (idx_name.empty() || idx_name.length() > TDB_TBLNAME_LEN)
+		throw TdbExcept("bad index name");
+	if (!plen)
+		throw TdbExcept("please specify index key prefix length");
+	if (tbl_size & ~TDB_EXT_MASK)
+		throw TdbExcept("table size must be multiple of extent size");
+
+	msg_send([&tbl_name, &idx_name, tbl_size, plen](nlmsghdr *nlh) {
+		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
+		memset(m, 0, sizeof(*m));
+		m->type = TDB_MSG_INDEX;
+		m->rec_n = 1;
+		tbl_name.copy(m->t_name, TDB_TBLNAME_LEN);
+		m->t_name[tbl_name.length()] = 0;
+
+		TdbIdxRec *ir = (TdbIdxRec *)(m->recs + 1);
+		memset(ir, 0, sizeof(*ir));
+		ir->tbl_size = tbl_size;
+		ir->plen = plen;
+		idx_name.copy(ir->name, TDB_TBLNAME_LEN);
+
+		m->recs[0].klen = 0;
+		m->recs[0].dlen = sizeof(*ir);
+
+		nlh->nlmsg_len = sizeof(*nlh) + sizeof(*m)
+				 + TDB_MSGREC_LEN(&m->recs[0]);
+		nlh->nlmsg_type = NLMSG_MIN_TYPE + 1;
+		nlh->nlmsg_flags |= NLM_F_REQUEST;
+	});
+
+	// Just check for status message.
+	msg_recv([=](nlmsghdr *nlh) -> bool {
+		if (nlh->nlmsg_len < sizeof(*nlh) + sizeof(TdbMsg))
+			throw TdbExcept("bad create index status msg");
+
+		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
+		if (m->type != (TDB_MSG_INDEX | TDB_NLF_RESP_OK))
+			throw TdbExcept("cannot create index, see dmesg");
+
+		last_status_.update(m);
+
+		return false;
+	});
+}
+
 void
 TdbHndl::insert(std::string &tbl_name, size_t klen, size_t vlen,
 		std::function<void (char *, char *)> placement_cb)
 {
-	static const size_t HDRS_LEN = sizeof(nl_mmap_hdr) + sizeof(TdbMsg)
-				       + sizeof(TdbMsgRec);
+	static const size_t HDRS_LEN = NL_MMAP_HDRLEN + sizeof(nlmsghdr)
+				       + sizeof(TdbMsg) + sizeof(TdbMsgRec);
 	bool in_trx = trx_;
 
+	if (klen + vlen + HDRS_LEN > NL_FR_SZ)
+		throw TdbExcept("too large data for one insertion");
+
 	if (!in_trx)
 		trx_begin();
 
-	if (trx_.off + sizeof(nlmsghdr) + sizeof(TdbMsgRec) + klen + vlen
-	    > NL_FR_SZ)
-	{
-		// Not enugh space in current frame, alllocate a new one.
-		advance_frame_offset(tx_fr_off_);
+	if (trx_.off + klen + vlen + HDRS_LEN > NL_FR_SZ) {
+		// Not enough space in current frame: send it to the kernel
+		// and continue the transaction in a new frame.
+		trx_commit();
 		alloc_trx_frame();
 	}
-	if (klen + vlen + HDRS_LEN > NL_FR_SZ)
-		throw TdbExcept("too large data for one insertion");
 
 	if (!trx_.tdb_hdr->type || !trx_.tdb_hdr->t_name[0]) {
 		// New transaction.
@@ -417,17 +538,125 @@ TdbHndl::insert(std::string &tbl_name, size_t klen, size_t vlen,
 		trx_commit();
 }
 
+/**
+ * Remove all records with key hash @key from table @tbl_name.
+ * The removal can be a part of insert transaction.
+ */
+void
+TdbHndl::remove(std::string &tbl_name, unsigned long key)
+{
+	insert(tbl_name, 0, sizeof(key), [key](char *, char *v) {
+		memcpy(v, &key, sizeof(key));
+	});
+}
+
+/**
+ * Get changes of table @tbl_name since sequence number @seq and move @seq
+ * after them. Each changed key is passed to @process_cb as a record with empty
+ * key and the key hash in the value followed by current records with the key.
+ * If @seq is TDB_REPL_START, then the kernel starts the table change log and
+ * only the sequence number is returned.
+ * @return false if the changes since @seq are lost and the table must be
+ * copied again.
+ */
+bool
+TdbHndl::changes(std::string &tbl_name, unsigned long &seq,
+		 std::function<void (char *, size_t, char *, size_t)>
+			process_cb)
+{
+	bool lost = false;
+
+	if (trx_)
+		throw TdbExcept("cannot run the action inside transaction");
+
+	if (tbl_name.length() > TDB_TBLNAME_LEN)
+		throw TdbExcept("too long table name");
+
+	msg_send([&tbl_name, seq](nlmsghdr *nlh) {
+		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
+		memset(m, 0, sizeof(*m));
+		m->type = TDB_MSG_CHANGES;
+		m->rec_n = 1;
+		tbl_name.copy(m->t_name, TDB_TBLNAME_LEN);
+		m->t_name[tbl_name.length()] = 0;
+
+		TdbReplRec *rr = (TdbReplRec *)(m->recs + 1);
+		memset(rr, 0, sizeof(*rr));
+		rr->seq = seq;
+
+		m->recs[0].klen = 0;
+		m->recs[0].dlen = sizeof(*rr);
+
+		nlh->nlmsg_len = sizeof(*nlh) + sizeof(*m)
+				 + TDB_MSGREC_LEN(&m->recs[0]);
+		nlh->nlmsg_type = NLMSG_MIN_TYPE + 1;
+		nlh->nlmsg_flags |= NLM_F_REQUEST;
+	});
+
+	msg_recv([this, &seq, &lost, &process_cb](nlmsghdr *nlh) -> bool {
+		if (nlh->nlmsg_len < sizeof(*nlh) + sizeof(TdbMsg)
+				     + sizeof(TdbMsgRec) + sizeof(TdbReplRec))
+			throw TdbExcept("bad changes msg len %u",
+					nlh->nlmsg_len);
+
+		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
+		if (!(m->type & TDB_NLF_RESP_OK))
+			throw TdbExcept("cannot get table changes, see dmesg");
+		if ((m->type & TDB_NLF_TYPE_MASK) != TDB_MSG_CHANGES
+		    || !m->rec_n || m->recs[0].klen
+		    || m->recs[0].dlen != sizeof(TdbReplRec))
+			throw TdbExcept("malformed changes msg type=%u"
+					" rec_n=%u", m->type, m->rec_n);
+
+		TdbReplRec *rr = (TdbReplRec *)(m->recs + 1);
+		seq = rr->seq;
+		lost = rr->lost;
+
+		unsigned int off = TDB_MSGREC_LEN(&m->recs[0]);
+		for (unsigned int i = 1; i < m->rec_n; ++i) {
+			TdbMsgRec *r = (TdbMsgRec *)((char *)m->recs + off);
+			process_cb(r->data, r->klen,
+				   TDB_MSGREC_DATA(r), r->dlen);
+			off += TDB_MSGREC_LEN(r);
+		}
+
+		last_status_.update(m);
+
+		return false; // changes are sent in one frame
+	});
+
+	return !lost;
+}
+
 void
 TdbHndl::query(std::string &tbl_name, std::string &key,
 	       std::function<void (char *, size_t, char *, size_t)> process_cb)
+{
+	std::string primary;
+
+	query(tbl_name, primary, key, process_cb);
+}
+
+/**
+ * Select records by key @key from index @idx_name of table @tbl_name,
+ * the key must be of the index prefix length. Empty @idx_name means
+ * the primary key.
+ */
+void
+TdbHndl::query(std::string &tbl_name, std::string &idx_name, std::string &key,
+	       std::function<void (char *, size_t, char *, size_t)> process_cb)
 {
 	if (trx_)
 		throw TdbExcept("cannot run the action inside transaction");
 
 	if (tbl_name.length() > TDB_TBLNAME_LEN)
 		throw TdbExcept("too long table name");
+	if (idx_name.length() > TDB_TBLNAME_LEN)
+		throw TdbExcept("too long index name");
+	if (!idx_name.empty() && key.empty())
+		throw TdbExcept("please specify key to select by index");
 
-	msg_send([&tbl_name, &key](nlmsghdr *nlh) {
+	msg_send([&tbl_name, &idx_name, &key](nlmsghdr *nlh) {
 		TdbMsg *m = (TdbMsg *)NLMSG_DATA(nlh);
 		m->type = TDB_MSG_SELECT;
 		m->rec_n = 1;
@@ -435,11 +664,12 @@ TdbHndl::query(std::string &tbl_name, std::string &key,
 		m->t_name[tbl_name.length()] = 0;
 
 		m->recs[0].klen = key.length();
-		m->recs[0].dlen = 0;
+		m->recs[0].dlen = idx_name.length();
 		key.copy(m->recs[0].data, m->recs[0].klen);
+		idx_name.copy(TDB_MSGREC_DATA(&m->recs[0]), m->recs[0].dlen);
 
-		nlh->nlmsg_len = sizeof(*nlh) + sizeof(*m) + sizeof(TdbMsgRec)
-				 + m->recs[0].klen;
+		nlh->nlmsg_len = sizeof(*nlh) + sizeof(*m)
+				 + TDB_MSGREC_LEN(&m->recs[0]);
 		nlh->nlmsg_type = NLMSG_MIN_TYPE + 1;
 		nlh->nlmsg_flags |= NLM_F_REQUEST;
 	});
@@ -473,6 +703,16 @@ TdbHndl::query(std::string &tbl_name, std::string &key,
 
 }
 
+void
+TdbHndl::scan(std::string &tbl_name,
+	      std::function<void (char *, size_t, char *, size_t)> process_cb)
+{
+	// Empty key requests all the table records.
+	std::string all;
+
+	query(tbl_name, all, process_cb);
+}
+
 std::string
 TdbHndl::last_status() noexcept
 {
@@ -496,7 +736,9 @@ TdbHndl::TdbHndl(size_t mm_sz)
 	sockaddr_nl addr = {
 		.nl_family	= AF_NETLINK,
 	};
-	addr.nl_pid = getpid();
+	// Let the kernel assign the port id, so a process can use many
+	// handlers, e.g. one per thread.
+	addr.nl_pid = 0;
 	if (bind(fd_, (const sockaddr *)&addr, sizeof(addr)))
 		throw TdbExcept("cannot bind netlink socket");
 
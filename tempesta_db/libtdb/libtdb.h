@@ -27,6 +27,7 @@
 
 #include <tdb_if.h>
 #include "exception.h"
+#include "map.h"
 
 class TdbHndl {
 public:
@@ -90,13 +91,28 @@ public:
 
 	void get_info(std::function<void (char *)> data_cb);
 	void open_table(std::string &db_path, std::string &tbl_name,
-			size_t pages, unsigned int rec_size);
+			size_t pages, unsigned int rec_size,
+			unsigned int hash = TDB_HASH_CRC32C);
 	void close_table(std::string &tbl_name);
+	void resize_table(std::string &tbl_name, size_t pages);
+	void create_index(std::string &tbl_name, std::string &idx_name,
+			  size_t pages, unsigned int plen);
 	void insert(std::string &tbl_name, size_t klen, size_t vlen,
 		    std::function<void (char *, char *)> placement_cb);
+	void remove(std::string &tbl_name, unsigned long key);
+	bool changes(std::string &tbl_name, unsigned long &seq,
+		     std::function<void (char *, size_t, char *, size_t)>
+			process_cb);
 	void query(std::string &tbl_name, std::string &key,
 		   std::function<void (char *, size_t, char *, size_t)>
 			process_cb);
+	void query(std::string &tbl_name, std::string &idx_name,
+		   std::string &key,
+		   std::function<void (char *, size_t, char *, size_t)>
+			process_cb);
+	void scan(std::string &tbl_name,
+		  std::function<void (char *, size_t, char *, size_t)>
+			process_cb);
 
 	std::string last_status() noexcept;
 
@@ -119,4 +135,36 @@ private:
 	LastOpStatus last_status_;
 };
 
+/**
+ * Read-only zero-copy access to a table file w/o the kernel, e.g. for
+ * analytics. The file contains the table of its last close by the kernel.
+ * Records are passed to the callbacks directly from the read-only mapping,
+ * so the callbacks must not write to them.
+ *
+ * Each query or scan is a consistent snapshot of the file: it waits while
+ * the kernel writes the table image and throws TdbExcept with EAGAIN errno
+ * if the image was written during the walk, so the caller must discard
+ * the observed records and can retry.
+ */
+class TdbMapping {
+public:
+	TdbMapping(const std::string &path);
+	~TdbMapping() noexcept;
+
+	void walk(std::function<void (TdbMapRec *)> rec_cb);
+	void query(std::string &key,
+		   std::function<void (char *, size_t, char *, size_t)>
+			process_cb);
+	void scan(std::function<void (char *, size_t, char *, size_t)>
+			process_cb);
+
+private:
+	void snapshot(std::function<long ()> walk_cb);
+	bool msg_rec(TdbMapRec *r, TdbMsgRec *&mr);
+
+private:
+	TdbMap *map_;
+	std::string buf_;
+};
+
 #endif // __LIBTDB_H__
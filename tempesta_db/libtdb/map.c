@@ -0,0 +1,279 @@
+/**
+ *		Tempesta DB User-space Library
+ *
+ * Read-only zero-copy access to table files w/o the kernel.
+ *
+ * The kernel keeps an open table in its own memory and writes the table image
+ * to the file on the table close, so a mapped table file contains the table
+ * of its last close. The image is written in place, so readers use
+ * the image state and sync generation from the table header like a seqlock:
+ * the snapshot is consistent if the image wasn't being written at the walk
+ * beginning and the generation didn't change during the walk.
+ * The walker checks all the offsets on the way, so it never leaves the mapping
+ * even if it walks a torn image.
+ *
+ * Copyright (C) 2016 Tempesta Technologies.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Use the kernel HTrie code with user-space shims. */
+#include "../core/htrie.c"
+#include "../core/hash.h"
+
+#include "map.h"
+
+/**
+ * Read-only mapping of a table file.
+ *
+ * @fd		- the table file descriptor;
+ * @size	- size of the mapping;
+ * @dbh		- the mapped table image;
+ * @gen		- sync generation of the image at the snapshot beginning;
+ */
+struct tdb_map_t {
+	int		fd;
+	size_t		size;
+	TdbHdr		*dbh;
+	unsigned long	gen;
+};
+
+/**
+ * Walk context.
+ *
+ * @m		- the mapping being walked;
+ * @fn		- user callback;
+ * @data	- user data for @fn;
+ * @key		- key of looked up records;
+ * @lookup	- pass only records with @key to @fn;
+ */
+typedef struct {
+	TdbMap		*m;
+	void		(*fn)(void *data, TdbMapRec *r);
+	void		*data;
+	unsigned long	key;
+	bool		lookup;
+} TdbMapCtx;
+
+/**
+ * (Re)map the whole table file, the table could grow since the last mapping.
+ */
+static int
+tdb_map_file(TdbMap *m)
+{
+	struct stat sb;
+	void *p;
+
+	if (fstat(m->fd, &sb) < 0)
+		return -errno;
+	if (!sb.st_size || sb.st_size % TDB_EXT_SZ)
+		return -EINVAL;
+	if (m->dbh && sb.st_size == m->size)
+		return 0;
+
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, m->fd, 0);
+	if (p == MAP_FAILED)
+		return -errno;
+	if (m->dbh)
+		munmap(m->dbh, m->size);
+	m->dbh = p;
+	m->size = sb.st_size;
+
+	return 0;
+}
+
+TdbMap *
+tdb_map_open(const char *path)
+{
+	int r;
+	TdbMap *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return NULL;
+
+	m->fd = open(path, O_RDONLY);
+	if (m->fd < 0)
+		goto err;
+	if ((r = tdb_map_file(m))) {
+		close(m->fd);
+		errno = -r;
+		goto err;
+	}
+
+	return m;
+err:
+	free(m);
+	return NULL;
+}
+
+void
+tdb_map_close(TdbMap *m)
+{
+	munmap(m->dbh, m->size);
+	close(m->fd);
+	free(m);
+}
+
+/**
+ * Begin a consistent snapshot of the table file.
+ * @return -EAGAIN if the kernel is writing the image at the moment.
+ *
+ * x86-64 doesn't reorder loads with other loads, so compiler barriers are
+ * enough to read the generation before the state.
+ */
+int
+tdb_map_begin(TdbMap *m)
+{
+	int r;
+
+	if ((r = tdb_map_file(m)))
+		return r;
+
+	barrier();
+	m->gen = m->dbh->sync_gen;
+	barrier();
+	if (m->dbh->state == TDB_ST_SYNC)
+		return -EAGAIN;
+
+	return 0;
+}
+
+/**
+ * Finish the snapshot started by tdb_map_begin().
+ * @return -EAGAIN if the image was written during the snapshot, so all
+ * the records observed since tdb_map_begin() must be discarded.
+ */
+int
+tdb_map_end(TdbMap *m)
+{
+	barrier();
+	if (m->dbh->state == TDB_ST_SYNC)
+		return -EAGAIN;
+	barrier();
+	if (m->dbh->sync_gen != m->gen)
+		return -EAGAIN;
+
+	return 0;
+}
+
+static void
+tdb_map_rec(void *data, TdbRec *rec)
+{
+	TdbMapCtx *ctx = data;
+	TdbHdr *dbh = ctx->m->dbh;
+	TdbMapRec r = {
+		.key		= rec->key,
+		.expires	= rec->expires,
+	};
+
+	if (ctx->lookup && rec->key != ctx->key)
+		return;
+
+	if (TDB_HTRIE_VARLENRECS(dbh)) {
+		TdbVRec *vr = (TdbVRec *)rec;
+
+		r.data = vr->data;
+		r.len = TDB_HTRIE_VRLEN(vr);
+		r.chunk = vr;
+	} else {
+		r.data = rec->data;
+		r.len = dbh->rec_len;
+	}
+
+	ctx->fn(ctx->data, &r);
+}
+
+/**
+ * Call @fn for each live record of the mapped table.
+ * @return number of found inconsistencies of the image or -1 if the file
+ * doesn't contain a table.
+ */
+long
+tdb_map_walk(TdbMap *m, void (*fn)(void *data, TdbMapRec *r), void *data)
+{
+	TdbMapCtx ctx = { .m = m, .fn = fn, .data = data };
+
+	return tdb_htrie_image_walk(m->dbh, m->size, tdb_map_rec, &ctx);
+}
+
+/**
+ * The same as tdb_map_walk(), but for records with key @key only.
+ */
+long
+tdb_map_lookup(TdbMap *m, unsigned long key,
+	       void (*fn)(void *data, TdbMapRec *r), void *data)
+{
+	TdbMapCtx ctx = {
+		.m	= m,
+		.fn	= fn,
+		.data	= data,
+		.key	= key,
+		.lookup	= true,
+	};
+
+	return tdb_htrie_image_lookup(m->dbh, m->size, key, tdb_map_rec, &ctx);
+}
+
+/**
+ * Move @r to the next chunk of the record. Chunks are checked by the walk,
+ * so the function must be called from the walk callback only.
+ * @return zero if there are no more chunks.
+ */
+int
+tdb_map_next_chunk(TdbMap *m, TdbMapRec *r)
+{
+	const TdbVRec *vr = r->chunk;
+
+	if (!vr || !vr->chunk_next)
+		return 0;
+
+	vr = TDB_PTR(m->dbh, TDB_DI2O(vr->chunk_next));
+	r->data = vr->data;
+	r->len = TDB_HTRIE_VRLEN(vr);
+	r->chunk = vr;
+
+	return 1;
+}
+
+/**
+ * The same as tdb_hash() in the kernel for the mapped table, so records
+ * inserted by the kernel for string keys can be looked up by the keys.
+ */
+unsigned long
+tdb_map_hash(TdbMap *m, const char *data, size_t len)
+{
+	return __tdb_hash(m->dbh->hash, m->dbh->hash_key, data, len);
+}
+
+/**
+ * Hash function @fn, which must not be keyed, of @data, e.g. to compute keys
+ * of a table on another node using the same function.
+ */
+unsigned long
+tdb_hash_fn(unsigned int fn, const char *data, size_t len)
+{
+	static const unsigned long no_key[2];
+
+	return __tdb_hash(fn, no_key, data, len);
+}
@@ -0,0 +1,66 @@
+/**
+ *		Tempesta DB User-space Library
+ *
+ * Read-only access to table files w/o the kernel.
+ *
+ * Copyright (C) 2016 Tempesta Technologies.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __TDB_MAP_H__
+#define __TDB_MAP_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tdb_map_t TdbMap;
+
+/**
+ * Chunk of a record in a mapped table file.
+ *
+ * @key		- the record key;
+ * @expires	- the record expiration time in seconds or zero;
+ * @data	- the chunk data, it's placed in the read-only mapping;
+ * @len		- length of @data;
+ * @chunk	- the chunk descriptor to move to next chunk of the record;
+ */
+typedef struct {
+	unsigned long	key;
+	unsigned long	expires;
+	const char	*data;
+	size_t		len;
+	const void	*chunk;
+} TdbMapRec;
+
+TdbMap *tdb_map_open(const char *path);
+void tdb_map_close(TdbMap *m);
+int tdb_map_begin(TdbMap *m);
+int tdb_map_end(TdbMap *m);
+long tdb_map_walk(TdbMap *m, void (*fn)(void *data, TdbMapRec *r),
+		  void *data);
+long tdb_map_lookup(TdbMap *m, unsigned long key,
+		    void (*fn)(void *data, TdbMapRec *r), void *data);
+int tdb_map_next_chunk(TdbMap *m, TdbMapRec *r);
+unsigned long tdb_map_hash(TdbMap *m, const char *data, size_t len);
+unsigned long tdb_hash_fn(unsigned int fn, const char *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TDB_MAP_H__ */
@@ -0,0 +1,163 @@
+/**
+ *		Tempesta DB User-space Library
+ *
+ * Read-only access to table files w/o the kernel.
+ *
+ * Copyright (C) 2016 Tempesta Technologies.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <errno.h>
+#include <time.h>
+
+#include <chrono>
+#include <thread>
+
+#include "libtdb.h"
+
+// How long to wait while the kernel writes the table image.
+static const unsigned int SYNC_WAIT_MS = 10000;
+
+typedef std::function<void (TdbMapRec *)> RecCb;
+
+static void
+rec_cb_call(void *data, TdbMapRec *r)
+{
+	(*static_cast<RecCb *>(data))(r);
+}
+
+void
+TdbMapping::snapshot(std::function<long ()> walk_cb)
+{
+	int r;
+	long err;
+
+	for (unsigned int ms = 0; (r = tdb_map_begin(map_)) == -EAGAIN; ++ms) {
+		if (ms == SYNC_WAIT_MS) {
+			errno = EAGAIN;
+			throw TdbExcept("the table file is being written");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (r) {
+		errno = -r;
+		throw TdbExcept("cannot map the table file");
+	}
+
+	err = walk_cb();
+
+	if (tdb_map_end(map_)) {
+		errno = EAGAIN;
+		throw TdbExcept("the table file was written during the walk");
+	}
+	errno = 0;
+	if (err < 0)
+		throw TdbExcept("the file doesn't contain a table");
+	if (err)
+		throw TdbExcept("the table file is broken, %ld errors", err);
+}
+
+/**
+ * Get record @r, which is TdbMsgRec placed by the kernel netlink interface,
+ * in one piece. Only records spanning many chunks are copied.
+ * @return false for expired records or records of other formats.
+ */
+bool
+TdbMapping::msg_rec(TdbMapRec *r, TdbMsgRec *&mr)
+{
+	size_t len, n;
+
+	if (r->expires && (unsigned long)time(NULL) >= r->expires)
+		return false;
+	if (r->len < sizeof(TdbMsgRec))
+		return false;
+
+	mr = (TdbMsgRec *)r->data;
+	len = TDB_MSGREC_LEN(mr);
+	if (len <= r->len)
+		return true;
+
+	buf_.resize(len);
+	for (n = 0; n < len; ) {
+		size_t c = std::min(r->len, len - n);
+		buf_.replace(n, c, r->data, c);
+		n += c;
+		if (n < len && !tdb_map_next_chunk(map_, r))
+			return false;
+	}
+	mr = (TdbMsgRec *)&buf_[0];
+
+	return true;
+}
+
+void
+TdbMapping::walk(std::function<void (TdbMapRec *)> rec_cb)
+{
+	snapshot([this, &rec_cb]() -> long {
+		return tdb_map_walk(map_, rec_cb_call, &rec_cb);
+	});
+}
+
+void
+TdbMapping::query(std::string &key,
+		  std::function<void (char *, size_t, char *, size_t)>
+			process_cb)
+{
+	// Empty key requests all the table records.
+	if (key.empty()) {
+		scan(process_cb);
+		return;
+	}
+
+	RecCb rec_cb = [this, &key, &process_cb](TdbMapRec *r) {
+		TdbMsgRec *mr;
+
+		if (!msg_rec(r, mr) || key.compare(0, key.length(), mr->data,
+						   mr->klen))
+			return;
+		process_cb(mr->data, mr->klen, TDB_MSGREC_DATA(mr), mr->dlen);
+	};
+
+	snapshot([this, &key, &rec_cb]() -> long {
+		return tdb_map_lookup(map_, tdb_map_hash(map_, key.data(),
+							 key.length()),
+				      rec_cb_call, &rec_cb);
+	});
+}
+
+void
+TdbMapping::scan(std::function<void (char *, size_t, char *, size_t)>
+			process_cb)
+{
+	walk([this, &process_cb](TdbMapRec *r) {
+		TdbMsgRec *mr;
+
+		if (msg_rec(r, mr))
+			process_cb(mr->data, mr->klen,
+				   TDB_MSGREC_DATA(mr), mr->dlen);
+	});
+}
+
+TdbMapping::TdbMapping(const std::string &path)
+{
+	map_ = tdb_map_open(path.c_str());
+	if (!map_)
+		throw TdbExcept("cannot map table file %s", path.c_str());
+}
+
+TdbMapping::~TdbMapping() noexcept
+{
+	tdb_map_close(map_);
+}
@@ -35,6 +35,7 @@
 #include <unistd.h>
 
 /* Include HTrie for test. */
+#include "../core/bloom.c"
 #include "../core/htrie.c"
 
 /*
@@ -161,37 +162,187 @@ test_hash_calc_dummy(const char *data, size_t len)
 	return h;
 }
 
+static int
+test_url_cmp(const void *a, const void *b)
+{
+	const TestUrl *u1 = a, *u2 = b;
+
+	if (u1->len != u2->len)
+		return u1->len < u2->len ? -1 : 1;
+	return memcmp(u1->data, u2->data, u1->len);
+}
+
+static int
+test_hash_cmp(const void *a, const void *b)
+{
+	unsigned long h1 = *(unsigned long *)a, h2 = *(unsigned long *)b;
+
+	return h1 < h2 ? -1 : h1 > h2;
+}
+
+/**
+ * Load unique URLs, one per line, from @fname or use the built-in URLs
+ * if the file isn't specified. Returns the number of loaded URLs.
+ */
+static size_t
+hash_corpus_load(const char *fname, TestUrl **corpus)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t i, j, n = 0, cap = 0, sz = 0;
+	ssize_t len;
+	TestUrl *c = NULL;
+
+	if (!fname) {
+		for (n = 0; urls[n].data; ++n)
+			;
+		c = malloc(n * sizeof(*c));
+		assert(c);
+		memcpy(c, urls, n * sizeof(*c));
+	} else {
+		if (!(f = fopen(fname, "r")))
+			TDB_ERR("cannot open hash corpus %s\n", fname);
+		while ((len = getline(&line, &sz, f)) > 0) {
+			if (line[len - 1] == '\n')
+				line[--len] = 0;
+			if (!len)
+				continue;
+			if (n == cap) {
+				cap = cap ? cap * 2 : 4096;
+				c = realloc(c, cap * sizeof(*c));
+				assert(c);
+			}
+			c[n].data = strndup(line, len);
+			c[n++].len = len;
+		}
+		free(line);
+		fclose(f);
+	}
+
+	/* Duplicate keys aren't collisions. */
+	qsort(c, n, sizeof(*c), test_url_cmp);
+	for (i = j = 0; i < n; ++i)
+		if (!j || test_url_cmp(&c[j - 1], &c[i]))
+			c[j++] = c[i];
+
+	*corpus = c;
+	return j;
+}
+
+/**
+ * Check the hash functions against their reference vectors and check that
+ * hashing of data by chunks gives the same result as for contiguous data.
+ */
+static void
+hash_fn_test(void)
+{
+	static const unsigned long key[2] = {
+		0x0706050403020100UL, 0x0f0e0d0c0b0a0908UL
+	};
+	char data[256];
+	unsigned int fn, i;
+	size_t off, n;
+	TdbHashCtx ctx;
+
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = i;
+
+	assert(__tdb_hash(TDB_HASH_XXH64, NULL, "", 0)
+	       == 0xef46db3751d8e999UL);
+	assert(__tdb_hash(TDB_HASH_XXH64, NULL, "abc", 3)
+	       == 0x44bc2cf5ad770999UL);
+	assert(__tdb_hash(TDB_HASH_SIPHASH, key, data, 0)
+	       == 0x726fdb47dd0e0e31UL);
+	assert(__tdb_hash(TDB_HASH_SIPHASH, key, data, 15)
+	       == 0xa129ca6149be45e5UL);
+
+	for (fn = 0; fn < __TDB_HASH_NUM; ++fn)
+		for (i = 0; i < 1000; ++i) {
+			n = rand() % sizeof(data);
+			__tdb_hash_init(&ctx, fn, key);
+			for (off = 0; off < n; ) {
+				size_t len = rand() % (n - off + 1);
+
+				__tdb_hash_update(&ctx, data + off, len);
+				off += len;
+			}
+			assert(__tdb_hash_final(&ctx)
+			       == __tdb_hash(fn, key, data, n));
+		}
+}
+
 /**
- * Benchmark for SSE 4.2 and trivial C hash function.
+ * Benchmark for the table hash functions and trivial C hash function over
+ * URLs corpus from file @fname or built-in URLs. Collisions of low 16 bits,
+ * which are used by the first 4 levels of HTrie index, and of whole hashes
+ * are reported for unique URLs.
  */
 void
-hash_calc_benchmark(void)
+hash_calc_benchmark(const char *fname)
 {
-#define N 1024
-	int r __attribute__((unused)), i, acc = 0;
-	TestUrl *u;
+	static const unsigned long key[2] = { 0x1234UL, 0x5678UL };
+	int r __attribute__((unused));
+	unsigned int fn;
+	unsigned long acc = 0, *h;
+	unsigned char *bmp;
+	size_t i, l, n, loops, bytes = 0, bcolls, hcolls;
+	TestUrl *c;
 	struct timeval tv0, tv1;
 
-	r = gettimeofday(&tv0, NULL);
-	assert(!r);
-	for (i = 0; i < N; ++i)
-		for (u = urls; u->data; ++u)
-			acc += tdb_hash_calc(u->data, u->len);
-	r = gettimeofday(&tv1, NULL);
-	assert(!r);
-	printf("tdb hash: time=%lums ignore_val=%d\n",
-	       tv_to_ms(&tv1) - tv_to_ms(&tv0), acc);
+	hash_fn_test();
+
+	n = hash_corpus_load(fname, &c);
+	for (i = 0; i < n; ++i)
+		bytes += c[i].len;
+	/* Hash about 64MB for each function. */
+	loops = bytes < (1 << 26) ? (1 << 26) / (bytes + 1) + 1 : 1;
+	h = malloc(n * sizeof(*h));
+	bmp = malloc(1 << 16);
+	assert(h && bmp);
+	printf("hash corpus: urls=%lu bytes=%lu loops=%lu\n", n, bytes, loops);
+
+	for (fn = 0; fn < __TDB_HASH_NUM; ++fn) {
+		r = gettimeofday(&tv0, NULL);
+		assert(!r);
+		for (l = 0; l < loops; ++l)
+			for (i = 0; i < n; ++i)
+				acc += __tdb_hash(fn, key, c[i].data,
+						  c[i].len);
+		r = gettimeofday(&tv1, NULL);
+		assert(!r);
+
+		memset(bmp, 0, 1 << 16);
+		for (i = bcolls = 0; i < n; ++i) {
+			h[i] = __tdb_hash(fn, key, c[i].data, c[i].len);
+			bcolls += bmp[h[i] & 0xffff];
+			bmp[h[i] & 0xffff] = 1;
+		}
+		qsort(h, n, sizeof(*h), test_hash_cmp);
+		for (i = 1, hcolls = 0; i < n; ++i)
+			hcolls += h[i] == h[i - 1];
+
+		printf("%s hash: time=%lums bucket_collisions=%lu"
+		       " collisions=%lu ignore_val=%lu\n",
+		       tdb_hash_name(fn), tv_to_ms(&tv1) - tv_to_ms(&tv0),
+		       bcolls, hcolls, acc);
+	}
 
 	r = gettimeofday(&tv0, NULL);
 	assert(!r);
-	for (i = 0; i < N; ++i)
-		for (u = urls; u->data; ++u)
-			acc += test_hash_calc_dummy(u->data, u->len);
+	for (l = 0; l < loops; ++l)
+		for (i = 0; i < n; ++i)
+			acc += test_hash_calc_dummy(c[i].data, c[i].len);
 	r = gettimeofday(&tv1, NULL);
 	assert(!r);
-	printf("dummy hash: time=%lums ignore_val=%d\n",
+	printf("dummy hash: time=%lums ignore_val=%lu\n",
 	       tv_to_ms(&tv1) - tv_to_ms(&tv0), acc);
-#undef N
+
+	if (fname)
+		for (i = 0; i < n; ++i)
+			free(c[i].data);
+	free(c);
+	free(h);
+	free(bmp);
 }
 
 void *
@@ -332,6 +483,7 @@ do_varsz(TdbHdr *dbh)
 	}
 
 	lookup_varsz_records(dbh);
+	assert(!tdb_htrie_check(dbh, TDB_VSF_SZ));
 }
 
 static void *
@@ -381,6 +533,28 @@ lookup_fixsz_records(TdbHdr *dbh)
 	}
 }
 
+/**
+ * Batched lookups must resolve the same buckets as ordinary ones.
+ */
+static void
+lookup_fixsz_batch(TdbHdr *dbh)
+{
+	int i, j, n;
+	unsigned long keys[TDB_BATCH_MAX];
+	TdbBucket *bckts[TDB_BATCH_MAX];
+
+	for (i = 0; i < DATA_N; i += n) {
+		n = DATA_N - i < TDB_BATCH_MAX ? DATA_N - i : TDB_BATCH_MAX;
+		for (j = 0; j < n; ++j)
+			keys[j] = ints[i + j];
+
+		tdb_htrie_lookup_batch(dbh, keys, bckts, n);
+
+		for (j = 0; j < n; ++j)
+			assert(bckts[j] == tdb_htrie_lookup(dbh, keys[j]));
+	}
+}
+
 static void
 do_fixsz(TdbHdr *dbh)
 {
@@ -504,16 +678,673 @@ tdb_htrie_test_fixsz(const char *fname)
 		TDB_ERR("cannot initialize htrie for ints");
 
 	lookup_fixsz_records(dbh);
+	lookup_fixsz_batch(dbh);
+	assert(!tdb_htrie_check(dbh, TDB_FSF_SZ));
+
+	tdb_htrie_exit(dbh);
+	tdb_htrie_pure_close(addr, TDB_FSF_SZ, fd);
+}
+
+static int
+count_expired_f(void *data, TdbRec *rec)
+{
+	if (tdb_rec_expired(rec, get_seconds()))
+		++*(int *)data;
+	return 0;
+}
+
+static bool
+expired_eq(TdbRec *rec, void *data)
+{
+	return tdb_rec_expired(rec, get_seconds());
+}
+
+/**
+ * Expire records with even keys stored by the fixed size records test
+ * and remove them as the background collector does.
+ */
+void
+tdb_htrie_test_expire(const char *fname)
+{
+	int i, fd, n = 0, removed = 0;
+	unsigned long cursor = 0;
+	char *addr;
+	TdbHdr *dbh;
+
+	printf("\n----------- Records expiration test -------------\n");
+
+	addr = tdb_htrie_open(TDB_MAP_ADDR1, fname, TDB_FSF_SZ, &fd);
+	dbh = tdb_htrie_init(addr, TDB_FSF_SZ, sizeof(ints[0]));
+	if (!dbh)
+		TDB_ERR("cannot initialize htrie for ints");
+
+	for (i = 0; i < DATA_N; i += 2) {
+		TdbBucket *b = tdb_htrie_lookup(dbh, ints[i]);
+		TdbRec *r;
+
+		assert(b);
+		/* Zero records and repeated keys can't be found. */
+		r = tdb_htrie_bscan_for_rec(dbh, &b, ints[i]);
+		for ( ; r; r = tdb_htrie_next_rec(dbh, r, &b, ints[i]))
+			r->expires = get_seconds() - 1;
+	}
+
+	for (i = 0; i < DATA_N; ++i) {
+		TdbBucket *b = tdb_htrie_lookup(dbh, ints[i]);
+		TdbRec *r = b ? tdb_htrie_bscan_for_rec(dbh, &b, ints[i]) : NULL;
+
+		/* Even keys can be equal to odd ones. */
+		if (!(i & 1))
+			for ( ; r; r = tdb_htrie_next_rec(dbh, r, &b, ints[i]))
+				assert(!tdb_rec_expired(r, get_seconds()));
+		if ((i & 1) && r)
+			while ((r = tdb_htrie_next_rec(dbh, r, &b, ints[i])))
+				;
+	}
+
+	/* Walk the tree in small portions. */
+	while (tdb_htrie_walk_from(dbh, &cursor, count_expired_f, &n))
+		;
+	assert(!cursor);
+	for (i = 0; i < DATA_N; i += 2)
+		removed += tdb_htrie_remove(dbh, ints[i], expired_eq, NULL);
+	printf("expired records: found=%d removed=%d\n", n, removed);
+	assert(n && n == removed);
+
+	n = 0;
+	tdb_htrie_walk(dbh, count_expired_f, &n);
+	assert(!n);
 
 	tdb_htrie_exit(dbh);
 	tdb_htrie_pure_close(addr, TDB_FSF_SZ, fd);
 }
 
+#define GROW_EXT_N		4
+
+/* Count records of a table image, each record keeps its key as data. */
+static void
+count_image_rec(void *data, TdbRec *rec)
+{
+	assert(rec->key == *(unsigned long *)rec->data);
+	++*(unsigned long *)data;
+}
+
+static void
+lookup_grow_records(TdbHdr *dbh, unsigned long n)
+{
+	unsigned long k;
+
+	for (k = 1; k < n; ++k) {
+		TdbBucket *b = tdb_htrie_lookup(dbh, k);
+		TdbRec *r;
+
+		assert(b);
+		r = tdb_htrie_bscan_for_rec(dbh, &b, k);
+		assert(r && *(unsigned long *)r->data == k);
+		read_unlock_bh(&b->lock);
+	}
+}
+
+/**
+ * Fill one extent table, grow it as the kernel does it: map more file
+ * space just after the table and extend the table. All the records must
+ * be available and new records must be inserted in the new extents.
+ */
+void
+tdb_htrie_test_grow(const char *fsf)
+{
+	int fd;
+	int cpu;
+	unsigned long n, k;
+	size_t len;
+	char *addr, fname[256];
+	TdbHdr *dbh;
+	TdbHtrieStat st;
+	TdbOpStat os = { 0 };
+	static const unsigned long hash_key[2] = { 1, 2 };
+
+	printf("\n----------- Table growth test -------------\n");
+
+	snprintf(fname, sizeof(fname), "%s.grow", fsf);
+	unlink(fname);
+
+	addr = tdb_htrie_open(TDB_MAP_ADDR2, fname, TDB_EXT_SZ, &fd);
+	dbh = tdb_htrie_init(addr, TDB_EXT_SZ, sizeof(n));
+	if (!dbh)
+		TDB_ERR("cannot initialize htrie for growth test");
+	assert(!tdb_htrie_set_hash(dbh, TDB_HASH_XXH64, hash_key));
+	assert(dbh->hash == TDB_HASH_XXH64 && dbh->hash_key[1] == 2);
+
+	for (n = 1; ; ++n) {
+		len = sizeof(n);
+		if (!tdb_htrie_insert(dbh, n, &n, &len))
+			break;
+	}
+	printf("out of space after %lu records\n", n - 1);
+	lookup_grow_records(dbh, n);
+
+	if (fallocate(fd, 0, 0, TDB_EXT_SZ * GROW_EXT_N)) {
+		perror("ERROR: fallocate failure");
+		exit(1);
+	}
+	if (mmap(addr + TDB_EXT_SZ, TDB_EXT_SZ * (GROW_EXT_N - 1),
+		 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+		 TDB_EXT_SZ) != addr + TDB_EXT_SZ)
+	{
+		perror("ERROR: cannot mmap the file tail");
+		exit(1);
+	}
+	assert(tdb_htrie_grow(dbh, TDB_EXT_SZ) == -EINVAL);
+	assert(!tdb_htrie_grow(dbh, TDB_EXT_SZ * GROW_EXT_N));
+
+	for (k = n, n *= 2; k < n; ++k) {
+		len = sizeof(k);
+		assert(tdb_htrie_insert(dbh, k, &k, &len));
+	}
+	lookup_grow_records(dbh, n);
+	assert(!tdb_htrie_check(dbh, TDB_EXT_SZ * GROW_EXT_N));
+
+	/* Lockless walks used by user-space readers of table files. */
+	k = 0;
+	assert(!tdb_htrie_image_walk(dbh, TDB_EXT_SZ * GROW_EXT_N,
+				     count_image_rec, &k));
+	assert(k == n - 1);
+	k = 0;
+	assert(!tdb_htrie_image_lookup(dbh, TDB_EXT_SZ * GROW_EXT_N, n / 2,
+				       count_image_rec, &k));
+	assert(k >= 1);
+	assert(tdb_htrie_image_walk(dbh, TDB_EXT_SZ, NULL, NULL) == 1);
+
+	tdb_htrie_stat(dbh, &st);
+	assert(st.records == n - 1);
+	assert(st.rec_bytes == st.records * sizeof(n));
+	assert(st.exts == GROW_EXT_N && st.free_exts < st.exts);
+	assert(st.chains && st.buckets >= st.chains);
+	assert(st.max_chain >= 1 && st.inodes >= 1);
+	assert(!st.key_colls);
+	for (k = 0, len = 0; k < TDB_STAT_CHAIN_HIST; ++k)
+		len += st.chain_hist[k];
+	assert(len == st.chains);
+	/* Hash function can't be changed for non-empty tables. */
+	assert(tdb_htrie_set_hash(dbh, __TDB_HASH_NUM, NULL) == -EINVAL);
+	assert(!tdb_htrie_set_hash(dbh, dbh->hash, NULL));
+	assert(tdb_htrie_set_hash(dbh, (dbh->hash + 1) % __TDB_HASH_NUM,
+				  NULL) == -EBUSY);
+	for_each_possible_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
+		os.inserts += p->os.inserts;
+		os.alloc_fails += p->os.alloc_fails;
+		os.bursts += p->os.bursts;
+	}
+	assert(os.inserts == n - 1);
+	assert(os.alloc_fails >= 1 && os.bursts >= 1);
+	printf("stat: records=%lu buckets=%lu chains=%lu max_chain=%lu"
+	       " free_extents=%lu/%lu\n", st.records, st.buckets, st.chains,
+	       st.max_chain, st.free_exts, st.exts);
+
+	tdb_htrie_exit(dbh);
+	tdb_htrie_pure_close(addr, TDB_EXT_SZ * GROW_EXT_N, fd);
+	unlink(fname);
+}
+
+#define BLOOM_KEYS		40000
+#define BLOOM_LOOPS		50
+
+static unsigned long
+bloom_rand_key(void)
+{
+	return ((unsigned long)rand() << 32) ^ rand();
+}
+
+static TdbRec *
+bloom_get(TdbHdr *dbh, const TdbBloom *bf, unsigned long key)
+{
+	TdbBucket *b;
+
+	if (bf && !tdb_bloom_test(bf, key))
+		return NULL;
+
+	b = tdb_htrie_lookup(dbh, key);
+	return b ? tdb_htrie_bscan_for_rec(dbh, &b, key) : NULL;
+}
+
+static unsigned long
+bloom_lookup_benchmark(TdbHdr *dbh, const TdbBloom *bf,
+		       const unsigned long *keys)
+{
+	int i, l;
+	struct timeval tv0, tv1;
+
+	gettimeofday(&tv0, NULL);
+	for (l = 0; l < BLOOM_LOOPS; ++l)
+		for (i = 0; i < BLOOM_KEYS; ++i)
+			assert(!bloom_get(dbh, bf, keys[i]));
+	gettimeofday(&tv1, NULL);
+
+	return tv_to_ms(&tv1) - tv_to_ms(&tv0);
+}
+
+/**
+ * Negative lookup filter must not reject stored keys, must reject most of
+ * missing and removed keys and must make lookups of missing keys faster.
+ */
+void
+tdb_htrie_test_bloom(const char *fsf)
+{
+	int i, fd, fp;
+	unsigned long *in, *out, t0, t1;
+	size_t len;
+	char *addr, fname[256];
+	TdbHdr *dbh;
+	TdbBloom *bf;
+
+	printf("\n----------- Negative lookup filter test -------------\n");
+
+	snprintf(fname, sizeof(fname), "%s.bloom", fsf);
+	unlink(fname);
+
+	addr = tdb_htrie_open(TDB_MAP_ADDR2, fname, TDB_FSF_SZ, &fd);
+	dbh = tdb_htrie_init(addr, TDB_FSF_SZ, sizeof(unsigned long));
+	if (!dbh)
+		TDB_ERR("cannot initialize htrie for filter test");
+	bf = tdb_bloom_alloc(BLOOM_KEYS, 0);
+	in = malloc(BLOOM_KEYS * sizeof(*in));
+	out = malloc(BLOOM_KEYS * sizeof(*out));
+	assert(bf && in && out);
+
+	/* Random 62-bit keys, so missing keys can't be equal to stored ones. */
+	for (i = 0; i < BLOOM_KEYS; ++i) {
+		in[i] = bloom_rand_key();
+		out[i] = bloom_rand_key();
+		len = sizeof(in[i]);
+		tdb_bloom_add(bf, in[i]);
+		assert(tdb_htrie_insert(dbh, in[i], &in[i], &len));
+	}
+	/* The filter doesn't filter lookups until it's populated. */
+	assert(tdb_bloom_test(bf, bloom_rand_key()));
+	tdb_bloom_populated(bf);
+
+	for (i = 0, fp = 0; i < BLOOM_KEYS; ++i) {
+		assert(tdb_bloom_test(bf, in[i]));
+		fp += tdb_bloom_test(bf, out[i]);
+	}
+	printf("false positives: %d of %d\n", fp, BLOOM_KEYS);
+	assert(fp < BLOOM_KEYS / 20);
+
+	t0 = bloom_lookup_benchmark(dbh, NULL, out);
+	t1 = bloom_lookup_benchmark(dbh, bf, out);
+	printf("missing keys lookup: htrie=%lums filter=%lums\n", t0, t1);
+
+	/* Remove a half of the keys. */
+	for (i = 0; i < BLOOM_KEYS; i += 2)
+		tdb_bloom_del(bf, in[i], tdb_htrie_remove(dbh, in[i], NULL,
+							  NULL));
+	for (i = 0, fp = 0; i < BLOOM_KEYS; ++i) {
+		if (i & 1)
+			assert(tdb_bloom_test(bf, in[i]));
+		else
+			fp += tdb_bloom_test(bf, in[i]);
+	}
+	printf("false positives for removed keys: %d of %d\n",
+	       fp, BLOOM_KEYS / 2);
+	assert(fp < BLOOM_KEYS / 40);
+
+	free(in);
+	free(out);
+	tdb_bloom_free(bf);
+	tdb_htrie_exit(dbh);
+	tdb_htrie_pure_close(addr, TDB_FSF_SZ, fd);
+	unlink(fname);
+}
+
+#define TRX_GRP_N		64
+#define TRX_GRP_SZ		4
+#define TRX_BALANCE		1000
+#define TRX_LOOP_N		20000
+
+typedef struct {
+	TdbHdr		*dbh;
+	unsigned int	seed;
+	unsigned long	commits;
+	unsigned long	aborts;
+} TrxThrData;
+
+static volatile int trx_done;
+
+static unsigned long
+trx_key(int g, int a)
+{
+	return (g * TRX_GRP_SZ + a + 1) * 0x9e3779b97f4a7c15UL;
+}
+
+/**
+ * Read balance of account @key to @v. Returns false if the record isn't
+ * found, e.g. because its bucket was just burst.
+ */
+static bool
+trx_balance(TdbHdr *dbh, unsigned long key, unsigned long *v)
+{
+	TdbBucket *b = tdb_htrie_lookup(dbh, key);
+	TdbRec *r;
+
+	if (!b || !(r = tdb_htrie_bscan_for_rec(dbh, &b, key)))
+		return false;
+	*v = *(unsigned long *)((TdbFRec *)r)->data;
+	read_unlock_bh(&b->lock);
+
+	return true;
+}
+
+/**
+ * Move up to @x from account @from to account @to of group @g by replacing
+ * both the records.
+ */
+static int
+trx_transfer(TdbHdr *dbh, int g, int from, int to, unsigned long x)
+{
+	TdbTrx trx;
+	unsigned long kf = trx_key(g, from), kt = trx_key(g, to), bf, bt;
+
+	tdb_trx_begin(NULL, &trx);
+	assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_REMOVE, kf, NULL, 0,
+				  NULL));
+	assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_REMOVE, kt, NULL, 0,
+				  NULL));
+	if (!trx_balance(dbh, kf, &bf) || !trx_balance(dbh, kt, &bt))
+		return -EAGAIN;
+
+	x = x < bf ? x : bf;
+	bf -= x;
+	bt += x;
+	assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_INSERT, kf, &bf,
+				  sizeof(bf), NULL));
+	assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_INSERT, kt, &bt,
+				  sizeof(bt), NULL));
+
+	return tdb_htrie_trx_commit(dbh, &trx);
+}
+
+static void *
+trx_thr_f(void *data)
+{
+	int i, g, from, to, r;
+	TrxThrData *d = data;
+
+	for (i = 0; i < TRX_LOOP_N; ++i) {
+		g = rand_r(&d->seed) % TRX_GRP_N;
+		from = rand_r(&d->seed) % TRX_GRP_SZ;
+		to = (from + 1 + rand_r(&d->seed) % (TRX_GRP_SZ - 1))
+		     % TRX_GRP_SZ;
+		while ((r = trx_transfer(d->dbh, g, from, to,
+					 rand_r(&d->seed) % TRX_BALANCE)))
+		{
+			assert(r == -EAGAIN);
+			++d->aborts;
+		}
+		++d->commits;
+	}
+
+	return NULL;
+}
+
+/**
+ * Read-only transactions see consistent groups of accounts.
+ */
+static void *
+trx_check_thr_f(void *data)
+{
+	int a, g;
+	TdbTrx trx;
+	unsigned long v, sum;
+	TrxThrData *d = data;
+
+	while (!trx_done) {
+		g = rand_r(&d->seed) % TRX_GRP_N;
+		tdb_trx_begin(NULL, &trx);
+		for (a = 0, sum = 0; a < TRX_GRP_SZ; ++a) {
+			assert(!tdb_htrie_trx_add(d->dbh, &trx, TDB_TRX_READ,
+						  trx_key(g, a), NULL, 0,
+						  NULL));
+			if (!trx_balance(d->dbh, trx_key(g, a), &v))
+				break;
+			sum += v;
+		}
+		if (a == TRX_GRP_SZ && !tdb_htrie_trx_commit(d->dbh, &trx)) {
+			assert(sum == TRX_GRP_SZ * TRX_BALANCE);
+			++d->commits;
+		} else {
+			++d->aborts;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Concurrent transfers between accounts stored as records of a table.
+ */
+void
+tdb_htrie_test_trx(const char *fsf)
+{
+	int g, a, t, fd;
+	char *addr, fname[256];
+	unsigned long k, v, sum;
+	size_t len;
+	TdbHdr *dbh;
+	TdbTrx trx;
+	TdbRec *r;
+	TdbBucket *b;
+	TrxThrData d[THR_N + 1] = {{ 0 }};
+	pthread_t thr[THR_N + 1];
+
+	printf("\n----------- Transactions test -------------\n");
+
+	snprintf(fname, sizeof(fname), "%s.trx", fsf);
+	unlink(fname);
+
+	addr = tdb_htrie_open(TDB_MAP_ADDR2, fname, TDB_FSF_SZ, &fd);
+	dbh = tdb_htrie_init(addr, TDB_FSF_SZ, sizeof(unsigned long));
+	if (!dbh)
+		TDB_ERR("cannot initialize htrie for transactions test");
+
+	v = TRX_BALANCE;
+	for (g = 0; g < TRX_GRP_N; ++g) {
+		do {
+			tdb_trx_begin(NULL, &trx);
+			for (a = 0; a < TRX_GRP_SZ; ++a)
+				assert(!tdb_htrie_trx_add(dbh, &trx,
+							  TDB_TRX_INSERT,
+							  trx_key(g, a), &v,
+							  sizeof(v), NULL));
+		} while (tdb_htrie_trx_commit(dbh, &trx) == -EAGAIN);
+	}
+
+	/* Concurrent change of read records aborts a transaction. */
+	k = trx_key(0, 0);
+	tdb_trx_begin(NULL, &trx);
+	assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_READ, k, NULL, 0, NULL));
+	assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_REMOVE, k, NULL, 0,
+				  NULL));
+	len = sizeof(v);
+	assert(tdb_htrie_insert(dbh, k, &v, &len));
+	assert(tdb_htrie_trx_commit(dbh, &trx) == -EAGAIN);
+	assert(tdb_htrie_remove(dbh, k, NULL, NULL) == 2);
+	len = sizeof(v);
+	assert(tdb_htrie_insert(dbh, k, &v, &len));
+	for (a = trx.n; a < TDB_TRX_MAX; ++a)
+		assert(!tdb_htrie_trx_add(dbh, &trx, TDB_TRX_READ, k, NULL, 0,
+					  NULL));
+	assert(tdb_htrie_trx_add(dbh, &trx, TDB_TRX_READ, k, NULL, 0, NULL)
+	       == -EINVAL);
+
+	trx_done = 0;
+	for (t = 0; t <= THR_N; ++t) {
+		d[t].dbh = dbh;
+		d[t].seed = t;
+		if (spawn_thread(thr + t, t < THR_N ? trx_thr_f
+						    : trx_check_thr_f, &d[t]))
+			perror("cannot spawn transactions thread");
+	}
+	for (t = 0; t < THR_N; ++t)
+		pthread_join(thr[t], NULL);
+	trx_done = 1;
+	pthread_join(thr[THR_N], NULL);
+
+	for (t = 0, k = v = 0; t < THR_N; ++t) {
+		assert(d[t].commits == TRX_LOOP_N);
+		k += d[t].aborts;
+	}
+	printf("transfers: commits=%d aborts=%lu, checks: commits=%lu"
+	       " aborts=%lu\n", THR_N * TRX_LOOP_N, k, d[THR_N].commits,
+	       d[THR_N].aborts);
+	assert(d[THR_N].commits);
+
+	/* Each account has exactly one record and money isn't lost. */
+	for (g = 0, sum = 0; g < TRX_GRP_N; ++g)
+		for (a = 0; a < TRX_GRP_SZ; ++a) {
+			k = trx_key(g, a);
+			b = tdb_htrie_lookup(dbh, k);
+			assert(b);
+			r = tdb_htrie_bscan_for_rec(dbh, &b, k);
+			assert(r);
+			sum += *(unsigned long *)((TdbFRec *)r)->data;
+			assert(!tdb_htrie_next_rec(dbh, r, &b, k));
+		}
+	assert(sum == TRX_GRP_N * TRX_GRP_SZ * TRX_BALANCE);
+	assert(!tdb_htrie_check(dbh, TDB_FSF_SZ));
+
+	tdb_htrie_exit(dbh);
+	tdb_htrie_pure_close(addr, TDB_FSF_SZ, fd);
+	unlink(fname);
+}
+
+#define CMP_REC_N		4
+#define CMP_CHUNK_N		4
+#define CMP_CHUNK_SZ		1000
+#define CMP_FILL_SZ		4000
+#define CMP_DB_SZ		(TDB_EXT_SZ * 16)
+
+static TdbVRec *
+cmp_get_rec(TdbHdr *dbh, unsigned long key)
+{
+	TdbBucket *b = tdb_htrie_lookup(dbh, key);
+	TdbRec *r;
+
+	assert(b);
+	r = tdb_htrie_bscan_for_rec(dbh, &b, key);
+	assert(r);
+	read_unlock_bh(&b->lock);
+
+	return (TdbVRec *)r;
+}
+
+static bool
+cmp_movable(TdbRec *rec)
+{
+	return true;
+}
+
+/* Head chunk of each record keeps offset of its second chunk data. */
+static void
+cmp_moved(TdbRec *rec, unsigned long from, unsigned long to, size_t len)
+{
+	unsigned long *off = (unsigned long *)((TdbVRec *)rec)->data;
+
+	if (*off >= from && *off <= from + len)
+		*off += to - from;
+}
+
+static const TdbRelocOps cmp_ops = {
+	.movable	= cmp_movable,
+	.moved		= cmp_moved,
+};
+
+/**
+ * Scatter chunks of several records over different extents by inserting
+ * other records between the records extensions, move the chunks by the
+ * compactor and check that the records data and stored offsets are valid.
+ */
+void
+tdb_htrie_test_compact(const char *vsf)
+{
+	int fd, i, j, f = 0;
+	size_t len;
+	char *addr, fname[256], fill[CMP_FILL_SZ] = { 0 };
+	TdbHdr *dbh;
+
+	printf("\n----------- Records compaction test -------------\n");
+
+	snprintf(fname, sizeof(fname), "%s.compact", vsf);
+	unlink(fname);
+
+	addr = tdb_htrie_open(TDB_MAP_ADDR2, fname, CMP_DB_SZ, &fd);
+	dbh = tdb_htrie_init(addr, CMP_DB_SZ, 0);
+	if (!dbh)
+		TDB_ERR("cannot initialize htrie for compaction test");
+
+	for (i = 1; i <= CMP_REC_N; ++i) {
+		len = TDB_HTRIE_MINDREC * 2;
+		assert(tdb_htrie_insert(dbh, i, fill, &len));
+	}
+	for (j = 0; j < CMP_CHUNK_N; ++j) {
+		for (i = 1; i <= CMP_REC_N; ++i) {
+			TdbVRec *r = cmp_get_rec(dbh, i), *c;
+
+			c = tdb_htrie_extend_rec(dbh, r, CMP_CHUNK_SZ);
+			assert(c && c->len == CMP_CHUNK_SZ);
+			memset(c->data, i * CMP_CHUNK_N + j, CMP_CHUNK_SZ);
+			if (j == 1)
+				*(unsigned long *)r->data
+					= TDB_HTRIE_OFF(dbh, c->data + 10);
+		}
+		/* Move the allocator to the next extent. */
+		for (len = 0; len < TDB_EXT_SZ; len += CMP_FILL_SZ) {
+			size_t n = CMP_FILL_SZ;
+			assert(tdb_htrie_insert(dbh, 1000 + f++, fill, &n));
+		}
+	}
+
+	for (i = 1; i <= CMP_REC_N; ++i) {
+		TdbVRec *r = cmp_get_rec(dbh, i);
+		unsigned long off;
+
+		assert(tdb_htrie_vrec_fragmented(dbh, r)
+		       == CMP_CHUNK_N * CMP_CHUNK_SZ);
+		assert(!tdb_htrie_compact(dbh, i, CMP_CHUNK_SZ, &cmp_ops));
+		assert(tdb_htrie_compact(dbh, i, ~0UL, &cmp_ops)
+		       == CMP_CHUNK_N * CMP_CHUNK_SZ);
+		assert(!tdb_htrie_vrec_fragmented(dbh, r));
+
+		for (j = 0; r->chunk_next; ++j) {
+			r = TDB_PTR(dbh, TDB_DI2O(r->chunk_next));
+			assert(r->len == CMP_CHUNK_SZ);
+			assert(r->data[0] == i * CMP_CHUNK_N + j
+			       && r->data[CMP_CHUNK_SZ - 1] == r->data[0]);
+			if (j == 1) {
+				off = *(unsigned long *)cmp_get_rec(dbh, i)->data;
+				assert(TDB_PTR(dbh, off) == r->data + 10);
+			}
+		}
+		assert(j == CMP_CHUNK_N);
+	}
+	printf("moved %d records\n", CMP_REC_N);
+	assert(!tdb_htrie_check(dbh, CMP_DB_SZ));
+
+	tdb_htrie_exit(dbh);
+	tdb_htrie_pure_close(addr, CMP_DB_SZ, fd);
+	unlink(fname);
+}
+
 static void
 tdb_htrie_test(const char *vsf, const char *fsf)
 {
 	tdb_htrie_test_varsz(vsf);
 	tdb_htrie_test_fixsz(fsf);
+	tdb_htrie_test_expire(fsf);
+	tdb_htrie_test_grow(fsf);
+	tdb_htrie_test_bloom(fsf);
+	tdb_htrie_test_trx(fsf);
+	tdb_htrie_test_compact(vsf);
 }
 
 static void
@@ -569,9 +1400,11 @@ main(int argc, char *argv[])
 	struct rlimit rlim = { TDB_VSF_SZ, TDB_VSF_SZ * 2};
 	
 	if (argc < 3) {
-		printf("\nUsage: %s <vsf> <fsf>\n"
+		printf("\nUsage: %s <vsf> <fsf> [urls]\n"
 		       "  vsf    - file name for variable-size records test\n"
-		       "  fsf    - file name for fixed-size records test\n\n",
+		       "  fsf    - file name for fixed-size records test\n"
+		       "  urls   - URLs corpus for hash benchmark, one per"
+		       " line\n\n",
 		       argv[0]);
 		return 1;
 	}
@@ -596,7 +1429,7 @@ main(int argc, char *argv[])
 	       THR_N, DATA_N, LOOP_N);
 
 	init_test_data_for_hash();
-	hash_calc_benchmark();
+	hash_calc_benchmark(argc > 3 ? argv[3] : NULL);
 
 	init_test_data_for_htrie();
 	tdb_htrie_test(argv[1], argv[2]);
@@ -0,0 +1,100 @@
+/**
+ *		Tempesta DB Query Tool
+ *
+ * Offline table consistency check. The table file must not be used by the
+ * kernel at the moment. The same checker is used by the kernel on loading of
+ * a table which wasn't completely synced to disk.
+ *
+ * Copyright (C) 2016 Tempesta Technologies.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Use the kernel HTrie code with user-space shims. */
+#include "../core/htrie.c"
+
+#include "fsck.h"
+
+static const char *tdb_states[] = {
+	[TDB_ST_CLEAN]	= "clean",
+	[TDB_ST_OPEN]	= "open",
+	[TDB_ST_SYNC]	= "sync",
+};
+
+/**
+ * HTrie requires extent-aligned address, so reserve an extent more than
+ * the table size and map the table at the first extent boundary.
+ *
+ * @return number of found errors or negative value if the table can't be
+ * checked at all.
+ */
+long
+tdb_fsck(const char *path)
+{
+	int fd;
+	long r = -1;
+	struct stat sb;
+	const char *st;
+	char *area;
+	TdbHdr *dbh;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		perror("cannot open table file");
+		return -1;
+	}
+	if (fstat(fd, &sb) < 0) {
+		perror("cannot stat table file");
+		goto err;
+	}
+	if (!sb.st_size || sb.st_size % TDB_EXT_SZ) {
+		fprintf(stderr, "bad table file size %lu\n", sb.st_size);
+		goto err;
+	}
+
+	area = mmap(NULL, sb.st_size + TDB_EXT_SZ, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED) {
+		perror("cannot reserve address space");
+		goto err;
+	}
+	dbh = mmap((void *)TDB_EXT_O(area + TDB_EXT_SZ - 1), sb.st_size,
+		   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+	if (dbh == MAP_FAILED) {
+		perror("cannot map table file");
+		goto err_map;
+	}
+
+	st = dbh->state < sizeof(tdb_states) / sizeof(*tdb_states)
+	     ? tdb_states[dbh->state] : "bad";
+	printf("table %s: size=%lu rec_len=%u hash=%s state=%s\n", path,
+	       sb.st_size, dbh->rec_len, tdb_hash_name(dbh->hash), st);
+
+	r = tdb_htrie_check(dbh, sb.st_size);
+	if (r < 0)
+		fprintf(stderr, "%s isn't a table file\n", path);
+err_map:
+	munmap(area, sb.st_size + TDB_EXT_SZ);
+err:
+	close(fd);
+	return r;
+}
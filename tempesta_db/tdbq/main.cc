@@ -17,32 +17,71 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <limits.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <random>
 #include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <boost/program_options.hpp>
 
 #include <libtdb.h>
 
+#include "fsck.h"
+
 enum {
 	ACT_INFO,
 	ACT_OPEN,
 	ACT_CLOSE,
 	ACT_INSERT,
 	ACT_SELECT,
+	ACT_IMPORT,
+	ACT_EXPORT,
+	ACT_BENCH,
+	ACT_FSCK,
+	ACT_RESIZE,
+	ACT_INDEX,
+	ACT_REPLICATE,
+	ACT_RECEIVE,
+};
+
+// Formats of import and export files.
+enum {
+	FMT_CSV,
+	FMT_TSV,
+	FMT_BIN,
 };
 
 namespace po = boost::program_options;
 
 struct Cfg {
 	int		action;
+	int		fmt;
 	unsigned int	rec_sz;
+	unsigned int	threads;
+	unsigned int	ins_pct;
+	unsigned int	plen;
+	unsigned int	hash;
 	size_t		tbl_sz;
 	size_t		mm_sz;
+	size_t		ops;
+	size_t		keys;
+	size_t		vlen;
 	std::string	db_path;
 	std::string	table;
 	std::string	key;
 	std::string	val;
+	std::string	file;
+	std::string	tbl_file;
+	std::string	index;
 
 	Cfg &
 	operator=(po::variables_map &&vm)
@@ -64,6 +103,39 @@ struct Cfg {
 					sizeof(TdbMsgRec) + 2);
 		}
 		mm_sz = vm["mmap"].as<size_t>();
+		file = std::move(vm["file"].as<std::string>());
+		if (vm.count("tbl_file"))
+			tbl_file = std::move(vm["tbl_file"].as<std::string>());
+		if (vm.count("index"))
+			index = std::move(vm["index"].as<std::string>());
+		plen = vm["prefix"].as<unsigned int>();
+		threads = vm["threads"].as<unsigned int>();
+		ops = vm["ops"].as<size_t>();
+		keys = vm["keys"].as<size_t>();
+		vlen = vm["vlen"].as<size_t>();
+		ins_pct = vm["insert_pct"].as<unsigned int>();
+
+		std::string h = std::move(vm["hash"].as<std::string>());
+		if (h == "crc32c") {
+			hash = TDB_HASH_CRC32C;
+		} else if (h == "xxh64") {
+			hash = TDB_HASH_XXH64;
+		} else if (h == "siphash") {
+			hash = TDB_HASH_SIPHASH;
+		} else {
+			throw TdbExcept("bad hash function: %s", h.c_str());
+		}
+
+		std::string f = std::move(vm["format"].as<std::string>());
+		if (f == "csv") {
+			fmt = FMT_CSV;
+		} else if (f == "tsv") {
+			fmt = FMT_TSV;
+		} else if (f == "bin") {
+			fmt = FMT_BIN;
+		} else {
+			throw TdbExcept("bad file format: %s", f.c_str());
+		}
 
 		if (!vm.count("action"))
 			throw TdbExcept("please specify an action to do");
@@ -78,6 +150,22 @@ struct Cfg {
 			action = ACT_INSERT;
 		} else if (a == "select") {
 			action = ACT_SELECT;
+		} else if (a == "import") {
+			action = ACT_IMPORT;
+		} else if (a == "export") {
+			action = ACT_EXPORT;
+		} else if (a == "bench") {
+			action = ACT_BENCH;
+		} else if (a == "fsck") {
+			action = ACT_FSCK;
+		} else if (a == "resize") {
+			action = ACT_RESIZE;
+		} else if (a == "index") {
+			action = ACT_INDEX;
+		} else if (a == "replicate") {
+			action = ACT_REPLICATE;
+		} else if (a == "receive") {
+			action = ACT_RECEIVE;
 		} else {
 			throw TdbExcept("bad action: %s", a.c_str());
 		}
@@ -91,11 +179,39 @@ struct Cfg {
 					" inserted item");
 		if (action == ACT_INSERT && key == "*")
 			throw TdbExcept("please specify exact key");
-		if (table == "*" && action != ACT_INFO)
+		if (action == ACT_INDEX && (index.empty() || !plen))
+			throw TdbExcept("please specify index name and key"
+					" prefix length");
+		if (!index.empty() && action != ACT_INDEX
+		    && action != ACT_SELECT)
+			throw TdbExcept("only select can use an index");
+		if (action == ACT_REPLICATE && hash == TDB_HASH_SIPHASH)
+			throw TdbExcept("tables with keyed hash can't be"
+					" replicated");
+		if (!index.empty() && action == ACT_SELECT && key.empty())
+			throw TdbExcept("please specify key prefix to select"
+					" by index");
+		if (!index.empty() && !tbl_file.empty())
+			throw TdbExcept("table files can't be selected by"
+					" index");
+		if (!tbl_file.empty() && action != ACT_SELECT
+		    && action != ACT_EXPORT)
+			throw TdbExcept("only select and export can read"
+					" table files directly");
+		if (table == "*" && action != ACT_INFO && action != ACT_FSCK
+		    && tbl_file.empty())
 			throw TdbExcept("please specify a table");
+		if (action == ACT_FSCK && file == "-")
+			throw TdbExcept("please specify table file to check");
 		if (action == ACT_OPEN && db_path.empty())
 			throw TdbExcept("please specify database path");
 
+		if (action == ACT_BENCH && (!threads || !ops || !keys))
+			throw TdbExcept("please specify non-zero number of"
+					" threads, operations and keys");
+		if (ins_pct > 100)
+			throw TdbExcept("insert percentage must be in 0-100");
+
 		if (mm_sz % 2)
 			throw TdbExcept("mmap size must be multiple of 2");
 		if (mm_sz > UINT_MAX)
@@ -104,6 +220,516 @@ struct Cfg {
 	}
 };
 
+/*
+ * Keys and values of text formats are escaped, so any records can be
+ * exported and imported back. TSV uses backslash escapes for backslash,
+ * TAB, CR and LF as PostgreSQL text COPY format does. CSV fields containing
+ * the separator, double quotes, CR or LF are quoted as RFC 4180 defines.
+ */
+static void
+write_field(std::ostream &os, int fmt, const char *s, size_t len)
+{
+	if (fmt == FMT_TSV) {
+		for (size_t i = 0; i < len; ++i)
+			switch (s[i]) {
+			case '\\':
+				os << "\\\\";
+				break;
+			case '\t':
+				os << "\\t";
+				break;
+			case '\n':
+				os << "\\n";
+				break;
+			case '\r':
+				os << "\\r";
+				break;
+			default:
+				os.put(s[i]);
+			}
+		return;
+	}
+
+	if (std::find_if(s, s + len, [](char c) {
+			return c == ',' || c == '"' || c == '\r' || c == '\n';
+		}) == s + len)
+	{
+		os.write(s, len);
+		return;
+	}
+	os << '"';
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] == '"')
+			os << '"';
+		os.put(s[i]);
+	}
+	os << '"';
+}
+
+/**
+ * Read a field of text format @fmt terminated by @sep, LF or end of input.
+ * The separator is a part of the field if @sep is zero.
+ * @return the terminating character or EOF.
+ */
+static int
+read_field(std::istream &is, int fmt, char sep, std::string &f)
+{
+	int c;
+
+	f.clear();
+	if (fmt == FMT_CSV && is.peek() == '"') {
+		is.get();
+		while (1) {
+			if ((c = is.get()) == EOF)
+				throw TdbExcept("unterminated quoted field");
+			if (c == '"' && (c = is.get()) != '"')
+				break;
+			f += (char)c;
+		}
+		if (c != EOF && c != '\n' && c != sep)
+			throw TdbExcept("garbage after quoted field '%s'",
+					f.c_str());
+		return c;
+	}
+
+	while ((c = is.get()) != EOF && c != '\n' && (!sep || c != sep)) {
+		if (fmt == FMT_TSV && c == '\\') {
+			switch (c = is.get()) {
+			case '\\':
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'n':
+				c = '\n';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			default:
+				throw TdbExcept("bad escape sequence in '%s'",
+						f.c_str());
+			}
+		}
+		f += (char)c;
+	}
+	return c;
+}
+
+/**
+ * Read next record from @is in format @fmt.
+ * @return false on end of input.
+ */
+static bool
+read_rec(std::istream &is, int fmt, std::string &key, std::string &val)
+{
+	if (fmt == FMT_BIN) {
+		uint32_t len[2];
+
+		if (!is.read((char *)len, sizeof(len)))
+			return false;
+		key.resize(len[0]);
+		val.resize(len[1]);
+		if (!is.read(&key[0], len[0]) || !is.read(&val[0], len[1]))
+			throw TdbExcept("truncated binary record");
+		return true;
+	}
+
+	char sep = fmt == FMT_CSV ? ',' : '\t';
+
+	// Skip empty lines.
+	while (is.peek() == '\n')
+		is.get();
+	if (is.peek() == EOF)
+		return false;
+
+	if (read_field(is, fmt, sep, key) != sep || key.empty())
+		throw TdbExcept("malformed record with key '%s'", key.c_str());
+	// Unescaped separators are allowed in the value.
+	read_field(is, fmt, 0, val);
+
+	return true;
+}
+
+static void
+write_rec(std::ostream &os, int fmt, const char *key, size_t klen,
+	  const char *val, size_t vlen)
+{
+	if (fmt == FMT_BIN) {
+		uint32_t len[2] = { (uint32_t)klen, (uint32_t)vlen };
+		os.write((char *)len, sizeof(len));
+		os.write(key, klen);
+		os.write(val, vlen);
+	} else {
+		write_field(os, fmt, key, klen);
+		os << (fmt == FMT_CSV ? ',' : '\t');
+		write_field(os, fmt, val, vlen);
+		os << '\n';
+	}
+}
+
+static size_t
+do_import(TdbHndl &th, Cfg &cfg)
+{
+	size_t n = 0;
+	std::string key, val;
+	std::ifstream ifs;
+	std::istream *is = &std::cin;
+
+	if (cfg.file != "-") {
+		ifs.open(cfg.file, std::ios::binary);
+		if (!ifs)
+			throw TdbExcept("cannot open %s", cfg.file.c_str());
+		is = &ifs;
+	}
+
+	// Pack as many records as possible to each netlink frame.
+	th.trx_begin();
+	while (read_rec(*is, cfg.fmt, key, val)) {
+		th.insert(cfg.table, key.length(), val.length(),
+			  [&](char *k, char *v) {
+				key.copy(k, key.length());
+				val.copy(v, val.length());
+			  });
+		++n;
+	}
+	if (!n)
+		throw TdbExcept("no records to import");
+	th.trx_commit();
+
+	return n;
+}
+
+typedef std::function<void (char *, size_t, char *, size_t)> RecCb;
+
+static void
+print_rec(char *key, size_t klen, char *val, size_t vlen)
+{
+	std::cout << "'";
+	std::cout.write(key, klen);
+	std::cout << "' -> '";
+	std::cout.write(val, vlen);
+	std::cout << "'" << std::endl;
+}
+
+/**
+ * Write all records passed by @scan to the output file.
+ */
+static size_t
+do_export(Cfg &cfg, std::function<void (RecCb)> scan)
+{
+	size_t n = 0;
+	std::ofstream ofs;
+	std::ostream *os = &std::cout;
+
+	if (cfg.file != "-") {
+		ofs.open(cfg.file, std::ios::binary | std::ios::trunc);
+		if (!ofs)
+			throw TdbExcept("cannot open %s", cfg.file.c_str());
+		os = &ofs;
+	}
+
+	scan([&](char *key, size_t klen, char *val, size_t vlen) {
+		write_rec(*os, cfg.fmt, key, klen, val, vlen);
+		++n;
+	});
+
+	os->flush();
+	if (!*os)
+		throw TdbExcept("cannot write %s", cfg.file.c_str());
+
+	return n;
+}
+
+/**
+ * Benchmark thread: runs @ops insert or select operations in proportion
+ * of @cfg.ins_pct using its own netlink connection and stores latency of
+ * each operation in nanoseconds.
+ */
+static void
+bench_thr(Cfg &cfg, size_t ops, unsigned int id, std::vector<uint64_t> &lat,
+	  size_t &errors)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	std::mt19937_64 rng(id);
+	std::uniform_int_distribution<size_t> kdist(0, cfg.keys - 1);
+	std::uniform_int_distribution<unsigned int> odist(0, 99);
+	std::string key, val(cfg.vlen, 'v');
+	auto place = [&](char *k, char *v) {
+		key.copy(k, key.length());
+		val.copy(v, val.length());
+	};
+	auto skip = [](char *, size_t, char *, size_t) {};
+
+	lat.reserve(ops);
+	errors = 0;
+
+	try {
+		TdbHndl th(cfg.mm_sz);
+
+		for (size_t i = 0; i < ops; ++i) {
+			bool ins = odist(rng) < cfg.ins_pct;
+			key = "key" + std::to_string(kdist(rng));
+
+			auto t0 = Clock::now();
+			try {
+				if (ins)
+					th.insert(cfg.table, key.length(),
+						  val.length(), place);
+				else
+					th.query(cfg.table, key, skip);
+			}
+			catch (TdbExcept &e) {
+				if (!errors++)
+					std::cerr << "thread " << id << ": "
+						  << e.what() << std::endl;
+			}
+			auto t1 = Clock::now();
+
+			lat.push_back(std::chrono::duration_cast<
+					std::chrono::nanoseconds>(t1 - t0)
+					.count());
+		}
+	}
+	catch (TdbExcept &e) {
+		std::cerr << "thread " << id << ": " << e.what() << std::endl;
+		errors = ops;
+	}
+}
+
+static void
+do_bench(Cfg &cfg)
+{
+	typedef std::chrono::steady_clock Clock;
+	static const double pcnts[] = { 50, 90, 99, 99.9, 100 };
+
+	std::vector<std::thread> thr;
+	std::vector<std::vector<uint64_t>> lat(cfg.threads);
+	std::vector<size_t> errors(cfg.threads);
+	size_t err_n = 0;
+
+	auto t0 = Clock::now();
+	for (unsigned int t = 0; t < cfg.threads; ++t) {
+		size_t ops = cfg.ops / cfg.threads
+			     + (t < cfg.ops % cfg.threads);
+		thr.emplace_back(bench_thr, std::ref(cfg), ops, t,
+				 std::ref(lat[t]), std::ref(errors[t]));
+	}
+	for (auto &t : thr)
+		t.join();
+	auto t1 = Clock::now();
+
+	std::vector<uint64_t> all;
+	for (unsigned int t = 0; t < cfg.threads; ++t) {
+		all.insert(all.end(), lat[t].begin(), lat[t].end());
+		err_n += errors[t];
+	}
+	if (all.empty())
+		throw TdbExcept("no operations were done");
+	std::sort(all.begin(), all.end());
+
+	double sec = std::chrono::duration<double>(t1 - t0).count();
+	std::cout << "bench: threads=" << cfg.threads
+		  << " ops=" << all.size()
+		  << " insert=" << cfg.ins_pct << "%"
+		  << " keys=" << cfg.keys
+		  << " vlen=" << cfg.vlen
+		  << " errors=" << err_n << std::endl
+		  << "throughput: " << std::fixed << std::setprecision(0)
+		  << all.size() / sec << " ops/s (" << std::setprecision(3)
+		  << sec << "s)" << std::endl
+		  << "latency (us):";
+	for (auto p : pcnts) {
+		size_t i = std::min(all.size() - 1,
+				    (size_t)(all.size() * p / 100));
+		std::cout << " p" << p << "=" << std::setprecision(1)
+			  << all[i] / 1000.0;
+	}
+	std::cout << std::endl;
+}
+
+// Interval between table changes requests in replication.
+static const unsigned int REPL_INTERVAL_MS = 100;
+
+/**
+ * Write a copy of the table and then its changes to the output file in binary
+ * format. A record with empty key and the key hash as the value stands for
+ * removal of all records with the key, a record with empty key and value
+ * ends a consistent batch of changes. Records with equal keys are always
+ * written after their removal record, so the receiver replaces all records
+ * with the key at once. If the changes are lost because the replicator is too
+ * slow, then the table is copied again.
+ *
+ * The function runs until the output is closed.
+ */
+static void
+do_replicate(TdbHndl &th, Cfg &cfg)
+{
+	std::ofstream ofs;
+	std::ostream *os = &std::cout;
+	unsigned long seq = TDB_REPL_START;
+	auto out = [&](char *key, size_t klen, char *val, size_t vlen) {
+		write_rec(*os, FMT_BIN, key, klen, val, vlen);
+	};
+	auto end_batch = [&]() {
+		write_rec(*os, FMT_BIN, NULL, 0, NULL, 0);
+		os->flush();
+		if (!*os)
+			throw TdbExcept("cannot write replication stream");
+	};
+
+	if (cfg.file != "-") {
+		ofs.open(cfg.file, std::ios::binary | std::ios::trunc);
+		if (!ofs)
+			throw TdbExcept("cannot open %s", cfg.file.c_str());
+		os = &ofs;
+	}
+
+	while (true) {
+		if (seq == TDB_REPL_START) {
+			// Start the change log before the copy, so changes
+			// done during the copy are sent after it.
+			th.changes(cfg.table, seq, out);
+
+			// Remove old records with the same key only once.
+			std::unordered_set<unsigned long> keys;
+			size_t n = 0;
+			th.scan(cfg.table, [&](char *key, size_t klen,
+					       char *val, size_t vlen) {
+				unsigned long h = tdb_hash_fn(cfg.hash, key,
+							      klen);
+				if (keys.insert(h).second)
+					out(NULL, 0, (char *)&h, sizeof(h));
+				out(key, klen, val, vlen);
+				++n;
+			});
+			end_batch();
+			std::clog << "table " << cfg.table << " copied, " << n
+				  << " records" << std::endl;
+			continue;
+		}
+
+		size_t n = 0;
+		if (!th.changes(cfg.table, seq,
+				[&](char *key, size_t klen, char *val,
+				    size_t vlen) {
+					out(key, klen, val, vlen);
+					++n;
+				}))
+		{
+			std::clog << "changes of table " << cfg.table
+				  << " are lost, copy it again" << std::endl;
+			seq = TDB_REPL_START;
+			continue;
+		}
+		if (n) {
+			end_batch();
+		} else {
+			if (!*os)
+				throw TdbExcept("replication stream is closed");
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(REPL_INTERVAL_MS));
+		}
+	}
+}
+
+/**
+ * Apply records written by do_replicate() to the table, each batch of changes
+ * is applied by one transaction.
+ */
+static size_t
+do_receive(TdbHndl &th, Cfg &cfg)
+{
+	size_t n = 0;
+	bool in_trx = false;
+	std::string key, val;
+	std::ifstream ifs;
+	std::istream *is = &std::cin;
+
+	if (cfg.file != "-") {
+		ifs.open(cfg.file, std::ios::binary);
+		if (!ifs)
+			throw TdbExcept("cannot open %s", cfg.file.c_str());
+		is = &ifs;
+	}
+
+	while (read_rec(*is, FMT_BIN, key, val)) {
+		if (key.empty() && val.empty()) {
+			if (in_trx)
+				th.trx_commit();
+			in_trx = false;
+			continue;
+		}
+		if (!in_trx)
+			th.trx_begin();
+		in_trx = true;
+
+		if (key.empty()) {
+			unsigned long h;
+
+			if (val.length() != sizeof(h))
+				throw TdbExcept("malformed removal record");
+			memcpy(&h, val.data(), sizeof(h));
+			th.remove(cfg.table, h);
+			continue;
+		}
+		th.insert(cfg.table, key.length(), val.length(),
+			  [&](char *k, char *v) {
+				key.copy(k, key.length());
+				val.copy(v, val.length());
+			  });
+		++n;
+	}
+	if (in_trx)
+		th.trx_commit();
+
+	return n;
+}
+
+/**
+ * Check table file offline, the kernel must not use the table.
+ */
+static int
+do_fsck(Cfg &cfg)
+{
+	long r = tdb_fsck(cfg.file.c_str());
+
+	if (r < 0) {
+		std::cerr << "Error: cannot check " << cfg.file << std::endl;
+		return 2;
+	}
+	std::cout << "FSCK: errors=" << r << " status="
+		  << (r ? "BROKEN" : "OK") << std::endl;
+	return r ? 3 : 0;
+}
+
+/**
+ * Read records directly from mapped table file, the kernel isn't involved.
+ */
+static int
+do_direct(Cfg &cfg)
+{
+	try {
+		TdbMapping tm(cfg.tbl_file);
+
+		if (cfg.action == ACT_SELECT) {
+			tm.query(cfg.key, print_rec);
+		} else {
+			std::clog << do_export(cfg, [&](RecCb cb) {
+					tm.scan(cb);
+				     })
+				  << " records exported" << std::endl;
+		}
+	}
+	catch (TdbExcept &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 2;
+	}
+
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -122,7 +748,47 @@ main(int argc, char *argv[])
 		 "  open    - open and create a new table if necessary;\n"
 		 "  close   - close a table;\n"
 		 "  insert  - insert a record to a table;\n"
-		 "  select  - select from a table")
+		 "  select  - select from a table;\n"
+		 "  import  - insert all records from a file;\n"
+		 "  export  - write all table records to a file;\n"
+		 "  bench   - run insert/select benchmark on a table;\n"
+		 "  fsck    - check consistency of a closed table file;\n"
+		 "  resize  - grow an opened table to the specified size;\n"
+		 "  index   - create index of a table by key prefixes;\n"
+		 "  replicate - write a table copy and then its changes to"
+		 " a file;\n"
+		 "  receive - apply a table copy and changes from a file")
+		("tbl_file,T", po::value<std::string>(),
+		 "Table file to select or export records from directly,"
+		 " w/o the kernel. The file contains the table of its last"
+		 " close")
+		("file,f", po::value<std::string>()->default_value("-"),
+		 "File to import from or export to, '-' for stdin/stdout,"
+		 " or table file to check")
+		("format,F", po::value<std::string>()->default_value("tsv"),
+		 "Import/export file format: 'csv' or 'tsv' for a <key,value>"
+		 " pair per line (with RFC 4180 quoting or backslash escapes"
+		 " correspondingly) or"
+		 " 'bin' for <32-bit key length, 32-bit value length, key,"
+		 " value> records")
+		("threads,n", po::value<unsigned int>()->default_value(1),
+		 "Number of benchmark threads")
+		("ops,o", po::value<size_t>()->default_value(100000),
+		 "Total number of benchmark operations")
+		("keys", po::value<size_t>()->default_value(10000),
+		 "Number of distinct keys for benchmark")
+		("vlen", po::value<size_t>()->default_value(64),
+		 "Length of benchmark values")
+		("insert_pct,i", po::value<unsigned int>()->default_value(10),
+		 "Percentage of inserts in benchmark operations")
+		("index,x", po::value<std::string>(),
+		 "Index to create or to select records by key prefix from")
+		("prefix,P", po::value<unsigned int>()->default_value(0),
+		 "Length of key prefixes in the created index")
+		("hash,H", po::value<std::string>()->default_value("crc32c"),
+		 "Hash function for keys of a new table: 'crc32c', 'xxh64' or"
+		 " 'siphash' (keyed by a random key of the table). Replicated"
+		 " tables must use the same unkeyed function on all nodes")
 		("key,k", po::value<std::string>(), "The record key")
 		("path,p", po::value<std::string>(), "Path to database files")
 		("rec_size,r", po::value<size_t>()->default_value(0),
@@ -132,7 +798,7 @@ main(int argc, char *argv[])
 		("table,t", po::value<std::string>()->default_value("*"),
 		 "The table to operate on or '*' for all tables")
 		("tbl_size,s", po::value<size_t>()->default_value(512),
-		 "Table size in pages")
+		 "Table or index size in pages")
 		("value,v", po::value<std::string>(), "The record value");
 	try {
 		// Parse config options
@@ -153,6 +819,11 @@ main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (cfg.action == ACT_FSCK)
+		return do_fsck(cfg);
+	if (!cfg.tbl_file.empty())
+		return do_direct(cfg);
+
 	try {
 		TdbHndl th(cfg.mm_sz);
 
@@ -164,7 +835,7 @@ main(int argc, char *argv[])
 			break;
 		case ACT_OPEN:
 			th.open_table(cfg.db_path, cfg.table, cfg.tbl_sz,
-				      cfg.rec_sz);
+				      cfg.rec_sz, cfg.hash);
 			std::cout << "table " << cfg.table << " opened"
 				  << std::endl;
 			break;
@@ -173,6 +844,11 @@ main(int argc, char *argv[])
 			std::cout << "table " << cfg.table << " closed"
 				  << std::endl;
 			break;
+		case ACT_RESIZE:
+			th.resize_table(cfg.table, cfg.tbl_sz);
+			std::cout << "table " << cfg.table << " resized"
+				  << std::endl;
+			break;
 		case ACT_INSERT:
 			th.trx_begin();
 			th.insert(cfg.table, cfg.key.length(), cfg.val.length(),
@@ -183,17 +859,39 @@ main(int argc, char *argv[])
 				  });
 			th.trx_commit();
 			break;
+		case ACT_INDEX:
+			th.create_index(cfg.table, cfg.index, cfg.tbl_sz,
+					cfg.plen);
+			std::cout << "index " << cfg.index << " of table "
+				  << cfg.table << " created" << std::endl;
+			break;
 		case ACT_SELECT:
-			th.query(cfg.table, cfg.key,
-				 [=](char *key, size_t klen,
-				     char *val, size_t vlen)
-				 {
-					std::cout << "'";
-					std::cout.write(key, klen);
-					std::cout << "' -> '";
-					std::cout.write(val, vlen);
-					std::cout << "'" << std::endl;
-				 });
+			th.query(cfg.table, cfg.index, cfg.key, print_rec);
+			break;
+		case ACT_IMPORT:
+			std::cout << do_import(th, cfg) << " records imported"
+				  << std::endl;
+			break;
+		case ACT_EXPORT:
+			// Don't mix exported data and status on stdout.
+			std::clog << do_export(cfg, [&](RecCb cb) {
+					th.scan(cfg.table, cb);
+				     })
+				  << " records exported" << std::endl;
+			if (cfg.file == "-") {
+				std::clog << th.last_status() << std::endl;
+				return 0;
+			}
+			break;
+		case ACT_BENCH:
+			do_bench(cfg);
+			return 0;
+		case ACT_REPLICATE:
+			do_replicate(th, cfg);
+			return 0;
+		case ACT_RECEIVE:
+			std::clog << do_receive(th, cfg) << " records received"
+				  << std::endl;
 			break;
 		default:
 			throw TdbExcept("bad action number %d", cfg.action);
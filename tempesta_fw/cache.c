@@ -43,13 +43,13 @@
 
 /* Flags stored in a Cache Entry. */
 #define TFW_CE_MUST_REVAL	0x0001		/* MUST revalidate if stale. */
+#define TFW_CE_COMPLETE		0x0002		/* The entry is fully written. */
 
 /*
  * @trec	- Database record descriptor;
  * @key_len	- length of key (URI + Host header);
  * @status_len	- length of response satus line;
- * @hdr_num	- number of headers;
- * @hdr_len	- length of whole headers data;
+ * @hdr_len	- length of the header block;
  * @method	- request method, part of the key;
  * @flags	- various cache entry flags;
  * @age		- the value of response Age: header field;
@@ -59,7 +59,8 @@
  * @lifetime	- the cache entry's current lifetime;
  * @key		- the cache enty key (URI + Host header);
  * @status	- pointer to status line  (with trailing CRLFs);
- * @hdrs	- pointer to list of HTTP headers (with trailing CRLFs);
+ * @hdrs	- pointer to the header block, the header fields are stored
+ *		  as they are sent (with trailing CRLFs);
  * @body	- pointer to response body (with a prepending CRLF);
  * @version	- HTTP version of the response;
  * @hmflags	- flags of the response after parsing and post-processing.
@@ -69,7 +70,6 @@ typedef struct {
 #define ce_body		key_len
 	unsigned int	key_len;
 	unsigned int	status_len;
-	unsigned int	hdr_num;
 	unsigned int	hdr_len;
 	unsigned int	method: 4;
 	unsigned int	flags: 28;
@@ -89,19 +89,13 @@ typedef struct {
 #define CE_BODY_SIZE							\
 	(sizeof(TfwCacheEntry) - offsetof(TfwCacheEntry, ce_body))
 
-/**
- * String header for cache entries used for TfwStr serialization.
- *
- * @flags	- only TFW_STR_DUPLICATE or zero;
- * @len		- string length or number of duplicates;
+/*
+ * Age: header field generated for responses served from cache. The value
+ * is limited by 2^31 as RFC 7234 1.2.1 allows.
  */
-typedef struct {
-	unsigned long	flags : 8,
-			len : 56;
-} TfwCStr;
-
-#define TFW_CSTR_MAXLEN		(1UL << 56)
-#define TFW_CSTR_HDRLEN		(sizeof(TfwCStr))
+#define S_F_AGE			"Age: "
+#define TFW_CACHE_AGE_MAX	2147483648L
+#define TFW_CACHE_AGE_HDRLEN	SLEN(S_F_AGE "2147483648" S_CRLF)
 
 /* Work to copy response body to database. */
 typedef struct {
@@ -141,7 +135,8 @@ enum {
  *
  * We don't store the headers in cache and create then from scratch.
  * Adding a header is faster then modify it, so this speeds up headers
- * adjusting as well as saves cache storage.
+ * adjusting as well as saves cache storage. Age header is also created
+ * from scratch on each cache hit.
  *
  * TODO process Cache-Control no-cache
  */
@@ -149,6 +144,8 @@ static const int hbh_hdrs[] = {
 	[0 ... TFW_HTTP_HDR_RAW]	= 0,
         [TFW_HTTP_HDR_SERVER]		= 1,
 	[TFW_HTTP_HDR_CONNECTION]	= 1,
+	[TFW_HTTP_HDR_KEEP_ALIVE]	= 1,
+	[TFW_HTTP_HDR_AGE]		= 1,
 };
 
 typedef struct {
@@ -433,7 +430,7 @@ tfw_cache_entry_key_eq(TDB *db, TfwHttpReq *req, TfwCacheEntry *ce)
 			return false;
 this_chunk:
 		n = min(c->len - c_off, (unsigned long)trec->len - t_off);
-		if (strncasecmp((char *)c->ptr + c_off, trec->data + t_off, n))
+		if (tfw_cstricmp((char *)c->ptr + c_off, trec->data + t_off, n))
 			return false;
 		c_off = (n == c->len - c_off) ? 0 : c_off + n;
 		if (n == trec->len - t_off) {
@@ -498,20 +495,6 @@ tfw_cache_sched_cpu(TfwHttpReq *req)
 	return node->cpu[idx % node->nr_cpus];
 }
 
-static void
-tfw_cache_str_write_hdr(const TfwStr *str, char *p)
-{
-	TfwCStr *s = (TfwCStr *)p;
-
-	if (TFW_STR_DUP(str)) {
-		s->flags = TFW_STR_DUPLICATE;
-		s->len = TFW_STR_CHUNKN(str);
-	} else {
-		s->flags = 0;
-		s->len = str->len ? str->len + SLEN(S_CRLF) : 0;
-	}
-}
-
 /**
  * Copies plain TfwStr @src to TdbRec @trec.
  * @return number of copied bytes (@src length).
@@ -592,49 +575,47 @@ tfw_cache_strcpy_eol(char **p, TdbVRec **trec,
 }
 
 /**
- * Deep HTTP header copy to TdbRec.
- * @src is copied in depth first fashion to speed up upcoming scans.
- * @return number of copied bytes on success and negative value otherwise.
+ * Copy response headers to TdbRec as the header block ready to be sent.
+ * Cache hits send the block as is, so all the headers transformations
+ * which don't depend on a particular request are done here: hop-by-hop
+ * headers are dropped and Date header is added if the response has none.
+ * @return length of the header block on success and negative value
+ * otherwise.
  */
 static long
-tfw_cache_copy_hdr(char **p, TdbVRec **trec, TfwStr *src, size_t *tot_len)
+tfw_cache_copy_hdrs(char **p, TdbVRec **trec, TfwHttpResp *resp,
+		    size_t *tot_len)
 {
-	long n = sizeof(TfwCStr), copied;
-	TfwStr *dup, *dup_end;
-
-	if (unlikely(src->len >= TFW_CSTR_MAXLEN)) {
-		TFW_WARN("Cache: trying to store too big string %lx\n",
-			 src->len);
-		return -E2BIG;
-	}
-	/* Don't split short strings. */
-	if (likely(!TFW_STR_DUP(src))
-	    && sizeof(TfwCStr) + src->len <= L1_CACHE_BYTES)
-		n += src->len;
-
-#define CSTR_WRITE_HDR(str)			\
-	tfw_cache_str_write_hdr(str, *p);	\
-	*p += TFW_CSTR_HDRLEN;			\
-	*tot_len -= TFW_CSTR_HDRLEN;		\
-	copied = TFW_CSTR_HDRLEN;
-
-	*p = tdb_entry_get_room(node_db(), trec, *p, n, *tot_len);
-	if (!*p) {
-		TFW_WARN("Cache: cannot allocate TDB space\n");
-		return -ENOMEM;
-	}
-
-	CSTR_WRITE_HDR(src);
-
-	if (!TFW_STR_DUP(src)) {
-		if ((n = tfw_cache_strcpy_eol(p, trec, src, tot_len, 1)) < 0)
-			return n;
-		return copied + n;
+	long n, copied = 0;
+	TfwStr *field, *dup, *end, *dup_end;
+	char date[SLEN(S_V_DATE)];
+	TfwStr s_date = {
+		.ptr = (TfwStr []){
+			{ .ptr = S_F_DATE,	.len = SLEN(S_F_DATE) },
+			{ .ptr = date,		.len = SLEN(S_V_DATE) },
+		},
+		.len = SLEN(S_F_DATE S_V_DATE),
+		.flags = 2 << TFW_STR_CN_SHIFT
+	};
+
+	FOR_EACH_HDR_FIELD(field, end, resp) {
+		n = field - resp->h_tbl->tbl;
+		/* Skip hop-by-hop headers. */
+		if (n < TFW_HTTP_HDR_RAW && hbh_hdrs[n])
+			continue;
+		TFW_STR_FOR_EACH_DUP(dup, field, dup_end) {
+			n = tfw_cache_strcpy_eol(p, trec, dup, tot_len, 1);
+			if (n < 0)
+				return n;
+			copied += n;
+		}
 	}
 
-	TFW_STR_FOR_EACH_DUP(dup, src, dup_end) {
-		CSTR_WRITE_HDR(dup);
-		if ((n = tfw_cache_strcpy_eol(p, trec, dup, tot_len, 1)) < 0)
+	if (!(resp->flags & TFW_HTTP_HAS_HDR_DATE)) {
+		/* @resp->date is the time the response was received. */
+		tfw_http_prep_date_from(date, resp->date);
+		n = tfw_cache_strcpy_eol(p, trec, &s_date, tot_len, 1);
+		if (n < 0)
 			return n;
 		copied += n;
 	}
@@ -644,14 +625,10 @@ tfw_cache_copy_hdr(char **p, TdbVRec **trec, TfwStr *src, size_t *tot_len)
 
 /**
  * Copy response skbs to database mapped area.
- * @tot_len - total length of actual data to write w/o TfwCStr's etc.
+ * @tot_len - total length of actual data to write.
  *
  * It's nasty to copy data on CPU, but we can't use DMA for mmaped file
  * as well as for unaligned memory areas.
- *
- * TODO Store the cache entries as a templates with placeholders for
- * changeable headers. That we can faster build the final answers instead
- * of adjusting skb's.
  */
 static int
 tfw_cache_copy_resp(TfwCacheEntry *ce, TfwHttpResp *resp, TfwHttpReq *req,
@@ -661,7 +638,7 @@ tfw_cache_copy_resp(TfwCacheEntry *ce, TfwHttpResp *resp, TfwHttpReq *req,
 	char *p;
 	TdbVRec *trec = &ce->trec;
 	TDB *db = node_db();
-	TfwStr *field, *h, *end1, *end2, empty = {};
+	TfwStr *field, *h, *end1, *end2;
 
 	p = (char *)(ce + 1);
 	tot_len -= CE_BODY_SIZE;
@@ -689,19 +666,11 @@ tfw_cache_copy_resp(TfwCacheEntry *ce, TfwHttpResp *resp, TfwHttpReq *req,
 	ce->status_len += n;
 
 	ce->hdrs = TDB_OFF(db->hdr, p);
-	ce->hdr_len = 0;
-	ce->hdr_num = resp->h_tbl->off;
-	FOR_EACH_HDR_FIELD(field, end1, resp) {
-		n = field - resp->h_tbl->tbl;
-		/* Skip hop-by-hop headers. */
-		h = (n < TFW_HTTP_HDR_RAW && hbh_hdrs[n]) ? &empty : field;
-		n = tfw_cache_copy_hdr(&p, &trec, h, &tot_len);
-		if (n < 0) {
-			TFW_ERR("Cache: cannot copy HTTP header\n");
-			return -ENOMEM;
-		}
-		ce->hdr_len += n;
+	if ((n = tfw_cache_copy_hdrs(&p, &trec, resp, &tot_len)) < 0) {
+		TFW_ERR("Cache: cannot copy HTTP headers\n");
+		return -ENOMEM;
 	}
+	ce->hdr_len = n;
 
 	/* Write HTTP response body. */
 	ce->body = TDB_OFF(db->hdr, p);
@@ -713,7 +682,8 @@ tfw_cache_copy_resp(TfwCacheEntry *ce, TfwHttpResp *resp, TfwHttpReq *req,
 	BUG_ON(tot_len != 0);
 
 	ce->version = resp->version;
-	ce->hmflags = resp->flags;
+	/* The header block always contains Date header. */
+	ce->hmflags = resp->flags | TFW_HTTP_HAS_HDR_DATE;
 
 	if (resp->cache_ctl.flags
 	    & (TFW_HTTP_CC_MUST_REVAL | TFW_HTTP_CC_PROXY_REVAL))
@@ -724,11 +694,15 @@ tfw_cache_copy_resp(TfwCacheEntry *ce, TfwHttpResp *resp, TfwHttpReq *req,
 	ce->resp_time = resp->cache_ctl.timestamp;
 	ce->lifetime = tfw_cache_calc_lifetime(resp);
 
+	/* Let TDB compactor move the entry only after it's written. */
+	smp_wmb();
+	ce->flags |= TFW_CE_COMPLETE;
+
 	TFW_DBG("Cache copied msg: content-length=%lu msg_len=%lu, ce=%p"
-		" (len=%u key_len=%u status_len=%u hdr_num=%u hdr_len=%u"
+		" (len=%u key_len=%u status_len=%u hdr_len=%u"
 		" key_off=%ld status_off=%ld hdrs_off=%ld body_off=%ld)",
 		resp->content_length, resp->msg.len, ce, ce->trec.len,
-		ce->key_len, ce->status_len, ce->hdr_num, ce->hdr_len,
+		ce->key_len, ce->status_len, ce->hdr_len,
 		ce->key, ce->status, ce->hdrs, ce->body);
 
 	return 0;
@@ -739,28 +713,25 @@ __cache_entry_size(TfwHttpResp *resp, TfwHttpReq *req)
 {
 	long n;
 	size_t size = CE_BODY_SIZE;
-	TfwStr *h, *hdr, *hdr_end, *dup, *dup_end, empty = {};
+	TfwStr *hdr, *hdr_end, *dup, *dup_end;
 
 	/* Add compound key size */
 	size += req->uri_path.len;
 	size += req->h_tbl->tbl[TFW_HTTP_HDR_HOST].len;
 
-	/* Add all the headers size */
+	/* Add the header block size, see tfw_cache_copy_hdrs(). */
 	FOR_EACH_HDR_FIELD(hdr, hdr_end, resp) {
 		/* Skip hop-by-hop headers. */
 		n = hdr - resp->h_tbl->tbl;
-		h = (n < TFW_HTTP_HDR_RAW && hbh_hdrs[n]) ? &empty : hdr;
-		if (!TFW_STR_DUP(h)) {
-			size += sizeof(TfwCStr);
-			size += h->len ? (h->len + SLEN(S_CRLF)) : 0;
-		} else {
-			size += sizeof(TfwCStr);
-			TFW_STR_FOR_EACH_DUP(dup, h, dup_end) {
-				size += sizeof(TfwCStr);
+		if (n < TFW_HTTP_HDR_RAW && hbh_hdrs[n])
+			continue;
+		TFW_STR_FOR_EACH_DUP(dup, hdr, dup_end) {
+			if (dup->len)
 				size += dup->len + SLEN(S_CRLF);
-			}
 		}
 	}
+	if (!(resp->flags & TFW_HTTP_HAS_HDR_DATE))
+		size += SLEN(S_F_DATE S_V_DATE S_CRLF);
 
 	/* Add status line length + CRLF */
 	size += resp->s_line.len + SLEN(S_CRLF);
@@ -773,6 +744,42 @@ __cache_entry_size(TfwHttpResp *resp, TfwHttpReq *req)
 	return size;
 }
 
+static bool
+tfw_cache_ce_movable(TdbRec *rec)
+{
+	return ((TfwCacheEntry *)rec)->flags & TFW_CE_COMPLETE;
+}
+
+/**
+ * TDB compactor moved a chunk of the cache entry, so update the entry
+ * offsets pointing to the chunk. An offset can point just after the chunk
+ * data if the next chunk was allocated for the string.
+ */
+static void
+tfw_cache_ce_moved(TdbRec *rec, unsigned long from, unsigned long to,
+		   size_t len)
+{
+	TfwCacheEntry *ce = (TfwCacheEntry *)rec;
+
+#define CE_MOVE_OFF(off)						\
+do {									\
+	if ((off) >= from && (off) <= from + len)			\
+		(off) += to - from;					\
+} while (0)
+
+	CE_MOVE_OFF(ce->key);
+	CE_MOVE_OFF(ce->status);
+	CE_MOVE_OFF(ce->hdrs);
+	CE_MOVE_OFF(ce->body);
+
+#undef CE_MOVE_OFF
+}
+
+static const TdbRelocOps tfw_cache_reloc_ops = {
+	.movable	= tfw_cache_ce_movable,
+	.moved		= tfw_cache_ce_moved,
+};
+
 static void
 __cache_add_node(TDB *db, TfwHttpResp *resp, TfwHttpReq *req,
 		 unsigned long key)
@@ -844,6 +851,31 @@ tfw_cache_ipi(struct irq_work *work)
 	tasklet_schedule(&ct->tasklet);
 }
 
+static bool
+tfw_cache_employ(TfwHttpReq *req, TfwHttpResp *resp)
+{
+	if (req->method == TFW_HTTP_METH_PURGE)
+		return true;
+	if (!cache_cfg.cache)
+		return false;
+	if (!tfw_cache_msg_cacheable(req))
+		return false;
+	return resp || tfw_cache_employ_req(req);
+}
+
+static void
+tfw_cache_work_init(TfwCWork *cw, TfwHttpReq *req, TfwHttpResp *resp,
+		    tfw_http_cache_cb_t action)
+{
+	cw->req = req;
+	cw->resp = resp;
+	cw->action = action;
+	cw->key = tfw_http_req_key_calc(req);
+	req->node = (cache_cfg.cache == TFW_CACHE_SHARD)
+		    ? tfw_cache_key_node(cw->key)
+		    : numa_node_id();
+}
+
 int
 tfw_cache_process(TfwHttpReq *req, TfwHttpResp *resp,
 		  tfw_http_cache_cb_t action)
@@ -852,22 +884,12 @@ tfw_cache_process(TfwHttpReq *req, TfwHttpResp *resp,
 	TfwWorkTasklet *ct;
 	TfwCWork cw;
 
-	if (req->method == TFW_HTTP_METH_PURGE)
-		goto do_cache;
-	if (!cache_cfg.cache)
-		goto dont_cache;
-	if (!tfw_cache_msg_cacheable(req))
-		goto dont_cache;
-	if (!resp && !tfw_cache_employ_req(req))
-		goto dont_cache;
-do_cache:
-	cw.req = req;
-	cw.resp = resp;
-	cw.action = action;
-	cw.key = tfw_http_req_key_calc(req);
-	req->node = (cache_cfg.cache == TFW_CACHE_SHARD)
-		    ? tfw_cache_key_node(cw.key)
-		    : numa_node_id();
+	if (!tfw_cache_employ(req, resp)) {
+		action(req, resp);
+		return 0;
+	}
+
+	tfw_cache_work_init(&cw, req, resp, action);
 	cpu = tfw_cache_sched_cpu(req);
 	ct = &per_cpu(cache_wq, cpu);
 
@@ -885,10 +907,65 @@ do_cache:
 		TFW_WARN("Cache work queue overrun: [%s]\n",
 			 resp ? "response" : "request");
 	return r;
+}
 
-dont_cache:
-	action(req, resp);
-	return 0;
+/**
+ * The same as tfw_cache_process() for a list of requests received at once.
+ * tfw_cache_process() spreads requests over CPUs of the node one by one,
+ * so each of them costs an IPI and the cache tasklets don't see them as
+ * a burst. Here consecutive requests for the same node are queued to the
+ * same CPU, which is kicked once for all of them, so the tasklet batches
+ * their lookups. Requests which couldn't be queued are left in @batch.
+ */
+void
+tfw_cache_process_batch(struct list_head *batch, tfw_http_cache_cb_t action)
+{
+	int cpu = -1, node = -1;
+	bool queued = false;
+	TfwMsg *msg, *tmp;
+	TfwWorkTasklet *ct = NULL;
+	TfwCWork cw;
+	LIST_HEAD(failed);
+
+	list_for_each_entry_safe(msg, tmp, batch, msg_list) {
+		TfwHttpReq *req = (TfwHttpReq *)msg;
+
+		/*
+		 * The request may be freed by the action or the tasklet
+		 * as soon as it's passed to them.
+		 */
+		list_del_init(&msg->msg_list);
+
+		if (!tfw_cache_employ(req, NULL)) {
+			action(req, NULL);
+			continue;
+		}
+
+		tfw_cache_work_init(&cw, req, NULL, action);
+		if (req->node != node) {
+			if (queued)
+				tfw_wq_kick(cpu, &ct->ipi_work, tfw_cache_ipi);
+			queued = false;
+			node = req->node;
+			cpu = tfw_cache_sched_cpu(req);
+			ct = &per_cpu(cache_wq, cpu);
+		}
+
+		TFW_DBG2("Cache: queue batched work: to_cpu=%d from_cpu=%d"
+			 " req=%p key=%lx\n", cpu, smp_processor_id(),
+			 cw.req, cw.key);
+
+		if (unlikely(__tfw_wq_push(&ct->wq, &cw, false))) {
+			TFW_WARN("Cache work queue overrun: [request]\n");
+			list_add_tail(&msg->msg_list, &failed);
+			continue;
+		}
+		queued = true;
+	}
+	if (queued)
+		tfw_wq_kick(cpu, &ct->ipi_work, tfw_cache_ipi);
+
+	list_splice(&failed, batch);
 }
 
 static int
@@ -925,48 +1002,6 @@ tfw_cache_write_field(TDB *db, TdbVRec **trec, TfwHttpResp *resp,
 	return 0;
 }
 
-/**
- * Write HTTP header to skb data.
- * The headers are likely to be adjusted, so copy them.
- */
-static int
-tfw_cache_build_resp_hdr(TDB *db, TfwHttpResp *resp, TfwStr *hdr,
-			 TdbVRec **trec, TfwMsgIter *it, char **p)
-{
-	int r, d, dn;
-	TfwStr *dups;
-	TfwCStr *s = (TfwCStr *)*p;
-
-	*p += TFW_CSTR_HDRLEN;
-	BUG_ON(*p > (*trec)->data + (*trec)->len);
-
-	if (likely(!(s->flags & TFW_STR_DUPLICATE)))
-		return tfw_cache_write_field(db, trec, resp, it, p, s->len,
-					     hdr);
-
-	/* Process duplicated headers. */
-	dn = s->len;
-	dups = tfw_pool_alloc(resp->pool, dn * sizeof(TfwStr));
-	if (!dups)
-		return -ENOMEM;
-
-	for (d = 0; d < dn; ++d) {
-		s = (TfwCStr *)*p;
-		BUG_ON(s->flags);
-		TFW_STR_INIT(&dups[d]);
-		*p += TFW_CSTR_HDRLEN;
-		if ((r = tfw_cache_write_field(db, trec, resp, it, p, s->len,
-					       &dups[d])))
-			return r;
-	}
-
-	hdr->ptr = dups;
-	__TFW_STR_CHUNKN_SET(hdr, dn);
-	hdr->flags |= TFW_STR_DUPLICATE;
-
-	return 0;
-}
-
 /**
  * Build the message body as paged fragments of skb.
  * See do_tcp_sendpages() as reference.
@@ -1029,6 +1064,11 @@ tfw_cache_build_resp_body(TDB *db, TfwHttpResp *resp, TdbVRec *trec,
  * We return skbs in the cache entry response w/o setting any
  * network headers - tcp_transmit_skb() will do it for us.
  *
+ * The header block is copied as is, so the response headers aren't
+ * available through the headers table, only Age header generated here and
+ * the headers added by further adjustments are. The adjustments only add
+ * new headers, so it's enough for them.
+ *
  * TODO Prebuild the response and use clones/copies for sending
  * (copy the list of skbs is faster than scan TDB and build TfwHttpResp).
  * TLS should encrypt the data in already prepared skbs.
@@ -1038,12 +1078,18 @@ tfw_cache_build_resp_body(TDB *db, TfwHttpResp *resp, TdbVRec *trec,
 static TfwHttpResp *
 tfw_cache_build_resp(TfwCacheEntry *ce)
 {
-	int h;
 	char *p;
 	TfwHttpResp *resp;
 	TdbVRec *trec = &ce->trec;
 	TDB *db = node_db();
 	TfwMsgIter it;
+	TfwStr hdrs = {}, *age;
+	char s_age[TFW_CACHE_AGE_HDRLEN + 1];
+	TfwStr age_hdr = { .ptr = s_age };
+
+	age_hdr.len = snprintf(s_age, sizeof(s_age), S_F_AGE "%ld" S_CRLF,
+			       min_t(long, tfw_cache_entry_age(ce),
+				     TFW_CACHE_AGE_MAX));
 
 	/*
 	 * Allocated response won't be checked by any filters and
@@ -1051,20 +1097,12 @@ tfw_cache_build_resp(TfwCacheEntry *ce)
 	 * connection and GFSM fields.
 	 */
 	resp = (TfwHttpResp *)tfw_http_msg_create(NULL, &it, Conn_Srv,
-						  ce->hdr_len + 2);
+						  ce->status_len + ce->hdr_len
+						  + age_hdr.len
+						  + SLEN(S_CRLF));
 	if (!resp)
 		return NULL;
 
-	/*
-	 * Allocate HTTP headers table of proper size.
-	 * There were no other allocations since the table is allocated,
-	 * so realloc() just grows the table and returns the same pointer.
-	 */
-	h = (ce->hdr_num + 2 * TFW_HTTP_HDR_NUM - 1) & ~(TFW_HTTP_HDR_NUM - 1);
-	p = tfw_pool_realloc(resp->pool, resp->h_tbl, TFW_HHTBL_SZ(1),
-			     TFW_HHTBL_EXACTSZ(h));
-	BUG_ON(p != (char *)resp->h_tbl);
-
 	/* Skip record key until status line. */
 	for (p = TDB_PTR(db->hdr, ce->status);
 	     trec && (unsigned long)(p - trec->data) > trec->len;
@@ -1080,12 +1118,16 @@ tfw_cache_build_resp(TfwCacheEntry *ce)
 				  ce->status_len, &resp->s_line))
 		goto err;
 
-	for (h = 0; h < ce->hdr_num; ++h) {
-		TFW_STR_INIT(resp->h_tbl->tbl + h);
-		if (tfw_cache_build_resp_hdr(db, resp, resp->h_tbl->tbl + h,
-					     &trec, &it, &p))
-			goto err;
-	}
+	/* The header block is sent as is. */
+	if (tfw_cache_write_field(db, &trec, resp, &it, &p,
+				  ce->hdr_len, &hdrs))
+		goto err;
+
+	/* RFC 7234 4: Age header is generated for each cache hit. */
+	age = &resp->h_tbl->tbl[TFW_HTTP_HDR_AGE];
+	if (tfw_http_msg_add_data(&it, (TfwHttpMsg *)resp, age, &age_hdr))
+		goto err;
+	tfw_str_fixup_eol(age, SLEN(S_CRLF));
 
 	if (tfw_http_msg_add_data(&it, (TfwHttpMsg *)resp, &resp->crlf,
 				  &g_crlf))
@@ -1105,12 +1147,14 @@ err:
 	return NULL;
 }
 
+/**
+ * Find the cache entry for @req starting from the record pointed by @iter.
+ */
 static TfwCacheEntry *
-tfw_cache_dbce_get(TDB *db, TdbIter *iter, TfwHttpReq *req, unsigned long key)
+tfw_cache_dbce_find(TDB *db, TdbIter *iter, TfwHttpReq *req)
 {
 	TfwCacheEntry *ce;
 
-	*iter = tdb_rec_get(db, key);
 	if (TDB_ITER_BAD(*iter)) {
 		TFW_INC_STAT_BH(cache.misses);
 		return NULL;
@@ -1129,6 +1173,14 @@ tfw_cache_dbce_get(TDB *db, TdbIter *iter, TfwHttpReq *req, unsigned long key)
 	return ce;
 }
 
+static TfwCacheEntry *
+tfw_cache_dbce_get(TDB *db, TdbIter *iter, TfwHttpReq *req, unsigned long key)
+{
+	*iter = tdb_rec_get(db, key);
+
+	return tfw_cache_dbce_find(db, iter, req);
+}
+
 static inline void
 tfw_cache_dbce_put(TfwCacheEntry *ce)
 {
@@ -1136,27 +1188,28 @@ tfw_cache_dbce_put(TfwCacheEntry *ce)
 		tdb_rec_put(ce);
 }
 
+/**
+ * Service @req from the cache entry found by @iter.
+ * The found entry is released by the caller.
+ */
 static void
-cache_req_process_node(TfwHttpReq *req, unsigned long key,
-			 tfw_http_cache_cb_t action)
+cache_req_process_node(TDB *db, TdbIter *iter, TfwHttpReq *req,
+		       tfw_http_cache_cb_t action)
 {
-	TfwCacheEntry *ce = NULL;
+	TfwCacheEntry *ce;
 	TfwHttpResp *resp = NULL;
-	TDB *db = node_db();
-	TdbIter iter;
 
-	if (!(ce = tfw_cache_dbce_get(db, &iter, req, key)))
+	if (!(ce = tfw_cache_dbce_find(db, iter, req)))
 		goto out;
 
 	if (!tfw_cache_entry_is_live(req, ce))
 		goto out;
 
 	TFW_DBG("Cache: service request w/ key=%lx, ce=%p (len=%u key_len=%u"
-		" status_len=%u hdr_num=%u hdr_len=%u key_off=%ld"
-		" status_off=%ld hdrs_off=%ld body_off=%ld)\n",
+		" status_len=%u hdr_len=%u key_off=%ld status_off=%ld"
+		" hdrs_off=%ld body_off=%ld)\n",
 		ce->trec.key, ce, ce->trec.len, ce->key_len, ce->status_len,
-		ce->hdr_num, ce->hdr_len, ce->key, ce->status, ce->hdrs,
-		ce->body);
+		ce->hdr_len, ce->key, ce->status, ce->hdrs, ce->body);
 	TFW_INC_STAT_BH(cache.hits);
 
 	resp = tfw_cache_build_resp(ce);
@@ -1165,8 +1218,30 @@ out:
 		tfw_http_send_504((TfwHttpMsg *)req);
 	else
 		action(req, resp);
+}
 
-	tfw_cache_dbce_put(ce);
+static void
+cache_req_batch_cb(TdbIter *iter, int i, void *data)
+{
+	TfwCWork *cw = (TfwCWork *)data + i;
+
+	cache_req_process_node(node_db(), iter, cw->req, cw->action);
+}
+
+/**
+ * Process cache lookups collected in @cw all at once, so cache misses
+ * of the index descends overlap.
+ */
+static void
+cache_req_process_batch(TfwCWork *cw, int n)
+{
+	int i;
+	unsigned long keys[TDB_BATCH_MAX];
+
+	for (i = 0; i < n; ++i)
+		keys[i] = cw[i].key;
+
+	tdb_rec_get_batch(node_db(), keys, n, cache_req_batch_cb, cw);
 }
 
 /*
@@ -1225,7 +1300,8 @@ static void
 tfw_wq_tasklet(unsigned long data)
 {
 	TfwWorkTasklet *ct = (TfwWorkTasklet *)data;
-	TfwCWork cw;
+	TfwCWork cw, lw[TDB_BATCH_MAX];
+	int n = 0;
 
 	while (!tfw_wq_pop(&ct->wq, &cw)) {
 		if (cw.resp) {
@@ -1233,9 +1309,16 @@ tfw_wq_tasklet(unsigned long data)
 		} else if (cw.req->method == TFW_HTTP_METH_PURGE) {
 			tfw_cache_purge_method(cw.req, cw.key);
 		} else {
-			cache_req_process_node(cw.req, cw.key, cw.action);
+			/* The work comes in bursts, so batch the lookups. */
+			lw[n++] = cw;
+			if (n == TDB_BATCH_MAX) {
+				cache_req_process_batch(lw, n);
+				n = 0;
+			}
 		}
 	}
+	if (n)
+		cache_req_process_batch(lw, n);
 }
 
 /**
@@ -1277,6 +1360,7 @@ tfw_cache_start(void)
 					 cache_cfg.db_size, 0, i);
 		if (!c_nodes[i].db)
 			goto close_db;
+		tdb_set_reloc(c_nodes[i].db, &tfw_cache_reloc_ops);
 	}
 
 	cache_mgr_thr = kthread_run(tfw_cache_mgr, NULL, "tfw_cache_mgr");
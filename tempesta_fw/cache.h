@@ -25,5 +25,7 @@
 
 int tfw_cache_process(TfwHttpReq *req, TfwHttpResp *resp,
 		      tfw_http_cache_cb_t action);
+void tfw_cache_process_batch(struct list_head *batch,
+			     tfw_http_cache_cb_t action);
 
 #endif /* __TFW_CACHE_H__ */
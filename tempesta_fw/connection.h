@@ -46,6 +46,9 @@ enum {
 	/* HTTPS */
 	Conn_HttpsClnt	= Conn_Clnt | TFW_FSM_HTTPS,
 	Conn_HttpsSrv	= Conn_Srv | TFW_FSM_HTTPS,
+
+	/* HTTP/2, client side only */
+	Conn_Http2Clnt	= Conn_Clnt | TFW_FSM_HTTP2,
 };
 
 #define TFW_CONN_TYPE2IDX(t)	TFW_FSM_TYPE(t)
@@ -80,6 +83,7 @@ enum {
  * @msg		- message that is currently being processed;
  * @peer	- TfwClient or TfwServer handler;
  * @sk		- an appropriate sock handler;
+ * @proto_ctx	- connection context of the protocol handler, if any;
  */
 typedef struct {
 	SsProto			proto;
@@ -90,6 +94,7 @@ typedef struct {
 	TfwMsg			*msg;
 	TfwPeer 		*peer;
 	struct sock		*sk;
+	void			*proto_ctx;
 } TfwConnection;
 
 #define TFW_CONN_DEATHCNT	(INT_MIN / 2)
@@ -56,6 +56,8 @@ typedef struct {
 
 static struct {
 	unsigned int	db_size;
+	unsigned int	block_ttl;
+	unsigned int	bloom_keys;
 	const char	*db_path;
 } filter_cfg __read_mostly;
 
@@ -79,11 +81,15 @@ tfw_filter_block_ip(struct in6_addr *addr)
 	};
 	unsigned long key = tfw_ipv6_hash(addr);
 	size_t len = sizeof(rule);
+	TdbRec *rec;
 
 	/* TODO create records on all NUMA nodes. */
-	if (!tdb_entry_create(ip_filter_db, key, &rule, &len)) {
+	rec = tdb_entry_create(ip_filter_db, key, &rule, &len);
+	if (!rec) {
 		TFW_WARN_ADDR6("cannot create blocking rule", addr);
 	} else {
+		/* The rule is removed by Tempesta DB when it expires. */
+		tdb_rec_set_ttl(ip_filter_db, rec, filter_cfg.block_ttl);
 		TFW_DBG_ADDR6("block client", addr);
 	}
 }
@@ -280,6 +286,10 @@ tfw_filter_start(void)
 	if (!ip_filter_db)
 		return -EINVAL;
 
+	if (filter_cfg.bloom_keys
+	    && tdb_bloom_create(ip_filter_db, filter_cfg.bloom_keys))
+		TFW_WARN("can't create lookup filter for blocking rules\n");
+
 	r = nf_register_hooks(tfw_nf_ops, ARRAY_SIZE(tfw_nf_ops));
 	if (r) {
 		TFW_ERR("can't register netfilter hooks\n");
@@ -318,6 +328,24 @@ static TfwCfgSpec tfw_filter_cfg_specs[] = {
 			.len_range = { 1, PATH_MAX },
 		}
 	},
+	{
+		"filter_block_ttl",
+		"0",
+		tfw_cfg_set_int,
+		&filter_cfg.block_ttl,
+		&(TfwCfgSpecInt) {
+			.range = { 0, INT_MAX },
+		}
+	},
+	{
+		"filter_bloom_keys",
+		"65536",
+		tfw_cfg_set_int,
+		&filter_cfg.bloom_keys,
+		&(TfwCfgSpecInt) {
+			.range = { 0, (1 << 26) },
+		}
+	},
 	{}
 };
 
@@ -82,6 +82,7 @@ enum {
 	/* Protocols */
 	TFW_FSM_HTTP,
 	TFW_FSM_HTTPS,
+	TFW_FSM_HTTP2,
 
 	/* Request connection limiting classifier */
 	TFW_FSM_FRANG,
@@ -40,31 +40,17 @@ tfw_hash_str(const TfwStr *str)
 	else {
 		const TfwStr *c = (TfwStr *)str->ptr;
 		const TfwStr *end = c + TFW_STR_CHUNKN(str);
-		unsigned char *p, *e;
-		unsigned int tail = 0;
+		TdbHashCtx ctx;
 
-		while (c < end) {
-			p = c->ptr;
-			e = p + c->len;
+		/*
+		 * The streaming context keeps track of the data position,
+		 * so chunks of any length give the same hash as plain data.
+		 */
+		__tdb_hash_init(&ctx, TDB_HASH_CRC32C, NULL);
+		for ( ; c < end; ++c)
+			__tdb_hash_update(&ctx, c->ptr, c->len);
 
-			if (tail) {
-				for ( ; tail < 8; ++p, ++tail) {
-					if (unlikely(p == e))
-						goto next_chunk;
-					CRCB(crc0, *p);
-				}
-				for ( ; tail < 16; ++p, ++tail) {
-					if (unlikely(p == e))
-						goto next_chunk;
-					CRCB(crc1, *p);
-				}
-			}
-
-			__tdb_hash_calc(&crc0, &crc1, p, e - p);
-			tail = c->len & 0xf;
-next_chunk:
-			++c;
-		}
+		return __tdb_hash_final(&ctx);
 	}
 
 	return (crc1 << 32) | crc0;
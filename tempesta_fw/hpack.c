@@ -0,0 +1,626 @@
+/**
+ *		Tempesta FW
+ *
+ * HPACK header compression for HTTP/2 (RFC 7541).
+ *
+ * The decoder works on complete header blocks: HTTP/2 layer collects
+ * HEADERS and CONTINUATION frames of a stream, so a header block is always
+ * contiguous here. Huffman strings are decoded by canonical code lengths:
+ * the codes of each length occupy a contiguous range, so the length of the
+ * next code is found by comparing left-justified input bits against the
+ * per-length upper bounds, and the symbol is the code offset within its
+ * length range.
+ *
+ * The encoder never inserts into the dynamic table, so the peer's table
+ * stays empty and responses for different streams can be encoded
+ * concurrently and sent in any order.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/ctype.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+
+#include "hpack.h"
+#include "log.h"
+
+/* The static table, RFC 7541 Appendix A. */
+static const struct {
+	const char	*name;
+	const char	*value;
+} hpack_static[TFW_HPACK_STATIC_N] = {
+	/*  1 */ { ":authority", "" },
+	/*  2 */ { ":method", "GET" },
+	/*  3 */ { ":method", "POST" },
+	/*  4 */ { ":path", "/" },
+	/*  5 */ { ":path", "/index.html" },
+	/*  6 */ { ":scheme", "http" },
+	/*  7 */ { ":scheme", "https" },
+	/*  8 */ { ":status", "200" },
+	/*  9 */ { ":status", "204" },
+	/* 10 */ { ":status", "206" },
+	/* 11 */ { ":status", "304" },
+	/* 12 */ { ":status", "400" },
+	/* 13 */ { ":status", "404" },
+	/* 14 */ { ":status", "500" },
+	/* 15 */ { "accept-charset", "" },
+	/* 16 */ { "accept-encoding", "gzip, deflate" },
+	/* 17 */ { "accept-language", "" },
+	/* 18 */ { "accept-ranges", "" },
+	/* 19 */ { "accept", "" },
+	/* 20 */ { "access-control-allow-origin", "" },
+	/* 21 */ { "age", "" },
+	/* 22 */ { "allow", "" },
+	/* 23 */ { "authorization", "" },
+	/* 24 */ { "cache-control", "" },
+	/* 25 */ { "content-disposition", "" },
+	/* 26 */ { "content-encoding", "" },
+	/* 27 */ { "content-language", "" },
+	/* 28 */ { "content-length", "" },
+	/* 29 */ { "content-location", "" },
+	/* 30 */ { "content-range", "" },
+	/* 31 */ { "content-type", "" },
+	/* 32 */ { "cookie", "" },
+	/* 33 */ { "date", "" },
+	/* 34 */ { "etag", "" },
+	/* 35 */ { "expect", "" },
+	/* 36 */ { "expires", "" },
+	/* 37 */ { "from", "" },
+	/* 38 */ { "host", "" },
+	/* 39 */ { "if-match", "" },
+	/* 40 */ { "if-modified-since", "" },
+	/* 41 */ { "if-none-match", "" },
+	/* 42 */ { "if-range", "" },
+	/* 43 */ { "if-unmodified-since", "" },
+	/* 44 */ { "last-modified", "" },
+	/* 45 */ { "link", "" },
+	/* 46 */ { "location", "" },
+	/* 47 */ { "max-forwards", "" },
+	/* 48 */ { "proxy-authenticate", "" },
+	/* 49 */ { "proxy-authorization", "" },
+	/* 50 */ { "range", "" },
+	/* 51 */ { "referer", "" },
+	/* 52 */ { "refresh", "" },
+	/* 53 */ { "retry-after", "" },
+	/* 54 */ { "server", "" },
+	/* 55 */ { "set-cookie", "" },
+	/* 56 */ { "strict-transport-security", "" },
+	/* 57 */ { "transfer-encoding", "" },
+	/* 58 */ { "user-agent", "" },
+	/* 59 */ { "vary", "" },
+	/* 60 */ { "via", "" },
+	/* 61 */ { "www-authenticate", "" },
+};
+
+/*
+ * Huffman code lengths with the upper bounds of codes of each length,
+ * left-justified to 32 bits, the first code of the length and index of
+ * its symbol in @huff_sym, RFC 7541 Appendix B.
+ */
+static const struct {
+	unsigned long	limit;
+	unsigned int	first;
+	unsigned char	len;
+	unsigned char	off;
+} huff_len[] = {
+	{ 0x50000000UL, 0x00000000,  5,   0 },
+	{ 0xb8000000UL, 0x00000014,  6,  10 },
+	{ 0xf8000000UL, 0x0000005c,  7,  36 },
+	{ 0xfe000000UL, 0x000000f8,  8,  68 },
+	{ 0xff400000UL, 0x000003f8, 10,  74 },
+	{ 0xffa00000UL, 0x000007fa, 11,  79 },
+	{ 0xffc00000UL, 0x00000ffa, 12,  82 },
+	{ 0xfff00000UL, 0x00001ff8, 13,  84 },
+	{ 0xfff80000UL, 0x00003ffc, 14,  90 },
+	{ 0xfffe0000UL, 0x00007ffc, 15,  92 },
+	{ 0xfffe6000UL, 0x0007fff0, 19,  95 },
+	{ 0xfffee000UL, 0x000fffe6, 20,  98 },
+	{ 0xffff4800UL, 0x001fffdc, 21, 106 },
+	{ 0xffffb000UL, 0x003fffd2, 22, 119 },
+	{ 0xffffea00UL, 0x007fffd8, 23, 145 },
+	{ 0xfffff600UL, 0x00ffffea, 24, 174 },
+	{ 0xfffff800UL, 0x01ffffec, 25, 186 },
+	{ 0xfffffbc0UL, 0x03ffffe0, 26, 190 },
+	{ 0xfffffe20UL, 0x07ffffde, 27, 205 },
+	{ 0xfffffff0UL, 0x0fffffe2, 28, 224 },
+	{ 0x100000000UL, 0x3ffffffc, 30, 253 },
+};
+
+/* Symbols sorted by code, the last one is EOS. */
+static const unsigned short huff_sym[257] = {
+	 48,  49,  50,  97,  99, 101, 105, 111,
+	115, 116,  32,  37,  45,  46,  47,  51,
+	 52,  53,  54,  55,  56,  57,  61,  65,
+	 95,  98, 100, 102, 103, 104, 108, 109,
+	110, 112, 114, 117,  58,  66,  67,  68,
+	 69,  70,  71,  72,  73,  74,  75,  76,
+	 77,  78,  79,  80,  81,  82,  83,  84,
+	 85,  86,  87,  89, 106, 107, 113, 118,
+	119, 120, 121, 122,  38,  42,  44,  59,
+	 88,  90,  33,  34,  40,  41,  63,  39,
+	 43, 124,  35,  62,   0,  36,  64,  91,
+	 93, 126,  94, 125,  60,  96, 123,  92,
+	195, 208, 128, 130, 131, 162, 184, 194,
+	224, 226, 153, 161, 167, 172, 176, 177,
+	179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160,
+	163, 164, 169, 170, 173, 178, 181, 185,
+	186, 187, 189, 190, 196, 198, 228, 232,
+	233,   1, 135, 137, 138, 139, 140, 141,
+	143, 147, 149, 150, 151, 152, 155, 157,
+	158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239,   9, 142,
+	144, 145, 148, 159, 171, 206, 215, 225,
+	236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219,
+	238, 240, 242, 243, 255, 203, 204, 211,
+	212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254,
+	  2,   3,   4,   5,   6,   7,   8,  11,
+	 12,  14,  15,  16,  17,  18,  19,  20,
+	 21,  23,  24,  25,  26,  27,  28,  29,
+	 30,  31, 127, 220, 249,  10,  13,  22,
+	256,
+};
+
+#define HPACK_DYN_SLOTS(hp)	((hp)->limit / TFW_HPACK_ENTRY_OVERHEAD)
+#define HPACK_ENTRY_SIZE(e)	((e)->nlen + (e)->vlen			\
+				 + TFW_HPACK_ENTRY_OVERHEAD)
+/* Huffman strings are at most 8/5 of their encoded size. */
+#define HPACK_HUFF_MAX(len)	((len) * 8 / 5 + 1)
+
+/*
+ * ------------------------------------------------------------------------
+ *	Decoder
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * Decode an integer with @prefix bits prefix, RFC 7541 5.1. Values which
+ * don't fit 28 bits are rejected: no sane header block has them.
+ */
+static int
+__hpack_get_int(const unsigned char **p, const unsigned char *end, int prefix,
+		unsigned long *v)
+{
+	unsigned long max = (1 << prefix) - 1;
+	unsigned int m = 0;
+	unsigned char c;
+
+	*v = *(*p)++ & max;
+	if (*v < max)
+		return 0;
+
+	do {
+		if (*p == end || m > 21)
+			return -EINVAL;
+		c = *(*p)++;
+		*v += (unsigned long)(c & 0x7f) << m;
+		m += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+/**
+ * Decode Huffman string @src of length @len to @dst, RFC 7541 5.2.
+ * @return length of the decoded string or negative value on error.
+ */
+static long
+__hpack_huff_decode(const unsigned char *src, size_t len, unsigned char *dst)
+{
+	int i, bits = 0;
+	unsigned long acc = 0, w;
+	unsigned int code, sym;
+	const unsigned char *end = src + len;
+	unsigned char *d = dst;
+
+	while (1) {
+		while (bits <= 56 && src < end) {
+			acc |= (unsigned long)*src++ << (56 - bits);
+			bits += 8;
+		}
+		if (!bits)
+			break;
+
+		w = acc >> 32;
+		for (i = 0; w >= huff_len[i].limit; ++i)
+			;
+		if (huff_len[i].len > bits) {
+			/* Padding must be up to 7 most significant bits of EOS. */
+			if (bits > 7 || w != (((1UL << bits) - 1) << (32 - bits)))
+				return -EINVAL;
+			break;
+		}
+
+		code = w >> (32 - huff_len[i].len);
+		sym = huff_sym[huff_len[i].off + code - huff_len[i].first];
+		if (unlikely(sym == 256))
+			return -EINVAL;
+		*d++ = sym;
+
+		acc <<= huff_len[i].len;
+		bits -= huff_len[i].len;
+	}
+
+	return d - dst;
+}
+
+/**
+ * Decode string literal, RFC 7541 5.2. Raw strings are referenced in place
+ * while Huffman strings are decoded to @*buf which is advanced.
+ */
+static int
+__hpack_get_str(const unsigned char **p, const unsigned char *end,
+		unsigned char **buf, TfwStr *s)
+{
+	long n;
+	bool huff;
+	unsigned long len;
+
+	if (*p == end)
+		return -EINVAL;
+	huff = **p & 0x80;
+	if (__hpack_get_int(p, end, 7, &len) || len > end - *p)
+		return -EINVAL;
+
+	if (!huff) {
+		s->ptr = (void *)*p;
+		s->len = len;
+	} else {
+		n = __hpack_huff_decode(*p, len, *buf);
+		if (n < 0)
+			return n;
+		s->ptr = *buf;
+		s->len = n;
+		*buf += n;
+	}
+	*p += len;
+
+	return 0;
+}
+
+static TfwHPackEntry *
+__hpack_dyn_entry(TfwHPack *hp, unsigned int i)
+{
+	unsigned int slots = HPACK_DYN_SLOTS(hp);
+
+	return hp->ent[(hp->head + slots - i) % slots];
+}
+
+/**
+ * Find header field by index @idx in the static and dynamic tables.
+ */
+static int
+__hpack_lookup(TfwHPack *hp, unsigned long idx, TfwStr *name, TfwStr *value)
+{
+	TfwHPackEntry *e;
+
+	if (!idx)
+		return -EINVAL;
+	if (idx <= TFW_HPACK_STATIC_N) {
+		name->ptr = (void *)hpack_static[idx - 1].name;
+		name->len = strlen(hpack_static[idx - 1].name);
+		value->ptr = (void *)hpack_static[idx - 1].value;
+		value->len = strlen(hpack_static[idx - 1].value);
+		return 0;
+	}
+	idx -= TFW_HPACK_STATIC_N + 1;
+	if (idx >= hp->n)
+		return -EINVAL;
+
+	e = __hpack_dyn_entry(hp, idx);
+	name->ptr = e->data;
+	name->len = e->nlen;
+	value->ptr = e->data + e->nlen;
+	value->len = e->vlen;
+
+	return 0;
+}
+
+/**
+ * Evict the oldest entries until the table size isn't greater than @size,
+ * RFC 7541 4.3 and 4.4.
+ */
+static void
+__hpack_evict(TfwHPack *hp, unsigned int size)
+{
+	TfwHPackEntry **e;
+
+	while (hp->n && hp->size > size) {
+		e = &hp->ent[(hp->head + HPACK_DYN_SLOTS(hp) - hp->n + 1)
+			     % HPACK_DYN_SLOTS(hp)];
+		hp->size -= HPACK_ENTRY_SIZE(*e);
+		kfree(*e);
+		*e = NULL;
+		--hp->n;
+	}
+}
+
+/**
+ * Add a copy of the header field to the dynamic table. The field may refer
+ * an entry evicted by the insertion, so the copy is made first. If the entry
+ * is larger than the table, then the table is just emptied and false is
+ * returned: the caller must free the entry.
+ */
+static bool
+__hpack_insert(TfwHPack *hp, TfwHPackEntry *e)
+{
+	unsigned int sz = HPACK_ENTRY_SIZE(e);
+
+	if (sz > hp->max_size) {
+		__hpack_evict(hp, 0);
+		return false;
+	}
+	__hpack_evict(hp, hp->max_size - sz);
+
+	hp->head = (hp->head + 1) % HPACK_DYN_SLOTS(hp);
+	hp->ent[hp->head] = e;
+	hp->size += sz;
+	++hp->n;
+
+	return true;
+}
+
+static int
+__hpack_buf_reserve(TfwHPack *hp, size_t len)
+{
+	size_t sz = HPACK_HUFF_MAX(len);
+
+	if (sz <= hp->buf_sz)
+		return 0;
+
+	sz = roundup_pow_of_two(sz);
+	kfree(hp->buf);
+	hp->buf = kmalloc(sz, GFP_ATOMIC);
+	if (!hp->buf) {
+		hp->buf_sz = 0;
+		return -ENOMEM;
+	}
+	hp->buf_sz = sz;
+
+	return 0;
+}
+
+/**
+ * Decode header block @src of length @len and call @cb for each header field.
+ *
+ * @return zero on success, -EINVAL for malformed block (the connection must
+ * be closed with COMPRESSION_ERROR since the decoder state is broken),
+ * -ENOMEM or non-zero value returned by @cb.
+ */
+int
+tfw_hpack_decode(TfwHPack *hp, const unsigned char *src, size_t len,
+		 tfw_hpack_field_cb_t cb, void *data)
+{
+	int r;
+	bool fields = false;
+	unsigned long idx;
+	const unsigned char *p = src, *end = src + len;
+
+	/* A field can't be longer than the block, see __hpack_get_str(). */
+	if (__hpack_buf_reserve(hp, len))
+		return -ENOMEM;
+
+	while (p < end) {
+		unsigned char *buf = hp->buf;
+		TfwStr name = { 0 }, value = { 0 };
+		TfwHPackEntry *e = NULL;
+
+		if (*p & 0x80) {
+			/* Indexed Header Field Representation, 6.1. */
+			if (__hpack_get_int(&p, end, 7, &idx)
+			    || __hpack_lookup(hp, idx, &name, &value))
+				return -EINVAL;
+		} else if ((*p & 0xe0) == 0x20) {
+			/* Dynamic Table Size Update, 6.3. */
+			if (fields || __hpack_get_int(&p, end, 5, &idx)
+			    || idx > hp->limit)
+				return -EINVAL;
+			hp->max_size = idx;
+			__hpack_evict(hp, idx);
+			continue;
+		} else {
+			/*
+			 * Literal Header Field with Incremental Indexing,
+			 * without Indexing or Never Indexed, 6.2.
+			 */
+			bool index = *p & 0x40;
+			TfwStr dummy;
+
+			if (__hpack_get_int(&p, end, index ? 6 : 4, &idx))
+				return -EINVAL;
+			r = idx ? __hpack_lookup(hp, idx, &name, &dummy)
+				: __hpack_get_str(&p, end, &buf, &name);
+			if (r || __hpack_get_str(&p, end, &buf, &value))
+				return -EINVAL;
+
+			if (index) {
+				e = kmalloc(sizeof(*e) + name.len + value.len,
+					    GFP_ATOMIC);
+				if (!e)
+					return -ENOMEM;
+				e->nlen = name.len;
+				e->vlen = value.len;
+				memcpy(e->data, name.ptr, name.len);
+				memcpy(e->data + name.len, value.ptr, value.len);
+				name.ptr = e->data;
+				value.ptr = e->data + e->nlen;
+				if (__hpack_insert(hp, e))
+					e = NULL;
+			}
+		}
+
+		fields = true;
+		r = cb(data, &name, &value);
+		kfree(e);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(tfw_hpack_decode);
+
+/**
+ * Initialize decoder @hp with dynamic table size @limit which the encoder
+ * of the peer can't exceed.
+ */
+int
+tfw_hpack_init(TfwHPack *hp, unsigned int limit)
+{
+	memset(hp, 0, sizeof(*hp));
+	hp->max_size = hp->limit = limit;
+
+	if (limit < TFW_HPACK_ENTRY_OVERHEAD)
+		return 0;
+	hp->ent = kcalloc(HPACK_DYN_SLOTS(hp), sizeof(*hp->ent), GFP_ATOMIC);
+	if (!hp->ent)
+		return -ENOMEM;
+
+	return 0;
+}
+EXPORT_SYMBOL(tfw_hpack_init);
+
+void
+tfw_hpack_destroy(TfwHPack *hp)
+{
+	__hpack_evict(hp, 0);
+	kfree(hp->ent);
+	kfree(hp->buf);
+}
+EXPORT_SYMBOL(tfw_hpack_destroy);
+
+/*
+ * ------------------------------------------------------------------------
+ *	Encoder
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * Encode integer @v with @prefix bits prefix, the other bits of the first
+ * octet are taken from @flags, RFC 7541 5.1.
+ */
+unsigned char *
+tfw_hpack_encode_int(unsigned char *dst, unsigned long v, int prefix,
+		     unsigned char flags)
+{
+	unsigned long max = (1 << prefix) - 1;
+
+	if (v < max) {
+		*dst++ = flags | v;
+		return dst;
+	}
+
+	*dst++ = flags | max;
+	for (v -= max; v >= 0x80; v >>= 7)
+		*dst++ = (v & 0x7f) | 0x80;
+	*dst++ = v;
+
+	return dst;
+}
+EXPORT_SYMBOL(tfw_hpack_encode_int);
+
+/**
+ * Find static table index of a regular (not pseudo) header field @name
+ * regardless of its case. @return zero if there is no such name.
+ */
+int
+tfw_hpack_static_name(const char *name, size_t len)
+{
+	int i;
+
+	/* Skip the pseudo-header fields. */
+	for (i = 14; i < TFW_HPACK_STATIC_N; ++i)
+		if (!strncasecmp(hpack_static[i].name, name, len)
+		    && !hpack_static[i].name[len])
+			return i + 1;
+
+	return 0;
+}
+EXPORT_SYMBOL(tfw_hpack_static_name);
+
+/**
+ * Encode :status pseudo-header field. The most frequent codes are in the
+ * static table, others are encoded as literals with the static name.
+ * @dst must have room for at least 5 bytes.
+ */
+unsigned char *
+tfw_hpack_encode_status(unsigned char *dst, unsigned short status)
+{
+	switch (status) {
+	case 200:
+		*dst++ = 0x80 | 8;
+		return dst;
+	case 204:
+		*dst++ = 0x80 | 9;
+		return dst;
+	case 206:
+		*dst++ = 0x80 | 10;
+		return dst;
+	case 304:
+		*dst++ = 0x80 | 11;
+		return dst;
+	case 400:
+		*dst++ = 0x80 | 12;
+		return dst;
+	case 404:
+		*dst++ = 0x80 | 13;
+		return dst;
+	case 500:
+		*dst++ = 0x80 | 14;
+		return dst;
+	}
+
+	/* Literal Header Field without Indexing, indexed name :status. */
+	*dst++ = 8;
+	*dst++ = 3;
+	*dst++ = '0' + status / 100 % 10;
+	*dst++ = '0' + status / 10 % 10;
+	*dst++ = '0' + status % 10;
+
+	return dst;
+}
+EXPORT_SYMBOL(tfw_hpack_encode_status);
+
+/**
+ * Encode a header field as a literal without indexing, RFC 7541 6.2.2.
+ * The name is referenced by static table index if possible, otherwise it's
+ * written in lower case as HTTP/2 requires. Huffman coding isn't used.
+ * @dst must have room for TFW_HPACK_HDR_MAX(nlen, vlen) bytes.
+ */
+unsigned char *
+tfw_hpack_encode_hdr(unsigned char *dst, const char *name, size_t nlen,
+		     const char *value, size_t vlen)
+{
+	size_t i;
+	int idx = tfw_hpack_static_name(name, nlen);
+
+	if (idx) {
+		dst = tfw_hpack_encode_int(dst, idx, 4, 0);
+	} else {
+		*dst++ = 0;
+		dst = tfw_hpack_encode_int(dst, nlen, 7, 0);
+		for (i = 0; i < nlen; ++i)
+			*dst++ = tolower(name[i]);
+	}
+	dst = tfw_hpack_encode_int(dst, vlen, 7, 0);
+	memcpy(dst, value, vlen);
+
+	return dst + vlen;
+}
+EXPORT_SYMBOL(tfw_hpack_encode_hdr);
@@ -0,0 +1,102 @@
+/**
+ *		Tempesta FW
+ *
+ * HPACK header compression for HTTP/2 (RFC 7541).
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __TFW_HPACK_H__
+#define __TFW_HPACK_H__
+
+#include "str.h"
+
+/* Default SETTINGS_HEADER_TABLE_SIZE, RFC 7540 6.5.2. */
+#define TFW_HPACK_TABLE_SIZE		4096
+/* Size of a dynamic table entry in addition to its name and value. */
+#define TFW_HPACK_ENTRY_OVERHEAD	32
+/* Number of entries in the static table, RFC 7541 Appendix A. */
+#define TFW_HPACK_STATIC_N		61
+
+/**
+ * Dynamic table entry.
+ *
+ * @nlen	- length of the header field name;
+ * @vlen	- length of the header field value;
+ * @data	- the name immediately followed by the value;
+ */
+typedef struct {
+	unsigned int		nlen;
+	unsigned int		vlen;
+	char			data[0];
+} TfwHPackEntry;
+
+/**
+ * HPACK decoder context, one for each HTTP/2 connection.
+ *
+ * The dynamic table is a ring of entries, the newest entry is at @head
+ * and has the lowest dynamic index.
+ *
+ * @ent		- the dynamic table ring;
+ * @head	- ring slot of the newest entry;
+ * @n		- number of entries in the dynamic table;
+ * @size	- current table size as defined by RFC 7541 4.1;
+ * @max_size	- maximum table size set by the encoder;
+ * @limit	- upper bound for @max_size announced in our SETTINGS;
+ * @buf		- scratch buffer for Huffman decoded strings;
+ * @buf_sz	- size of @buf;
+ */
+typedef struct {
+	TfwHPackEntry		**ent;
+	unsigned int		head;
+	unsigned int		n;
+	unsigned int		size;
+	unsigned int		max_size;
+	unsigned int		limit;
+	unsigned char		*buf;
+	unsigned int		buf_sz;
+} TfwHPack;
+
+/*
+ * The callback is called for each decoded header field in order of
+ * appearance. @name and @value are plain strings valid until the callback
+ * returns; a non-zero return value stops decoding and is returned as is.
+ */
+typedef int (*tfw_hpack_field_cb_t)(void *data, const TfwStr *name,
+				    const TfwStr *value);
+
+int tfw_hpack_init(TfwHPack *hp, unsigned int limit);
+void tfw_hpack_destroy(TfwHPack *hp);
+int tfw_hpack_decode(TfwHPack *hp, const unsigned char *src, size_t len,
+		     tfw_hpack_field_cb_t cb, void *data);
+
+/*
+ * Maximum length of a header field encoded by tfw_hpack_encode_hdr():
+ * a representation octet, name and value lengths of up to 6 octets each and
+ * the strings themselves.
+ */
+#define TFW_HPACK_HDR_MAX(nlen, vlen)	((nlen) + (vlen) + 13)
+
+int tfw_hpack_static_name(const char *name, size_t len);
+unsigned char *tfw_hpack_encode_int(unsigned char *dst, unsigned long v,
+				    int prefix, unsigned char flags);
+unsigned char *tfw_hpack_encode_status(unsigned char *dst,
+				       unsigned short status);
+unsigned char *tfw_hpack_encode_hdr(unsigned char *dst, const char *name,
+				    size_t nlen, const char *value,
+				    size_t vlen);
+
+#endif /* __TFW_HPACK_H__ */
@@ -24,6 +24,7 @@
 #include "classifier.h"
 #include "client.h"
 #include "hash.h"
+#include "http2.h"
 #include "http_msg.h"
 #include "http_sticky.h"
 #include "log.h"
@@ -49,12 +50,10 @@ int ghprio; /* GFSM hook priority. */
 #define S_504			"HTTP/1.1 504 Gateway Timeout"
 
 #define S_F_HOST		"Host: "
-#define S_F_DATE		"Date: "
 #define S_F_CONTENT_LENGTH	"Content-Length: "
 #define S_F_LOCATION		"Location: "
 #define S_F_CONNECTION		"Connection: "
 
-#define S_V_DATE		"Sun, 06 Nov 1994 08:49:37 GMT"
 #define S_V_CONTENT_LENGTH	"9999"
 #define S_V_CONN_CLOSE		"close"
 #define S_V_CONN_KA		"keep-alive"
@@ -66,7 +65,7 @@ int ghprio; /* GFSM hook priority. */
  * Prepare current date in the format required for HTTP "Date:"
  * header field. See RFC 2616 section 3.3.
  */
-static void
+void
 tfw_http_prep_date_from(char *buf, time_t date)
 {
 	struct tm tm;
@@ -205,6 +204,19 @@ tfw_http_prep_302(TfwHttpMsg *resp, TfwHttpMsg *hmreq, TfwStr *cookie)
 	return TFW_PASS;
 }
 
+/*
+ * Send response @resp to the client of request @hmreq. Responses to requests
+ * received over HTTP/2 are converted to frames of the request stream.
+ */
+int
+tfw_http_resp_send(TfwHttpMsg *hmreq, TfwHttpMsg *resp)
+{
+	if (TFW_CONN_TYPE2IDX(TFW_CONN_TYPE(hmreq->conn)) == TFW_FSM_HTTP2)
+		return tfw_h2_resp_send((TfwHttpReq *)hmreq, resp);
+
+	return tfw_cli_conn_send(hmreq->conn, (TfwMsg *)resp);
+}
+
 static inline void
 __init_req_ss_flags(TfwHttpReq *req)
 {
@@ -253,7 +265,7 @@ tfw_http_send_resp(TfwHttpMsg *hmreq, TfwStr *msg, const TfwStr *date)
 
 	__init_resp_ss_flags((TfwHttpResp *)&resp, (TfwHttpReq *)hmreq);
 
-	return tfw_cli_conn_send(hmreq->conn, (TfwMsg *)&resp);
+	return tfw_http_resp_send(hmreq, &resp);
 }
 
 #define S_200_PART_01	S_200 S_CRLF S_F_DATE
@@ -779,7 +791,7 @@ tfw_http_req_cache_cb(TfwHttpReq *req, TfwHttpResp *resp)
 		 */
 		if (tfw_http_adjust_resp(resp, req))
 			goto resp_err;
-		if (tfw_cli_conn_send(req->conn, (TfwMsg *)resp))
+		if (tfw_http_resp_send((TfwHttpMsg *)req, (TfwHttpMsg *)resp))
 			goto resp_err;
 		TFW_INC_STAT_BH(clnt.msgs_fromcache);
 resp_out:
@@ -866,6 +878,36 @@ tfw_http_req_set_context(TfwHttpReq *req)
 }
 
 /**
+ * Pass requests parsed from the same SKB to the cache and, through it,
+ * to the scheduler. The requests are already unlinked from the client
+ * connection and aren't referenced by anything else.
+ */
+static void
+tfw_http_req_process_batch(struct list_head *batch)
+{
+	TfwMsg *msg, *tmp;
+
+	tfw_cache_process_batch(batch, tfw_http_req_cache_cb);
+
+	/*
+	 * The requests left couldn't be passed to the cache. They should
+	 * be released, otherwise we lose the references to them.
+	 */
+	list_for_each_entry_safe(msg, tmp, batch, msg_list) {
+		list_del_init(&msg->msg_list);
+		tfw_http_send_500((TfwHttpMsg *)msg);
+		tfw_http_conn_msg_free((TfwHttpMsg *)msg);
+		TFW_INC_STAT_BH(clnt.msgs_otherr);
+	}
+}
+
+/**
+ * Parse all pipelined requests in @skb and collect the complete ones in
+ * a batch, then pass the batch to the cache at once. The cache queues the
+ * whole batch to one CPU and wakes it up once, so the lookups are done in
+ * a batch too. Requests received before an invalid one are processed
+ * as usual.
+ *
  * @return zero on success and negative value otherwise.
  * TODO enter the function depending on current GFSM state.
  */
@@ -875,6 +917,7 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 	int r = TFW_BLOCK;
 	unsigned int data_off = off;
 	unsigned int skb_len = skb->len;
+	LIST_HEAD(batch);
 
 	BUG_ON(!conn->msg);
 	BUG_ON(data_off >= skb_len);
@@ -920,14 +963,14 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 		case TFW_BLOCK:
 			TFW_DBG2("Block invalid HTTP request\n");
 			TFW_INC_STAT_BH(clnt.msgs_parserr);
-			return TFW_BLOCK;
+			goto out;
 		case TFW_POSTPONE:
 			r = tfw_gfsm_move(&hmreq->msg.state,
 					  TFW_HTTP_FSM_REQ_CHUNK, skb, off);
 			TFW_DBG3("TFW_HTTP_FSM_REQ_CHUNK return code %d\n", r);
 			if (r == TFW_BLOCK) {
 				TFW_INC_STAT_BH(clnt.msgs_filtout);
-				return TFW_BLOCK;
+				goto out;
 			}
 			/*
 			 * TFW_POSTPONE status means that parsing succeeded
@@ -935,7 +978,8 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 			 * just supply data for parsing. They only want to know
 			 * if processing of a message should continue or not.
 			 */
-			return TFW_PASS;
+			r = TFW_PASS;
+			goto out;
 		case TFW_PASS:
 			/*
 			 * The request is fully parsed,
@@ -950,7 +994,7 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 		/* Don't accept any following requests from the peer. */
 		if (r == TFW_BLOCK) {
 			TFW_INC_STAT_BH(clnt.msgs_filtout);
-			return TFW_BLOCK;
+			goto out;
 		}
 
 		/*
@@ -960,8 +1004,10 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 		hmreq->cache_ctl.timestamp = tfw_current_timestamp();
 
 		/* Assign the right Vhost for this request. */
-		if (tfw_http_req_set_context((TfwHttpReq *)hmreq))
-			return TFW_BLOCK;
+		if (tfw_http_req_set_context((TfwHttpReq *)hmreq)) {
+			r = TFW_BLOCK;
+			goto out;
+		}
 
 		/*
 		 * In HTTP 0.9 the server always closes the connection
@@ -992,10 +1038,7 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 		 * The request has been successfully parsed and processed.
 		 * If the connection will be closed after the response to
 		 * the request is sent to the client, then there's no need
-		 * to process pipelined requests. Also, the request may be
-		 * released when handled in tfw_cache_req_process() below.
-		 * So, save the needed request flag for later use as it
-		 * may not be accessible later through @req->flags.
+		 * to process pipelined requests.
 		 */
 		req_conn_close = (hmreq->flags & TFW_HTTP_CONN_CLOSE);
 
@@ -1017,7 +1060,8 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 				TFW_WARN("Not enough memory to create"
 					 " a request sibling\n");
 				TFW_INC_STAT_BH(clnt.msgs_otherr);
-				return TFW_BLOCK;
+				r = TFW_BLOCK;
+				goto out;
 			}
 		}
 
@@ -1031,19 +1075,7 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 		 * which can be used to release it.
 		 */
 		tfw_connection_unlink_msg(conn);
-
-		/*
-		 * The request should either be stored or released.
-		 * Otherwise we lose the reference to it and get a leak.
-		 */
-		if (tfw_cache_process((TfwHttpReq *)hmreq, NULL,
-				      tfw_http_req_cache_cb))
-		{
-			tfw_http_send_500(hmreq);
-			tfw_http_conn_msg_free(hmreq);
-			TFW_INC_STAT_BH(clnt.msgs_otherr);
-			return TFW_PASS;
-		}
+		list_add_tail(&hmreq->msg.msg_list, &batch);
 
 		/*
 		 * According to RFC 7230 6.3.2, connection with a client
@@ -1051,12 +1083,11 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 		 * if the client sends "Connection: close" header field in
 		 * the request. Subsequent requests from the client coming
 		 * over the same connection are ignored.
-		 *
-		 * Note: This connection's @conn must not be dereferenced
-		 * from this point on.
 		 */
-		if (req_conn_close)
-			return TFW_STOP;
+		if (req_conn_close) {
+			r = TFW_STOP;
+			goto out;
+		}
 
 		if (hmsib) {
 			/*
@@ -1068,9 +1099,93 @@ tfw_http_req_process(TfwConnection *conn, struct sk_buff *skb, unsigned int off)
 			conn->msg = (TfwMsg *)hmsib;
 		}
 	}
+out:
+	/*
+	 * Note: This connection's @conn must not be dereferenced
+	 * after the requests are processed.
+	 */
+	tfw_http_req_process_batch(&batch);
+
+	return r;
+}
+
+/**
+ * Process a request received on HTTP/2 stream @stream_id of client connection
+ * @conn. The HTTP/2 layer transcodes the stream to HTTP/1.1 message @data,
+ * so the request is parsed and processed as if it came over HTTP/1.1, but
+ * it's always complete and there are no pipelined requests.
+ *
+ * @return TFW_PASS if the request is passed for processing, TFW_BLOCK if it's
+ * invalid or blocked by a GFSM hook and negative value on other errors.
+ */
+int
+tfw_http_req_h2_process(TfwConnection *conn, unsigned int stream_id,
+			const TfwStr *data)
+{
+	int r = TFW_BLOCK;
+	TfwMsg *h2msg = conn->msg;
+	TfwHttpMsg *hmreq;
+	TfwMsgIter it;
+	struct sk_buff *skb;
+	LIST_HEAD(batch);
+
+	hmreq = tfw_http_msg_create(NULL, &it, Conn_HttpClnt, data->len);
+	if (!hmreq)
+		return -ENOMEM;
+	tfw_http_msg_write(&it, hmreq, data);
+
+	hmreq->conn = conn;
+	tfw_connection_get(conn);
+	tfw_gfsm_state_init(&hmreq->msg.state, conn, TFW_HTTP_FSM_INIT);
+	((TfwHttpReq *)hmreq)->stream_id = stream_id;
+	TFW_INC_STAT_BH(clnt.rx_messages);
+
+	/* GFSM hooks look for the request being processed in @conn->msg. */
+	conn->msg = (TfwMsg *)hmreq;
 
+	for (skb = ss_skb_peek(&hmreq->msg.skb_list); skb;
+	     skb = ss_skb_next(skb))
+	{
+		unsigned int off = 0;
+
+		r = ss_skb_process(skb, &off, tfw_http_parse_req, hmreq);
+		if (r != TFW_POSTPONE)
+			break;
+	}
+	if (r != TFW_PASS || hmreq->parser.to_go
+	    || skb != ss_skb_peek_tail(&hmreq->msg.skb_list))
+	{
+		TFW_DBG2("Block invalid HTTP/2 request\n");
+		TFW_INC_STAT_BH(clnt.msgs_parserr);
+		r = TFW_BLOCK;
+		goto err;
+	}
+	hmreq->msg.len = data->len;
+
+	r = tfw_gfsm_move(&hmreq->msg.state, TFW_HTTP_FSM_REQ_MSG, skb, 0);
+	TFW_DBG3("TFW_HTTP_FSM_REQ_MSG return code %d\n", r);
+	if (r == TFW_BLOCK) {
+		TFW_INC_STAT_BH(clnt.msgs_filtout);
+		goto err;
+	}
+
+	hmreq->cache_ctl.timestamp = tfw_current_timestamp();
+	if (tfw_http_req_set_context((TfwHttpReq *)hmreq)) {
+		r = TFW_BLOCK;
+		goto err;
+	}
+
+	conn->msg = h2msg;
+	list_add_tail(&hmreq->msg.msg_list, &batch);
+	tfw_http_req_process_batch(&batch);
+
+	return TFW_PASS;
+err:
+	conn->msg = h2msg;
+	tfw_http_conn_msg_free(hmreq);
 	return r;
 }
+EXPORT_SYMBOL(tfw_http_req_h2_process);
 
 /**
  * This is the second half of tfw_http_resp_process().
@@ -1094,7 +1209,7 @@ tfw_http_resp_cache_cb(TfwHttpReq *req, TfwHttpResp *resp)
 	if (tfw_http_adjust_resp(resp, req))
 		goto err;
 
-	if (tfw_cli_conn_send(req->conn, (TfwMsg *)resp))
+	if (tfw_http_resp_send((TfwHttpMsg *)req, (TfwHttpMsg *)resp))
 		goto err;
 
 	TFW_INC_STAT_BH(serv.msgs_forwarded);
@@ -1435,7 +1550,11 @@ static TfwConnHooks http_conn_hooks = {
 int __init
 tfw_http_init(void)
 {
-	int r = tfw_gfsm_register_fsm(TFW_FSM_HTTP, tfw_http_msg_process);
+	int r = tfw_http_msg_init();
+	if (r)
+		return r;
+
+	r = tfw_gfsm_register_fsm(TFW_FSM_HTTP, tfw_http_msg_process);
 	if (r)
 		return r;
 
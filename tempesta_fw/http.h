@@ -174,47 +174,211 @@ typedef struct {
 /**
  * Http headers table.
  *
- * Singular headers (in terms of RFC 7230 3.2.2) go first to protect header
- * repetition attacks. See __hdr_is_singular() and don't forget to
- * update the static headers array when add a new singular header here.
+ * Requests and responses have different sets of special headers, which are
+ * stored in the same slots of the headers table: headers common for the both
+ * message types are defined by tfw_http_hdr_t, request and response specific
+ * headers are defined by tfw_http_req_hdr_t and tfw_http_resp_hdr_t
+ * correspondingly. Special headers of other message type, e.g. Server in
+ * a request, are raw headers.
  *
- * Note: don't forget to update __http_msg_hdr_val() upon adding a new header.
+ * Singular headers (in terms of RFC 7230 3.2.2) of each set go first to
+ * protect header repetition attacks. Singularity of raw headers is defined
+ * by khdr_tbl[]. TFW_HTTP_HDR_NONSINGULAR and TFW_HTTP_HDR_RAW can't be
+ * derived from the message specific sets defined later, so they're checked
+ * against the sets in tfw_http_msg_init().
  *
- * Cookie: singular according to RFC 6265 5.4.
+ * Note: don't forget to update req_hdrs[] or resp_hdrs[] upon adding a new
+ * special header.
  *
- * TODO split the enumeration to separate server and client sets to avoid
- * vasting of headers array slots.
+ * Cookie: singular according to RFC 6265 5.4.
  */
 typedef enum {
-	TFW_HTTP_HDR_HOST,
+	/* Singular headers common for requests and responses. */
 	TFW_HTTP_HDR_CONTENT_LENGTH,
+	TFW_HTTP_HDR_CONTENT_LOCATION,
+	TFW_HTTP_HDR_CONTENT_RANGE,
 	TFW_HTTP_HDR_CONTENT_TYPE,
-	TFW_HTTP_HDR_USER_AGENT,
-	TFW_HTTP_HDR_SERVER = TFW_HTTP_HDR_USER_AGENT,
-	TFW_HTTP_HDR_COOKIE,
+	__TFW_HTTP_HDR_SINGULAR_COMMON,
 
-	/* End of list of singular header. */
-	TFW_HTTP_HDR_NONSINGULAR,
+	/* End of list of singular headers. */
+	TFW_HTTP_HDR_NONSINGULAR = 10,
 
+	/* Non-singular headers common for requests and responses. */
 	TFW_HTTP_HDR_CONNECTION = TFW_HTTP_HDR_NONSINGULAR,
-	TFW_HTTP_HDR_X_FORWARDED_FOR,
+	TFW_HTTP_HDR_CACHE_CONTROL,
+	TFW_HTTP_HDR_CONTENT_ENCODING,
+	TFW_HTTP_HDR_CONTENT_LANGUAGE,
+	TFW_HTTP_HDR_KEEP_ALIVE,
+	TFW_HTTP_HDR_TRANSFER_ENCODING,
+	__TFW_HTTP_HDR_NONSINGULAR_COMMON,
 
 	/* Start of list of generic (raw) headers. */
-	TFW_HTTP_HDR_RAW,
+	TFW_HTTP_HDR_RAW = 19,
 
-	TFW_HTTP_HDR_NUM	= 16,
+	/* Initial size of the headers table. */
+	TFW_HTTP_HDR_NUM = 32,
 } tfw_http_hdr_t;
 
+/* Request special headers. */
+typedef enum {
+	TFW_HTTP_HDR_HOST = __TFW_HTTP_HDR_SINGULAR_COMMON,
+	TFW_HTTP_HDR_USER_AGENT,
+	TFW_HTTP_HDR_COOKIE,
+	TFW_HTTP_HDR_IF_MODIFIED_SINCE,
+	TFW_HTTP_HDR_IF_RANGE,
+	TFW_HTTP_HDR_IF_UNMODIFIED_SINCE,
+	__TFW_HTTP_HDR_REQ_SINGULAR,
+
+	TFW_HTTP_HDR_X_FORWARDED_FOR = __TFW_HTTP_HDR_NONSINGULAR_COMMON,
+	TFW_HTTP_HDR_IF_MATCH,
+	TFW_HTTP_HDR_IF_NONE_MATCH,
+	__TFW_HTTP_HDR_REQ_NUM,
+} tfw_http_req_hdr_t;
+
+/* Response special headers. */
+typedef enum {
+	TFW_HTTP_HDR_SERVER = __TFW_HTTP_HDR_SINGULAR_COMMON,
+	TFW_HTTP_HDR_AGE,
+	TFW_HTTP_HDR_DATE,
+	TFW_HTTP_HDR_ETAG,
+	TFW_HTTP_HDR_EXPIRES,
+	TFW_HTTP_HDR_LAST_MODIFIED,
+	__TFW_HTTP_HDR_RESP_SINGULAR,
+
+	TFW_HTTP_HDR_SET_COOKIE = __TFW_HTTP_HDR_NONSINGULAR_COMMON,
+	TFW_HTTP_HDR_VARY,
+	__TFW_HTTP_HDR_RESP_NUM,
+} tfw_http_resp_hdr_t;
+
+/**
+ * Known (standard) header names.
+ *
+ * The names are recognized by minimal perfect hash, see
+ * tfw_http_msg_hdr_known(), and a header stored in raw part of the headers
+ * table is found by its known identifier in O(1) instead of linear scan over
+ * all the raw headers. Special headers are also here since they're raw
+ * headers in messages for which parser doesn't process them specially,
+ * e.g. Cookie in a response.
+ *
+ * Note: don't forget to update khdr_tbl[] upon adding a new header.
+ */
+typedef enum {
+	TFW_HTTP_KHDR_ACCEPT,
+	TFW_HTTP_KHDR_ACCEPT_CHARSET,
+	TFW_HTTP_KHDR_ACCEPT_ENCODING,
+	TFW_HTTP_KHDR_ACCEPT_LANGUAGE,
+	TFW_HTTP_KHDR_ACCEPT_RANGES,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_ALLOW_CREDENTIALS,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_ALLOW_HEADERS,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_ALLOW_METHODS,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_ALLOW_ORIGIN,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_EXPOSE_HEADERS,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_MAX_AGE,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_REQUEST_HEADERS,
+	TFW_HTTP_KHDR_ACCESS_CONTROL_REQUEST_METHOD,
+	TFW_HTTP_KHDR_AGE,
+	TFW_HTTP_KHDR_ALLOW,
+	TFW_HTTP_KHDR_ALT_SVC,
+	TFW_HTTP_KHDR_AUTHORIZATION,
+	TFW_HTTP_KHDR_CACHE_CONTROL,
+	TFW_HTTP_KHDR_CONNECTION,
+	TFW_HTTP_KHDR_CONTENT_DISPOSITION,
+	TFW_HTTP_KHDR_CONTENT_ENCODING,
+	TFW_HTTP_KHDR_CONTENT_LANGUAGE,
+	TFW_HTTP_KHDR_CONTENT_LENGTH,
+	TFW_HTTP_KHDR_CONTENT_LOCATION,
+	TFW_HTTP_KHDR_CONTENT_MD5,
+	TFW_HTTP_KHDR_CONTENT_RANGE,
+	TFW_HTTP_KHDR_CONTENT_SECURITY_POLICY,
+	TFW_HTTP_KHDR_CONTENT_TYPE,
+	TFW_HTTP_KHDR_COOKIE,
+	TFW_HTTP_KHDR_DATE,
+	TFW_HTTP_KHDR_DNT,
+	TFW_HTTP_KHDR_ETAG,
+	TFW_HTTP_KHDR_EXPECT,
+	TFW_HTTP_KHDR_EXPIRES,
+	TFW_HTTP_KHDR_FORWARDED,
+	TFW_HTTP_KHDR_FROM,
+	TFW_HTTP_KHDR_HOST,
+	TFW_HTTP_KHDR_IF_MATCH,
+	TFW_HTTP_KHDR_IF_MODIFIED_SINCE,
+	TFW_HTTP_KHDR_IF_NONE_MATCH,
+	TFW_HTTP_KHDR_IF_RANGE,
+	TFW_HTTP_KHDR_IF_UNMODIFIED_SINCE,
+	TFW_HTTP_KHDR_KEEP_ALIVE,
+	TFW_HTTP_KHDR_LAST_MODIFIED,
+	TFW_HTTP_KHDR_LINK,
+	TFW_HTTP_KHDR_LOCATION,
+	TFW_HTTP_KHDR_MAX_FORWARDS,
+	TFW_HTTP_KHDR_ORIGIN,
+	TFW_HTTP_KHDR_P3P,
+	TFW_HTTP_KHDR_PRAGMA,
+	TFW_HTTP_KHDR_PROXY_AUTHENTICATE,
+	TFW_HTTP_KHDR_PROXY_AUTHORIZATION,
+	TFW_HTTP_KHDR_PROXY_CONNECTION,
+	TFW_HTTP_KHDR_PUBLIC_KEY_PINS,
+	TFW_HTTP_KHDR_RANGE,
+	TFW_HTTP_KHDR_REFERER,
+	TFW_HTTP_KHDR_REFRESH,
+	TFW_HTTP_KHDR_RETRY_AFTER,
+	TFW_HTTP_KHDR_SERVER,
+	TFW_HTTP_KHDR_SET_COOKIE,
+	TFW_HTTP_KHDR_STRICT_TRANSPORT_SECURITY,
+	TFW_HTTP_KHDR_TE,
+	TFW_HTTP_KHDR_TRAILER,
+	TFW_HTTP_KHDR_TRANSFER_ENCODING,
+	TFW_HTTP_KHDR_UPGRADE,
+	TFW_HTTP_KHDR_UPGRADE_INSECURE_REQUESTS,
+	TFW_HTTP_KHDR_USER_AGENT,
+	TFW_HTTP_KHDR_VARY,
+	TFW_HTTP_KHDR_VIA,
+	TFW_HTTP_KHDR_WARNING,
+	TFW_HTTP_KHDR_WWW_AUTHENTICATE,
+	TFW_HTTP_KHDR_X_CONTENT_TYPE_OPTIONS,
+	TFW_HTTP_KHDR_X_CSRF_TOKEN,
+	TFW_HTTP_KHDR_X_FORWARDED_FOR,
+	TFW_HTTP_KHDR_X_FORWARDED_HOST,
+	TFW_HTTP_KHDR_X_FORWARDED_PROTO,
+	TFW_HTTP_KHDR_X_FRAME_OPTIONS,
+	TFW_HTTP_KHDR_X_HTTP_METHOD_OVERRIDE,
+	TFW_HTTP_KHDR_X_POWERED_BY,
+	TFW_HTTP_KHDR_X_REAL_IP,
+	TFW_HTTP_KHDR_X_REQUESTED_WITH,
+	TFW_HTTP_KHDR_X_XSS_PROTECTION,
+
+	TFW_HTTP_KHDR_NUM
+} tfw_http_khdr_t;
+
+/**
+ * Storage of message headers indexed by tfw_http_hdr_t.
+ *
+ * @size	- number of elements in the table;
+ * @off		- index of the first free element;
+ * @kmap	- special header identifiers of the message type by known
+ *		  header identifiers, TFW_HTTP_HDR_RAW for raw headers;
+ * @kidx	- indexes of known headers stored in raw part of the table,
+ *		  zero if there is no such header in the message;
+ * @tbl		- the headers;
+ */
 typedef struct {
-	unsigned int	size;	/* number of elements in the table */
-	unsigned int	off;
-	TfwStr		tbl[0];
+	unsigned int		size;
+	unsigned int		off;
+	const unsigned char	*kmap;
+	unsigned short		kidx[TFW_HTTP_KHDR_NUM];
+	TfwStr			tbl[0];
 } TfwHttpHdrTbl;
 
-#define __HHTBL_SZ(o)			(TFW_HTTP_HDR_NUM * (o))
 #define TFW_HHTBL_EXACTSZ(s)		(sizeof(TfwHttpHdrTbl)		\
 					 + sizeof(TfwStr) * (s))
-#define TFW_HHTBL_SZ(o)			TFW_HHTBL_EXACTSZ(__HHTBL_SZ(o))
+/*
+ * Size classes of the headers table. The initial table of TFW_HTTP_HDR_NUM
+ * headers is allocated with the message, larger tables occupy whole pool
+ * chunks of 1, 2, 4 and so on pages.
+ */
+#define TFW_HHTBL_CLASS(o)		(((PAGE_SIZE << (o))		\
+					  - sizeof(TfwPoolChunk)	\
+					  - sizeof(TfwHttpHdrTbl))	\
+					 / sizeof(TfwStr))
 
 /* Common flags for requests and responses. */
 #define TFW_HTTP_CONN_CLOSE		0x000001
@@ -276,6 +440,7 @@ typedef struct {
  * @tm_header	- time HTTP header started coming;
  * @tm_bchunk	- time previous chunk of HTTP body had come at;
  * @hash	- hash value calculated for the request;
+ * @stream_id	- HTTP/2 stream the request is received on;
  *
  * TfwStr members must be the first for efficient scanning.
  */
@@ -293,6 +458,7 @@ typedef struct {
 	unsigned long		tm_header;
 	unsigned long		tm_bchunk;
 	unsigned long		hash;
+	unsigned int		stream_id;
 } TfwHttpReq;
 
 #define TFW_HTTP_REQ_STR_START(r)	__MSG_STR_START(r)
@@ -351,12 +517,16 @@ bool tfw_http_parse_terminate(TfwHttpMsg *hm);
 
 /* External HTTP functions. */
 int tfw_http_msg_process(void *conn, struct sk_buff *skb, unsigned int off);
+int tfw_http_req_h2_process(TfwConnection *conn, unsigned int stream_id,
+			    const TfwStr *data);
+int tfw_http_resp_send(TfwHttpMsg *hmreq, TfwHttpMsg *resp);
 unsigned long tfw_http_req_key_calc(TfwHttpReq *req);
 
 /*
  * Helper functions for preparation of an HTTP message.
  */
 void tfw_http_prep_hexstring(char *buf, u_char *value, size_t len);
+void tfw_http_prep_date_from(char *buf, time_t date);
 /*
  * Functions to send an HTTP error response to a client.
  */
@@ -0,0 +1,1687 @@
+/**
+ *		Tempesta FW
+ *
+ * HTTP/2 connection layer (RFC 7540).
+ *
+ * The layer handles framing, stream multiplexing and flow control of client
+ * HTTP/2 connections. A request received on a stream is transcoded to an
+ * HTTP/1.1 message and passed to the HTTP layer as is, so HTTP/2 requests go
+ * through the same parser, GFSM hooks, cache and scheduler as HTTP/1.1 ones.
+ * A response to such a request, either from a backend server or from the
+ * cache, is converted back to HEADERS and DATA frames of the stream.
+ *
+ * Only "prior knowledge" cleartext HTTP/2 (h2c) is supported since there is
+ * no TLS and ALPN yet.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <linux/ctype.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <asm/unaligned.h>
+
+#include "client.h"
+#include "connection.h"
+#include "hpack.h"
+#include "http2.h"
+#include "http_msg.h"
+#include "log.h"
+#include "procfs.h"
+
+#define TFW_H2_PREFACE		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define TFW_H2_FRAME_HDR_LEN	9
+/* Our SETTINGS_MAX_FRAME_SIZE, which is the protocol default. */
+#define TFW_H2_FRAME_MAX	16384
+/* Upper bound of SETTINGS_MAX_FRAME_SIZE announced by a peer. */
+#define TFW_H2_FRAME_LIMIT	((1 << 24) - 1)
+/* Our SETTINGS_MAX_CONCURRENT_STREAMS. */
+#define TFW_H2_STREAMS_MAX	128
+/* Initial flow control window size, RFC 7540 6.9.2. */
+#define TFW_H2_WND_DEF		65535
+#define TFW_H2_WND_MAX		0x7fffffff
+/* Limits for a header block and a request body received on a stream. */
+#define TFW_H2_HDR_MAX		(64 << 10)
+#define TFW_H2_BODY_MAX		(1 << 20)
+/* Limit for number of contiguous pieces of a response body. */
+#define TFW_H2_SEG_MAX		(1 << 16)
+
+#define TFW_H2_STREAM_HBITS	6
+#define TFW_H2_STREAM_HASH(id)	(((id) >> 1) & ((1 << TFW_H2_STREAM_HBITS) - 1))
+
+/* Frame types, RFC 7540 6. */
+enum {
+	H2_DATA,
+	H2_HEADERS,
+	H2_PRIORITY,
+	H2_RST_STREAM,
+	H2_SETTINGS,
+	H2_PUSH_PROMISE,
+	H2_PING,
+	H2_GOAWAY,
+	H2_WINDOW_UPDATE,
+	H2_CONTINUATION,
+};
+
+/* Frame flags. */
+#define H2_F_END_STREAM		0x01
+#define H2_F_ACK		0x01
+#define H2_F_END_HEADERS	0x04
+#define H2_F_PADDED		0x08
+#define H2_F_PRIORITY		0x20
+
+/* Error codes, RFC 7540 7. */
+enum {
+	H2_ERR_NO_ERROR,
+	H2_ERR_PROTOCOL,
+	H2_ERR_INTERNAL,
+	H2_ERR_FLOW_CONTROL,
+	H2_ERR_SETTINGS_TIMEOUT,
+	H2_ERR_STREAM_CLOSED,
+	H2_ERR_FRAME_SIZE,
+	H2_ERR_REFUSED_STREAM,
+	H2_ERR_CANCEL,
+	H2_ERR_COMPRESSION,
+	H2_ERR_CONNECT,
+	H2_ERR_ENHANCE_YOUR_CALM,
+	H2_ERR_INADEQUATE_SECURITY,
+	H2_ERR_HTTP_1_1_REQUIRED,
+};
+
+/* SETTINGS parameters, RFC 7540 6.5.2. */
+enum {
+	H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+	H2_SETTINGS_ENABLE_PUSH,
+	H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+	H2_SETTINGS_INITIAL_WINDOW_SIZE,
+	H2_SETTINGS_MAX_FRAME_SIZE,
+	H2_SETTINGS_MAX_HEADER_LIST_SIZE,
+};
+
+/* Connection parsing states. */
+enum {
+	H2_PREFACE,
+	H2_FRAME_HDR,
+	H2_FRAME_PAYLOAD,
+};
+
+/* Stream flags. */
+#define H2_S_CLEN		0x01	/* request has content-length */
+#define H2_S_REQ_DONE		0x02	/* request is passed to HTTP layer */
+#define H2_S_RESP		0x04	/* response headers are sent */
+
+/**
+ * Growable buffer.
+ *
+ * @data	- the buffer;
+ * @len		- length of data in the buffer;
+ * @size	- size of the buffer;
+ */
+typedef struct {
+	char			*data;
+	unsigned int		len;
+	unsigned int		size;
+} TfwH2Buf;
+
+/* Contiguous piece of a response body. */
+typedef struct {
+	char			*ptr;
+	unsigned int		len;
+} TfwH2Seg;
+
+/**
+ * HTTP/2 stream.
+ *
+ * A stream lives in the streams hash of its connection from the end of its
+ * first header block until the response is sent or the stream is reset.
+ * Until @flags has H2_S_REQ_DONE the stream is accessed from receive path
+ * only, after that it can be deleted by response path.
+ *
+ * @hentry	- entry in the streams hash table;
+ * @id		- stream identifier;
+ * @flags	- H2_S_* flags;
+ * @swnd	- flow control window for sending to the peer;
+ * @req		- HTTP/1.1 header of the request being received;
+ * @body	- body of the request being received;
+ * @skbs	- response SKBs referenced by @seg;
+ * @seg		- response body pieces;
+ * @seg_n	- number of pieces in @seg;
+ * @seg_i	- current piece of the response body;
+ * @seg_off	- offset of unsent data in the current piece;
+ * @left	- length of the response body not sent yet;
+ */
+typedef struct {
+	struct hlist_node	hentry;
+	unsigned int		id;
+	unsigned int		flags;
+	long			swnd;
+	TfwH2Buf		req;
+	TfwH2Buf		body;
+	SsSkbList		skbs;
+	TfwH2Seg		*seg;
+	unsigned int		seg_n;
+	unsigned int		seg_i;
+	unsigned int		seg_off;
+	unsigned long		left;
+} TfwH2Stream;
+
+/**
+ * HTTP/2 connection context.
+ *
+ * Frames are processed in softirq of the connection while responses are sent
+ * from the cache and the server connections contexts, so @lock protects the
+ * streams hash, the send windows and sending of HEADERS and DATA frames.
+ *
+ * @msg		- connection message to collect SKBs, must be the first;
+ * @lock	- lock for the streams and the send windows;
+ * @conn	- the client connection;
+ * @hpack	- HPACK decoder context;
+ * @state	- parsing state;
+ * @off		- number of bytes of current preface, header or payload read;
+ * @fhdr	- current frame header;
+ * @len		- current frame payload length;
+ * @type	- current frame type;
+ * @flags	- current frame flags;
+ * @id		- current frame stream identifier;
+ * @buf		- current frame payload;
+ * @hblk	- header block being received in HEADERS and CONTINUATION frames;
+ * @hblk_id	- stream of @hblk or zero if there is no header block;
+ * @hblk_flags	- flags of the HEADERS frame starting @hblk;
+ * @settings	- client SETTINGS frame is received;
+ * @last_id	- the highest stream identifier opened by the client;
+ * @streams_n	- number of streams in the hash;
+ * @swnd	- connection flow control window for sending to the peer;
+ * @init_swnd	- SETTINGS_INITIAL_WINDOW_SIZE of the peer;
+ * @max_frame	- SETTINGS_MAX_FRAME_SIZE of the peer;
+ * @streams	- streams hash table;
+ */
+typedef struct {
+	TfwMsg			msg;
+	spinlock_t		lock;
+	TfwConnection		*conn;
+	TfwHPack		hpack;
+	int			state;
+	unsigned int		off;
+	unsigned char		fhdr[TFW_H2_FRAME_HDR_LEN];
+	unsigned int		len;
+	unsigned char		type;
+	unsigned char		flags;
+	unsigned int		id;
+	unsigned char		*buf;
+	TfwH2Buf		hblk;
+	unsigned int		hblk_id;
+	unsigned char		hblk_flags;
+	bool			settings;
+	unsigned int		last_id;
+	unsigned int		streams_n;
+	long			swnd;
+	long			init_swnd;
+	unsigned int		max_frame;
+	struct hlist_head	streams[1 << TFW_H2_STREAM_HBITS];
+} TfwH2Ctx;
+
+static int
+__h2_buf_add(TfwH2Buf *b, const void *data, unsigned int len,
+	     unsigned int limit)
+{
+	if (b->len + len > limit)
+		return -E2BIG;
+	if (b->len + len > b->size) {
+		unsigned int sz = roundup_pow_of_two(max(b->len + len, 256U));
+		char *p = krealloc(b->data, sz, GFP_ATOMIC);
+		if (!p)
+			return -ENOMEM;
+		b->data = p;
+		b->size = sz;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+
+	return 0;
+}
+
+static void
+__h2_buf_free(TfwH2Buf *b)
+{
+	kfree(b->data);
+	memset(b, 0, sizeof(*b));
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Frames and streams
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * Write a frame with @len bytes of payload to message @hm. If @data is NULL,
+ * then only the frame header is written and the caller writes the payload.
+ */
+static void
+__h2_write_frame(TfwMsgIter *it, TfwHttpMsg *hm, unsigned char type,
+		 unsigned char flags, unsigned int id, const void *data,
+		 unsigned int len)
+{
+	unsigned char hdr[TFW_H2_FRAME_HDR_LEN];
+	TfwStr s = { .ptr = hdr, .len = sizeof(hdr) };
+
+	hdr[0] = len >> 16;
+	hdr[1] = len >> 8;
+	hdr[2] = len;
+	hdr[3] = type;
+	hdr[4] = flags;
+	put_unaligned_be32(id, hdr + 5);
+	tfw_http_msg_write(it, hm, &s);
+
+	if (data && len) {
+		s.ptr = (void *)data;
+		s.len = len;
+		tfw_http_msg_write(it, hm, &s);
+	}
+}
+
+static int
+tfw_h2_send_frame(TfwH2Ctx *ctx, unsigned char type, unsigned char flags,
+		  unsigned int id, const void *data, unsigned int len)
+{
+	TfwHttpMsg hm;
+	TfwMsgIter it;
+
+	if (!tfw_http_msg_create(&hm, &it, Conn_Srv, TFW_H2_FRAME_HDR_LEN + len))
+		return -ENOMEM;
+	__h2_write_frame(&it, &hm, type, flags, id, data, len);
+
+	return tfw_cli_conn_send(ctx->conn, (TfwMsg *)&hm);
+}
+
+/**
+ * Send GOAWAY on a connection error. The connection is closed when
+ * the caller returns TFW_BLOCK.
+ */
+static int
+tfw_h2_conn_error(TfwH2Ctx *ctx, unsigned int err)
+{
+	unsigned char p[8];
+
+	TFW_DBG2("HTTP/2 connection error %u on conn=%p: frame type=%u"
+		 " stream=%u\n", err, ctx->conn, ctx->type, ctx->id);
+
+	put_unaligned_be32(ctx->last_id, p);
+	put_unaligned_be32(err, p + 4);
+	tfw_h2_send_frame(ctx, H2_GOAWAY, 0, 0, p, sizeof(p));
+	TFW_INC_STAT_BH(clnt.msgs_parserr);
+
+	return TFW_BLOCK;
+}
+
+static int
+tfw_h2_wnd_update(TfwH2Ctx *ctx, unsigned int id, unsigned int inc)
+{
+	TfwHttpMsg hm;
+	TfwMsgIter it;
+	unsigned char p[4];
+	size_t len = (TFW_H2_FRAME_HDR_LEN + sizeof(p)) * (id ? 2 : 1);
+
+	if (!tfw_http_msg_create(&hm, &it, Conn_Srv, len))
+		return -ENOMEM;
+	put_unaligned_be32(inc, p);
+	__h2_write_frame(&it, &hm, H2_WINDOW_UPDATE, 0, 0, p, sizeof(p));
+	if (id)
+		__h2_write_frame(&it, &hm, H2_WINDOW_UPDATE, 0, id, p,
+				 sizeof(p));
+
+	return tfw_cli_conn_send(ctx->conn, (TfwMsg *)&hm);
+}
+
+static TfwH2Stream *
+tfw_h2_stream_lookup(TfwH2Ctx *ctx, unsigned int id)
+{
+	TfwH2Stream *s;
+
+	hlist_for_each_entry(s, &ctx->streams[TFW_H2_STREAM_HASH(id)], hentry)
+		if (s->id == id)
+			return s;
+
+	return NULL;
+}
+
+/* Must be called under @ctx->lock. */
+static void
+__h2_stream_del(TfwH2Ctx *ctx, TfwH2Stream *s)
+{
+	hlist_del(&s->hentry);
+	--ctx->streams_n;
+
+	__h2_buf_free(&s->req);
+	__h2_buf_free(&s->body);
+	ss_skb_queue_purge(&s->skbs);
+	kfree(s->seg);
+	kfree(s);
+}
+
+/**
+ * Reset stream @id if it's still alive and send RST_STREAM with @err.
+ * The stream is looked up again since it may be closed by a response.
+ */
+static int
+tfw_h2_stream_close(TfwH2Ctx *ctx, unsigned int id, unsigned int err)
+{
+	TfwH2Stream *s;
+	unsigned char p[4];
+
+	spin_lock(&ctx->lock);
+	s = tfw_h2_stream_lookup(ctx, id);
+	if (s)
+		__h2_stream_del(ctx, s);
+	spin_unlock(&ctx->lock);
+
+	TFW_DBG2("Reset HTTP/2 stream %u with error %u\n", id, err);
+
+	put_unaligned_be32(err, p);
+	tfw_h2_send_frame(ctx, H2_RST_STREAM, 0, id, p, sizeof(p));
+
+	return 0;
+}
+
+/**
+ * Write @n bytes of pending response body of stream @s.
+ */
+static void
+__h2_write_data(TfwMsgIter *it, TfwHttpMsg *hm, TfwH2Stream *s,
+		unsigned int n)
+{
+	TfwStr c = { 0 };
+
+	while (n) {
+		TfwH2Seg *seg = &s->seg[s->seg_i];
+
+		c.ptr = seg->ptr + s->seg_off;
+		c.len = min(n, seg->len - s->seg_off);
+		tfw_http_msg_write(it, hm, &c);
+
+		n -= c.len;
+		s->seg_off += c.len;
+		if (s->seg_off == seg->len) {
+			++s->seg_i;
+			s->seg_off = 0;
+		}
+	}
+}
+
+/**
+ * Send response header block @blk, if it's not NULL, and as much of pending
+ * response body of stream @s as the flow control windows allow. The stream
+ * is deleted when the whole response is sent. Called under @ctx->lock.
+ */
+static int
+tfw_h2_stream_flush(TfwH2Ctx *ctx, TfwH2Stream *s, const unsigned char *blk,
+		    unsigned int blk_len)
+{
+	int r;
+	TfwHttpMsg hm;
+	TfwMsgIter it;
+	unsigned long i, f, n, len = 0, mf = ctx->max_frame;
+	long wnd = min(ctx->swnd, s->swnd);
+	bool end;
+
+	n = min_t(unsigned long, s->left, max(wnd, 0L));
+	end = n == s->left;
+	if (blk)
+		len += blk_len + DIV_ROUND_UP(blk_len, mf) * TFW_H2_FRAME_HDR_LEN;
+	if (n)
+		len += n + DIV_ROUND_UP(n, mf) * TFW_H2_FRAME_HDR_LEN;
+	if (!len)
+		return 0;
+
+	if (!tfw_http_msg_create(&hm, &it, Conn_Srv, len))
+		return -ENOMEM;
+
+	for (i = 0; blk && i < blk_len; i += f) {
+		unsigned char flags = 0;
+
+		f = min(blk_len - i, mf);
+		if (!i && !s->left)
+			flags |= H2_F_END_STREAM;
+		if (i + f == blk_len)
+			flags |= H2_F_END_HEADERS;
+		__h2_write_frame(&it, &hm, i ? H2_CONTINUATION : H2_HEADERS,
+				 flags, s->id, blk + i, f);
+	}
+	for (i = 0; i < n; i += f) {
+		f = min(n - i, mf);
+		__h2_write_frame(&it, &hm, H2_DATA,
+				 end && i + f == n ? H2_F_END_STREAM : 0,
+				 s->id, NULL, f);
+		__h2_write_data(&it, &hm, s, f);
+	}
+	s->left -= n;
+	s->swnd -= n;
+	ctx->swnd -= n;
+
+	r = tfw_cli_conn_send(ctx->conn, (TfwMsg *)&hm);
+	if (end)
+		__h2_stream_del(ctx, s);
+
+	return r;
+}
+
+/**
+ * Send pending response data of all the streams after the send windows
+ * growth. Called under @ctx->lock.
+ */
+static void
+tfw_h2_flush_all(TfwH2Ctx *ctx)
+{
+	int i;
+	TfwH2Stream *s;
+	struct hlist_node *tmp;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->streams) && ctx->swnd > 0; ++i)
+		hlist_for_each_entry_safe(s, tmp, &ctx->streams[i], hentry)
+			if ((s->flags & H2_S_RESP) && s->left && s->swnd > 0)
+				tfw_h2_stream_flush(ctx, s, NULL, 0);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Requests transcoding
+ * ------------------------------------------------------------------------
+ */
+
+enum {
+	H2_PH_METHOD,
+	H2_PH_SCHEME,
+	H2_PH_AUTHORITY,
+	H2_PH_PATH,
+	H2_PH_NUM
+};
+
+static const TfwStr h2_pseudo[H2_PH_NUM] = {
+	[H2_PH_METHOD]		= { .ptr = ":method",	 .len = 7 },
+	[H2_PH_SCHEME]		= { .ptr = ":scheme",	 .len = 7 },
+	[H2_PH_AUTHORITY]	= { .ptr = ":authority", .len = 10 },
+	[H2_PH_PATH]		= { .ptr = ":path",	 .len = 5 },
+};
+
+#define H2_PH_REQUIRED	((1 << H2_PH_METHOD) | (1 << H2_PH_SCHEME)	\
+			 | (1 << H2_PH_PATH))
+
+/**
+ * State of a header block transcoding to HTTP/1.1 request header.
+ *
+ * @s		- the stream, NULL if the fields are decoded and discarded;
+ * @ph		- values of pseudo-header fields;
+ * @ph_off	- offsets of the pseudo-header values in @ph;
+ * @ph_len	- lengths of the pseudo-header values;
+ * @ph_mask	- bitmap of received pseudo-header fields;
+ * @cookie	- values of all cookie header fields;
+ * @regular	- a regular header field is received;
+ * @malformed	- the request is malformed, RFC 7540 8.1.2.6;
+ */
+typedef struct {
+	TfwH2Stream		*s;
+	TfwH2Buf		ph;
+	unsigned int		ph_off[H2_PH_NUM];
+	unsigned int		ph_len[H2_PH_NUM];
+	unsigned int		ph_mask;
+	TfwH2Buf		cookie;
+	bool			regular;
+	bool			malformed;
+} TfwH2ReqConv;
+
+#define H2_NAME_IS(n, s)	((n)->len == SLEN(s)			\
+				 && !memcmp((n)->ptr, s, SLEN(s)))
+
+/* Field names must be lowercase tokens in HTTP/2, RFC 7540 8.1.2. */
+static bool
+__h2_name_valid(const TfwStr *n)
+{
+	const unsigned char *p = n->ptr, *end = p + n->len;
+
+	if (!n->len)
+		return false;
+	for ( ; p < end; ++p)
+		if (*p <= ' ' || *p >= 0x7f || *p == ':'
+		    || (*p >= 'A' && *p <= 'Z'))
+			return false;
+
+	return true;
+}
+
+static bool
+__h2_value_valid(const TfwStr *v, bool pseudo)
+{
+	const unsigned char *p = v->ptr, *end = p + v->len;
+
+	for ( ; p < end; ++p)
+		if (!*p || *p == '\r' || *p == '\n' || (pseudo && *p == ' '))
+			return false;
+
+	return true;
+}
+
+static int
+__h2_req_add(TfwH2ReqConv *conv, const void *data, unsigned int len)
+{
+	return __h2_buf_add(&conv->s->req, data, len, TFW_H2_HDR_MAX);
+}
+
+#define H2_REQ_ADD(conv, s)	__h2_req_add(conv, s, SLEN(s))
+#define H2_PH_ADD(conv, i)	__h2_req_add(conv, (conv)->ph.data	\
+					     + (conv)->ph_off[i],	\
+					     (conv)->ph_len[i])
+
+/**
+ * Write the request line and Host header field built from the pseudo-header
+ * fields. Called when all the pseudo-header fields are received.
+ */
+static int
+__h2_req_line(TfwH2ReqConv *conv)
+{
+	const char *path = conv->ph.data + conv->ph_off[H2_PH_PATH];
+	unsigned int path_len = conv->ph_len[H2_PH_PATH];
+
+	if ((conv->ph_mask & H2_PH_REQUIRED) != H2_PH_REQUIRED
+	    || !conv->ph_len[H2_PH_METHOD] || !path_len
+	    || !(*path == '/' || (path_len == 1 && *path == '*')))
+		return -EINVAL;
+
+	if (H2_PH_ADD(conv, H2_PH_METHOD) || H2_REQ_ADD(conv, " ")
+	    || H2_PH_ADD(conv, H2_PH_PATH) || H2_REQ_ADD(conv, " HTTP/1.1\r\n"))
+		return -ENOMEM;
+	if ((conv->ph_mask & (1 << H2_PH_AUTHORITY))
+	    && (H2_REQ_ADD(conv, "Host: ") || H2_PH_ADD(conv, H2_PH_AUTHORITY)
+		|| H2_REQ_ADD(conv, S_CRLF)))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int
+__h2_req_pseudo(TfwH2ReqConv *conv, const TfwStr *name, const TfwStr *value)
+{
+	int i;
+
+	if (conv->regular || !__h2_value_valid(value, true))
+		return -EINVAL;
+	for (i = 0; i < H2_PH_NUM; ++i)
+		if (name->len == h2_pseudo[i].len
+		    && !memcmp(name->ptr, h2_pseudo[i].ptr, name->len))
+			break;
+	if (i == H2_PH_NUM || (conv->ph_mask & (1 << i)))
+		return -EINVAL;
+
+	conv->ph_mask |= 1 << i;
+	conv->ph_off[i] = conv->ph.len;
+	conv->ph_len[i] = value->len;
+
+	return __h2_buf_add(&conv->ph, value->ptr, value->len, TFW_H2_HDR_MAX);
+}
+
+/**
+ * HPACK callback building HTTP/1.1 request header from a header block.
+ * Decoding never stops on a malformed request since the dynamic table must
+ * be kept in sync with the peer's encoder, the stream is reset after that.
+ */
+static int
+tfw_h2_hdr_cb(void *data, const TfwStr *name, const TfwStr *value)
+{
+	TfwH2ReqConv *conv = data;
+
+	if (!conv->s || conv->malformed)
+		return 0;
+
+	if (name->len && *(char *)name->ptr == ':') {
+		if (__h2_req_pseudo(conv, name, value))
+			goto malformed;
+		return 0;
+	}
+	if (!conv->regular) {
+		conv->regular = true;
+		if (__h2_req_line(conv))
+			goto malformed;
+	}
+
+	if (!__h2_name_valid(name) || !__h2_value_valid(value, false))
+		goto malformed;
+	/* Connection-specific header fields, RFC 7540 8.1.2.2. */
+	if (H2_NAME_IS(name, "connection") || H2_NAME_IS(name, "keep-alive")
+	    || H2_NAME_IS(name, "proxy-connection")
+	    || H2_NAME_IS(name, "transfer-encoding")
+	    || H2_NAME_IS(name, "upgrade"))
+		goto malformed;
+	if (H2_NAME_IS(name, "te")) {
+		if (value->len != SLEN("trailers")
+		    || memcmp(value->ptr, "trailers", SLEN("trailers")))
+			goto malformed;
+		return 0;
+	}
+	/* Cookie fields may be split, RFC 7540 8.1.2.5. */
+	if (H2_NAME_IS(name, "cookie")) {
+		if ((conv->cookie.len
+		     && __h2_buf_add(&conv->cookie, "; ", 2, TFW_H2_HDR_MAX))
+		    || __h2_buf_add(&conv->cookie, value->ptr, value->len,
+				    TFW_H2_HDR_MAX))
+			goto malformed;
+		return 0;
+	}
+	/* The length is set by DATA frames. */
+	if (H2_NAME_IS(name, "content-length")) {
+		conv->s->flags |= H2_S_CLEN;
+		return 0;
+	}
+	if (H2_NAME_IS(name, "host")
+	    && (conv->ph_mask & (1 << H2_PH_AUTHORITY)))
+		return 0;
+
+	if (__h2_req_add(conv, name->ptr, name->len)
+	    || H2_REQ_ADD(conv, ": ")
+	    || __h2_req_add(conv, value->ptr, value->len)
+	    || H2_REQ_ADD(conv, S_CRLF))
+		goto malformed;
+
+	return 0;
+malformed:
+	TFW_DBG2("Malformed HTTP/2 request field '%.*s'\n",
+		 (int)name->len, (char *)name->ptr);
+	conv->malformed = true;
+	return 0;
+}
+
+static int
+__h2_req_finish(TfwH2ReqConv *conv)
+{
+	if (conv->malformed)
+		return -EINVAL;
+	if (!conv->regular && __h2_req_line(conv))
+		return -EINVAL;
+	if (conv->cookie.len
+	    && (H2_REQ_ADD(conv, "Cookie: ")
+		|| __h2_req_add(conv, conv->cookie.data, conv->cookie.len)
+		|| H2_REQ_ADD(conv, S_CRLF)))
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * The request on stream @s is received completely, pass it to HTTP layer.
+ * The stream must not be accessed after that since a response may be sent
+ * and the stream closed right away.
+ */
+static int
+tfw_h2_req_complete(TfwH2Ctx *ctx, TfwH2Stream *s)
+{
+	int r, i, n = 0;
+	char clen[SLEN("Content-Length: \r\n") + 11];
+	unsigned int id = s->id;
+	TfwH2Buf req = s->req, body = s->body;
+	TfwStr c[4], data = { .ptr = c };
+
+	memset(&s->req, 0, sizeof(s->req));
+	memset(&s->body, 0, sizeof(s->body));
+	memset(c, 0, sizeof(c));
+
+	c[n].ptr = req.data;
+	c[n++].len = req.len;
+	if (body.len || (s->flags & H2_S_CLEN)) {
+		c[n].ptr = clen;
+		c[n++].len = sprintf(clen, "Content-Length: %u\r\n", body.len);
+	}
+	c[n].ptr = S_CRLF;
+	c[n++].len = SLEN(S_CRLF);
+	if (body.len) {
+		c[n].ptr = body.data;
+		c[n++].len = body.len;
+	}
+	for (i = 0; i < n; ++i)
+		data.len += c[i].len;
+	__TFW_STR_CHUNKN_SET(&data, n);
+
+	s->flags |= H2_S_REQ_DONE;
+	r = tfw_http_req_h2_process(ctx->conn, id, &data);
+
+	__h2_buf_free(&req);
+	__h2_buf_free(&body);
+
+	if (likely(r == TFW_PASS))
+		return 0;
+	/* The request is freed without a response. */
+	tfw_h2_stream_close(ctx, id, H2_ERR_REFUSED_STREAM);
+
+	return r == TFW_BLOCK ? tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL) : 0;
+}
+
+/**
+ * Header block of a stream is received, decode it. The block either opens
+ * a new stream or carries trailers of a request, which are discarded.
+ */
+static int
+tfw_h2_hblk_done(TfwH2Ctx *ctx)
+{
+	int r;
+	TfwH2Stream *s;
+	TfwH2ReqConv conv = { 0 };
+	unsigned int id = ctx->hblk_id, flags = 0, err = 0;
+	bool trailers = false, end = ctx->hblk_flags & H2_F_END_STREAM;
+
+	ctx->hblk_id = 0;
+
+	spin_lock(&ctx->lock);
+	s = tfw_h2_stream_lookup(ctx, id);
+	if (s)
+		flags = s->flags;
+	spin_unlock(&ctx->lock);
+
+	if (s) {
+		if (flags & H2_S_REQ_DONE) {
+			err = H2_ERR_STREAM_CLOSED;
+			s = NULL;
+		}
+		else if (!end) {
+			return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+		}
+		else {
+			trailers = true;
+		}
+	}
+	else if (id <= ctx->last_id || !(id & 1)) {
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	}
+	else {
+		ctx->last_id = id;
+		if (ctx->streams_n >= TFW_H2_STREAMS_MAX
+		    || !(s = kzalloc(sizeof(*s), GFP_ATOMIC)))
+		{
+			err = H2_ERR_REFUSED_STREAM;
+		} else {
+			s->id = id;
+			s->swnd = ctx->init_swnd;
+			spin_lock(&ctx->lock);
+			hlist_add_head(&s->hentry,
+				       &ctx->streams[TFW_H2_STREAM_HASH(id)]);
+			++ctx->streams_n;
+			spin_unlock(&ctx->lock);
+		}
+	}
+
+	conv.s = trailers ? NULL : s;
+	r = tfw_hpack_decode(&ctx->hpack, ctx->hblk.data, ctx->hblk.len,
+			     tfw_h2_hdr_cb, &conv);
+	if (!r && conv.s)
+		r = __h2_req_finish(&conv) ? 1 : 0;
+	__h2_buf_free(&conv.ph);
+	__h2_buf_free(&conv.cookie);
+
+	if (r < 0)
+		return tfw_h2_conn_error(ctx, H2_ERR_COMPRESSION);
+	if (err)
+		return tfw_h2_stream_close(ctx, id, err);
+	if (r)
+		return tfw_h2_stream_close(ctx, id, H2_ERR_PROTOCOL);
+	if (end)
+		return tfw_h2_req_complete(ctx, s);
+
+	return 0;
+}
+
+static int
+tfw_h2_headers(TfwH2Ctx *ctx)
+{
+	unsigned int off = 0, pad = 0;
+
+	if (!ctx->id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	if (ctx->flags & H2_F_PADDED) {
+		if (!ctx->len)
+			return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+		pad = ctx->buf[off++];
+	}
+	if (ctx->flags & H2_F_PRIORITY)
+		off += 5;
+	if (off + pad > ctx->len)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+
+	ctx->hblk.len = 0;
+	ctx->hblk_id = ctx->id;
+	ctx->hblk_flags = ctx->flags;
+	if (__h2_buf_add(&ctx->hblk, ctx->buf + off, ctx->len - off - pad,
+			 TFW_H2_HDR_MAX))
+		return tfw_h2_conn_error(ctx, H2_ERR_ENHANCE_YOUR_CALM);
+
+	return (ctx->flags & H2_F_END_HEADERS) ? tfw_h2_hblk_done(ctx) : 0;
+}
+
+static int
+tfw_h2_continuation(TfwH2Ctx *ctx)
+{
+	if (!ctx->hblk_id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	if (__h2_buf_add(&ctx->hblk, ctx->buf, ctx->len, TFW_H2_HDR_MAX))
+		return tfw_h2_conn_error(ctx, H2_ERR_ENHANCE_YOUR_CALM);
+
+	return (ctx->flags & H2_F_END_HEADERS) ? tfw_h2_hblk_done(ctx) : 0;
+}
+
+static int
+tfw_h2_data(TfwH2Ctx *ctx)
+{
+	TfwH2Stream *s;
+	unsigned int off = 0, pad = 0, flags = 0;
+	bool end = ctx->flags & H2_F_END_STREAM;
+
+	if (!ctx->id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	if (ctx->flags & H2_F_PADDED) {
+		if (!ctx->len)
+			return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+		pad = ctx->buf[off++];
+		if (off + pad > ctx->len)
+			return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	}
+
+	if (ctx->id > ctx->last_id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+
+	spin_lock(&ctx->lock);
+	s = tfw_h2_stream_lookup(ctx, ctx->id);
+	if (s)
+		flags = s->flags;
+	spin_unlock(&ctx->lock);
+
+	/*
+	 * Requests bodies are limited by TFW_H2_BODY_MAX anyway, so just give
+	 * the peer the credit back right away. The whole frame is counted in
+	 * flow control including the padding, RFC 7540 6.9.1.
+	 */
+	if (!s || (flags & H2_S_REQ_DONE)) {
+		if (ctx->len)
+			tfw_h2_wnd_update(ctx, 0, ctx->len);
+		return tfw_h2_stream_close(ctx, ctx->id, H2_ERR_STREAM_CLOSED);
+	}
+	if (ctx->len)
+		tfw_h2_wnd_update(ctx, end ? 0 : ctx->id, ctx->len);
+
+	if (__h2_buf_add(&s->body, ctx->buf + off, ctx->len - off - pad,
+			 TFW_H2_BODY_MAX))
+		return tfw_h2_stream_close(ctx, ctx->id,
+					   H2_ERR_REFUSED_STREAM);
+
+	return end ? tfw_h2_req_complete(ctx, s) : 0;
+}
+
+static int
+tfw_h2_rst_stream(TfwH2Ctx *ctx)
+{
+	TfwH2Stream *s;
+
+	if (!ctx->id || ctx->id > ctx->last_id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	if (ctx->len != 4)
+		return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+
+	/* A response to the stream, if any, is dropped. */
+	spin_lock(&ctx->lock);
+	s = tfw_h2_stream_lookup(ctx, ctx->id);
+	if (s)
+		__h2_stream_del(ctx, s);
+	spin_unlock(&ctx->lock);
+
+	return 0;
+}
+
+static int
+tfw_h2_settings(TfwH2Ctx *ctx)
+{
+	unsigned int i, v, err = 0;
+	TfwH2Stream *s;
+
+	if (ctx->id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	if (ctx->flags & H2_F_ACK)
+		return ctx->len ? tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE) : 0;
+	if (ctx->len % 6)
+		return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+
+	ctx->settings = true;
+
+	spin_lock(&ctx->lock);
+	for (i = 0; i < ctx->len && !err; i += 6) {
+		v = get_unaligned_be32(ctx->buf + i + 2);
+		switch (get_unaligned_be16(ctx->buf + i)) {
+		case H2_SETTINGS_ENABLE_PUSH:
+			if (v > 1)
+				err = H2_ERR_PROTOCOL;
+			break;
+		case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+			int j;
+			long delta = (long)v - ctx->init_swnd;
+
+			if (v > TFW_H2_WND_MAX) {
+				err = H2_ERR_FLOW_CONTROL;
+				break;
+			}
+			ctx->init_swnd = v;
+			for (j = 0; j < ARRAY_SIZE(ctx->streams); ++j) {
+				hlist_for_each_entry(s, &ctx->streams[j],
+						     hentry) {
+					s->swnd += delta;
+					if (s->swnd > TFW_H2_WND_MAX)
+						err = H2_ERR_FLOW_CONTROL;
+				}
+			}
+			break;
+		}
+		case H2_SETTINGS_MAX_FRAME_SIZE:
+			if (v < TFW_H2_FRAME_MAX || v > TFW_H2_FRAME_LIMIT)
+				err = H2_ERR_PROTOCOL;
+			else
+				ctx->max_frame = v;
+			break;
+		default:
+			/* Unknown or unused settings are ignored. */
+			break;
+		}
+	}
+	if (!err)
+		tfw_h2_flush_all(ctx);
+	spin_unlock(&ctx->lock);
+
+	if (err)
+		return tfw_h2_conn_error(ctx, err);
+	tfw_h2_send_frame(ctx, H2_SETTINGS, H2_F_ACK, 0, NULL, 0);
+
+	return 0;
+}
+
+static int
+tfw_h2_ping(TfwH2Ctx *ctx)
+{
+	if (ctx->id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	if (ctx->len != 8)
+		return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+	if (!(ctx->flags & H2_F_ACK))
+		tfw_h2_send_frame(ctx, H2_PING, H2_F_ACK, 0, ctx->buf, 8);
+
+	return 0;
+}
+
+static int
+tfw_h2_window_update(TfwH2Ctx *ctx)
+{
+	TfwH2Stream *s;
+	unsigned int inc, err = 0;
+
+	if (ctx->len != 4)
+		return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+	inc = get_unaligned_be32(ctx->buf) & TFW_H2_WND_MAX;
+
+	if (!ctx->id) {
+		if (!inc)
+			return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+		spin_lock(&ctx->lock);
+		ctx->swnd += inc;
+		if (ctx->swnd > TFW_H2_WND_MAX)
+			err = H2_ERR_FLOW_CONTROL;
+		else
+			tfw_h2_flush_all(ctx);
+		spin_unlock(&ctx->lock);
+
+		return err ? tfw_h2_conn_error(ctx, err) : 0;
+	}
+
+	if (ctx->id > ctx->last_id)
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+
+	spin_lock(&ctx->lock);
+	s = tfw_h2_stream_lookup(ctx, ctx->id);
+	if (s) {
+		s->swnd += inc;
+		if (!inc)
+			err = H2_ERR_PROTOCOL;
+		else if (s->swnd > TFW_H2_WND_MAX)
+			err = H2_ERR_FLOW_CONTROL;
+		else if ((s->flags & H2_S_RESP) && s->left)
+			tfw_h2_stream_flush(ctx, s, NULL, 0);
+	}
+	spin_unlock(&ctx->lock);
+
+	return err ? tfw_h2_stream_close(ctx, ctx->id, err) : 0;
+}
+
+static int
+tfw_h2_frame_process(TfwH2Ctx *ctx)
+{
+	TFW_DBG3("HTTP/2 frame: type=%u flags=%#x stream=%u len=%u\n",
+		 ctx->type, ctx->flags, ctx->id, ctx->len);
+
+	/* Header block must be contiguous, RFC 7540 6.2. */
+	if (ctx->hblk_id && (ctx->type != H2_CONTINUATION
+			     || ctx->id != ctx->hblk_id))
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	/* The preface is followed by SETTINGS, RFC 7540 3.5. */
+	if (!ctx->settings
+	    && (ctx->type != H2_SETTINGS || (ctx->flags & H2_F_ACK)))
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+
+	switch (ctx->type) {
+	case H2_DATA:
+		return tfw_h2_data(ctx);
+	case H2_HEADERS:
+		return tfw_h2_headers(ctx);
+	case H2_PRIORITY:
+		/* Responses are sent as soon as they're ready. */
+		if (!ctx->id)
+			return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+		if (ctx->len != 5)
+			return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+		return 0;
+	case H2_RST_STREAM:
+		return tfw_h2_rst_stream(ctx);
+	case H2_SETTINGS:
+		return tfw_h2_settings(ctx);
+	case H2_PUSH_PROMISE:
+		/* Clients can't push, RFC 7540 8.2. */
+		return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+	case H2_PING:
+		return tfw_h2_ping(ctx);
+	case H2_GOAWAY:
+		/*
+		 * The client doesn't open new streams and closes
+		 * the connection when it gets the responses.
+		 */
+		if (ctx->id)
+			return tfw_h2_conn_error(ctx, H2_ERR_PROTOCOL);
+		if (ctx->len < 8)
+			return tfw_h2_conn_error(ctx, H2_ERR_FRAME_SIZE);
+		return 0;
+	case H2_WINDOW_UPDATE:
+		return tfw_h2_window_update(ctx);
+	case H2_CONTINUATION:
+		return tfw_h2_continuation(ctx);
+	default:
+		/* Unknown frame types are ignored, RFC 7540 4.1. */
+		return 0;
+	}
+}
+
+static int
+tfw_h2_send_settings(TfwH2Ctx *ctx)
+{
+	unsigned char p[6];
+
+	put_unaligned_be16(H2_SETTINGS_MAX_CONCURRENT_STREAMS, p);
+	put_unaligned_be32(TFW_H2_STREAMS_MAX, p + 2);
+
+	return tfw_h2_send_frame(ctx, H2_SETTINGS, 0, 0, p, sizeof(p));
+}
+
+/**
+ * Parse the connection preface and frames. Each frame is collected in
+ * @ctx->buf and processed as a whole.
+ */
+static int
+tfw_h2_parse(void *data, unsigned char *p, size_t len)
+{
+	int r;
+	unsigned int n;
+	TfwH2Ctx *ctx = data;
+
+	while (len) {
+		switch (ctx->state) {
+		case H2_PREFACE:
+			n = min_t(size_t, len, SLEN(TFW_H2_PREFACE) - ctx->off);
+			if (memcmp(p, TFW_H2_PREFACE + ctx->off, n)) {
+				TFW_DBG2("Bad HTTP/2 connection preface\n");
+				TFW_INC_STAT_BH(clnt.msgs_parserr);
+				return TFW_BLOCK;
+			}
+			ctx->off += n;
+			if (ctx->off == SLEN(TFW_H2_PREFACE)) {
+				if (tfw_h2_send_settings(ctx))
+					return TFW_BLOCK;
+				ctx->state = H2_FRAME_HDR;
+				ctx->off = 0;
+			}
+			break;
+		case H2_FRAME_HDR:
+			n = min_t(size_t, len, TFW_H2_FRAME_HDR_LEN - ctx->off);
+			memcpy(ctx->fhdr + ctx->off, p, n);
+			ctx->off += n;
+			if (ctx->off < TFW_H2_FRAME_HDR_LEN)
+				break;
+
+			ctx->off = 0;
+			ctx->len = (ctx->fhdr[0] << 16) | (ctx->fhdr[1] << 8)
+				   | ctx->fhdr[2];
+			ctx->type = ctx->fhdr[3];
+			ctx->flags = ctx->fhdr[4];
+			/* Ignore the reserved bit. */
+			ctx->id = get_unaligned_be32(ctx->fhdr + 5)
+				  & ~(1U << 31);
+			if (ctx->len > TFW_H2_FRAME_MAX)
+				return tfw_h2_conn_error(ctx,
+							 H2_ERR_FRAME_SIZE);
+			if (ctx->len) {
+				ctx->state = H2_FRAME_PAYLOAD;
+				break;
+			}
+			r = tfw_h2_frame_process(ctx);
+			if (r)
+				return r;
+			break;
+		case H2_FRAME_PAYLOAD:
+			n = min_t(size_t, len, ctx->len - ctx->off);
+			memcpy(ctx->buf + ctx->off, p, n);
+			ctx->off += n;
+			if (ctx->off < ctx->len)
+				break;
+
+			ctx->state = H2_FRAME_HDR;
+			ctx->off = 0;
+			r = tfw_h2_frame_process(ctx);
+			if (r)
+				return r;
+			break;
+		default:
+			BUG();
+		}
+		p += n;
+		len -= n;
+	}
+
+	return TFW_POSTPONE;
+}
+
+/**
+ * GFSM entry point for HTTP/2 client connections.
+ */
+static int
+tfw_h2_msg_process(void *conn, struct sk_buff *skb, unsigned int off)
+{
+	int r;
+	TfwConnection *c = conn;
+	TfwH2Ctx *ctx = c->proto_ctx;
+
+	TFW_ADD_STAT_BH(skb->len - off, clnt.rx_bytes);
+
+	r = ss_skb_process(skb, &off, tfw_h2_parse, ctx);
+
+	/* All the needed data is copied from the SKB. */
+	ss_skb_queue_purge(&ctx->msg.skb_list);
+
+	return r == TFW_BLOCK ? TFW_BLOCK : TFW_PASS;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Responses conversion
+ * ------------------------------------------------------------------------
+ */
+
+/* Response parsing states. */
+enum {
+	H2_R_HDR,
+	H2_R_BODY,
+	H2_R_EOF,
+	H2_R_CHUNK_SIZE,
+	H2_R_CHUNK_EXT,
+	H2_R_CHUNK_DATA,
+	H2_R_CHUNK_END,
+	H2_R_TRAILER,
+	H2_R_DONE,
+};
+
+/**
+ * HTTP/1.1 response being converted to HTTP/2 stream.
+ *
+ * The header section is copied and encoded to a header block, the body is
+ * referenced in the response SKBs which are kept until it's sent.
+ *
+ * @req		- the request the response is sent for;
+ * @skbs	- the response SKBs;
+ * @hdr		- the response header section;
+ * @blk		- HPACK encoded header block;
+ * @blk_len	- length of @blk;
+ * @seg		- the response body pieces;
+ * @seg_n	- number of pieces in @seg;
+ * @seg_sz	- size of @seg;
+ * @left	- total length of the body;
+ * @state	- parsing state;
+ * @ll		- length of current line;
+ * @clen	- length of the body or current chunk not parsed yet;
+ * @chunked	- the body uses chunked transfer coding;
+ */
+typedef struct {
+	TfwHttpReq		*req;
+	SsSkbList		skbs;
+	TfwH2Buf		hdr;
+	unsigned char		*blk;
+	unsigned int		blk_len;
+	TfwH2Seg		*seg;
+	unsigned int		seg_n;
+	unsigned int		seg_sz;
+	unsigned long		left;
+	int			state;
+	unsigned int		ll;
+	unsigned long		clen;
+	bool			chunked;
+} TfwH2Resp;
+
+#define H2_HDR_IS(p, n, s)	((n) == SLEN(s) && !strncasecmp(p, s, n))
+
+static int
+__h2_resp_seg(TfwH2Resp *cv, unsigned char *p, unsigned int len)
+{
+	TfwH2Seg *seg = cv->seg_n ? &cv->seg[cv->seg_n - 1] : NULL;
+
+	if (!len)
+		return 0;
+	cv->left += len;
+	if (seg && seg->ptr + seg->len == (char *)p) {
+		seg->len += len;
+		return 0;
+	}
+	if (cv->seg_n == cv->seg_sz) {
+		unsigned int sz = cv->seg_sz ? cv->seg_sz * 2 : 16;
+
+		if (sz > TFW_H2_SEG_MAX)
+			return -E2BIG;
+		seg = krealloc(cv->seg, sz * sizeof(*seg), GFP_ATOMIC);
+		if (!seg)
+			return -ENOMEM;
+		cv->seg = seg;
+		cv->seg_sz = sz;
+	}
+	cv->seg[cv->seg_n].ptr = p;
+	cv->seg[cv->seg_n++].len = len;
+
+	return 0;
+}
+
+/**
+ * Encode the response header section to HPACK header block and determine
+ * how the body is delimited. Connection-specific header fields are dropped.
+ */
+static int
+tfw_h2_resp_hdrs(TfwH2Resp *cv)
+{
+	char *p = cv->hdr.data, *end = p + cv->hdr.len, *eol, *v, *ve;
+	unsigned int lines = 0, nlen;
+	unsigned short status;
+	unsigned char *o;
+	bool has_clen = false;
+
+	for (v = p; (v = memchr(v, '\n', end - v)); ++v)
+		++lines;
+	o = cv->blk = kmalloc(cv->hdr.len + lines * TFW_HPACK_HDR_MAX(0, 0),
+			      GFP_ATOMIC);
+	if (!cv->blk)
+		return -ENOMEM;
+
+	/* Status line: HTTP-version SP status-code SP reason-phrase. */
+	eol = memchr(p, '\n', end - p);
+	if (eol - p < 12 || memcmp(p, "HTTP/1.", 7) || p[8] != ' '
+	    || !isdigit(p[9]) || !isdigit(p[10]) || !isdigit(p[11]))
+		return -EINVAL;
+	status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + p[11] - '0';
+	o = tfw_hpack_encode_status(o, status);
+
+	for (p = eol + 1; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		ve = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+		if (ve == p)
+			break;
+
+		v = memchr(p, ':', ve - p);
+		if (!v || v == p || isspace(*p))
+			return -EINVAL;
+		nlen = v - p;
+		for (++v; v < ve && (*v == ' ' || *v == '\t'); ++v)
+			;
+		while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t'))
+			--ve;
+
+		if (H2_HDR_IS(p, nlen, "transfer-encoding")) {
+			cv->chunked = ve - v >= 7
+				      && !strncasecmp(ve - 7, "chunked", 7);
+			continue;
+		}
+		if (H2_HDR_IS(p, nlen, "connection")
+		    || H2_HDR_IS(p, nlen, "keep-alive")
+		    || H2_HDR_IS(p, nlen, "proxy-connection")
+		    || H2_HDR_IS(p, nlen, "upgrade"))
+			continue;
+		if (H2_HDR_IS(p, nlen, "content-length")) {
+			char *d;
+
+			has_clen = true;
+			for (cv->clen = 0, d = v; d < ve && isdigit(*d); ++d)
+				cv->clen = cv->clen * 10 + *d - '0';
+			if (d != ve || d == v)
+				return -EINVAL;
+		}
+		o = tfw_hpack_encode_hdr(o, p, nlen, v, ve - v);
+	}
+	cv->blk_len = o - cv->blk;
+
+	if (cv->req->method == TFW_HTTP_METH_HEAD || status / 100 == 1
+	    || status == 204 || status == 304)
+		cv->state = H2_R_DONE;
+	else if (cv->chunked)
+		cv->state = H2_R_CHUNK_SIZE;
+	else if (has_clen)
+		cv->state = cv->clen ? H2_R_BODY : H2_R_DONE;
+	else
+		cv->state = H2_R_EOF;
+	cv->clen = cv->chunked ? 0 : cv->clen;
+	cv->ll = 0;
+
+	return 0;
+}
+
+/**
+ * Actor for the response SKBs: collect the header section and the body
+ * pieces, chunked transfer coding is removed.
+ */
+static int
+tfw_h2_resp_parse(void *data, unsigned char *p, size_t len)
+{
+	TfwH2Resp *cv = data;
+	unsigned char *end = p + len;
+	unsigned int n, d;
+	bool eoh = false;
+
+	while (p < end) {
+		switch (cv->state) {
+		case H2_R_HDR:
+			/* Look for the empty line ending the header section. */
+			for (n = 0; p + n < end && !eoh; ++n) {
+				if (p[n] == '\n') {
+					eoh = !cv->ll;
+					cv->ll = 0;
+				}
+				else if (p[n] != '\r') {
+					++cv->ll;
+				}
+			}
+			if (__h2_buf_add(&cv->hdr, p, n, TFW_H2_HDR_MAX))
+				return TFW_BLOCK;
+			p += n;
+			if (eoh && tfw_h2_resp_hdrs(cv))
+				return TFW_BLOCK;
+			break;
+		case H2_R_BODY:
+			n = min_t(unsigned long, end - p, cv->clen);
+			if (__h2_resp_seg(cv, p, n))
+				return TFW_BLOCK;
+			p += n;
+			cv->clen -= n;
+			if (!cv->clen)
+				cv->state = H2_R_DONE;
+			break;
+		case H2_R_EOF:
+			if (__h2_resp_seg(cv, p, end - p))
+				return TFW_BLOCK;
+			p = end;
+			break;
+		case H2_R_CHUNK_SIZE:
+			if (*p == '\n') {
+				cv->state = cv->clen ? H2_R_CHUNK_DATA
+						     : H2_R_TRAILER;
+			}
+			else if (*p == ';' || *p == ' ' || *p == '\t') {
+				cv->state = H2_R_CHUNK_EXT;
+			}
+			else if (*p != '\r') {
+				d = hex_to_bin(*p);
+				if (d > 15 || cv->clen >> 28)
+					return TFW_BLOCK;
+				cv->clen = (cv->clen << 4) | d;
+			}
+			++p;
+			break;
+		case H2_R_CHUNK_EXT:
+			if (*p++ == '\n')
+				cv->state = cv->clen ? H2_R_CHUNK_DATA
+						     : H2_R_TRAILER;
+			break;
+		case H2_R_CHUNK_DATA:
+			n = min_t(unsigned long, end - p, cv->clen);
+			if (__h2_resp_seg(cv, p, n))
+				return TFW_BLOCK;
+			p += n;
+			cv->clen -= n;
+			if (!cv->clen)
+				cv->state = H2_R_CHUNK_END;
+			break;
+		case H2_R_CHUNK_END:
+			if (*p++ == '\n')
+				cv->state = H2_R_CHUNK_SIZE;
+			break;
+		case H2_R_TRAILER:
+			/* Trailer fields aren't forwarded. */
+			if (*p == '\n') {
+				if (!cv->ll)
+					cv->state = H2_R_DONE;
+				cv->ll = 0;
+			}
+			else if (*p != '\r') {
+				++cv->ll;
+			}
+			++p;
+			break;
+		case H2_R_DONE:
+			return TFW_PASS;
+		}
+	}
+
+	return cv->state == H2_R_DONE ? TFW_PASS : TFW_POSTPONE;
+}
+
+/**
+ * Send response @resp to HTTP/2 request @req. The response is converted to
+ * HEADERS frame, followed by CONTINUATION frames if the header block is
+ * larger than the peer's maximum frame size, and DATA frames. The body
+ * is sent as the flow control windows allow and the rest of it is sent on
+ * WINDOW_UPDATE frames. Like tfw_cli_conn_send(), the function consumes
+ * the response SKBs. The stream is reset if the response can't be sent.
+ */
+int
+tfw_h2_resp_send(TfwHttpReq *req, TfwHttpMsg *resp)
+{
+	int r = 0;
+	struct sk_buff *skb, *twin;
+	TfwH2Ctx *ctx = req->conn->proto_ctx;
+	TfwH2Stream *s;
+	TfwH2Resp resp_cv = { .req = req }, *cv = &resp_cv;
+
+	if (!(resp->msg.ss_flags & SS_F_KEEP_SKB)) {
+		cv->skbs = resp->msg.skb_list;
+		ss_skb_queue_head_init(&resp->msg.skb_list);
+	} else {
+		for (skb = ss_skb_peek(&resp->msg.skb_list); skb;
+		     skb = ss_skb_next(skb))
+		{
+			if (!(twin = pskb_copy_for_clone(skb, GFP_ATOMIC))) {
+				r = -ENOMEM;
+				goto out;
+			}
+			ss_skb_queue_tail(&cv->skbs, twin);
+		}
+	}
+
+	for (skb = ss_skb_peek(&cv->skbs);
+	     skb && r != TFW_BLOCK && cv->state != H2_R_DONE;
+	     skb = ss_skb_next(skb))
+	{
+		unsigned int off = 0;
+		r = ss_skb_process(skb, &off, tfw_h2_resp_parse, cv);
+	}
+	if (r == TFW_BLOCK
+	    || (cv->state != H2_R_DONE && cv->state != H2_R_EOF))
+	{
+		TFW_WARN("Cannot convert HTTP response to HTTP/2\n");
+		r = -EINVAL;
+		goto out;
+	}
+	/* The body ending at connection close leaves TFW_POSTPONE. */
+	r = 0;
+
+	spin_lock(&ctx->lock);
+	s = tfw_h2_stream_lookup(ctx, req->stream_id);
+	if (s && !(s->flags & H2_S_RESP)) {
+		s->flags |= H2_S_RESP;
+		s->skbs = cv->skbs;
+		s->seg = cv->seg;
+		s->seg_n = cv->seg_n;
+		s->left = cv->left;
+		ss_skb_queue_head_init(&cv->skbs);
+		cv->seg = NULL;
+		r = tfw_h2_stream_flush(ctx, s, cv->blk, cv->blk_len);
+	} else {
+		/* The stream is reset by the client. */
+		TFW_DBG2("Drop response to closed HTTP/2 stream %u\n",
+			 req->stream_id);
+	}
+	spin_unlock(&ctx->lock);
+out:
+	ss_skb_queue_purge(&cv->skbs);
+	__h2_buf_free(&cv->hdr);
+	kfree(cv->blk);
+	kfree(cv->seg);
+	/*
+	 * The client waits for the response forever if the stream isn't
+	 * reset, so reset it if the response can't be converted or sent.
+	 */
+	if (r < 0)
+		tfw_h2_stream_close(ctx, req->stream_id, H2_ERR_INTERNAL);
+
+	return r;
+}
+EXPORT_SYMBOL(tfw_h2_resp_send);
+
+/*
+ * ------------------------------------------------------------------------
+ *	Connection hooks
+ * ------------------------------------------------------------------------
+ */
+
+static void
+tfw_h2_ctx_free(TfwH2Ctx *ctx)
+{
+	int i;
+	TfwH2Stream *s;
+	struct hlist_node *tmp;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->streams); ++i)
+		hlist_for_each_entry_safe(s, tmp, &ctx->streams[i], hentry)
+			__h2_stream_del(ctx, s);
+	tfw_hpack_destroy(&ctx->hpack);
+	__h2_buf_free(&ctx->hblk);
+	kfree(ctx->buf);
+	kfree(ctx);
+}
+
+static int
+tfw_h2_conn_init(TfwConnection *conn)
+{
+	TfwH2Ctx *ctx = kzalloc(sizeof(*ctx), GFP_ATOMIC);
+
+	if (!ctx)
+		return -ENOMEM;
+	ctx->buf = kmalloc(TFW_H2_FRAME_MAX, GFP_ATOMIC);
+	if (!ctx->buf || tfw_hpack_init(&ctx->hpack, TFW_HPACK_TABLE_SIZE)) {
+		kfree(ctx->buf);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	INIT_LIST_HEAD(&ctx->msg.msg_list);
+	ss_skb_queue_head_init(&ctx->msg.skb_list);
+	spin_lock_init(&ctx->lock);
+	ctx->conn = conn;
+	ctx->state = H2_PREFACE;
+	ctx->swnd = ctx->init_swnd = TFW_H2_WND_DEF;
+	ctx->max_frame = TFW_H2_FRAME_MAX;
+
+	conn->proto_ctx = ctx;
+
+	return 0;
+}
+
+/*
+ * The connection context is the only message of HTTP/2 connection,
+ * requests are created for each stream separately.
+ */
+static TfwMsg *
+tfw_h2_conn_msg_alloc(TfwConnection *conn)
+{
+	TfwH2Ctx *ctx = conn->proto_ctx;
+
+	tfw_gfsm_state_init(&ctx->msg.state, conn, TFW_HTTP2_FSM_INIT);
+
+	return &ctx->msg;
+}
+
+static void
+tfw_h2_conn_drop(TfwConnection *conn)
+{
+	TfwH2Ctx *ctx = conn->proto_ctx;
+
+	if (ctx)
+		ss_skb_queue_purge(&ctx->msg.skb_list);
+	tfw_connection_unlink_msg(conn);
+}
+
+/*
+ * The context is freed when there are no requests referencing
+ * the connection, so no responses can be sent to the streams.
+ */
+static void
+tfw_h2_conn_release(TfwConnection *conn)
+{
+	if (conn->proto_ctx)
+		tfw_h2_ctx_free(conn->proto_ctx);
+	conn->proto_ctx = NULL;
+}
+
+static TfwConnHooks h2_conn_hooks = {
+	.conn_init	= tfw_h2_conn_init,
+	.conn_drop	= tfw_h2_conn_drop,
+	.conn_release	= tfw_h2_conn_release,
+	.conn_msg_alloc	= tfw_h2_conn_msg_alloc,
+};
+
+int __init
+tfw_h2_init(void)
+{
+	int r = tfw_gfsm_register_fsm(TFW_FSM_HTTP2, tfw_h2_msg_process);
+	if (r)
+		return r;
+
+	tfw_connection_hooks_register(&h2_conn_hooks, TFW_FSM_HTTP2);
+
+	return 0;
+}
+
+void
+tfw_h2_exit(void)
+{
+	tfw_connection_hooks_unregister(TFW_FSM_HTTP2);
+	tfw_gfsm_unregister_fsm(TFW_FSM_HTTP2);
+}
@@ -0,0 +1,44 @@
+/**
+ *		Tempesta FW
+ *
+ * HTTP/2 connection layer (RFC 7540).
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __TFW_HTTP2_H__
+#define __TFW_HTTP2_H__
+
+#include "gfsm.h"
+#include "http.h"
+
+/**
+ * HTTP/2 states.
+ *
+ * Frames are handled by the connection layer itself, requests carried by
+ * the streams are passed to HTTP FSM as separate messages.
+ */
+#define TFW_GFSM_HTTP2_STATE(s)	((TFW_FSM_HTTP2 << TFW_GFSM_FSM_SHIFT) | (s))
+enum {
+	/* HTTP/2 FSM initial state, not hookable. */
+	TFW_HTTP2_FSM_INIT	= TFW_GFSM_HTTP2_STATE(0),
+
+	TFW_HTTP2_FSM_DONE	= TFW_GFSM_HTTP2_STATE(TFW_GFSM_STATE_LAST)
+};
+
+int tfw_h2_resp_send(TfwHttpReq *req, TfwHttpMsg *resp);
+
+#endif /* __TFW_HTTP2_H__ */
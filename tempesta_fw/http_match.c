@@ -102,7 +102,7 @@ hdr_val_eq(const TfwHttpReq *req, tfw_http_hdr_t id, tfw_http_match_op_t op,
 	TfwStr *hdr;
 	TfwStr hdr_val;
 
-	BUG_ON(id < 0 || id >= TFW_HTTP_HDR_NUM);
+	BUG_ON(id < 0 || id >= TFW_HTTP_HDR_RAW);
 
 	hdr = &req->h_tbl->tbl[id];
 	if (TFW_STR_EMPTY(hdr))
@@ -26,6 +26,167 @@
 #include "http_msg.h"
 #include "ss_skb.h"
 
+/**
+ * Known header names terminated by ':' to compare them with header strings
+ * by tfw_stricmpspn().
+ *
+ * @name	- the header name;
+ * @singular	- true for headers which must never have duplicates;
+ */
+typedef struct {
+	TfwStr		name;
+	bool		singular;
+} TfwHttpKhdr;
+
+#define __KHDR_INIT(id, n, s)						\
+	[TFW_HTTP_KHDR_##id] = { { n ":", NULL, SLEN(n ":"), 0 }, s }
+#define __KHDR(id, n)		__KHDR_INIT(id, n, false)
+#define __KHDR_S(id, n)		__KHDR_INIT(id, n, true)
+
+static const TfwHttpKhdr khdr_tbl[] = {
+	__KHDR(ACCEPT, "Accept"),
+	__KHDR(ACCEPT_CHARSET, "Accept-Charset"),
+	__KHDR(ACCEPT_ENCODING, "Accept-Encoding"),
+	__KHDR(ACCEPT_LANGUAGE, "Accept-Language"),
+	__KHDR(ACCEPT_RANGES, "Accept-Ranges"),
+	__KHDR(ACCESS_CONTROL_ALLOW_CREDENTIALS,
+	       "Access-Control-Allow-Credentials"),
+	__KHDR(ACCESS_CONTROL_ALLOW_HEADERS, "Access-Control-Allow-Headers"),
+	__KHDR(ACCESS_CONTROL_ALLOW_METHODS, "Access-Control-Allow-Methods"),
+	__KHDR(ACCESS_CONTROL_ALLOW_ORIGIN, "Access-Control-Allow-Origin"),
+	__KHDR(ACCESS_CONTROL_EXPOSE_HEADERS, "Access-Control-Expose-Headers"),
+	__KHDR(ACCESS_CONTROL_MAX_AGE, "Access-Control-Max-Age"),
+	__KHDR(ACCESS_CONTROL_REQUEST_HEADERS,
+	       "Access-Control-Request-Headers"),
+	__KHDR(ACCESS_CONTROL_REQUEST_METHOD, "Access-Control-Request-Method"),
+	__KHDR(AGE, "Age"),
+	__KHDR(ALLOW, "Allow"),
+	__KHDR(ALT_SVC, "Alt-Svc"),
+	__KHDR_S(AUTHORIZATION, "Authorization"),
+	__KHDR(CACHE_CONTROL, "Cache-Control"),
+	__KHDR(CONNECTION, "Connection"),
+	__KHDR(CONTENT_DISPOSITION, "Content-Disposition"),
+	__KHDR(CONTENT_ENCODING, "Content-Encoding"),
+	__KHDR(CONTENT_LANGUAGE, "Content-Language"),
+	__KHDR(CONTENT_LENGTH, "Content-Length"),
+	__KHDR(CONTENT_LOCATION, "Content-Location"),
+	__KHDR(CONTENT_MD5, "Content-MD5"),
+	__KHDR(CONTENT_RANGE, "Content-Range"),
+	__KHDR(CONTENT_SECURITY_POLICY, "Content-Security-Policy"),
+	__KHDR(CONTENT_TYPE, "Content-Type"),
+	__KHDR(COOKIE, "Cookie"),
+	__KHDR(DATE, "Date"),
+	__KHDR(DNT, "DNT"),
+	__KHDR(ETAG, "ETag"),
+	__KHDR(EXPECT, "Expect"),
+	__KHDR(EXPIRES, "Expires"),
+	__KHDR(FORWARDED, "Forwarded"),
+	__KHDR_S(FROM, "From"),
+	__KHDR(HOST, "Host"),
+	__KHDR(IF_MATCH, "If-Match"),
+	__KHDR_S(IF_MODIFIED_SINCE, "If-Modified-Since"),
+	__KHDR(IF_NONE_MATCH, "If-None-Match"),
+	__KHDR(IF_RANGE, "If-Range"),
+	__KHDR_S(IF_UNMODIFIED_SINCE, "If-Unmodified-Since"),
+	__KHDR(KEEP_ALIVE, "Keep-Alive"),
+	__KHDR(LAST_MODIFIED, "Last-Modified"),
+	__KHDR(LINK, "Link"),
+	__KHDR_S(LOCATION, "Location"),
+	__KHDR_S(MAX_FORWARDS, "Max-Forwards"),
+	__KHDR(ORIGIN, "Origin"),
+	__KHDR(P3P, "P3P"),
+	__KHDR(PRAGMA, "Pragma"),
+	__KHDR(PROXY_AUTHENTICATE, "Proxy-Authenticate"),
+	__KHDR_S(PROXY_AUTHORIZATION, "Proxy-Authorization"),
+	__KHDR(PROXY_CONNECTION, "Proxy-Connection"),
+	__KHDR(PUBLIC_KEY_PINS, "Public-Key-Pins"),
+	__KHDR(RANGE, "Range"),
+	__KHDR_S(REFERER, "Referer"),
+	__KHDR(REFRESH, "Refresh"),
+	__KHDR(RETRY_AFTER, "Retry-After"),
+	__KHDR(SERVER, "Server"),
+	__KHDR(SET_COOKIE, "Set-Cookie"),
+	__KHDR(STRICT_TRANSPORT_SECURITY, "Strict-Transport-Security"),
+	__KHDR(TE, "TE"),
+	__KHDR(TRAILER, "Trailer"),
+	__KHDR(TRANSFER_ENCODING, "Transfer-Encoding"),
+	__KHDR(UPGRADE, "Upgrade"),
+	__KHDR(UPGRADE_INSECURE_REQUESTS, "Upgrade-Insecure-Requests"),
+	__KHDR(USER_AGENT, "User-Agent"),
+	__KHDR(VARY, "Vary"),
+	__KHDR(VIA, "Via"),
+	__KHDR(WARNING, "Warning"),
+	__KHDR(WWW_AUTHENTICATE, "WWW-Authenticate"),
+	__KHDR(X_CONTENT_TYPE_OPTIONS, "X-Content-Type-Options"),
+	__KHDR(X_CSRF_TOKEN, "X-CSRF-Token"),
+	__KHDR(X_FORWARDED_FOR, "X-Forwarded-For"),
+	__KHDR(X_FORWARDED_HOST, "X-Forwarded-Host"),
+	__KHDR(X_FORWARDED_PROTO, "X-Forwarded-Proto"),
+	__KHDR(X_FRAME_OPTIONS, "X-Frame-Options"),
+	__KHDR(X_HTTP_METHOD_OVERRIDE, "X-HTTP-Method-Override"),
+	__KHDR(X_POWERED_BY, "X-Powered-By"),
+	__KHDR(X_REAL_IP, "X-Real-IP"),
+	__KHDR(X_REQUESTED_WITH, "X-Requested-With"),
+	__KHDR(X_XSS_PROTECTION, "X-XSS-Protection"),
+};
+
+#undef __KHDR_S
+#undef __KHDR
+#undef __KHDR_INIT
+
+/*
+ * Known identifiers of special headers of requests and responses.
+ * Reverse mappings, from known identifiers to special headers, are built
+ * on initialization.
+ */
+static const unsigned char req_hdrs[TFW_HTTP_HDR_RAW] = {
+	[0 ... TFW_HTTP_HDR_RAW - 1]	= TFW_HTTP_KHDR_NUM,
+	[TFW_HTTP_HDR_CONTENT_LENGTH]	= TFW_HTTP_KHDR_CONTENT_LENGTH,
+	[TFW_HTTP_HDR_CONTENT_LOCATION]	= TFW_HTTP_KHDR_CONTENT_LOCATION,
+	[TFW_HTTP_HDR_CONTENT_RANGE]	= TFW_HTTP_KHDR_CONTENT_RANGE,
+	[TFW_HTTP_HDR_CONTENT_TYPE]	= TFW_HTTP_KHDR_CONTENT_TYPE,
+	[TFW_HTTP_HDR_HOST]		= TFW_HTTP_KHDR_HOST,
+	[TFW_HTTP_HDR_USER_AGENT]	= TFW_HTTP_KHDR_USER_AGENT,
+	[TFW_HTTP_HDR_COOKIE]		= TFW_HTTP_KHDR_COOKIE,
+	[TFW_HTTP_HDR_IF_MODIFIED_SINCE] = TFW_HTTP_KHDR_IF_MODIFIED_SINCE,
+	[TFW_HTTP_HDR_IF_RANGE]		= TFW_HTTP_KHDR_IF_RANGE,
+	[TFW_HTTP_HDR_IF_UNMODIFIED_SINCE] = TFW_HTTP_KHDR_IF_UNMODIFIED_SINCE,
+	[TFW_HTTP_HDR_CONNECTION]	= TFW_HTTP_KHDR_CONNECTION,
+	[TFW_HTTP_HDR_CACHE_CONTROL]	= TFW_HTTP_KHDR_CACHE_CONTROL,
+	[TFW_HTTP_HDR_CONTENT_ENCODING]	= TFW_HTTP_KHDR_CONTENT_ENCODING,
+	[TFW_HTTP_HDR_CONTENT_LANGUAGE]	= TFW_HTTP_KHDR_CONTENT_LANGUAGE,
+	[TFW_HTTP_HDR_KEEP_ALIVE]	= TFW_HTTP_KHDR_KEEP_ALIVE,
+	[TFW_HTTP_HDR_TRANSFER_ENCODING] = TFW_HTTP_KHDR_TRANSFER_ENCODING,
+	[TFW_HTTP_HDR_X_FORWARDED_FOR]	= TFW_HTTP_KHDR_X_FORWARDED_FOR,
+	[TFW_HTTP_HDR_IF_MATCH]		= TFW_HTTP_KHDR_IF_MATCH,
+	[TFW_HTTP_HDR_IF_NONE_MATCH]	= TFW_HTTP_KHDR_IF_NONE_MATCH,
+};
+
+static const unsigned char resp_hdrs[TFW_HTTP_HDR_RAW] = {
+	[0 ... TFW_HTTP_HDR_RAW - 1]	= TFW_HTTP_KHDR_NUM,
+	[TFW_HTTP_HDR_CONTENT_LENGTH]	= TFW_HTTP_KHDR_CONTENT_LENGTH,
+	[TFW_HTTP_HDR_CONTENT_LOCATION]	= TFW_HTTP_KHDR_CONTENT_LOCATION,
+	[TFW_HTTP_HDR_CONTENT_RANGE]	= TFW_HTTP_KHDR_CONTENT_RANGE,
+	[TFW_HTTP_HDR_CONTENT_TYPE]	= TFW_HTTP_KHDR_CONTENT_TYPE,
+	[TFW_HTTP_HDR_SERVER]		= TFW_HTTP_KHDR_SERVER,
+	[TFW_HTTP_HDR_AGE]		= TFW_HTTP_KHDR_AGE,
+	[TFW_HTTP_HDR_DATE]		= TFW_HTTP_KHDR_DATE,
+	[TFW_HTTP_HDR_ETAG]		= TFW_HTTP_KHDR_ETAG,
+	[TFW_HTTP_HDR_EXPIRES]		= TFW_HTTP_KHDR_EXPIRES,
+	[TFW_HTTP_HDR_LAST_MODIFIED]	= TFW_HTTP_KHDR_LAST_MODIFIED,
+	[TFW_HTTP_HDR_CONNECTION]	= TFW_HTTP_KHDR_CONNECTION,
+	[TFW_HTTP_HDR_CACHE_CONTROL]	= TFW_HTTP_KHDR_CACHE_CONTROL,
+	[TFW_HTTP_HDR_CONTENT_ENCODING]	= TFW_HTTP_KHDR_CONTENT_ENCODING,
+	[TFW_HTTP_HDR_CONTENT_LANGUAGE]	= TFW_HTTP_KHDR_CONTENT_LANGUAGE,
+	[TFW_HTTP_HDR_KEEP_ALIVE]	= TFW_HTTP_KHDR_KEEP_ALIVE,
+	[TFW_HTTP_HDR_TRANSFER_ENCODING] = TFW_HTTP_KHDR_TRANSFER_ENCODING,
+	[TFW_HTTP_HDR_SET_COOKIE]	= TFW_HTTP_KHDR_SET_COOKIE,
+	[TFW_HTTP_HDR_VARY]		= TFW_HTTP_KHDR_VARY,
+};
+
+static unsigned char req_kmap[TFW_HTTP_KHDR_NUM] __read_mostly;
+static unsigned char resp_kmap[TFW_HTTP_KHDR_NUM] __read_mostly;
+
 /**
  * Fills @val with second part of special HTTP header containing the header
  * value.
@@ -33,17 +194,6 @@
 void
 __http_msg_hdr_val(TfwStr *hdr, unsigned id, TfwStr *val, bool client)
 {
-	static const size_t hdr_lens[] = {
-		[TFW_HTTP_HDR_HOST]	= SLEN("Host:"),
-		[TFW_HTTP_HDR_CONTENT_LENGTH] = SLEN("Content-Length:"),
-		[TFW_HTTP_HDR_CONTENT_TYPE] = SLEN("Content-Type:"),
-		[TFW_HTTP_HDR_CONNECTION] = SLEN("Connection:"),
-		[TFW_HTTP_HDR_X_FORWARDED_FOR] = SLEN("X-Forwarded-For:"),
-		[TFW_HTTP_HDR_USER_AGENT] = SLEN("User-Agent:"),
-		[TFW_HTTP_HDR_SERVER]	= SLEN("Server:"),
-		[TFW_HTTP_HDR_COOKIE]	= SLEN("Cookie:"),
-	};
-
 	TfwStr *c, *end;
 	int nlen;
 
@@ -55,17 +205,16 @@ __http_msg_hdr_val(TfwStr *hdr, unsigned id, TfwStr *val, bool client)
 	BUG_ON(TFW_STR_DUP(hdr));
 	BUG_ON(id >= TFW_HTTP_HDR_RAW);
 
-	if (unlikely(id == TFW_HTTP_HDR_SERVER && client))
-		nlen = SLEN("User-Agent:");
-	else
-		nlen = hdr_lens[id];
+	id = client ? req_hdrs[id] : resp_hdrs[id];
+	BUG_ON(id >= TFW_HTTP_KHDR_NUM);
+	nlen = khdr_tbl[id].name.len;
 
 	/*
-	 * Only Host header is allowed to be empty.
+	 * Special headers parsed by the FSM can't be empty, excepting Host.
+	 * However, headers recognized by their names only can be empty.
 	 * If header string is plain, it is always empty header.
-	 * Not empty headers are compound strings.
 	 */
-	BUG_ON(id == TFW_HTTP_HDR_HOST ? nlen > hdr->len : nlen >= hdr->len);
+	BUG_ON(nlen > hdr->len);
 
 	*val = *hdr;
 
@@ -108,47 +257,73 @@ __http_msg_hdr_val(TfwStr *hdr, unsigned id, TfwStr *val, bool client)
 }
 EXPORT_SYMBOL(__http_msg_hdr_val);
 
+/*
+ * Minimal perfect hash of the known header names in "hash and displace"
+ * manner. Case insensitive FNV-1a hash of a header name selects
+ * a displacement, which is mixed with the hash to get one of
+ * TFW_HTTP_KHDR_NUM slots. The displacements are chosen on module
+ * initialization, so that all the known names get different slots,
+ * see tfw_http_msg_init(). So adding a new header requires only
+ * a new entry in tfw_http_khdr_t and khdr_tbl[].
+ */
+#define KHDR_DISP_BITS		5
+#define KHDR_DISP_N		(1 << KHDR_DISP_BITS)
+#define KHDR_DISP_MASK		(KHDR_DISP_N - 1)
+#define KHDR_HASH_INIT		0x811c9dc5U
+#define KHDR_HASH(h, c)		(((h) ^ tolower(c)) * 0x01000193U)
+
+static unsigned short khdr_disp[KHDR_DISP_N] __read_mostly;
+static unsigned char khdr_slot[TFW_HTTP_KHDR_NUM] __read_mostly;
+static unsigned int khdr_maxlen __read_mostly;
+
+static inline unsigned int
+__khdr_slot(unsigned int h)
+{
+	unsigned int m = (h ^ khdr_disp[h & KHDR_DISP_MASK]) * 0x9e3779b1U;
+
+	return ((unsigned long)m * TFW_HTTP_KHDR_NUM) >> 32;
+}
+
 /**
- * Slow check of generic (raw) header for singularity.
- * Some of the header should be special and moved to tfw_http_hdr_t enum,
- * so linear search is Ok here.
- * @return true for headers which must never have duplicates.
+ * Get known identifier of header @hdr name, the name is read until ':'.
+ * @return tfw_http_khdr_t identifier or negative value for unknown headers.
  */
-static bool
-__hdr_is_singular(const TfwStr *hdr)
+int
+tfw_http_msg_hdr_known(const TfwStr *hdr)
 {
-	int i, fc;
-	static const TfwStr hdr_singular[] __read_mostly = {
-#define TfwStr_string(v) { (v), NULL, sizeof(v) - 1, 0 }
-		TfwStr_string("authorization:"),
-		TfwStr_string("from:"),
-		TfwStr_string("if-modified-since:"),
-		TfwStr_string("if-unmodified-since:"),
-		TfwStr_string("location:"),
-		TfwStr_string("max-forwards:"),
-		TfwStr_string("proxy-authorization:"),
-		TfwStr_string("referer:"),
-#undef TfwStr_string
-	};
+	int kid;
+	unsigned int h = KHDR_HASH_INIT, n = 0;
+	const TfwStr *c, *end;
 
-	fc = tolower(*(unsigned char *)TFW_STR_CHUNK(hdr, 0));
-	for (i = 0; i < ARRAY_SIZE(hdr_singular); i++) {
-		const TfwStr *sh = &hdr_singular[i];
-		int sc = *(unsigned char *)sh->ptr;
-		if (fc > sc)
-			continue;
-		if (fc < sc)
-			break;
-		if (!tfw_stricmpspn(hdr, sh, ':'))
-			return true;
+	TFW_STR_FOR_EACH_CHUNK(c, hdr, end) {
+		unsigned char *p = c->ptr, *e = p + c->len;
+
+		for ( ; p < e; ++p) {
+			if (*p == ':')
+				goto hashed;
+			if (unlikely(++n > khdr_maxlen))
+				return -1;
+			h = KHDR_HASH(h, *p);
+		}
 	}
-	return false;
+	return -1;
+hashed:
+	kid = khdr_slot[__khdr_slot(h)];
+	if (n + 1 != khdr_tbl[kid].name.len
+	    || tfw_stricmpspn(hdr, &khdr_tbl[kid].name, ':'))
+		return -1;
+
+	return kid;
 }
+EXPORT_SYMBOL(tfw_http_msg_hdr_known);
 
 /**
  * Lookup for the header @hdr in already collected headers table @ht,
  * i.e. check whether the header is duplicate.
- * The lookup is performed untill ':', so header name only is enough in @hdr.
+ * Known headers, @kid is their identifier, are found by the table index,
+ * while unknown headers (negative @kid) require linear scan over the raw
+ * headers. The lookup is performed untill ':', so header name only is
+ * enough in @hdr.
  * @return the header id.
  *
  * Certain header fields are strictly singular and may not be repeated in
@@ -156,24 +331,43 @@ __hdr_is_singular(const TfwStr *hdr)
  * blocking the whole HTTP message.
  */
 static int
-__hdr_lookup(TfwHttpMsg *hm, const TfwStr *hdr)
+__hdr_lookup(TfwHttpMsg *hm, const TfwStr *hdr, int kid)
 {
 	int id;
 	TfwHttpHdrTbl *ht = hm->h_tbl;
 
+	if (likely(kid >= 0)) {
+		if ((id = ht->kidx[kid]))
+			goto found;
+		/* Indexes aren't stored for extremely large tables. */
+		if (likely(ht->off <= USHRT_MAX))
+			return ht->off;
+	}
+
 	for (id = TFW_HTTP_HDR_RAW; id < ht->off; ++id) {
 		TfwStr *h = &ht->tbl[id];
 		/* There is no sense to compare against all duplicates. */
 		if (h->flags & TFW_STR_DUPLICATE)
 			h = TFW_STR_CHUNK(h, 0);
-		if (tfw_stricmpspn(hdr, h, ':'))
-			continue;
-		if (__hdr_is_singular(hdr))
-			hm->flags |= TFW_HTTP_FIELD_DUPENTRY;
-		break;
+		if (!tfw_stricmpspn(hdr, h, ':'))
+			goto found;
 	}
 
 	return id;
+found:
+	if (kid >= 0 && khdr_tbl[kid].singular)
+		hm->flags |= TFW_HTTP_FIELD_DUPENTRY;
+	return id;
+}
+
+/**
+ * Remember index @id of a new known header @kid in the headers table.
+ */
+static inline void
+__hdr_kidx_set(TfwHttpHdrTbl *ht, int kid, int id)
+{
+	if (kid >= 0 && !ht->kidx[kid] && id <= USHRT_MAX)
+		ht->kidx[kid] = id;
 }
 
 /**
@@ -257,6 +451,7 @@ tfw_http_msg_hdr_chunk_fixup(TfwHttpMsg *hm, char *data, int len)
 int
 tfw_http_msg_hdr_close(TfwHttpMsg *hm, int id)
 {
+	int kid = -1;
 	TfwStr *h;
 	TfwHttpHdrTbl *ht = hm->h_tbl;
 
@@ -266,6 +461,16 @@ tfw_http_msg_hdr_close(TfwHttpMsg *hm, int id)
 	/* Close just parsed header. */
 	hm->parser.hdr.flags |= TFW_STR_COMPLETE;
 
+	/*
+	 * Headers which aren't parsed by the FSM, but have special slots for
+	 * the message type, are recognized by their names.
+	 */
+	if (id == TFW_HTTP_HDR_RAW) {
+		kid = tfw_http_msg_hdr_known(&hm->parser.hdr);
+		if (kid >= 0)
+			id = ht->kmap[kid];
+	}
+
 	/* Quick path for special headers. */
 	if (likely(id < TFW_HTTP_HDR_RAW)) {
 		h = &ht->tbl[id];
@@ -278,14 +483,18 @@ tfw_http_msg_hdr_close(TfwHttpMsg *hm, int id)
 		 *
 		 * RFC 7230 3.2.2: all duplicates of special singular
 		 * headers must be blocked as early as possible,
-		 * just when parser reads them.
+		 * just when parser reads them. Singular headers recognized
+		 * by their names are blocked by classification layer.
 		 */
-		BUG_ON(id < TFW_HTTP_HDR_NONSINGULAR);
+		BUG_ON(id < TFW_HTTP_HDR_NONSINGULAR && kid < 0);
 		/*
 		 * RFC 7230 3.2.2: duplicate of non-singular special
 		 * header - leave the decision to classification layer.
+		 * Set-Cookie and other non-singular headers recognized
+		 * by their names are normally repeated.
 		 */
-		hm->flags |= TFW_HTTP_FIELD_DUPENTRY;
+		if (id < TFW_HTTP_HDR_NONSINGULAR || kid < 0)
+			hm->flags |= TFW_HTTP_FIELD_DUPENTRY;
 		goto duplicate;
 	}
 
@@ -295,11 +504,11 @@ tfw_http_msg_hdr_close(TfwHttpMsg *hm, int id)
 	 * Both the headers, the new one and existing one, can already be
 	 * compound.
 	 */
-	id = __hdr_lookup(hm, &hm->parser.hdr);
+	id = __hdr_lookup(hm, &hm->parser.hdr, kid);
 
 	/* Allocate some more room if not enough to store the header. */
 	if (unlikely(id == ht->size)) {
-		if (tfw_http_msg_grow_hdr_tbl(hm))
+		if (tfw_http_msg_grow_hdr_tbl(hm, id + 1))
 			return TFW_BLOCK;
 
 		ht = hm->h_tbl;
@@ -307,9 +516,11 @@ tfw_http_msg_hdr_close(TfwHttpMsg *hm, int id)
 
 	h = &ht->tbl[id];
 
-	if (TFW_STR_EMPTY(h))
+	if (TFW_STR_EMPTY(h)) {
 		/* Add the new header. */
+		__hdr_kidx_set(ht, kid, id);
 		goto done;
+	}
 
 duplicate:
 	h = tfw_str_add_duplicate(hm->pool, h);
@@ -363,20 +574,34 @@ __tfw_http_msg_add_data_ptr(TfwHttpMsg *hm, TfwStr *str, void *data,
 	return 0;
 }
 
+/**
+ * Grow headers table of @hm to keep at least @n headers.
+ *
+ * The tables are allocated by size classes of whole pool chunks instead of
+ * doubling by tfw_pool_realloc(), which copies the table each time when
+ * the table isn't the last allocation in the pool (and it's almost never
+ * for messages having plenty of headers). Thus, a message with hundreds
+ * of headers requires only one or two reallocations.
+ */
 int
-tfw_http_msg_grow_hdr_tbl(TfwHttpMsg *hm)
+tfw_http_msg_grow_hdr_tbl(TfwHttpMsg *hm, unsigned int n)
 {
+	unsigned int order = 0;
 	TfwHttpHdrTbl *ht = hm->h_tbl;
-	size_t order = ht->size / TFW_HTTP_HDR_NUM, new_order = order << 1;
 
-	ht = tfw_pool_realloc(hm->pool, ht, TFW_HHTBL_SZ(order),
-			      TFW_HHTBL_SZ(new_order));
+	BUG_ON(n <= ht->size);
+
+	while (TFW_HHTBL_CLASS(order) < n)
+		if (++order >= MAX_ORDER)
+			return -E2BIG;
+	n = TFW_HHTBL_CLASS(order);
+
+	ht = tfw_pool_alloc(hm->pool, TFW_HHTBL_EXACTSZ(n));
 	if (!ht)
 		return -ENOMEM;
-	ht->size = __HHTBL_SZ(new_order);
-	ht->off = hm->h_tbl->off;
-	memset(ht->tbl + __HHTBL_SZ(order), 0,
-	       __HHTBL_SZ(order) * sizeof(TfwStr));
+	memcpy(ht, hm->h_tbl, TFW_HHTBL_EXACTSZ(hm->h_tbl->off));
+	memset(ht->tbl + ht->off, 0, (n - ht->off) * sizeof(TfwStr));
+	ht->size = n;
 	hm->h_tbl = ht;
 
 	TFW_DBG3("grow http headers table to %d items\n", ht->size);
@@ -392,7 +617,7 @@ __hdr_add(TfwHttpMsg *hm, const TfwStr *hdr, int hid)
 {
 	int r;
 	TfwStr it = {};
-	TfwStr *h = TFW_STR_CHUNK(&hm->crlf, 0);
+	TfwStr *dst, *h = TFW_STR_CHUNK(&hm->crlf, 0);
 
 	r = ss_skb_get_room(&hm->msg.skb_list, hm->crlf.skb,
 			    h->ptr, tfw_str_total_len(hdr), &it);
@@ -409,7 +634,13 @@ __hdr_add(TfwHttpMsg *hm, const TfwStr *hdr, int hid)
 	 * (e.g. header name and value are placed in different chunks) aren't
 	 * satisfied. So don't consider the header for normal HTTP processing.
 	 */
-	hm->h_tbl->tbl[hid] = it;
+	dst = &hm->h_tbl->tbl[hid];
+	if (!TFW_STR_EMPTY(dst)) {
+		dst = tfw_str_add_duplicate(hm->pool, dst);
+		if (unlikely(!dst))
+			return -ENOMEM;
+	}
+	*dst = it;
 
 	return 0;
 }
@@ -466,10 +697,21 @@ __hdr_del(TfwHttpMsg *hm, int hid)
 	if (hid < TFW_HTTP_HDR_RAW) {
 		TFW_STR_INIT(&ht->tbl[hid]);
 	} else {
+		int k;
+
 		if (hid < ht->off - 1)
 			memmove(&ht->tbl[hid], &ht->tbl[hid + 1],
-				ht->off - hid - 1);
+				(ht->off - hid - 1) * sizeof(TfwStr));
 		--ht->off;
+		TFW_STR_INIT(&ht->tbl[ht->off]);
+
+		/* Fix indexes of the known headers after the deleted one. */
+		for (k = 0; k < TFW_HTTP_KHDR_NUM; ++k) {
+			if (ht->kidx[k] == hid)
+				ht->kidx[k] = 0;
+			else if (ht->kidx[k] > hid)
+				--ht->kidx[k];
+		}
 	}
 
 	return 0;
@@ -555,6 +797,7 @@ int
 tfw_http_msg_hdr_xfrm(TfwHttpMsg *hm, char *name, size_t n_len,
 		      char *val, size_t v_len, int hid, bool append)
 {
+	int r, kid = -1;
 	TfwHttpHdrTbl *ht = hm->h_tbl;
 	TfwStr *orig_hdr;
 	TfwStr new_hdr = {
@@ -570,6 +813,12 @@ tfw_http_msg_hdr_xfrm(TfwHttpMsg *hm, char *name, size_t n_len,
 
 	BUG_ON(!val && v_len);
 
+	/* Raw headers can have special slots for the message type. */
+	if (hid >= TFW_HTTP_HDR_RAW) {
+		kid = tfw_http_msg_hdr_known(&new_hdr);
+		hid = kid >= 0 ? ht->kmap[kid] : TFW_HTTP_HDR_RAW;
+	}
+
 	/* Firstly, get original message header to transform. */
 	if (hid < TFW_HTTP_HDR_RAW) {
 		orig_hdr = &ht->tbl[hid];
@@ -577,13 +826,15 @@ tfw_http_msg_hdr_xfrm(TfwHttpMsg *hm, char *name, size_t n_len,
 			/* Not found, nothing to delete. */
 			return 0;
 	} else {
-		hid = __hdr_lookup(hm, &new_hdr);
+		hid = __hdr_lookup(hm, &new_hdr, kid);
 		if (hid == ht->off && !val)
 			/* Not found, nothing to delete. */
 			return 0;
-		if (hid == ht->size)
-			if (tfw_http_msg_grow_hdr_tbl(hm))
+		if (hid == ht->size) {
+			if (tfw_http_msg_grow_hdr_tbl(hm, hid + 1))
 				return -ENOMEM;
+			ht = hm->h_tbl;
+		}
 		orig_hdr = &ht->tbl[hid];
 	}
 
@@ -595,7 +846,14 @@ tfw_http_msg_hdr_xfrm(TfwHttpMsg *hm, char *name, size_t n_len,
 	if (TFW_STR_EMPTY(orig_hdr)) {
 		if (unlikely(!val))
 			return 0;
-		return __hdr_add(hm, &new_hdr, hid);
+		r = __hdr_add(hm, &new_hdr, hid);
+		if (r)
+			return r;
+		if (hid == ht->off) {
+			++ht->off;
+			__hdr_kidx_set(ht, kid, hid);
+		}
+		return 0;
 	}
 
 	if (!val)
@@ -622,14 +880,21 @@ tfw_http_msg_hdr_xfrm(TfwHttpMsg *hm, char *name, size_t n_len,
 int
 tfw_http_msg_hdr_add(TfwHttpMsg *hm, TfwStr *hdr)
 {
-	int hid;
+	int hid, kid = tfw_http_msg_hdr_known(hdr);
 	TfwHttpHdrTbl *ht = hm->h_tbl;
 
+	/* Special headers are added as duplicates to their slots. */
+	if (kid >= 0 && ht->kmap[kid] < TFW_HTTP_HDR_RAW)
+		return __hdr_add(hm, hdr, ht->kmap[kid]);
+
 	hid = ht->off;
-	if (hid == ht->size)
-		if (tfw_http_msg_grow_hdr_tbl(hm))
+	if (hid == ht->size) {
+		if (tfw_http_msg_grow_hdr_tbl(hm, hid + 1))
 			return -ENOMEM;
+		ht = hm->h_tbl;
+	}
 	++ht->off;
+	__hdr_kidx_set(ht, kid, hid);
 
 	return __hdr_add(hm, hdr, hid);
 }
@@ -839,19 +1104,123 @@ tfw_http_msg_alloc(int type)
 	if (!hm)
 		return NULL;
 
-	hm->h_tbl = (TfwHttpHdrTbl *)tfw_pool_alloc(hm->pool, TFW_HHTBL_SZ(1));
+	hm->h_tbl = (TfwHttpHdrTbl *)
+		    tfw_pool_alloc(hm->pool,
+				   TFW_HHTBL_EXACTSZ(TFW_HTTP_HDR_NUM));
 	if (unlikely(!hm->h_tbl)) {
 		TFW_WARN("Insufficient memory to create message\n");
 		tfw_pool_destroy(hm->pool);
 		return NULL;
 	}
 
-	hm->h_tbl->size = __HHTBL_SZ(1);
+	hm->h_tbl->size = TFW_HTTP_HDR_NUM;
 	hm->h_tbl->off = TFW_HTTP_HDR_RAW;
-	memset(hm->h_tbl->tbl, 0, __HHTBL_SZ(1) * sizeof(TfwStr));
+	hm->h_tbl->kmap = (type & Conn_Clnt) ? req_kmap : resp_kmap;
+	memset(hm->h_tbl->kidx, 0, sizeof(hm->h_tbl->kidx));
+	memset(hm->h_tbl->tbl, 0, TFW_HTTP_HDR_NUM * sizeof(TfwStr));
 
 	ss_skb_queue_head_init(&hm->msg.skb_list);
 	INIT_LIST_HEAD(&hm->msg.msg_list);
 
 	return hm;
 }
+
+/**
+ * Place all the known headers from hash bucket @g to free slots, which are
+ * unset bits in @used, using displacement @d.
+ */
+static bool __init
+__khdr_place(const unsigned int *hash, unsigned int g, unsigned int d,
+	     unsigned long *used)
+{
+	int i;
+	DECLARE_BITMAP(b, TFW_HTTP_KHDR_NUM);
+
+	khdr_disp[g] = d;
+	bitmap_copy(b, used, TFW_HTTP_KHDR_NUM);
+	for (i = 0; i < TFW_HTTP_KHDR_NUM; ++i) {
+		unsigned int s;
+
+		if ((hash[i] & KHDR_DISP_MASK) != g)
+			continue;
+		s = __khdr_slot(hash[i]);
+		if (test_and_set_bit(s, b))
+			return false;
+		khdr_slot[s] = i;
+	}
+	bitmap_copy(used, b, TFW_HTTP_KHDR_NUM);
+
+	return true;
+}
+
+/**
+ * Build mappings of known headers to special headers of requests and
+ * responses, and the perfect hash of the known headers names.
+ * Larger buckets are placed first while there are many free slots, so
+ * the search takes about a thousand of probes.
+ */
+int __init
+tfw_http_msg_init(void)
+{
+	int i, n, g;
+	unsigned int d, hash[TFW_HTTP_KHDR_NUM];
+	unsigned char cnt[KHDR_DISP_N] = {};
+	DECLARE_BITMAP(used, TFW_HTTP_KHDR_NUM);
+
+	BUILD_BUG_ON(ARRAY_SIZE(khdr_tbl) != TFW_HTTP_KHDR_NUM);
+	BUILD_BUG_ON(TFW_HTTP_KHDR_NUM > 256);
+	/*
+	 * The slots boundaries are the ends of the larger of the request and
+	 * response specific sets, see tfw_http_hdr_t.
+	 */
+	BUILD_BUG_ON((int)__TFW_HTTP_HDR_REQ_SINGULAR
+		     > TFW_HTTP_HDR_NONSINGULAR);
+	BUILD_BUG_ON((int)__TFW_HTTP_HDR_RESP_SINGULAR
+		     > TFW_HTTP_HDR_NONSINGULAR);
+	BUILD_BUG_ON((int)__TFW_HTTP_HDR_REQ_SINGULAR
+		     != TFW_HTTP_HDR_NONSINGULAR
+		     && (int)__TFW_HTTP_HDR_RESP_SINGULAR
+			!= TFW_HTTP_HDR_NONSINGULAR);
+	BUILD_BUG_ON((int)__TFW_HTTP_HDR_REQ_NUM > TFW_HTTP_HDR_RAW);
+	BUILD_BUG_ON((int)__TFW_HTTP_HDR_RESP_NUM > TFW_HTTP_HDR_RAW);
+	BUILD_BUG_ON((int)__TFW_HTTP_HDR_REQ_NUM != TFW_HTTP_HDR_RAW
+		     && (int)__TFW_HTTP_HDR_RESP_NUM != TFW_HTTP_HDR_RAW);
+	BUILD_BUG_ON(TFW_HTTP_HDR_RAW >= TFW_HTTP_HDR_NUM);
+
+	memset(req_kmap, TFW_HTTP_HDR_RAW, sizeof(req_kmap));
+	memset(resp_kmap, TFW_HTTP_HDR_RAW, sizeof(resp_kmap));
+	for (i = 0; i < TFW_HTTP_HDR_RAW; ++i) {
+		if (req_hdrs[i] < TFW_HTTP_KHDR_NUM)
+			req_kmap[req_hdrs[i]] = i;
+		if (resp_hdrs[i] < TFW_HTTP_KHDR_NUM)
+			resp_kmap[resp_hdrs[i]] = i;
+	}
+
+	for (i = 0; i < TFW_HTTP_KHDR_NUM; ++i) {
+		const TfwStr *name = &khdr_tbl[i].name;
+
+		BUG_ON(!name->len);
+		hash[i] = KHDR_HASH_INIT;
+		for (n = 0; n < name->len - 1; ++n)
+			hash[i] = KHDR_HASH(hash[i],
+					    ((unsigned char *)name->ptr)[n]);
+		khdr_maxlen = max_t(unsigned int, khdr_maxlen, name->len - 1);
+		++cnt[hash[i] & KHDR_DISP_MASK];
+	}
+
+	bitmap_zero(used, TFW_HTTP_KHDR_NUM);
+	for (n = TFW_HTTP_KHDR_NUM; n > 0; --n)
+		for (g = 0; g < KHDR_DISP_N; ++g) {
+			if (cnt[g] != n)
+				continue;
+			for (d = 0; d <= USHRT_MAX; ++d)
+				if (__khdr_place(hash, g, d, used))
+					break;
+			if (d > USHRT_MAX) {
+				TFW_ERR("Cannot build HTTP headers hash\n");
+				return -EINVAL;
+			}
+		}
+
+	return 0;
+}
@@ -24,6 +24,8 @@
 #include "http.h"
 
 #define S_F_SET_COOKIE		"Set-Cookie: "
+#define S_F_DATE		"Date: "
+#define S_V_DATE		"Sun, 06 Nov 1994 08:49:37 GMT"
 #define S_CRLF			"\r\n"
 
 #define SLEN(s)			(sizeof(s) - 1)
@@ -63,6 +65,7 @@ int __tfw_http_msg_add_data_ptr(TfwHttpMsg *hm, TfwStr *str, void *data,
 #define tfw_http_msg_add_data_ptr(hm, str, data, len)			\
 	__tfw_http_msg_add_data_ptr(hm, str, data, len, NULL)
 
+int tfw_http_msg_hdr_known(const TfwStr *hdr);
 int tfw_http_msg_hdr_add(TfwHttpMsg *hm, TfwStr *hdr);
 int tfw_http_msg_hdr_xfrm(TfwHttpMsg *hm, char *name, size_t n_len,
 			  char *val, size_t v_len, int hid, bool append);
@@ -84,9 +87,11 @@ void tfw_http_msg_hdr_chunk_fixup(TfwHttpMsg *hm, char *data, int len);
 void tfw_http_msg_field_chunk_fixup(TfwHttpMsg *hm, TfwStr *field,
 				    char *data, int len);
 int tfw_http_msg_hdr_close(TfwHttpMsg *hm, int id);
-int tfw_http_msg_grow_hdr_tbl(TfwHttpMsg *hm);
+int tfw_http_msg_grow_hdr_tbl(TfwHttpMsg *hm, unsigned int n);
 
 TfwHttpMsg *tfw_http_msg_alloc(int type);
 void tfw_http_msg_free(TfwHttpMsg *m);
 
+int tfw_http_msg_init(void);
+
 #endif /* __TFW_HTTP_MSG_H__ */
@@ -30,6 +30,7 @@
  */
 #include <linux/ctype.h>
 #include <linux/kernel.h>
+#include <linux/percpu.h>
 
 #include "gfsm.h"
 #include "http_msg.h"
@@ -51,6 +52,7 @@ enum {
 	RGen_Hdr,
 	RGen_HdrOther,
 	RGen_HdrOtherN,
+	RGen_HdrOtherS,
 	RGen_HdrOtherV,
 
 	RGen_BodyInit,
@@ -68,33 +70,6 @@ enum {
  */
 #define IS_CR_OR_LF(c) (c == '\r' || c == '\n')
 
-/**
- * Scans the initial @n bytes of the memory area pointed to by @s for the first
- * occurance of EOL character.
- *
- * NOTE: We can use @strcspn here, but at the moment it's generic implementation
- * from the kernel's library is more badly than the @memchreol provided as: 1)
- * it uses for-in-for logic that can't be optimized at compile time 2) it
- * operates on zero-terminated strings so needless string boudary check occures
- * on every iteration 3) it returns not the pointer but the number of bytes, so
- * additinal logic needs to be implemented while preparing the result.
- *
- * In any case, it will be a good deal to rewrite such a function using
- * vectorized extenstions such as AVX/SSE in the future.
- *
- * Related to #182 (https://github.com/natsys/tempesta/issues/182)
- */
-static inline unsigned char *
-memchreol(const unsigned char *s, size_t n)
-{
-	while (n) {
-		if (IS_CR_OR_LF(*s))
-			return (unsigned char *)s;
-		s++, n--;
-	}
-	return NULL;
-}
-
 /**
  * Check whether a character is a whitespace (RWS/OWS/BWS according to RFC7230).
  */
@@ -146,8 +121,8 @@ do {									\
 	TfwHttpMsg	*msg = (TfwHttpMsg *)(ptr);			\
 	TfwHttpParser	*parser = &msg->parser;				\
 	unsigned char	*p = data;					\
-	unsigned char	c = *p;						\
-	int		__fsm_const_state;				\
+	unsigned char	__maybe_unused c = *p;				\
+	int		__maybe_unused __fsm_const_state;		\
 	int		__maybe_unused __fsm_n;				\
 	size_t		__maybe_unused __fsm_sz;			\
 	unsigned char	__maybe_unused *__fsm_ch;			\
@@ -292,21 +267,28 @@ __FSM_STATE(st) {							\
 
 /* Little endian. */
 #define LC(c)		((c) | 0x20)
-#define TFW_LC_INT	0x20202020
-#define TFW_LC_LONG	0x2020202020202020UL
 #define TFW_CHAR4_INT(a, b, c, d)					\
 	 ((d << 24) | (c << 16) | (b << 8) | a)
 #define TFW_CHAR8_INT(a, b, c, d, e, f, g, h)				\
 	 (((long)h << 56) | ((long)g << 48) | ((long)f << 40)		\
 	  | ((long)e << 32) | (d << 24) | (c << 16) | (b << 8) | a)
+/*
+ * Case folding bit for a pattern character. Only letters are folded:
+ * OR'ing 0x20 to punctuation would match e.g. 0x1a as ':' or CR as '-'.
+ */
+#define __LCM(c)	(((c) >= 'a' && (c) <= 'z') ? 0x20 : 0)
 /*
  * Match 4 or 8 characters with conversion to lower case
  * and type conversion to int or long type.
  */
 #define C4_INT_LCM(p, a, b, c, d)					\
-	 !((*(unsigned int *)(p) | TFW_LC_INT) ^ TFW_CHAR4_INT(a, b, c, d))
+	 !((*(unsigned int *)(p)					\
+	    | TFW_CHAR4_INT(__LCM(a), __LCM(b), __LCM(c), __LCM(d)))	\
+	   ^ TFW_CHAR4_INT(a, b, c, d))
 #define C8_INT_LCM(p, a, b, c, d, e, f, g, h)				\
-	 !((*(unsigned long *)(p) | TFW_LC_LONG)			\
+	 !((*(unsigned long *)(p)					\
+	    | TFW_CHAR8_INT(__LCM(a), __LCM(b), __LCM(c), __LCM(d),	\
+			    __LCM(e), __LCM(f), __LCM(g), __LCM(h)))	\
 	   ^ TFW_CHAR8_INT(a, b, c, d, e, f, g, h))
 
 /*
@@ -316,9 +298,8 @@ __FSM_STATE(st) {							\
  * 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
  * 	"!#$%&'*+-.^_`|~0123456789"
  */
-static const unsigned long hdr_a[] ____cacheline_aligned = {
-	0x3ff6cfa00000000UL, 0x57ffffffc7fffffeUL, 0, 0
-};
+static const TfwStrAlpha hdr_a ____cacheline_aligned =
+	TFW_STR_ALPHA(0x3ff6cfa00000000UL, 0x57ffffffc7fffffeUL);
 
 #define IN_ALPHABET(c, a)	(a[c >> 6] & (1UL << (c & 0x3f)))
 
@@ -349,13 +330,7 @@ __try_str(TfwStr *hdr, TfwStr* chunk, unsigned char *p, size_t len,
 
 	len = min(len, str_len - offset);
 
-	/*
-	 * TODO kernel has dummy C strcasecmp() implementation which converts
-	 * both the strings to low case while @str is always in lower case.
-	 * Also GLIBC has assembly implementation of the functions, so
-	 * implement our own strcasecmp() if it becomes a bottle neck.
-	 */
-	if (strncasecmp(p, str + offset, len) ||
+	if (tfw_cstricmp(p, str + offset, len) ||
 	    (chunk->len && !tfw_str_eq_cstr_pos(hdr, chunk->ptr, str, chunk->len,
 						TFW_STR_EQ_CASEI)))
 		return CSTR_NEQ;
@@ -430,6 +405,20 @@ parse_int_list(unsigned char *data, size_t len, unsigned long *acc)
 	return parse_int_a(data, len, ws_comma_a, acc);
 }
 
+/*
+ * Values of hexadecimal digits with 0x10 bit set to tell them from other
+ * characters, which are zero.
+ */
+static const unsigned char hex_tbl[256] ____cacheline_aligned = {
+	['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13,
+	['4'] = 0x14, ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17,
+	['8'] = 0x18, ['9'] = 0x19,
+	['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d,
+	['E'] = 0x1e, ['F'] = 0x1f,
+	['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d,
+	['e'] = 0x1e, ['f'] = 0x1f,
+};
+
 /**
  * Parse probably chunked string representation of an hexadecimal integer.
  * @return number of parsed bytes.
@@ -440,18 +429,44 @@ parse_int_hex(unsigned char *data, size_t len, unsigned long *acc)
 	unsigned char *p;
 
 	for (p = data; p - data < len; ++p) {
-		if (unlikely(IS_CR_OR_LF(*p) || (*p == ';')))
-			return p - data;
-		if (unlikely(!isxdigit(*p)))
+		if (unlikely(!hex_tbl[*p])) {
+			if (IS_CR_OR_LF(*p) || (*p == ';'))
+				return p - data;
 			return CSTR_NEQ;
+		}
 		if (unlikely(*acc > (UINT_MAX - 16) / 16))
 			return CSTR_BADLEN;
-		*acc = (*acc << 4) + (*p & 0xf) + (*p >> 6) * 9;
+		*acc = (*acc << 4) | (hex_tbl[*p] & 0xf);
 	}
 
 	return CSTR_POSTPONE;
 }
 
+/**
+ * Fast path for a chunk size line "1*HEXDIG CRLF" which lies entirely in
+ * @data. Not more than 7 digits are accepted, so the size always fits @size.
+ *
+ * @return length of the line and the chunk size in @size, or CSTR_NEQ if
+ * the line must be parsed by parse_int_hex(): it's split between data
+ * chunks, has a chunk extension, zero or long size, or it's malformed.
+ */
+static int
+parse_chunk_size(unsigned char *data, size_t len, int *size)
+{
+	unsigned char *p, *end = data + min_t(size_t, len, 8);
+	unsigned int v, acc = 0;
+
+	for (p = data; p < end && (v = hex_tbl[*p]); ++p)
+		acc = (acc << 4) | (v & 0xf);
+	if (unlikely(p == data || p - data > 7 || !acc))
+		return CSTR_NEQ;
+	if (unlikely(p - data + 2 > len || *p != '\r' || *(p + 1) != '\n'))
+		return CSTR_NEQ;
+
+	*size = acc;
+	return p - data + 2;
+}
+
 /* Helping (inferior) states to process particular parts of HTTP message. */
 enum {
 	I_0, /* initial state */
@@ -556,7 +571,7 @@ __FSM_STATE(st_curr) {							\
 	 * Check whether the header slot is acquired to catch		\
 	 * duplicate headers in sense of RFC 7230 3.2.2.		\
 	 */								\
-	if (id < TFW_HTTP_HDR_NONSINGULAR				\
+	if ((int)(id) < TFW_HTTP_HDR_NONSINGULAR			\
 	    && unlikely(!TFW_STR_EMPTY(&(msg)->h_tbl->tbl[id])))	\
 		return TFW_BLOCK;					\
 	/* Store header name and field in different chunks. */		\
@@ -627,10 +642,14 @@ __FSM_STATE(st_curr) {							\
  * Parse raw (common) HTTP headers.
  * Note that some of these can be extremely large.
  *
+ * Header name is scanned over the allowed alphabet and the value is scanned
+ * for EOL by vectorized functions, so long headers, e.g. cookies, are eaten
+ * in 16 or 32 bytes steps. Header name and value are stored in different
+ * chunks like for special headers, so headers recognized by their names
+ * can be stored in special slots of the headers table.
+ *
  * TODO: Here we should check if the rest of the header consists only of
  *       characters allowed by RFCs.
- * TODO Use AVX scan over _allowed_ alphabet.
- * TODO Split the headers to header name and header field as special headers.
  */
 #define RGEN_HDR_OTHER()						\
 __FSM_STATE(RGen_HdrOther) {						\
@@ -638,23 +657,32 @@ __FSM_STATE(RGen_HdrOther) {						\
 	/* Fall through. */						\
 }									\
 __FSM_STATE(RGen_HdrOtherN) {						\
-	if (likely(IN_ALPHABET(c, hdr_a))) {				\
-		__FSM_MOVE(RGen_HdrOtherN);				\
+	if (likely(IN_ALPHABET(c, hdr_a.a))) {				\
+		__fsm_sz = tfw_memspn(p, __data_remain(p), &hdr_a);	\
+		__FSM_MOVE_n(RGen_HdrOtherN, __fsm_sz);			\
 	} else if (likely(c == ':')) {					\
-		__FSM_MOVE(RGen_HdrOtherV);				\
+		__FSM_MOVE(RGen_HdrOtherS);				\
 	}								\
 	return TFW_BLOCK;						\
 }									\
+__FSM_STATE(RGen_HdrOtherS) {						\
+	/* Skip OWS and store the header name in separate chunk. */	\
+	if (likely(IS_WS(c)))						\
+		__FSM_MOVE(RGen_HdrOtherS);				\
+	tfw_http_msg_hdr_chunk_fixup(msg, data, p - data);		\
+	/* Fall through. */						\
+}									\
 __FSM_STATE(RGen_HdrOtherV) {						\
-	/* Just eat the header until EOL. */				\
+	/* Just eat the header value until EOL. */			\
 	__fsm_sz = __data_remain(p);					\
-	__fsm_ch = memchreol(p, __fsm_sz);				\
+	__fsm_ch = tfw_memchreol(p, __fsm_sz);				\
 	if (__fsm_ch) {							\
-		/* Get length of the header. */				\
-		tfw_http_msg_hdr_chunk_fixup(msg, data, __fsm_ch - data);\
+		/* Get length of the header value. */			\
+		tfw_http_msg_hdr_chunk_fixup(msg, p, __fsm_ch - p);	\
 		__FSM_MOVE_n(RGen_EoL, __fsm_ch - p);			\
 	}								\
-	__FSM_MOVE_n(RGen_HdrOtherV, __fsm_sz);				\
+	tfw_http_msg_hdr_chunk_fixup(msg, p, __fsm_sz);			\
+	__FSM_MOVE_nff(RGen_HdrOtherV, __fsm_sz, NULL, 0);		\
 }
 
 /*
@@ -786,6 +814,14 @@ __FSM_STATE(RGen_BodyChunk) {						\
 		/* Prevent @parse_int_hex false positives. */		\
 		if (!isxdigit(c))					\
 			return TFW_BLOCK;				\
+		/*							\
+		 * Fast path: the whole chunk size line is in the	\
+		 * current data chunk, so skip it at once.		\
+		 */							\
+		__fsm_n = parse_chunk_size(p, __data_remain(p),		\
+					   &parser->to_read);		\
+		if (likely(__fsm_n > 0))				\
+			__FSM_B_MOVE_n(RGen_BodyReadChunk, __fsm_n);	\
 		__FSM_JMP(RGen_BodyChunkLen);				\
 	}								\
 	/* Fall through. */						\
@@ -795,8 +831,14 @@ __FSM_STATE(RGen_BodyReadChunk) {					\
 	parser->to_read -= __fsm_sz;					\
 	if (parser->to_read)						\
 		__FSM_B_MOVE_n(RGen_BodyReadChunk, __fsm_sz);		\
-	if (msg->flags & TFW_HTTP_CHUNKED)				\
+	if (msg->flags & TFW_HTTP_CHUNKED) {				\
+		/* Skip CRLF after the chunk data if it is here. */	\
+		if (likely(__data_available(p, __fsm_sz + 2)		\
+			   && *(p + __fsm_sz) == '\r'			\
+			   && *(p + __fsm_sz + 1) == '\n'))		\
+			__FSM_B_MOVE_n(RGen_BodyChunk, __fsm_sz + 2);	\
 		__FSM_B_MOVE_n(RGen_BodyEoL, __fsm_sz);			\
+	}								\
 	/* We've fully read Content-Length bytes. */			\
 	msg->body.flags |= TFW_STR_COMPLETE;				\
 	if (tfw_http_msg_add_data_ptr(msg, &msg->body, p, __fsm_sz))	\
@@ -819,6 +861,9 @@ __FSM_STATE(RGen_BodyChunkLen) {					\
 		return TFW_BLOCK;					\
 	default:							\
 		BUG_ON(__fsm_n < 0);					\
+		/* The chunk size must fit @parser->to_read. */		\
+		if (unlikely(parser->_acc > INT_MAX))			\
+			return TFW_BLOCK;				\
 		parser->to_read = parser->_acc;				\
 		if (!parser->to_read)					\
 			msg->body.flags |= TFW_STR_COMPLETE;		\
@@ -827,7 +872,7 @@ __FSM_STATE(RGen_BodyChunkLen) {					\
 	}								\
 }									\
 __FSM_STATE(RGen_BodyChunkExt) {					\
-	if (unlikely(c == ';' || c == '=' || IN_ALPHABET(c, hdr_a)))	\
+	if (unlikely(c == ';' || c == '=' || IN_ALPHABET(c, hdr_a.a)))	\
 		__FSM_B_MOVE(RGen_BodyChunkExt);			\
 	/* Fall through. */						\
 }									\
@@ -879,6 +924,17 @@ __FSM_STATE(RGen_BodyEoLine) {						\
 #define RGEN_LWS_empty()						\
 __FSM_STATE(RGen_LWS_empty) {						\
 	if (unlikely(IS_CR_OR_LF(c))) {					\
+		if (parser->_i_st == RGen_EoL)				\
+			__FSM_JMP(RGen_EoL);				\
+		/*							\
+		 * Empty value: the header isn't checked for singular	\
+		 * duplicates and its name isn't stored by value parser.\
+		 */							\
+		if (parser->_hdr_tag < TFW_HTTP_HDR_NONSINGULAR		\
+		    && !TFW_STR_EMPTY(msg->h_tbl->tbl			\
+				      + parser->_hdr_tag))		\
+			return TFW_BLOCK;				\
+		tfw_http_msg_hdr_chunk_fixup(msg, data, p - data);	\
 		__FSM_JMP(RGen_EoL);					\
 	}								\
 	RGEN_LWS_common_cases(RGen_LWS_empty)				\
@@ -932,7 +988,7 @@ __parse_connection(TfwHttpMsg *hm, unsigned char *data, size_t len)
 		 */
 		unsigned char *comma;
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		comma = memchr(p, ',', __fsm_sz);
 		if (comma && (!__fsm_ch || (__fsm_ch && (comma < __fsm_ch))))
 			__FSM_I_MOVE_n(I_EoT, comma - p);
@@ -945,7 +1001,7 @@ __parse_connection(TfwHttpMsg *hm, unsigned char *data, size_t len)
 	__FSM_STATE(I_EoT) {
 		if (c == ' ' || c == ',')
 			__FSM_I_MOVE(I_EoT);
-		if (IN_ALPHABET(c, hdr_a))
+		if (IN_ALPHABET(c, hdr_a.a))
 			__FSM_I_MOVE_n(I_Conn, 0);
 		if (IS_CR_OR_LF(c))
 			return __data_offset(p);
@@ -1011,7 +1067,7 @@ __parse_content_type(TfwHttpMsg *hm, unsigned char *data, size_t len)
 		 *   null-terminated strings.
 		 */
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (__fsm_ch)
 			return __data_offset(__fsm_ch);
 		__FSM_I_MOVE_n(I_ContType, __fsm_sz);
@@ -1073,7 +1129,7 @@ __parse_transfer_encoding(TfwHttpMsg *hm, unsigned char *data, size_t len)
 		 */
 		unsigned char *comma;
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		comma = memchr(p, ',', __fsm_sz);
 		if (comma && (!__fsm_ch || (__fsm_ch && (comma < __fsm_ch))))
 			__FSM_I_MOVE_n(I_EoT, comma - p);
@@ -1086,7 +1142,7 @@ __parse_transfer_encoding(TfwHttpMsg *hm, unsigned char *data, size_t len)
 	__FSM_STATE(I_EoT) {
 		if (c == ' ' || c == ',')
 			__FSM_I_MOVE(I_EoT);
-		if (IN_ALPHABET(c, hdr_a))
+		if (IN_ALPHABET(c, hdr_a.a))
 			__FSM_I_MOVE(I_TransEncod);
 		if (IS_CR_OR_LF(c))
 			return __data_offset(p);
@@ -1104,9 +1160,8 @@ done:
  * ------------------------------------------------------------------------
  */
 /*
- * TODO Performance.
- * The alphabets below are less than 8 ranges, so they can be handled
- * using CMPESTRI(_SIDD_CMP_RANGES).
+ * Long runs of characters from the alphabets below, e.g. long URIs, are
+ * skipped by tfw_memspn() which checks 16 or 32 characters at once.
  */
 /*
  * Alphabet for URI abs_path (RFC 3986).
@@ -1125,9 +1180,8 @@ done:
  * In a similar way, that violates RFC 7230 that distinguishes "absolute-path"
  * from "query" and "fragment" components.
  */
-static const unsigned long uap_a[] ____cacheline_aligned = {
-	0xaffffffa00000000UL, 0x47fffffeafffffffUL, 0, 0
-};
+static const TfwStrAlpha uap_a ____cacheline_aligned =
+	TFW_STR_ALPHA(0xaffffffa00000000UL, 0x47fffffeafffffffUL);
 
 /*
  * Alphabet for X-Forwarded-For Node ID (RFC 7239).
@@ -1360,7 +1414,7 @@ __req_parse_authorization(TfwHttpReq *req, unsigned char *data, size_t len)
 
 	__FSM_STATE(Req_I_Auth) {
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (__fsm_ch) {
 			return __data_offset(__fsm_ch);
 			req->cache_ctl.flags |= TFW_HTTP_CC_HDR_AUTHORIZATION;
@@ -1493,7 +1547,7 @@ __req_parse_cache_control(TfwHttpReq *req, unsigned char *data, size_t len)
 		 */
 		unsigned char *comma;
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		comma = memchr(p, ',', __fsm_sz);
 		if (comma && (!__fsm_ch || (__fsm_ch && (comma < __fsm_ch))))
 			__FSM_I_MOVE_n(Req_I_CC_EoT, comma - p);
@@ -1506,7 +1560,7 @@ __req_parse_cache_control(TfwHttpReq *req, unsigned char *data, size_t len)
 	__FSM_STATE(Req_I_CC_EoT) {
 		if (c == ' ' || c == ',')
 			__FSM_I_MOVE(Req_I_CC_EoT);
-		if (IN_ALPHABET(c, hdr_a))
+		if (IN_ALPHABET(c, hdr_a.a))
 			__FSM_I_MOVE_n(Req_I_CC, 0);
 		if (IS_CR_OR_LF(c))
 			return __data_offset(p);
@@ -1690,7 +1744,7 @@ __req_parse_pragma(TfwHttpReq *req, unsigned char *data, size_t len)
 	__FSM_STATE(Req_I_Pragma_Ext) {
 		/* Just skip the extensions. */
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (__fsm_ch)
 			return __data_offset(__fsm_ch);
 		__FSM_I_MOVE_n(Req_I_Pragma_Ext, __fsm_sz);
@@ -1711,7 +1765,7 @@ __req_parse_user_agent(TfwHttpMsg *hm, unsigned char *data, size_t len)
 
 	__FSM_STATE(Req_I_UserAgent) {
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (__fsm_ch)
 			return __data_offset(__fsm_ch);
 		__FSM_I_MOVE_n(Req_I_UserAgent, __fsm_sz);
@@ -1981,9 +2035,21 @@ tfw_http_parse_req(void *req_data, unsigned char *data, size_t len)
 	 * as we should according to RFC 2616 (3.2.2) and RFC 7230 (2.7).
 	 */
 	__FSM_STATE(Req_UriAbsPath) {
-		if (likely(IN_ALPHABET(c, uap_a)))
+		if (likely(IN_ALPHABET(c, uap_a.a))) {
+#ifdef TFW_HTTP_NORMALIZATION
 			/* Move forward through possibly segmented data. */
 			__FSM_MOVE_f(TFW_HTTP_URI_HOOK, &req->uri_path);
+#else
+			/*
+			 * Skip all the allowed characters in the data chunk,
+			 * the field is fixed up if the URI continues in next
+			 * chunk.
+			 */
+			__fsm_sz = tfw_memspn(p, __data_remain(p), &uap_a);
+			__FSM_MOVE_nf(Req_UriAbsPath, __fsm_sz,
+				      &req->uri_path);
+#endif
+		}
 
 		if (likely(c == ' ')) {
 			__msg_field_finish(&req->uri_path, p);
@@ -2031,7 +2097,7 @@ tfw_http_parse_req(void *req_data, unsigned char *data, size_t len)
 		if (unlikely(IS_CR_OR_LF((c))))
 			__FSM_JMP(RGen_EoL);
 
-		if (unlikely(!IN_ALPHABET(c, hdr_a)))
+		if (unlikely(!IN_ALPHABET(c, hdr_a.a)))
 			return TFW_BLOCK;
 
 		switch (LC(c)) {
@@ -2043,7 +2109,7 @@ tfw_http_parse_req(void *req_data, unsigned char *data, size_t len)
 				   && *(p + 13) == ':'))
 			{
 				parser->_i_st = Req_HdrAuthorizationV;
-				__FSM_MOVE_n(RGen_LWS_empty, 14);
+				__FSM_MOVE_n(RGen_LWS, 14);
 			}
 			__FSM_MOVE(Req_HdrA);
 		case 'c':
@@ -2382,6 +2448,7 @@ tfw_http_parse_req(void *req_data, unsigned char *data, size_t len)
 	__FSM_STATE(Req_HdrHost) {
 		if (likely(c == ':')) {
 			parser->_i_st = Req_HdrHostV;
+			parser->_hdr_tag = TFW_HTTP_HDR_HOST;
 			__FSM_MOVE(RGen_LWS_empty);
 		}
 		__FSM_JMP(RGen_HdrOther);
@@ -2773,7 +2840,7 @@ __resp_parse_cache_control(TfwHttpResp *resp, unsigned char *data, size_t len)
 		 */
 		unsigned char *comma;
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		comma = memchr(p, ',', __fsm_sz);
 		if (comma && (!__fsm_ch || (__fsm_ch && (comma < __fsm_ch))))
 			__FSM_I_MOVE_n(Resp_I_EoT, comma - p);
@@ -2793,7 +2860,7 @@ __resp_parse_cache_control(TfwHttpResp *resp, unsigned char *data, size_t len)
 		 */
 		if (c == '=')
 			__FSM_I_MOVE(Resp_I_Ext);
-		if (IN_ALPHABET(c, hdr_a))
+		if (IN_ALPHABET(c, hdr_a.a))
 			__FSM_I_MOVE_n(Resp_I_CC, 0);
 		if (IS_CR_OR_LF(c))
 			return __data_offset(p);
@@ -2845,6 +2912,118 @@ __year_day_secs(unsigned int year, unsigned int day_sec)
 	return (days - EPOCH_DAYS) * SEC24H + day_sec;
 }
 
+/* IMF-fixdate, RFC 7231 7.1.1.1. */
+#define IMF_FIXDATE		"Sun, 06 Nov 1994 08:49:37 GMT"
+#define IMF_FIXDATE_FMT		"___, 00 ___ 0000 00:00:00 GMT"
+#define IMF_FIXDATE_LEN		SLEN(IMF_FIXDATE)
+
+/**
+ * Last date string seen on the CPU and its value for Date and Expires
+ * headers. Origins send the same Date value during a second, and Expires
+ * is usually the same offset from it, so they repeat in many responses.
+ */
+typedef struct {
+	unsigned char	str[IMF_FIXDATE_LEN];
+	time_t		date;
+} TfwDateMemo;
+
+static DEFINE_PER_CPU(TfwDateMemo[2], date_memo);
+
+#define __D2(p)		(((p)[0] - '0') * 10 + (p)[1] - '0')
+
+/**
+ * Parse IMF-fixdate at @p, which is the only format modern servers
+ * generate, at once. The result is the same as computed by the FSM below,
+ * which is left for dates split between data chunks and obsolete formats.
+ *
+ * @return the date or negative value if the FSM must be used.
+ */
+static long
+__parse_imf_fixdate(const unsigned char *p)
+{
+	static const char fmt[] = IMF_FIXDATE_FMT;
+	int i, day, month;
+	long date;
+
+	for (i = 0; i < IMF_FIXDATE_LEN; ++i) {
+		if (fmt[i] == '_')
+			continue;
+		if (fmt[i] == '0' ? !isdigit(p[i]) : p[i] != fmt[i])
+			return -1;
+	}
+
+	/*
+	 * Match the weekday name along with the following comma. The FSM
+	 * skips the weekday, but it must reject the same values, e.g. with
+	 * CR or LF inside, as the fast path.
+	 */
+	switch (*(unsigned int *)p) {
+	case TFW_CHAR4_INT('M', 'o', 'n', ','):
+	case TFW_CHAR4_INT('T', 'u', 'e', ','):
+	case TFW_CHAR4_INT('W', 'e', 'd', ','):
+	case TFW_CHAR4_INT('T', 'h', 'u', ','):
+	case TFW_CHAR4_INT('F', 'r', 'i', ','):
+	case TFW_CHAR4_INT('S', 'a', 't', ','):
+	case TFW_CHAR4_INT('S', 'u', 'n', ','):
+		break;
+	default:
+		return -1;
+	}
+
+	day = __D2(p + 5);
+	if (unlikely(!day))
+		return -1;
+
+	/* Match the month name along with the following SP. */
+	switch (*(unsigned int *)(p + 8)) {
+	case TFW_CHAR4_INT('J', 'a', 'n', ' '):
+		month = 0;
+		break;
+	case TFW_CHAR4_INT('F', 'e', 'b', ' '):
+		month = SB_FEB;
+		break;
+	case TFW_CHAR4_INT('M', 'a', 'r', ' '):
+		month = SB_MAR;
+		break;
+	case TFW_CHAR4_INT('A', 'p', 'r', ' '):
+		month = SB_APR;
+		break;
+	case TFW_CHAR4_INT('M', 'a', 'y', ' '):
+		month = SB_MAY;
+		break;
+	case TFW_CHAR4_INT('J', 'u', 'n', ' '):
+		month = SB_JUN;
+		break;
+	case TFW_CHAR4_INT('J', 'u', 'l', ' '):
+		month = SB_JUL;
+		break;
+	case TFW_CHAR4_INT('A', 'u', 'g', ' '):
+		month = SB_AUG;
+		break;
+	case TFW_CHAR4_INT('S', 'e', 'p', ' '):
+		month = SB_SEP;
+		break;
+	case TFW_CHAR4_INT('O', 'c', 't', ' '):
+		month = SB_OCT;
+		break;
+	case TFW_CHAR4_INT('N', 'o', 'v', ' '):
+		month = SB_NOV;
+		break;
+	case TFW_CHAR4_INT('D', 'e', 'c', ' '):
+		month = SB_DEC;
+		break;
+	default:
+		return -1;
+	}
+
+	date = __year_day_secs(__D2(p + 12) * 100 + __D2(p + 14),
+			       (day - 1) * SEC24H + month);
+	if (unlikely(date < 0))
+		return -1;
+
+	return date + __D2(p + 17) * 3600 + __D2(p + 20) * 60 + __D2(p + 23);
+}
+
 static int
 __resp_parse_http_date(TfwHttpResp *resp, unsigned char *data, size_t len)
 {
@@ -2877,19 +3056,45 @@ __resp_parse_http_date(TfwHttpResp *resp, unsigned char *data, size_t len)
 			BUG();
 			return CSTR_NEQ;
 		}
-		/* Skip a weekday as redundant information. */
+		/* Fast path: the whole IMF-fixdate is in the data chunk. */
+		if (likely(__data_available(p, IMF_FIXDATE_LEN))) {
+			long date;
+			TfwDateMemo *dm = *this_cpu_ptr(&date_memo)
+					  + (parser->state == Resp_HdrExpiresV);
+
+			if (!memcmp(p, dm->str, IMF_FIXDATE_LEN)) {
+				parser->_date = dm->date;
+				__FSM_I_MOVE_n(Resp_I_EoL, IMF_FIXDATE_LEN);
+			}
+			date = __parse_imf_fixdate(p);
+			if (likely(date >= 0)) {
+				memcpy(dm->str, p, IMF_FIXDATE_LEN);
+				dm->date = parser->_date = date;
+				__FSM_I_MOVE_n(Resp_I_EoL, IMF_FIXDATE_LEN);
+			}
+		}
+		/*
+		 * Skip a weekday as redundant information, but don't run
+		 * out of the header line if there is no space in the value.
+		 */
 		__fsm_sz = __data_remain(p);
 		__fsm_ch = memchr(p, ' ', __fsm_sz);
 		if (__fsm_ch)
-			__FSM_I_MOVE_n(Resp_I_DateDay, __fsm_ch - p + 1);
+			__fsm_sz = __fsm_ch - p;
+		if (tfw_memchreol(p, __fsm_sz))
+			return CSTR_NEQ;
+		if (__fsm_ch)
+			__FSM_I_MOVE_n(Resp_I_DateDay, __fsm_sz + 1);
 		__FSM_I_MOVE_n(Resp_I_Date, __fsm_sz);
 	}
 
 	__FSM_STATE(Resp_I_DateDay) {
 		__fsm_sz = __data_remain(p);
-		if (!isdigit(c))
-			return CSTR_NEQ;
-		/* Parse a 2-digit day. */
+		/*
+		 * Parse a 2-digit day. Don't check the first character: we
+		 * can be here in the middle of the day on the next data chunk,
+		 * and an empty day is rejected below anyway.
+		 */
 		__fsm_n = parse_int_ws(p, __fsm_sz, &parser->_acc);
 		if (__fsm_n == CSTR_POSTPONE)
 			tfw_http_msg_hdr_chunk_fixup(msg, p, __fsm_sz);
@@ -3067,7 +3272,7 @@ __resp_parse_http_date(TfwHttpResp *resp, unsigned char *data, size_t len)
 	__FSM_STATE(Resp_I_EoL) {
 		/* Skip the rest of the line. */
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (!__fsm_ch)
 			__FSM_I_MOVE_n(Resp_I_EoL, __fsm_sz);
 		switch (parser->state) {
@@ -3144,7 +3349,7 @@ __resp_parse_keep_alive(TfwHttpResp *resp, unsigned char *data, size_t len)
 	__FSM_STATE(Resp_I_Ext) {
 		unsigned char *comma;
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		comma = memchr(p, ',', __fsm_sz);
 		if (comma && (!__fsm_ch || (__fsm_ch && (comma < __fsm_ch))))
 			__FSM_I_MOVE_n(Resp_I_EoT, comma - p);
@@ -3159,7 +3364,7 @@ __resp_parse_keep_alive(TfwHttpResp *resp, unsigned char *data, size_t len)
 			__FSM_I_MOVE(Resp_I_EoT);
 		if (c == '=')
 			__FSM_I_MOVE(Resp_I_Ext);
-		if (IN_ALPHABET(c, hdr_a))
+		if (IN_ALPHABET(c, hdr_a.a))
 			__FSM_I_MOVE(Resp_I_KeepAlive);
 		if (IS_CR_OR_LF(c))
 			return __data_offset(p);
@@ -3190,7 +3395,7 @@ __resp_parse_server(TfwHttpResp *resp, unsigned char *data, size_t len)
 		 *   null-terminated strings.
 		 */
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (__fsm_ch)
 			return __data_offset(__fsm_ch);
 		__FSM_I_MOVE_n(Resp_I_Server, __fsm_sz);
@@ -3298,7 +3503,7 @@ tfw_http_parse_resp(void *resp_data, unsigned char *data, size_t len)
 	/* Reason-Phrase: just skip. */
 	__FSM_STATE(Resp_ReasonPhrase) {
 		__fsm_sz = __data_remain(p);
-		__fsm_ch = memchreol(p, __fsm_sz);
+		__fsm_ch = tfw_memchreol(p, __fsm_sz);
 		if (__fsm_ch) {
 			__msg_field_finish(&resp->s_line, __fsm_ch);
 			__FSM_MOVE_n(RGen_EoL, __fsm_ch - p);
@@ -3315,7 +3520,7 @@ tfw_http_parse_resp(void *resp_data, unsigned char *data, size_t len)
 		if (unlikely(IS_CR_OR_LF((c))))
 			__FSM_JMP(RGen_EoL);
 
-		if (unlikely(!IN_ALPHABET(c, hdr_a)))
+		if (unlikely(!IN_ALPHABET(c, hdr_a.a)))
 			return TFW_BLOCK;
 
 		switch (LC(c)) {
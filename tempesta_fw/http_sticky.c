@@ -53,7 +53,6 @@ static char tfw_sticky_key[STICKY_KEY_MAXLEN];
 static int
 tfw_http_sticky_send_302(TfwHttpMsg *hm)
 {
-	TfwConnection *conn = hm->conn;
 	TfwClient *client = (TfwClient *)hm->conn->peer;
 	TfwStr chunks[3], cookie = { 0 };
 	DEFINE_TFW_STR(s_eq, "=");
@@ -75,7 +74,7 @@ tfw_http_sticky_send_302(TfwHttpMsg *hm)
 
 	if (tfw_http_prep_302(&resp, hm, &cookie))
 		return -1;
-	tfw_cli_conn_send(conn, (TfwMsg *)&resp);
+	tfw_http_resp_send(hm, &resp);
 
 	return 0;
 }
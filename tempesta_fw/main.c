@@ -83,6 +83,7 @@ tfw_init(void)
 	/* Register TLS before HTTP, so HTTP FSM can register TLS hooks. */
 	DO_INIT(tls);
 	DO_INIT(http);
+	DO_INIT(h2);
 	DO_INIT(http_sticky);
 
 	DO_INIT(sync_socket);
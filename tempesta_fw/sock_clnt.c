@@ -101,6 +101,9 @@ tfw_cli_conn_release(TfwConnection *conn)
 
 	del_timer_sync(&cli_conn->ka_timer);
 
+	/* Ask higher levels to free resources of the connection. */
+	tfw_connection_release(conn);
+
 	if (likely(conn->sk))
 		tfw_connection_unlink_to_sk(conn);
 	if (likely(conn->peer))
@@ -291,7 +294,8 @@ tfw_listen_sock_add(const TfwAddr *addr, int type)
 	TfwListenSock *ls;
 
 	/* Check for supported types */
-	if (!(type == TFW_FSM_HTTP || type == TFW_FSM_HTTPS))
+	if (!(type == TFW_FSM_HTTP || type == TFW_FSM_HTTPS
+	      || type == TFW_FSM_HTTP2))
 		return -EINVAL;
 
 	/* Is there such an address on the list already? */
@@ -310,6 +314,8 @@ tfw_listen_sock_add(const TfwAddr *addr, int type)
 		ss_proto_init(&ls->proto, &tfw_sock_clnt_ss_hooks, Conn_HttpClnt);
 	else if (type == TFW_FSM_HTTPS)
 		ss_proto_init(&ls->proto, &tfw_sock_clnt_ss_hooks, Conn_HttpsClnt);
+	else if (type == TFW_FSM_HTTP2)
+		ss_proto_init(&ls->proto, &tfw_sock_clnt_ss_hooks, Conn_Http2Clnt);
 
 	list_add(&ls->list, &tfw_listen_socks);
 	ls->addr = *addr;
@@ -502,6 +508,9 @@ tfw_sock_clnt_cfg_handle_listen(TfwCfgSpec *cs, TfwCfgEntry *ce)
 		return tfw_listen_sock_add(&addr, TFW_FSM_HTTP);
 	else if (!strcasecmp(in_str, "https"))
 		return tfw_listen_sock_add(&addr, TFW_FSM_HTTPS);
+	/* HTTP/2 over cleartext TCP with prior knowledge, RFC 7540 3.4. */
+	else if (!strcasecmp(in_str, "h2c"))
+		return tfw_listen_sock_add(&addr, TFW_FSM_HTTP2);
 	else
 		goto parse_err;
 
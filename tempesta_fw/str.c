@@ -20,7 +20,6 @@
  */
 #include <linux/bug.h>
 #include <linux/kernel.h>
-#include <linux/ctype.h>
 
 #include "str.h"
 
@@ -122,7 +121,7 @@ tfw_str_add_duplicate(TfwPool *pool, TfwStr *str)
 int
 tfw_strcpy(TfwStr *dst, const TfwStr *src)
 {
-	int n1, n2, o1 = 0, o2 = 0, chunks = 0;
+	int n1, o1 = 0, o2 = 0, chunks = 0;
 	int mode = (TFW_STR_PLAIN(src) << 1) | TFW_STR_PLAIN(dst);
 	TfwStr *c1, *c2, *end;
 
@@ -157,7 +156,6 @@ tfw_strcpy(TfwStr *dst, const TfwStr *src)
 		break;
 	case 0: /* The both are compound. */
 		n1 = TFW_STR_CHUNKN(src);
-		n2 = TFW_STR_CHUNKN(dst);
 		c1 = (TfwStr *)src->ptr;
 		c2 = (TfwStr *)dst->ptr;
 		end = c1 + n1 - 1;
@@ -225,36 +223,6 @@ tfw_strcat(TfwPool *pool, TfwStr *dst, TfwStr *src)
 }
 EXPORT_SYMBOL(tfw_strcat);
 
-/**
- * Core routine for tfw_stricmpspn() working on flat C strings.
- *
- * Returns:
- *   0 - strings match;
- *   1 - strings match and @stop is found;
- *  -1 - strings do not match;
- *
- * TODO too slow, rewrite on AVX2.
- */
-static int
-__cstricmpspn(const char *s1, const char *s2, int n, int stop)
-{
-	unsigned char c1, c2;
-
-	while (n) {
-		c1 = tolower(*s1++);
-		c2 = tolower(*s2++);
-		if (c1 != c2)
-			return -1;
-		if (!c1)
-			return 0;
-		if (c1 == stop)
-			return 1;
-		n--;
-	}
-
-	return 0;
-}
-
 /**
  * Like strcasecmp(3) for TfwStr, but stops matching when faces @stop.
  * Do not use it for duplicate strings, rather call it for each duplicate
@@ -282,10 +250,10 @@ tfw_stricmpspn(const TfwStr *s1, const TfwStr *s2, int stop)
 	while (n) {
 		int cn = min(c1->len - off1, c2->len - off2);
 		int r = stop
-			? __cstricmpspn((char *)c1->ptr + off1,
-					(char *)c2->ptr + off2, cn, stop)
-			: strncasecmp((char *)c1->ptr + off1,
-				      (char *)c2->ptr + off2, cn);
+			? tfw_cstricmpspn((char *)c1->ptr + off1,
+					  (char *)c2->ptr + off2, cn, stop)
+			: tfw_cstricmp((char *)c1->ptr + off1,
+				       (char *)c2->ptr + off2, cn);
 		if (r)
 			return stop ? !(r > 0) : r;
 
@@ -337,7 +305,7 @@ tfw_str_eq_cstr(const TfwStr *str, const char *cstr, int cstr_len,
 	int len, clen = cstr_len;
 	const TfwStr *chunk, *end;
 	typeof(&strncmp) cmp = (flags & TFW_STR_EQ_CASEI)
-			       ? strncasecmp
+			       ? tfw_cstricmp
 			       : strncmp;
 
 	BUG_ON(str->len && !str->ptr);
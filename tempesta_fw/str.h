@@ -266,6 +266,50 @@ bool tfw_str_eq_cstr_off(const TfwStr *str, ssize_t offset, const char *cstr,
 
 size_t tfw_str_to_cstr(const TfwStr *str, char *out_buf, int buf_size);
 
+/*
+ * Alphabet (set of allowed characters) for scanning of strings.
+ *
+ * @a	- bitmap of the allowed characters, the same as used by the HTTP parser
+ *	  for per-character checks;
+ * @nib	- the bitmap rearranged for vectorized (PSHUFB) lookups: bit @h of
+ *	  @nib[@l] is set if character (@h << 4 | @l) is allowed.
+ *
+ * Only 7-bit characters can be in an alphabet, so characters with the most
+ * significant bit set never match. Use TFW_STR_ALPHA() to define alphabets.
+ */
+typedef struct {
+	unsigned long	a[4];
+	unsigned char	nib[16];
+} TfwStrAlpha;
+
+#define __TFW_ALPHA_B(a0, a1, h, l)					\
+	(((((h) < 4 ? (a0) : (a1)) >> (((h) & 3) * 16 + (l))) & 1) << (h))
+#define __TFW_ALPHA_NIB(a0, a1, l)					\
+	(__TFW_ALPHA_B(a0, a1, 0, l) | __TFW_ALPHA_B(a0, a1, 1, l)	\
+	 | __TFW_ALPHA_B(a0, a1, 2, l) | __TFW_ALPHA_B(a0, a1, 3, l)	\
+	 | __TFW_ALPHA_B(a0, a1, 4, l) | __TFW_ALPHA_B(a0, a1, 5, l)	\
+	 | __TFW_ALPHA_B(a0, a1, 6, l) | __TFW_ALPHA_B(a0, a1, 7, l))
+/* Alphabet by the two lower words of its bitmap. */
+#define TFW_STR_ALPHA(a0, a1) {						\
+	.a = { a0, a1, 0, 0 },						\
+	.nib = {							\
+		__TFW_ALPHA_NIB(a0, a1, 0), __TFW_ALPHA_NIB(a0, a1, 1),	\
+		__TFW_ALPHA_NIB(a0, a1, 2), __TFW_ALPHA_NIB(a0, a1, 3),	\
+		__TFW_ALPHA_NIB(a0, a1, 4), __TFW_ALPHA_NIB(a0, a1, 5),	\
+		__TFW_ALPHA_NIB(a0, a1, 6), __TFW_ALPHA_NIB(a0, a1, 7),	\
+		__TFW_ALPHA_NIB(a0, a1, 8), __TFW_ALPHA_NIB(a0, a1, 9),	\
+		__TFW_ALPHA_NIB(a0, a1, 10), __TFW_ALPHA_NIB(a0, a1, 11),\
+		__TFW_ALPHA_NIB(a0, a1, 12), __TFW_ALPHA_NIB(a0, a1, 13),\
+		__TFW_ALPHA_NIB(a0, a1, 14), __TFW_ALPHA_NIB(a0, a1, 15),\
+	}								\
+}
+
+size_t tfw_memspn(const unsigned char *s, size_t len, const TfwStrAlpha *al);
+size_t tfw_strspn(const TfwStr *str, const TfwStrAlpha *al);
+unsigned char *tfw_memchreol(const unsigned char *s, size_t len);
+int tfw_cstricmp(const char *s1, const char *s2, size_t len);
+int tfw_cstricmpspn(const char *s1, const char *s2, size_t len, int stop);
+
 #ifdef DEBUG
 void tfw_str_dprint(TfwStr *str, const char *msg);
 #else
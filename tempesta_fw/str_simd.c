@@ -0,0 +1,588 @@
+/**
+ *		Tempesta FW
+ *
+ * Vectorized scanning of strings.
+ *
+ * HTTP messages mostly consist of long runs of characters from small
+ * alphabets, e.g. URIs and cookies, so the parser spends most of its time
+ * checking the characters one by one. The functions below check 16 (SSSE3)
+ * or 32 (AVX2) characters at once. An alphabet is looked up by PSHUFB: low
+ * nibble of each character selects a byte of TfwStrAlpha->nib, which is the
+ * bitmap of allowed high nibbles for the low nibble, and high nibble of the
+ * character selects the bit in the byte. This handles any 7-bit alphabet,
+ * while CMPESTRI handles only alphabets of up to 8 ranges.
+ *
+ * Case-insensitive comparisons of short strings, e.g. header names, fold
+ * case of 8 characters at once in general purpose registers, and vector
+ * registers are used for long strings only.
+ *
+ * The implementation is chosen by CPU features using static_cpu_has(), which
+ * is patched by alternatives at module load. The functions are called from
+ * softirq, so vector registers are used only if FPU is usable in current
+ * context and the data is long enough to amortize FPU context saving. The
+ * kernel is compiled without SSE, so the compiler doesn't use the vector
+ * registers and we don't declare them as clobbered (as lib/raid6 does).
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <asm/cpufeature.h>
+#include <asm/i387.h>
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+
+#include "str.h"
+
+/*
+ * Most of the runs are short, e.g. header names, and FPU context saving is
+ * relatively expensive, so the first bytes of a run are scanned by scalar
+ * code and vector registers are used only if the run is longer.
+ */
+#define TFW_STR_SIMD_MIN	128
+
+/* Bits for high nibbles of 7-bit characters, all other characters fail. */
+static const unsigned char __simd_hib[16] __aligned(16) = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+};
+static const unsigned char __simd_lom[16] __aligned(16) = {
+	[0 ... 15] = 0x0f
+};
+static const unsigned char __simd_cr[16] __aligned(16) = {
+	[0 ... 15] = '\r'
+};
+static const unsigned char __simd_lf[16] __aligned(16) = {
+	[0 ... 15] = '\n'
+};
+
+#define __SIMD_V16(a)		(*(const unsigned char (*)[16])(a))
+
+static size_t
+__memspn(const unsigned char *s, size_t len, const TfwStrAlpha *al)
+{
+	size_t n;
+
+	for (n = 0; n < len; ++n)
+		if (!(al->a[s[n] >> 6] & (1UL << (s[n] & 0x3f))))
+			break;
+	return n;
+}
+
+/**
+ * Span 16-byte blocks of @s, @len must be at least 16.
+ * @return offset of the first not allowed character or number of bytes in
+ * the scanned blocks if all of them are allowed.
+ */
+static size_t
+__memspn_ssse3(const unsigned char *s, size_t len, const TfwStrAlpha *al)
+{
+	size_t n = 0, end = len & ~15UL;
+	unsigned int m = 0;
+
+	asm volatile(
+		"movdqu		%[nib], %%xmm0\n"
+		"movdqa		%[hib], %%xmm1\n"
+		"movdqa		%[lom], %%xmm2\n"
+		"pxor		%%xmm7, %%xmm7\n"
+		"1:\n"
+		"movdqu		(%[s],%[n]), %%xmm3\n"
+		"movdqa		%%xmm3, %%xmm4\n"
+		"psrlw		$4, %%xmm4\n"
+		"pand		%%xmm2, %%xmm3\n"
+		"pand		%%xmm2, %%xmm4\n"
+		"movdqa		%%xmm0, %%xmm5\n"
+		"pshufb		%%xmm3, %%xmm5\n"
+		"movdqa		%%xmm1, %%xmm6\n"
+		"pshufb		%%xmm4, %%xmm6\n"
+		"pand		%%xmm6, %%xmm5\n"
+		"pcmpeqb	%%xmm7, %%xmm5\n"
+		"pmovmskb	%%xmm5, %[m]\n"
+		"test		%[m], %[m]\n"
+		"jnz		2f\n"
+		"add		$16, %[n]\n"
+		"cmp		%[end], %[n]\n"
+		"jb		1b\n"
+		"2:\n"
+		: [n]"+r"(n), [m]"+r"(m)
+		: [s]"r"(s), [end]"r"(end), [nib]"m"(__SIMD_V16(al->nib)),
+		  [hib]"m"(__simd_hib), [lom]"m"(__simd_lom)
+		: "cc", "memory");
+
+	return m ? n + __ffs(m) : n;
+}
+
+/**
+ * The same as __memspn_ssse3(), but for 32-byte blocks, @len must be at
+ * least 32.
+ */
+static size_t
+__memspn_avx2(const unsigned char *s, size_t len, const TfwStrAlpha *al)
+{
+	size_t n = 0, end = len & ~31UL;
+	unsigned int m = 0;
+
+	asm volatile(
+		"vbroadcasti128	%[nib], %%ymm0\n"
+		"vbroadcasti128	%[hib], %%ymm1\n"
+		"vbroadcasti128	%[lom], %%ymm2\n"
+		"vpxor		%%ymm7, %%ymm7, %%ymm7\n"
+		"1:\n"
+		"vmovdqu	(%[s],%[n]), %%ymm3\n"
+		"vpsrlw		$4, %%ymm3, %%ymm4\n"
+		"vpand		%%ymm2, %%ymm3, %%ymm3\n"
+		"vpand		%%ymm2, %%ymm4, %%ymm4\n"
+		"vpshufb	%%ymm3, %%ymm0, %%ymm5\n"
+		"vpshufb	%%ymm4, %%ymm1, %%ymm6\n"
+		"vpand		%%ymm6, %%ymm5, %%ymm5\n"
+		"vpcmpeqb	%%ymm7, %%ymm5, %%ymm5\n"
+		"vpmovmskb	%%ymm5, %[m]\n"
+		"test		%[m], %[m]\n"
+		"jnz		2f\n"
+		"add		$32, %[n]\n"
+		"cmp		%[end], %[n]\n"
+		"jb		1b\n"
+		"2:\n"
+		"vzeroupper\n"
+		: [n]"+r"(n), [m]"+r"(m)
+		: [s]"r"(s), [end]"r"(end), [nib]"m"(__SIMD_V16(al->nib)),
+		  [hib]"m"(__simd_hib), [lom]"m"(__simd_lom)
+		: "cc", "memory");
+
+	return m ? n + __ffs(m) : n;
+}
+
+/**
+ * Returns length of the initial segment of @s of length @len which consists
+ * only of characters from alphabet @al, i.e. strspn(3) for not terminated
+ * memory areas.
+ */
+size_t
+tfw_memspn(const unsigned char *s, size_t len, const TfwStrAlpha *al)
+{
+	size_t n = __memspn(s, min_t(size_t, len, TFW_STR_SIMD_MIN), al);
+
+	if (n < TFW_STR_SIMD_MIN || len - n < 32 || !irq_fpu_usable())
+		return n + __memspn(s + n, len - n, al);
+
+	kernel_fpu_begin();
+
+	if (static_cpu_has(X86_FEATURE_AVX2))
+		n += __memspn_avx2(s + n, len - n, al);
+	else if (static_cpu_has(X86_FEATURE_SSSE3))
+		n += __memspn_ssse3(s + n, len - n, al);
+
+	kernel_fpu_end();
+
+	/* Scan the tail which is shorter than a vector, if any. */
+	return n + __memspn(s + n, len - n, al);
+}
+EXPORT_SYMBOL(tfw_memspn);
+
+/**
+ * The same as tfw_memspn(), but for TfwStr which may be plain or compound.
+ * Chunks are scanned one by one, so the span can cross chunk boundaries.
+ * Do not use it for duplicate strings, rather call it for each duplicate
+ * separately.
+ */
+size_t
+tfw_strspn(const TfwStr *str, const TfwStrAlpha *al)
+{
+	size_t n, r = 0;
+	const TfwStr *c, *end;
+
+	TFW_STR_FOR_EACH_CHUNK(c, str, end) {
+		n = tfw_memspn(c->ptr, c->len, al);
+		r += n;
+		if (n < c->len)
+			break;
+	}
+
+	return r;
+}
+EXPORT_SYMBOL(tfw_strspn);
+
+static unsigned char *
+__memchreol(const unsigned char *s, size_t len)
+{
+	while (len) {
+		if (*s == '\r' || *s == '\n')
+			return (unsigned char *)s;
+		s++, len--;
+	}
+	return NULL;
+}
+
+/**
+ * Scan 16-byte blocks of @s for CR or LF, @len must be at least 16.
+ * @return offset of the first EOL character or number of bytes in the scanned
+ * blocks if there is no EOL in them.
+ */
+static size_t
+__memchreol_sse2(const unsigned char *s, size_t len)
+{
+	size_t n = 0, end = len & ~15UL;
+	unsigned int m = 0;
+
+	asm volatile(
+		"movdqa		%[cr], %%xmm0\n"
+		"movdqa		%[lf], %%xmm1\n"
+		"1:\n"
+		"movdqu		(%[s],%[n]), %%xmm2\n"
+		"movdqa		%%xmm2, %%xmm3\n"
+		"pcmpeqb	%%xmm0, %%xmm2\n"
+		"pcmpeqb	%%xmm1, %%xmm3\n"
+		"por		%%xmm3, %%xmm2\n"
+		"pmovmskb	%%xmm2, %[m]\n"
+		"test		%[m], %[m]\n"
+		"jnz		2f\n"
+		"add		$16, %[n]\n"
+		"cmp		%[end], %[n]\n"
+		"jb		1b\n"
+		"2:\n"
+		: [n]"+r"(n), [m]"+r"(m)
+		: [s]"r"(s), [end]"r"(end), [cr]"m"(__simd_cr),
+		  [lf]"m"(__simd_lf)
+		: "cc", "memory");
+
+	return m ? n + __ffs(m) : n;
+}
+
+static size_t
+__memchreol_avx2(const unsigned char *s, size_t len)
+{
+	size_t n = 0, end = len & ~31UL;
+	unsigned int m = 0;
+
+	asm volatile(
+		"vbroadcasti128	%[cr], %%ymm0\n"
+		"vbroadcasti128	%[lf], %%ymm1\n"
+		"1:\n"
+		"vmovdqu	(%[s],%[n]), %%ymm2\n"
+		"vpcmpeqb	%%ymm0, %%ymm2, %%ymm3\n"
+		"vpcmpeqb	%%ymm1, %%ymm2, %%ymm2\n"
+		"vpor		%%ymm3, %%ymm2, %%ymm2\n"
+		"vpmovmskb	%%ymm2, %[m]\n"
+		"test		%[m], %[m]\n"
+		"jnz		2f\n"
+		"add		$32, %[n]\n"
+		"cmp		%[end], %[n]\n"
+		"jb		1b\n"
+		"2:\n"
+		"vzeroupper\n"
+		: [n]"+r"(n), [m]"+r"(m)
+		: [s]"r"(s), [end]"r"(end), [cr]"m"(__simd_cr),
+		  [lf]"m"(__simd_lf)
+		: "cc", "memory");
+
+	return m ? n + __ffs(m) : n;
+}
+
+/**
+ * Scans the initial @len bytes of the memory area pointed to by @s for the
+ * first occurance of EOL character.
+ *
+ * NOTE: We can use strcspn() here, but the generic implementation from the
+ * kernel's library operates on zero-terminated strings and returns number of
+ * bytes instead of the pointer, so this is faster even for short strings.
+ *
+ * Related to #182 (https://github.com/natsys/tempesta/issues/182)
+ */
+unsigned char *
+tfw_memchreol(const unsigned char *s, size_t len)
+{
+	size_t n = min_t(size_t, len, TFW_STR_SIMD_MIN);
+	unsigned char *eol = __memchreol(s, n);
+
+	if (eol || len - n < 32 || !irq_fpu_usable())
+		return eol ? : __memchreol(s + n, len - n);
+
+	kernel_fpu_begin();
+
+	if (static_cpu_has(X86_FEATURE_AVX2))
+		n += __memchreol_avx2(s + n, len - n);
+	else
+		n += __memchreol_sse2(s + n, len - n);
+
+	kernel_fpu_end();
+
+	/* Scan the tail which is shorter than a vector, if any. */
+	return __memchreol(s + n, len - n);
+}
+EXPORT_SYMBOL(tfw_memchreol);
+
+/*
+ * HTTP is case-insensitive for ASCII characters only, so all the functions
+ * below fold case of ASCII letters only, unlike tolower() in the kernel which
+ * folds Latin-1 letters as well.
+ */
+#define TFW_LC(c)		((c) >= 'A' && (c) <= 'Z' ? (c) | 0x20 : (c))
+#define __SWAR_ONES		0x0101010101010101UL
+#define __SWAR_HIGHS		0x8080808080808080UL
+
+/**
+ * Fold case of 8 characters at once: add biases to the 7-bit characters so
+ * that the most significant bit of a byte is set for the characters starting
+ * from 'A' and for the characters after 'Z'.
+ */
+static inline unsigned long
+__swar_lc(unsigned long x)
+{
+	unsigned long h = x & ~__SWAR_HIGHS;
+	unsigned long a = h + __SWAR_ONES * (0x80 - 'A');
+	unsigned long z = h + __SWAR_ONES * (0x7f - 'Z');
+
+	return x | (((a ^ z) & ~x & __SWAR_HIGHS) >> 2);
+}
+
+/*
+ * Most significant bits of zero bytes. There are false positives only for
+ * bytes following a zero byte, so the lowest set bit is always precise.
+ */
+#define __SWAR_ZERO(x)		(((x) - __SWAR_ONES) & ~(x) & __SWAR_HIGHS)
+
+/**
+ * Returns offset of the first character which differs in @s1 and @s2 after
+ * case folding or, if @stop is not negative, which is zero or @stop in @s1.
+ * Returns @len if there is no such character.
+ */
+static size_t
+__stricmp_swar(const char *s1, const char *s2, size_t len, int stop)
+{
+	size_t n;
+	unsigned long c1, c2, ev;
+
+	for (n = 0; n + 8 <= len; n += 8) {
+		c1 = __swar_lc(*(unsigned long *)(s1 + n));
+		c2 = __swar_lc(*(unsigned long *)(s2 + n));
+		ev = c1 ^ c2;
+		if (stop >= 0)
+			ev |= __SWAR_ZERO(c1)
+			      | __SWAR_ZERO(c1 ^ (__SWAR_ONES * stop));
+		if (ev)
+			return n + (__ffs(ev) >> 3);
+	}
+	for ( ; n < len; ++n) {
+		c1 = TFW_LC((unsigned char)s1[n]);
+		c2 = TFW_LC((unsigned char)s2[n]);
+		if (c1 != c2 || (stop >= 0 && (!c1 || c1 == stop)))
+			break;
+	}
+
+	return n;
+}
+
+/*
+ * Vectors for case folding: the characters from 'A' to 'Z' become less than
+ * -102 after adding 0x3f.
+ */
+static const unsigned char __simd_lc_bias[16] __aligned(16) = {
+	[0 ... 15] = 0x80 - 'A'
+};
+static const unsigned char __simd_lc_max[16] __aligned(16) = {
+	[0 ... 15] = 0x80 + 26
+};
+static const unsigned char __simd_lc_bit[16] __aligned(16) = {
+	[0 ... 15] = 0x20
+};
+
+/**
+ * Vectorized __stricmp_swar() for 16-byte blocks, @len must be at least 16.
+ * @st and @en are vectors of the stop character and 0xff if zero and stop
+ * characters must be checked or zeroes otherwise.
+ * @return offset of the found character or number of bytes in the scanned
+ * blocks.
+ */
+static size_t
+__stricmp_sse2(const char *s1, const char *s2, size_t len,
+	       const unsigned char *st, const unsigned char *en)
+{
+	size_t n = 0, end = len & ~15UL;
+	unsigned int m = 0, e;
+
+	asm volatile(
+		"movdqa		%[bias], %%xmm0\n"
+		"movdqa		%[max], %%xmm1\n"
+		"movdqa		%[bit], %%xmm2\n"
+		"movdqu		%[st], %%xmm3\n"
+		"movdqu		%[en], %%xmm4\n"
+		"pxor		%%xmm5, %%xmm5\n"
+		"1:\n"
+		"movdqu		(%[s1],%[n]), %%xmm6\n"
+		"movdqu		(%[s2],%[n]), %%xmm7\n"
+		/* Fold case of the both the vectors. */
+		"movdqa		%%xmm6, %%xmm8\n"
+		"movdqa		%%xmm7, %%xmm9\n"
+		"paddb		%%xmm0, %%xmm8\n"
+		"paddb		%%xmm0, %%xmm9\n"
+		"movdqa		%%xmm1, %%xmm10\n"
+		"movdqa		%%xmm1, %%xmm11\n"
+		"pcmpgtb	%%xmm8, %%xmm10\n"
+		"pcmpgtb	%%xmm9, %%xmm11\n"
+		"pand		%%xmm2, %%xmm10\n"
+		"pand		%%xmm2, %%xmm11\n"
+		"por		%%xmm10, %%xmm6\n"
+		"por		%%xmm11, %%xmm7\n"
+		/* Zero and stop characters of the first vector. */
+		"movdqa		%%xmm6, %%xmm8\n"
+		"movdqa		%%xmm6, %%xmm9\n"
+		"pcmpeqb	%%xmm3, %%xmm8\n"
+		"pcmpeqb	%%xmm5, %%xmm9\n"
+		"por		%%xmm9, %%xmm8\n"
+		"pand		%%xmm4, %%xmm8\n"
+		"pcmpeqb	%%xmm7, %%xmm6\n"
+		"pmovmskb	%%xmm6, %[m]\n"
+		"pmovmskb	%%xmm8, %[e]\n"
+		"xor		$0xffff, %[m]\n"
+		"or		%[e], %[m]\n"
+		"jnz		2f\n"
+		"add		$16, %[n]\n"
+		"cmp		%[end], %[n]\n"
+		"jb		1b\n"
+		"2:\n"
+		: [n]"+r"(n), [m]"+r"(m), [e]"=&r"(e)
+		: [s1]"r"(s1), [s2]"r"(s2), [end]"r"(end),
+		  [st]"m"(__SIMD_V16(st)), [en]"m"(__SIMD_V16(en)),
+		  [bias]"m"(__simd_lc_bias), [max]"m"(__simd_lc_max),
+		  [bit]"m"(__simd_lc_bit)
+		: "cc", "memory");
+
+	return m ? n + __ffs(m) : n;
+}
+
+/**
+ * The same as __stricmp_sse2(), but for 32-byte blocks, @len must be at
+ * least 32.
+ */
+static size_t
+__stricmp_avx2(const char *s1, const char *s2, size_t len,
+	       const unsigned char *st, const unsigned char *en)
+{
+	size_t n = 0, end = len & ~31UL;
+	unsigned int m = 0, e;
+
+	asm volatile(
+		"vbroadcasti128	%[bias], %%ymm0\n"
+		"vbroadcasti128	%[max], %%ymm1\n"
+		"vbroadcasti128	%[bit], %%ymm2\n"
+		"vbroadcasti128	%[st], %%ymm3\n"
+		"vbroadcasti128	%[en], %%ymm4\n"
+		"vpxor		%%ymm5, %%ymm5, %%ymm5\n"
+		"1:\n"
+		"vmovdqu	(%[s1],%[n]), %%ymm6\n"
+		"vmovdqu	(%[s2],%[n]), %%ymm7\n"
+		/* Fold case of the both the vectors. */
+		"vpaddb		%%ymm0, %%ymm6, %%ymm8\n"
+		"vpaddb		%%ymm0, %%ymm7, %%ymm9\n"
+		"vpcmpgtb	%%ymm8, %%ymm1, %%ymm8\n"
+		"vpcmpgtb	%%ymm9, %%ymm1, %%ymm9\n"
+		"vpand		%%ymm2, %%ymm8, %%ymm8\n"
+		"vpand		%%ymm2, %%ymm9, %%ymm9\n"
+		"vpor		%%ymm8, %%ymm6, %%ymm6\n"
+		"vpor		%%ymm9, %%ymm7, %%ymm7\n"
+		/* Zero and stop characters of the first vector. */
+		"vpcmpeqb	%%ymm3, %%ymm6, %%ymm8\n"
+		"vpcmpeqb	%%ymm5, %%ymm6, %%ymm9\n"
+		"vpor		%%ymm9, %%ymm8, %%ymm8\n"
+		"vpand		%%ymm4, %%ymm8, %%ymm8\n"
+		"vpcmpeqb	%%ymm7, %%ymm6, %%ymm6\n"
+		"vpmovmskb	%%ymm6, %[m]\n"
+		"vpmovmskb	%%ymm8, %[e]\n"
+		"not		%[m]\n"
+		"or		%[e], %[m]\n"
+		"jnz		2f\n"
+		"add		$32, %[n]\n"
+		"cmp		%[end], %[n]\n"
+		"jb		1b\n"
+		"2:\n"
+		"vzeroupper\n"
+		: [n]"+r"(n), [m]"+r"(m), [e]"=&r"(e)
+		: [s1]"r"(s1), [s2]"r"(s2), [end]"r"(end),
+		  [st]"m"(__SIMD_V16(st)), [en]"m"(__SIMD_V16(en)),
+		  [bias]"m"(__simd_lc_bias), [max]"m"(__simd_lc_max),
+		  [bit]"m"(__simd_lc_bit)
+		: "cc", "memory");
+
+	return m ? n + __ffs(m) : n;
+}
+
+static size_t
+__stricmp(const char *s1, const char *s2, size_t len, int stop)
+{
+	unsigned char st[16], en[16];
+	size_t n = __stricmp_swar(s1, s2, min_t(size_t, len, TFW_STR_SIMD_MIN),
+				  stop);
+
+	if (n < TFW_STR_SIMD_MIN)
+		return n;
+	if (len - n < 32 || !irq_fpu_usable())
+		return n + __stricmp_swar(s1 + n, s2 + n, len - n, stop);
+
+	memset(st, stop, sizeof(st));
+	memset(en, stop >= 0 ? 0xff : 0, sizeof(en));
+
+	kernel_fpu_begin();
+
+	if (static_cpu_has(X86_FEATURE_AVX2))
+		n += __stricmp_avx2(s1 + n, s2 + n, len - n, st, en);
+	else
+		n += __stricmp_sse2(s1 + n, s2 + n, len - n, st, en);
+
+	kernel_fpu_end();
+
+	/* Compare the tail which is shorter than a vector, if any. */
+	return n + __stricmp_swar(s1 + n, s2 + n, len - n, stop);
+}
+
+/**
+ * Case-insensitive comparison of @len bytes of @s1 and @s2, i.e. strncasecmp()
+ * for not terminated strings. Zero bytes are compared as other characters.
+ */
+int
+tfw_cstricmp(const char *s1, const char *s2, size_t len)
+{
+	size_t n = __stricmp(s1, s2, len, -1);
+
+	if (n == len)
+		return 0;
+	return (int)TFW_LC((unsigned char)s1[n])
+	       - (int)TFW_LC((unsigned char)s2[n]);
+}
+EXPORT_SYMBOL(tfw_cstricmp);
+
+/**
+ * Case-insensitive comparison of at most @len characters of @s1 and @s2 which
+ * stops at zero character or at @stop character in lower case.
+ *
+ * Returns:
+ *   0 - strings match;
+ *   1 - strings match and @stop is found;
+ *  -1 - strings do not match;
+ */
+int
+tfw_cstricmpspn(const char *s1, const char *s2, size_t len, int stop)
+{
+	size_t n = __stricmp(s1, s2, len, stop);
+	unsigned char c1, c2;
+
+	if (n == len)
+		return 0;
+	c1 = TFW_LC((unsigned char)s1[n]);
+	c2 = TFW_LC((unsigned char)s2[n]);
+	if (c1 != c2)
+		return -1;
+
+	return !!c1;
+}
+EXPORT_SYMBOL(tfw_cstricmpspn);
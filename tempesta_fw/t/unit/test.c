@@ -87,8 +87,10 @@ test_call_teardown_fn(void)
 TEST_SUITE(tfw_str);
 TEST_SUITE(http_parser);
 TEST_SUITE(http_sticky);
+TEST_SUITE(cache);
 TEST_SUITE(http_match);
 TEST_SUITE(hash);
+TEST_SUITE(hpack);
 TEST_SUITE(addr);
 TEST_SUITE(cfg);
 TEST_SUITE(sched_rr);
@@ -104,7 +106,9 @@ test_run_all(void)
 	TEST_SUITE_RUN(http_parser);
 	TEST_SUITE_RUN(http_match);
 	TEST_SUITE_RUN(http_sticky);
+	TEST_SUITE_RUN(cache);
 	TEST_SUITE_RUN(hash);
+	TEST_SUITE_RUN(hpack);
 	TEST_SUITE_RUN(addr);
 	TEST_SUITE_RUN(cfg);
 	TEST_SUITE_RUN(sched_rr);
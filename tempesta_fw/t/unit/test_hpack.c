@@ -0,0 +1,248 @@
+/**
+ *		Tempesta FW
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "hpack.h"
+
+#include "test.h"
+
+static TfwHPack hp;
+static char fields[512];
+static size_t fields_len;
+
+/* Collect decoded fields as "name: value\n" lines. */
+static int
+collect_field(void *data, const TfwStr *name, const TfwStr *value)
+{
+	int n = snprintf(fields + fields_len, sizeof(fields) - fields_len,
+			 "%.*s: %.*s\n", (int)name->len, (char *)name->ptr,
+			 (int)value->len, (char *)value->ptr);
+
+	if (n >= sizeof(fields) - fields_len)
+		return -E2BIG;
+	fields_len += n;
+
+	return 0;
+}
+
+static int
+decode(const char *block, size_t len)
+{
+	fields_len = 0;
+	fields[0] = '\0';
+
+	return tfw_hpack_decode(&hp, block, len, collect_field, NULL);
+}
+
+#define EXPECT_DECODED(block, expected)					\
+do {									\
+	EXPECT_ZERO(decode(block, sizeof(block) - 1));			\
+	EXPECT_ZERO(strcmp(fields, expected));				\
+} while (0)
+
+#define EXPECT_MALFORMED(block)						\
+	EXPECT_EQ(decode(block, sizeof(block) - 1), -EINVAL)
+
+static const char *req1 =
+	":method: GET\n"
+	":scheme: http\n"
+	":path: /\n"
+	":authority: www.example.com\n";
+static const char *req2 =
+	":method: GET\n"
+	":scheme: http\n"
+	":path: /\n"
+	":authority: www.example.com\n"
+	"cache-control: no-cache\n";
+static const char *req3 =
+	":method: GET\n"
+	":scheme: https\n"
+	":path: /index.html\n"
+	":authority: www.example.com\n"
+	"custom-key: custom-value\n";
+
+/* RFC 7541 C.3: requests without Huffman coding. */
+TEST(hpack, decodes_requests)
+{
+	tfw_hpack_init(&hp, TFW_HPACK_TABLE_SIZE);
+
+	EXPECT_DECODED(
+		"\x82\x86\x84\x41\x0f\x77\x77\x77\x2e\x65\x78\x61\x6d\x70\x6c\x65"
+		"\x2e\x63\x6f\x6d", req1);
+	EXPECT_EQ(hp.size, 57);
+
+	EXPECT_DECODED(
+		"\x82\x86\x84\xbe\x58\x08\x6e\x6f\x2d\x63\x61\x63\x68\x65",
+		req2);
+	EXPECT_EQ(hp.size, 110);
+
+	EXPECT_DECODED(
+		"\x82\x87\x85\xbf\x40\x0a\x63\x75\x73\x74\x6f\x6d\x2d\x6b\x65\x79"
+		"\x0c\x63\x75\x73\x74\x6f\x6d\x2d\x76\x61\x6c\x75\x65", req3);
+	EXPECT_EQ(hp.size, 164);
+	EXPECT_EQ(hp.n, 3);
+
+	tfw_hpack_destroy(&hp);
+}
+
+/* RFC 7541 C.4: requests with Huffman coding. */
+TEST(hpack, decodes_huffman_requests)
+{
+	tfw_hpack_init(&hp, TFW_HPACK_TABLE_SIZE);
+
+	EXPECT_DECODED(
+		"\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4"
+		"\xff", req1);
+	EXPECT_DECODED(
+		"\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf", req2);
+	EXPECT_DECODED(
+		"\x82\x87\x85\xbf\x40\x88\x25\xa8\x49\xe9\x5b\xa9\x7d\x7f\x89\x25"
+		"\xa8\x49\xe9\x5b\xb8\xe8\xb4\xbf", req3);
+	EXPECT_EQ(hp.size, 164);
+
+	tfw_hpack_destroy(&hp);
+}
+
+/*
+ * RFC 7541 C.6: responses with Huffman coding and dynamic table of 256
+ * bytes, so the entries are evicted.
+ */
+TEST(hpack, evicts_dynamic_entries)
+{
+	tfw_hpack_init(&hp, 256);
+
+	EXPECT_DECODED(
+		"\x48\x82\x64\x02\x58\x85\xae\xc3\x77\x1a\x4b\x61\x96\xd0\x7a\xbe"
+		"\x94\x10\x54\xd4\x44\xa8\x20\x05\x95\x04\x0b\x81\x66\xe0\x82\xa6"
+		"\x2d\x1b\xff\x6e\x91\x9d\x29\xad\x17\x18\x63\xc7\x8f\x0b\x97\xc8"
+		"\xe9\xae\x82\xae\x43\xd3",
+		":status: 302\n"
+		"cache-control: private\n"
+		"date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+		"location: https://www.example.com\n");
+	EXPECT_EQ(hp.size, 222);
+	EXPECT_EQ(hp.n, 4);
+
+	EXPECT_DECODED(
+		"\x48\x83\x64\x0e\xff\xc1\xc0\xbf",
+		":status: 307\n"
+		"cache-control: private\n"
+		"date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+		"location: https://www.example.com\n");
+	EXPECT_EQ(hp.size, 222);
+	EXPECT_EQ(hp.n, 4);
+
+	EXPECT_DECODED(
+		"\x88\xc1\x61\x96\xd0\x7a\xbe\x94\x10\x54\xd4\x44\xa8\x20\x05\x95"
+		"\x04\x0b\x81\x66\xe0\x84\xa6\x2d\x1b\xff\xc0\x5a\x83\x9b\xd9\xab"
+		"\x77\xad\x94\xe7\x82\x1d\xd7\xf2\xe6\xc7\xb3\x35\xdf\xdf\xcd\x5b"
+		"\x39\x60\xd5\xaf\x27\x08\x7f\x36\x72\xc1\xab\x27\x0f\xb5\x29\x1f"
+		"\x95\x87\x31\x60\x65\xc0\x03\xed\x4e\xe5\xb1\x06\x3d\x50\x07",
+		":status: 200\n"
+		"cache-control: private\n"
+		"date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+		"location: https://www.example.com\n"
+		"content-encoding: gzip\n"
+		"set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600;"
+		" version=1\n");
+	EXPECT_EQ(hp.size, 215);
+	EXPECT_EQ(hp.n, 3);
+
+	/* Dynamic table size update to zero empties the table. */
+	EXPECT_DECODED("\x20\x82", ":method: GET\n");
+	EXPECT_EQ(hp.size, 0);
+	EXPECT_EQ(hp.n, 0);
+
+	tfw_hpack_destroy(&hp);
+}
+
+TEST(hpack, blocks_malformed)
+{
+	tfw_hpack_init(&hp, TFW_HPACK_TABLE_SIZE);
+
+	/* Zero index and index out of the tables. */
+	EXPECT_MALFORMED("\x80");
+	EXPECT_MALFORMED("\xbe");
+	/* Truncated integer and string. */
+	EXPECT_MALFORMED("\xff\x80");
+	EXPECT_MALFORMED("\x04\x05/abc");
+	/* Integer overflow. */
+	EXPECT_MALFORMED("\xff\xff\xff\xff\xff\xff\x01");
+	/* Table size update above the limit and after a field. */
+	EXPECT_MALFORMED("\x3f\xe2\x1f");
+	EXPECT_MALFORMED("\x82\x20");
+	/* Huffman padding longer than 7 bits or not of EOS. */
+	EXPECT_MALFORMED("\x04\x82\x63\xff");
+	EXPECT_MALFORMED("\x04\x81\x62");
+	/* Explicitly encoded EOS. */
+	EXPECT_MALFORMED("\x04\x84\xff\xff\xff\xff");
+
+	EXPECT_EQ(hp.n, 0);
+	tfw_hpack_destroy(&hp);
+}
+
+TEST(hpack, encodes_integers)
+{
+	unsigned char buf[8], *p;
+
+	/* RFC 7541 C.1. */
+	p = tfw_hpack_encode_int(buf, 10, 5, 0xe0);
+	EXPECT_EQ(p - buf, 1);
+	EXPECT_EQ(buf[0], 0xea);
+
+	p = tfw_hpack_encode_int(buf, 1337, 5, 0);
+	EXPECT_EQ(p - buf, 3);
+	EXPECT_ZERO(memcmp(buf, "\x1f\x9a\x0a", 3));
+
+	p = tfw_hpack_encode_int(buf, 42, 8, 0);
+	EXPECT_EQ(p - buf, 1);
+	EXPECT_EQ(buf[0], 42);
+}
+
+TEST(hpack, encodes_response_headers)
+{
+	unsigned char buf[256], *p = buf;
+
+	p = tfw_hpack_encode_status(p, 200);
+	p = tfw_hpack_encode_status(p, 302);
+	p = tfw_hpack_encode_hdr(p, "Content-Type", 12, "text/html", 9);
+	p = tfw_hpack_encode_hdr(p, "X-Custom", 8, "Value", 5);
+	EXPECT_LE(p - buf, 5 + 5 + TFW_HPACK_HDR_MAX(12, 9)
+			   + TFW_HPACK_HDR_MAX(8, 5));
+
+	/* The encoder doesn't touch the dynamic table. */
+	tfw_hpack_init(&hp, TFW_HPACK_TABLE_SIZE);
+	EXPECT_ZERO(decode(buf, p - buf));
+	EXPECT_ZERO(strcmp(fields,
+			   ":status: 200\n"
+			   ":status: 302\n"
+			   "content-type: text/html\n"
+			   "x-custom: Value\n"));
+	EXPECT_EQ(hp.n, 0);
+	tfw_hpack_destroy(&hp);
+}
+
+TEST_SUITE(hpack)
+{
+	TEST_RUN(hpack, decodes_requests);
+	TEST_RUN(hpack, decodes_huffman_requests);
+	TEST_RUN(hpack, evicts_dynamic_entries);
+	TEST_RUN(hpack, blocks_malformed);
+	TEST_RUN(hpack, encodes_integers);
+	TEST_RUN(hpack, encodes_response_headers);
+}
@@ -302,15 +302,15 @@ TEST(http_parser, fills_hdr_tbl_for_req)
 		tfw_http_msg_clnthdr_val(&ht->tbl[TFW_HTTP_HDR_COOKIE],
 					 TFW_HTTP_HDR_COOKIE, &h_cookie);
 
-		/* Common (raw) headers: 14 total with 10 dummies. */
-		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 14);
+		/* Common (raw) headers: 12 total with 10 dummies. */
+		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 12);
 
 		h_accept     = &ht->tbl[TFW_HTTP_HDR_RAW + 0];
 		h_xch        = &ht->tbl[TFW_HTTP_HDR_RAW + 1];
 		h_dummy4     = &ht->tbl[TFW_HTTP_HDR_RAW + 6];
 		h_dummy9     = &ht->tbl[TFW_HTTP_HDR_RAW + 11];
-		h_cc         = &ht->tbl[TFW_HTTP_HDR_RAW + 12];
-		h_te         = &ht->tbl[TFW_HTTP_HDR_RAW + 13];
+		h_cc         = &ht->tbl[TFW_HTTP_HDR_CACHE_CONTROL];
+		h_te         = &ht->tbl[TFW_HTTP_HDR_TRANSFER_ENCODING];
 
 		EXPECT_TRUE(tfw_str_eq_cstr(&h_host, s_host,
 					    strlen(s_host), 0));
@@ -342,6 +342,36 @@ TEST(http_parser, fills_hdr_tbl_for_req)
 	}
 }
 
+/* 64 bytes of URI or header characters. */
+#define LONG_SEG	"0123456789abcdefghijklmnopqrstuvwxyz"			\
+			"-ABCDEFGHIJKLMNOPQRSTUVWXYZ_"
+#define LONG_PATH	"/" LONG_SEG "/" LONG_SEG "/" LONG_SEG "?q=" LONG_SEG
+#define LONG_HDR	"X-" LONG_SEG LONG_SEG LONG_SEG ": " LONG_SEG "; "	\
+			LONG_SEG "; " LONG_SEG
+
+TEST(http_parser, parses_long_uri_and_hdrs)
+{
+	/*
+	 * Long URIs and headers are scanned by vector instructions, check
+	 * that they're correctly split among data chunks.
+	 */
+	FOR_REQ("GET " LONG_PATH " HTTP/1.1\r\n"
+		LONG_HDR "\r\n"
+		"Host: localhost\r\n"
+		"\r\n")
+	{
+		EXPECT_TFWSTR_EQ(&req->uri_path, LONG_PATH);
+		EXPECT_EQ(req->h_tbl->off, TFW_HTTP_HDR_RAW + 1);
+		EXPECT_TFWSTR_EQ(&req->h_tbl->tbl[TFW_HTTP_HDR_RAW], LONG_HDR);
+	}
+
+	EXPECT_BLOCK_REQ("GET " LONG_PATH "\x7f HTTP/1.1\r\n"
+			 "\r\n");
+	EXPECT_BLOCK_REQ("GET / HTTP/1.1\r\n"
+			 "X-" LONG_SEG LONG_SEG LONG_SEG "\x80: foo\r\n"
+			 "\r\n");
+}
+
 TEST(http_parser, fills_hdr_tbl_for_resp)
 {
 	TfwHttpHdrTbl *ht;
@@ -398,15 +428,18 @@ TEST(http_parser, fills_hdr_tbl_for_resp)
 					TFW_HTTP_HDR_SERVER, &h_srv);
 
 		/*
-		 * Common (raw) headers: 10 dummies, Cache-Control,
-		 * Expires, Keep-Alive, Transfer-Encoding.
+		 * Common (raw) headers: 10 dummies, while Cache-Control,
+		 * Expires, Keep-Alive and Transfer-Encoding have special
+		 * slots for responses.
 		 */
-		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 14);
+		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 10);
 
 		h_dummy4     = &ht->tbl[TFW_HTTP_HDR_RAW + 4];
-		h_cc         = &ht->tbl[TFW_HTTP_HDR_RAW + 9];
-		h_dummy9     = &ht->tbl[TFW_HTTP_HDR_RAW + 10];
-		h_te         = &ht->tbl[TFW_HTTP_HDR_RAW + 13];
+		h_cc         = &ht->tbl[TFW_HTTP_HDR_CACHE_CONTROL];
+		h_dummy9     = &ht->tbl[TFW_HTTP_HDR_RAW + 9];
+		h_te         = &ht->tbl[TFW_HTTP_HDR_TRANSFER_ENCODING];
+		EXPECT_FALSE(TFW_STR_EMPTY(&ht->tbl[TFW_HTTP_HDR_EXPIRES]));
+		EXPECT_FALSE(TFW_STR_EMPTY(&ht->tbl[TFW_HTTP_HDR_KEEP_ALIVE]));
 
 		EXPECT_TRUE(tfw_str_eq_cstr(&h_connection, s_connection,
 					    strlen(s_connection), 0));
@@ -483,6 +516,178 @@ TEST(http_parser, content_length_duplicate)
 			  "\r\n");
 }
 
+TEST(http_parser, recognizes_known_hdrs)
+{
+	int i;
+	static const struct {
+		const char	*name;
+		int		kid;
+	} names[] = {
+		{ "Accept: */*",		TFW_HTTP_KHDR_ACCEPT },
+		{ "ACCESS-CONTROL-ALLOW-CREDENTIALS:",
+		  TFW_HTTP_KHDR_ACCESS_CONTROL_ALLOW_CREDENTIALS },
+		{ "etag:",			TFW_HTTP_KHDR_ETAG },
+		{ "TE: trailers",		TFW_HTTP_KHDR_TE },
+		{ "x-Xss-Protection:1",		TFW_HTTP_KHDR_X_XSS_PROTECTION },
+		{ "Set-Cookie: a=b",		TFW_HTTP_KHDR_SET_COOKIE },
+		{ "Dummy: 0",			-1 },
+		{ "Accept-Encodingx: gzip",	-1 },
+		{ "Accept-Encodin: gzip",	-1 },
+		{ "T:",				-1 },
+		{ "Accept",			-1 },
+		{ ": Accept",			-1 },
+		{ "Access-Control-Allow-Credentials1:", -1 },
+		{ "",				-1 },
+	};
+	TfwStr chunked = {
+		.ptr = (TfwStr []){
+			{ .ptr = "Cache-Con",	.len = 9 },
+			{ .ptr = "trol",	.len = 4 },
+			{ .ptr = ": no-cache",	.len = 10 },
+		},
+		.len = 23,
+		.flags = 3 << TFW_STR_CN_SHIFT
+	};
+
+	for (i = 0; i < ARRAY_SIZE(names); ++i) {
+		TfwStr h = TFW_STR_FROM(names[i].name);
+
+		EXPECT_EQ(tfw_http_msg_hdr_known(&h), names[i].kid);
+	}
+	EXPECT_EQ(tfw_http_msg_hdr_known(&chunked),
+		  TFW_HTTP_KHDR_CACHE_CONTROL);
+}
+
+TEST(http_parser, indexes_known_hdrs)
+{
+	TfwHttpHdrTbl *ht;
+
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "Dummy0: 0\r\n"
+		 "Cache-Control: no-cache\r\n"
+		 "ETag: \"abc\"\r\n"
+		 "Warning: 110 - \"stale\"\r\n"
+		 "Cookie: a=b\r\n"
+		 "warning: 112 - \"offline\"\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		ht = resp->h_tbl;
+
+		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 3);
+		EXPECT_EQ(ht->kidx[TFW_HTTP_KHDR_WARNING],
+			  TFW_HTTP_HDR_RAW + 1);
+		EXPECT_TRUE(TFW_STR_DUP(&ht->tbl[TFW_HTTP_HDR_RAW + 1]));
+		/* Cookie is a special header for requests only. */
+		EXPECT_EQ(ht->kidx[TFW_HTTP_KHDR_COOKIE], TFW_HTTP_HDR_RAW + 2);
+		/* Special headers aren't indexed. */
+		EXPECT_ZERO(ht->kidx[TFW_HTTP_KHDR_CACHE_CONTROL]);
+		EXPECT_ZERO(ht->kidx[TFW_HTTP_KHDR_ETAG]);
+		EXPECT_ZERO(ht->kidx[TFW_HTTP_KHDR_CONTENT_LENGTH]);
+		EXPECT_ZERO(resp->flags & TFW_HTTP_FIELD_DUPENTRY);
+	}
+
+	FOR_RESP("HTTP/1.1 302 Found\r\n"
+		 "Location: /a\r\n"
+		 "Dummy0: 0\r\n"
+		 "LOCATION: /b\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		ht = resp->h_tbl;
+
+		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 2);
+		EXPECT_EQ(ht->kidx[TFW_HTTP_KHDR_LOCATION], TFW_HTTP_HDR_RAW);
+		EXPECT_TRUE(resp->flags & TFW_HTTP_FIELD_DUPENTRY);
+	}
+}
+
+TEST(http_parser, stores_hdrs_in_special_slots)
+{
+	TfwHttpHdrTbl *ht;
+	TfwStr *h_lm, h_etag, h_vary, h_inm;
+
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "Set-Cookie: a=1\r\n"
+		 "ETag:  \"abc\"\r\n"
+		 "set-cookie: b=2\r\n"
+		 "Vary: Accept-Encoding\r\n"
+		 "Last-Modified: Tue, 31 Jan 2012 15:02:53 GMT\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		ht = resp->h_tbl;
+
+		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW);
+		EXPECT_TRUE(TFW_STR_DUP(&ht->tbl[TFW_HTTP_HDR_SET_COOKIE]));
+		EXPECT_ZERO(resp->flags & TFW_HTTP_FIELD_DUPENTRY);
+		h_lm = &ht->tbl[TFW_HTTP_HDR_LAST_MODIFIED];
+		EXPECT_FALSE(TFW_STR_EMPTY(h_lm));
+
+		tfw_http_msg_srvhdr_val(&ht->tbl[TFW_HTTP_HDR_ETAG],
+					TFW_HTTP_HDR_ETAG, &h_etag);
+		tfw_http_msg_srvhdr_val(&ht->tbl[TFW_HTTP_HDR_VARY],
+					TFW_HTTP_HDR_VARY, &h_vary);
+		EXPECT_TFWSTR_EQ(&h_etag, "\"abc\"");
+		EXPECT_TFWSTR_EQ(&h_vary, "Accept-Encoding");
+	}
+
+	/* Duplicate of singular ETag must be blocked by classifier. */
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "ETag: \"abc\"\r\n"
+		 "ETag: \"def\"\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		EXPECT_TRUE(resp->flags & TFW_HTTP_FIELD_DUPENTRY);
+	}
+
+	FOR_REQ("GET / HTTP/1.1\r\n"
+		"If-None-Match: \"abc\"\r\n"
+		"Server: foo\r\n"
+		"\r\n")
+	{
+		ht = req->h_tbl;
+
+		/* Server is a special header for responses only. */
+		EXPECT_EQ(ht->off, TFW_HTTP_HDR_RAW + 1);
+		EXPECT_TFWSTR_EQ(&ht->tbl[TFW_HTTP_HDR_RAW], "Server: foo");
+
+		tfw_http_msg_clnthdr_val(&ht->tbl[TFW_HTTP_HDR_IF_NONE_MATCH],
+					 TFW_HTTP_HDR_IF_NONE_MATCH, &h_inm);
+		EXPECT_TFWSTR_EQ(&h_inm, "\"abc\"");
+	}
+}
+
+#define __HDR(n)	"X-Hdr" n ": 1\r\n"
+#define __HDR10(n)	__HDR(n "0") __HDR(n "1") __HDR(n "2") __HDR(n "3") \
+			__HDR(n "4") __HDR(n "5") __HDR(n "6") __HDR(n "7") \
+			__HDR(n "8") __HDR(n "9")
+#define __HDR100(n)	__HDR10(n "0") __HDR10(n "1") __HDR10(n "2")	\
+			__HDR10(n "3") __HDR10(n "4") __HDR10(n "5")	\
+			__HDR10(n "6") __HDR10(n "7") __HDR10(n "8")	\
+			__HDR10(n "9")
+
+TEST(http_parser, grows_hdr_tbl)
+{
+	/* The table grows twice to store the headers. */
+	FOR_REQ("GET / HTTP/1.1\r\n"
+		__HDR100("1") __HDR100("2")
+		"\r\n")
+	{
+		EXPECT_EQ(req->h_tbl->off, TFW_HTTP_HDR_RAW + 200);
+		EXPECT_TRUE(req->h_tbl->size >= req->h_tbl->off);
+		EXPECT_TFWSTR_EQ(&req->h_tbl->tbl[TFW_HTTP_HDR_RAW],
+				 "X-Hdr100: 1");
+		EXPECT_TFWSTR_EQ(&req->h_tbl->tbl[TFW_HTTP_HDR_RAW + 199],
+				 "X-Hdr299: 1");
+	}
+}
+
+#undef __HDR100
+#undef __HDR10
+#undef __HDR
+
 #define N 6	// Count of generations
 #define MOVE 1	// Mutations per generation
 
@@ -555,6 +760,126 @@ TEST(http_parser, empty_host)
 		"Host:\r\n"
 		"Connection: close\r\n"
 		"\r\n");
+
+	FOR_REQ("GET / HTTP/1.1\r\n"
+		"User-Agent: Wget/1.13.4 (linux-gnu)\r\n"
+		"Host:\r\n"
+		"\r\n")
+	{
+		TfwStr *h_host = &req->h_tbl->tbl[TFW_HTTP_HDR_HOST];
+
+		EXPECT_TRUE(tfw_str_eq_cstr(h_host, "Host:", 5, 0));
+	}
+
+	EXPECT_BLOCK_REQ("GET / HTTP/1.1\r\n"
+			 "Host: foo.com\r\n"
+			 "Host:\r\n"
+			 "\r\n");
+
+	EXPECT_BLOCK_REQ("GET / HTTP/1.1\r\n"
+			 "Authorization:\r\n"
+			 "\r\n");
+}
+
+TEST(http_parser, parses_resp_date)
+{
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "Date: Mon, 12 Sep 2016 10:21:33 GMT\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		EXPECT_TRUE(resp->flags & TFW_HTTP_HAS_HDR_DATE);
+		EXPECT_TRUE(resp->date);
+	}
+
+	/*
+	 * Whole dates are parsed by the fast path and split ones by FSM,
+	 * the results must be the same.
+	 */
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "Date: Tue, 12 Sep 2017 10:21:33 GMT\r\n"
+		 "Expires: Wed, 13 Sep 2017 10:21:33 GMT\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		EXPECT_EQ(resp->date, 1505211693);
+		EXPECT_EQ(resp->cache_ctl.expires, 1505298093);
+	}
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "Date: Sun, 17 Sep 2017 10:21:33 GMT\r\n"
+		 "Content-Length: 0\r\n"
+		 "\r\n")
+	{
+		EXPECT_EQ(resp->date, 1505643693);
+	}
+
+	/* The weekday skipping mustn't run out of the header line. */
+	EXPECT_BLOCK_RESP("HTTP/1.1 200 OK\r\n"
+			  "Date: Mon,12\r\n"
+			  "Content-Length: 0\r\n"
+			  "\r\n");
+	EXPECT_BLOCK_RESP("HTTP/1.1 200 OK\r\n"
+			  "Date: a\r\n, 12 Sep 2016 10:21:34 GMT\r\n"
+			  "Content-Length: 0\r\n"
+			  "\r\n");
+}
+
+TEST(http_parser, parses_chunked_body)
+{
+	FOR_REQ("POST / HTTP/1.1\r\n"
+		"Transfer-Encoding: chunked\r\n"
+		"\r\n"
+		"5\r\n"
+		"abcde\r\n"
+		"1A;ext=1\r\n"
+		"abcdefghijklmnopqrstuvwxyz\r\n"
+		"0\r\n"
+		"\r\n")
+	{
+		EXPECT_TRUE(req->body.flags & TFW_STR_COMPLETE);
+	}
+
+	/* Leading zeros, bare LF and chunks in one line are slow path. */
+	FOR_RESP("HTTP/1.1 200 OK\r\n"
+		 "Transfer-Encoding: chunked\r\n"
+		 "\r\n"
+		 "00001a\r\n"
+		 "abcdefghijklmnopqrstuvwxyz\n"
+		 "1\r\na\r\n2\r\nab\r\n"
+		 "0\r\n"
+		 "\r\n")
+	{
+		EXPECT_TRUE(resp->body.flags & TFW_STR_COMPLETE);
+	}
+
+	EXPECT_BLOCK_RESP("HTTP/1.1 200 OK\r\n"
+			  "Transfer-Encoding: chunked\r\n"
+			  "\r\n"
+			  "5\r\n"
+			  "abcdeX\r\n"
+			  "0\r\n"
+			  "\r\n");
+
+	/* The chunk size doesn't fit the parser's counter. */
+	EXPECT_BLOCK_RESP("HTTP/1.1 200 OK\r\n"
+			  "Transfer-Encoding: chunked\r\n"
+			  "\r\n"
+			  "80000000\r\n"
+			  "abcde\r\n"
+			  "0\r\n"
+			  "\r\n");
+}
+
+TEST(http_parser, matches_hdr_name_punctuation_exactly)
+{
+	/* 0x1a | 0x20 is ':', so case folding mustn't apply to it. */
+	EXPECT_BLOCK_REQ("GET / HTTP/1.1\r\n"
+			 "Host\x1a foo.com\r\n"
+			 "\r\n");
+	/* And CR | 0x20 is '-'. */
+	EXPECT_BLOCK_REQ("GET / HTTP/1.1\r\n"
+			 "Cache\rControl: no-cache\r\n"
+			 "\r\n");
 }
 
 TEST_SUITE(http_parser)
@@ -563,10 +888,18 @@ TEST_SUITE(http_parser)
 	TEST_RUN(http_parser, parses_req_uri);
 	TEST_RUN(http_parser, fills_hdr_tbl_for_req);
 	TEST_RUN(http_parser, fills_hdr_tbl_for_resp);
+	TEST_RUN(http_parser, parses_long_uri_and_hdrs);
 	TEST_RUN(http_parser, blocks_suspicious_x_forwarded_for_hdrs);
 	TEST_RUN(http_parser, parses_connection_value);
 	TEST_RUN(http_parser, content_length_duplicate);
+	TEST_RUN(http_parser, recognizes_known_hdrs);
+	TEST_RUN(http_parser, indexes_known_hdrs);
+	TEST_RUN(http_parser, stores_hdrs_in_special_slots);
+	TEST_RUN(http_parser, grows_hdr_tbl);
 	TEST_RUN(http_parser, fuzzer);
 	TEST_RUN(http_parser, folding);
 	TEST_RUN(http_parser, empty_host);
+	TEST_RUN(http_parser, parses_resp_date);
+	TEST_RUN(http_parser, matches_hdr_name_punctuation_exactly);
+	TEST_RUN(http_parser, parses_chunked_body);
 }
@@ -51,7 +51,9 @@
 #undef tfw_cli_conn_send
 
 #include "hash.c"
+#include "hpack.c"
 #include "http.c"
+#include "http2.c"
 #include "addr.c"
 #include "ss_skb.c"
 #include "sched.c"
@@ -87,7 +89,8 @@ static struct {
 } mock;
 
 /*
- * Find a specific non-special header field in an HTTP message.
+ * Find a specific header field in an HTTP message. Set-Cookie and
+ * some other headers are stored in special slots of the headers table.
  *
  * This function assumes that the header field name is stored
  * in TfwStr{} after an HTTP message is parsed.
@@ -97,7 +100,7 @@ tfw_http_field_raw(TfwHttpMsg *hm, const char *field_name, size_t len)
 {
 	int i;
 
-	for (i = TFW_HTTP_HDR_RAW; i < hm->h_tbl->off; i++) {
+	for (i = 0; i < hm->h_tbl->off; i++) {
 		TfwStr *hdr_field = &hm->h_tbl->tbl[i];
 		if (tfw_str_eq_cstr(hdr_field, field_name, len,
 				    TFW_STR_EQ_PREFIX | TFW_STR_EQ_CASEI))
@@ -320,14 +323,21 @@ http_parse_req_helper(void)
 }
 
 static int
-http_parse_resp_helper(void)
+__http_parse_resp_helper(TfwHttpMsg *hm)
 {
 	/* XXX reset parser explicitly to be able to call it multiple times */
-	memset(&mock.hmresp->parser, 0, sizeof(mock.hmresp->parser));
-	mock.hmresp->h_tbl->off = TFW_HTTP_HDR_RAW;
-	memset(mock.hmresp->h_tbl->tbl, 0, __HHTBL_SZ(1) * sizeof(TfwStr));
+	memset(&hm->parser, 0, sizeof(hm->parser));
+	hm->h_tbl->off = TFW_HTTP_HDR_RAW;
+	memset(hm->h_tbl->kidx, 0, sizeof(hm->h_tbl->kidx));
+	memset(hm->h_tbl->tbl, 0, hm->h_tbl->size * sizeof(TfwStr));
 
-	return http_parse_helper(mock.hmresp, tfw_http_parse_resp);
+	return http_parse_helper(hm, tfw_http_parse_resp);
+}
+
+static int
+http_parse_resp_helper(void)
+{
+	return __http_parse_resp_helper(mock.hmresp);
 }
 
 TEST(http_sticky, sticky_get_absent)
@@ -524,3 +534,91 @@ TEST_SUITE(http_sticky)
 
 	tfw_http_sticky_exit();
 }
+
+/*
+ * The cache tests are here since cache.c is included into this file.
+ * A cache entry is written to a fake table of one page, which is enough for
+ * a small response, so the tests don't need Tempesta DB.
+ */
+#define CACHE_TEST_TBL_SZ	PAGE_SIZE
+
+TEST(cache, store_and_build_resp)
+{
+	const char *s_req = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	const char *s_resp = "HTTP/1.1 200 OK\r\n"
+			     "Connection: keep-alive\r\n"
+			     "Keep-Alive: timeout=5\r\n"
+			     "Age: 12\r\n"
+			     "Content-Length: 0\r\n"
+			     "\r\n";
+	char date[SLEN(S_V_DATE)];
+	char hdrs[SLEN("Content-Length: 0\r\n" S_F_DATE S_V_DATE S_CRLF) + 1];
+	char *tbl;
+	size_t len;
+	time_t now = tfw_current_timestamp();
+	TDB db = {}, *node_db_orig;
+	TfwCacheEntry *ce;
+	TfwHttpReq *req = (TfwHttpReq *)mock.hmreq;
+	TfwHttpResp *resp = (TfwHttpResp *)mock.hmresp, *cached;
+
+	append_string_to_msg(mock.hmreq, s_req);
+	append_string_to_msg(mock.hmresp, s_resp);
+	EXPECT_EQ(http_parse_req_helper(), 0);
+	EXPECT_EQ(http_parse_resp_helper(), 0);
+	EXPECT_FALSE(resp->flags & TFW_HTTP_HAS_HDR_DATE);
+	req->cache_ctl.timestamp = now;
+	resp->cache_ctl.timestamp = now;
+	resp->date = now;
+
+	tbl = kzalloc(CACHE_TEST_TBL_SZ, GFP_KERNEL);
+	BUG_ON(!tbl);
+	db.hdr = (TdbHdr *)tbl;
+	node_db_orig = c_nodes[numa_node_id()].db;
+	c_nodes[numa_node_id()].db = &db;
+	/* Allocate the record of the entry size as tdb_entry_create() does. */
+	len = __cache_entry_size(resp, req);
+	BUG_ON(len > CACHE_TEST_TBL_SZ - sizeof(TdbVRec));
+	ce = (TfwCacheEntry *)tbl;
+	ce->trec.len = len;
+	EXPECT_ZERO(tfw_cache_copy_resp(ce, resp, req, len));
+
+	/* Hop-by-hop headers and Age are dropped, Date is added. */
+	tfw_http_prep_date_from(date, now);
+	snprintf(hdrs, sizeof(hdrs), "Content-Length: 0\r\n" S_F_DATE "%.*s"
+		 S_CRLF, (int)sizeof(date), date);
+	EXPECT_EQ(ce->hdr_len, strlen(hdrs));
+	EXPECT_ZERO(memcmp(TDB_PTR(db.hdr, ce->hdrs), hdrs, strlen(hdrs)));
+	EXPECT_TRUE(ce->hmflags & TFW_HTTP_HAS_HDR_DATE);
+
+	cached = tfw_cache_build_resp(ce);
+	EXPECT_NOT_NULL(cached);
+	if (cached) {
+		EXPECT_EQ(__http_parse_resp_helper((TfwHttpMsg *)cached), 0);
+		EXPECT_EQ(cached->status, 200);
+		EXPECT_EQ(cached->date, now);
+		EXPECT_TRUE(TFW_STR_EMPTY(&cached->h_tbl->tbl[
+					  TFW_HTTP_HDR_CONNECTION]));
+		EXPECT_TRUE(TFW_STR_EMPTY(&cached->h_tbl->tbl[
+					  TFW_HTTP_HDR_KEEP_ALIVE]));
+		/* The stored Age is accounted in the generated one. */
+		EXPECT_TRUE(cached->cache_ctl.flags & TFW_HTTP_CC_HDR_AGE);
+		EXPECT_GE(cached->cache_ctl.age, 12);
+		EXPECT_LE(cached->cache_ctl.age,
+			  12 + tfw_current_timestamp() - now);
+		tfw_http_msg_free((TfwHttpMsg *)cached);
+	}
+
+	c_nodes[numa_node_id()].db = node_db_orig;
+	kfree(tbl);
+}
+
+TEST_SUITE(cache)
+{
+	TEST_SETUP(http_sticky_suite_setup);
+	TEST_TEARDOWN(http_sticky_suite_teardown);
+
+	/* Known headers parsed as raw ones need the special slots mapping. */
+	tfw_http_msg_init();
+
+	TEST_RUN(cache, store_and_build_resp);
+}
@@ -19,7 +19,9 @@
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <linux/bug.h>
+#include <linux/ctype.h>
 #include <linux/kernel.h>
+#include <linux/timex.h>
 
 #include "str.h"
 #include "test.h"
@@ -520,6 +522,222 @@ TEST(tfw_str_eq_cstr_off, compound)
 
 }
 
+/* URI abs_path alphabet of the HTTP parser. */
+static const TfwStrAlpha uap_a = TFW_STR_ALPHA(0xaffffffa00000000UL,
+					       0x47fffffeafffffffUL);
+static const char uap_chars[] = "abcXYZ019/?=_-.~%";
+static const unsigned char uap_stop[] = { ' ', '"', '\r', 0x7f, 0x81, 0xe1 };
+
+static void
+fill_uap(char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = uap_chars[i % (sizeof(uap_chars) - 1)];
+}
+
+TEST(tfw_memspn, alpha_matches_bitmap)
+{
+	int c;
+
+	for (c = 0; c < 256; ++c)
+		EXPECT_EQ(!!(uap_a.a[c >> 6] & (1UL << (c & 0x3f))),
+			  c < 128 && !!(uap_a.nib[c & 0xf] & (1 << (c >> 4))));
+}
+
+TEST(tfw_memspn, spans_all_lengths_and_alignments)
+{
+	static char buf[32 + 512];
+	const unsigned char *s;
+	int off, len, pos;
+
+	/* Long spans are scanned by vector instructions. */
+	for (off = 0; off < 32; ++off)
+		for (len = 0; len <= 512; len += len < 160 ? 1 : 31) {
+			s = (unsigned char *)buf + off;
+			fill_uap(buf + off, len);
+			EXPECT_EQ(tfw_memspn(s, len, &uap_a), len);
+
+			for (pos = 0; pos < len; pos += pos < 160 ? 3 : 29) {
+				buf[off + pos] = uap_stop[pos
+							  % sizeof(uap_stop)];
+				EXPECT_EQ(tfw_memspn(s, len, &uap_a), pos);
+				buf[off + pos] = 'a';
+			}
+		}
+}
+
+TEST(tfw_memchreol, finds_eol)
+{
+	static unsigned char buf[32 + 512];
+	int off, len, pos;
+
+	for (off = 0; off < 32; off += 5)
+		for (len = 0; len <= 512; len += len < 160 ? 1 : 31) {
+			fill_uap((char *)buf + off, len);
+			EXPECT_NULL(tfw_memchreol(buf + off, len));
+
+			for (pos = 0; pos < len; pos += pos < 160 ? 3 : 29) {
+				buf[off + pos] = pos & 1 ? '\r' : '\n';
+				EXPECT_EQ(tfw_memchreol(buf + off, len),
+					  buf + off + pos);
+				buf[off + pos] = 0x8a;
+			}
+		}
+}
+
+TEST(tfw_strspn, plain_and_compound)
+{
+	static char b1[300], b2[300];
+	TfwStr *s;
+
+	fill_uap(b1, sizeof(b1) - 1);
+	fill_uap(b2, sizeof(b2) - 1);
+
+	s = make_plain_str(b1);
+	EXPECT_EQ(tfw_strspn(s, &uap_a), sizeof(b1) - 1);
+
+	/* The span crosses the chunks boundary. */
+	b2[200] = ' ';
+	s = make_compound_str2(b1, b2);
+	EXPECT_EQ(tfw_strspn(s, &uap_a), sizeof(b1) - 1 + 200);
+
+	b1[1] = 0x80;
+	EXPECT_EQ(tfw_strspn(s, &uap_a), 1);
+}
+
+/* Reference scalar implementations with ASCII case folding. */
+static int
+__ref_lc(int c)
+{
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+static int
+__ref_stricmp(const char *s1, const char *s2, size_t len, int stop)
+{
+	int c1, c2;
+
+	for ( ; len; --len) {
+		c1 = __ref_lc((unsigned char)*s1++);
+		c2 = __ref_lc((unsigned char)*s2++);
+		if (c1 != c2)
+			return stop ? -1 : c1 - c2;
+		if (stop && !c1)
+			return 0;
+		if (stop && c1 == stop)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+fill_mixed_case(char *s1, char *s2, int len)
+{
+	static const char *lc = "content-type; text/html, charset=utf-8[]@`{}";
+	int i, n = strlen(lc);
+
+	for (i = 0; i < len; ++i) {
+		s1[i] = lc[i % n];
+		s2[i] = (i & 1) ? toupper(lc[i % n]) : lc[i % n];
+	}
+}
+
+TEST(tfw_cstricmp, matches_scalar)
+{
+	static const char diff[] = { 'A', 'z', '\0', '@', '[', '`', '{',
+				     '\xc1', '\xe1', '\x80', '\xff' };
+	static char b1[16 + 512], b2[512];
+	int off, len, pos, i, r;
+	char *s1, c;
+
+	for (off = 0; off < 16; off += 3)
+		for (len = 0; len <= 512; len += len < 160 ? 1 : 37) {
+			s1 = b1 + off;
+			fill_mixed_case(s1, b2, len);
+			EXPECT_ZERO(tfw_cstricmp(s1, b2, len));
+
+			for (pos = 0; pos < len; pos += pos < 160 ? 3 : 31)
+				for (i = 0; i < ARRAY_SIZE(diff); ++i) {
+					c = s1[pos];
+					s1[pos] = diff[i];
+					r = __ref_stricmp(s1, b2, len, 0);
+					EXPECT_EQ(tfw_cstricmp(s1, b2, len) > 0,
+						  r > 0);
+					EXPECT_EQ(tfw_cstricmp(s1, b2, len) < 0,
+						  r < 0);
+					s1[pos] = c;
+				}
+		}
+}
+
+TEST(tfw_cstricmpspn, matches_scalar)
+{
+	static const char diff[] = { 'X', '\0', ':', '\xba' };
+	static char b1[16 + 512], b2[512];
+	int off, len, pos, i, r;
+	char *s1, c1, c2;
+
+	for (off = 0; off < 16; off += 5)
+		for (len = 0; len <= 512; len += len < 160 ? 1 : 37) {
+			s1 = b1 + off;
+			fill_mixed_case(s1, b2, len);
+			EXPECT_EQ(tfw_cstricmpspn(s1, b2, len, ':'),
+				  __ref_stricmp(s1, b2, len, ':'));
+
+			for (pos = 0; pos < len; pos += pos < 160 ? 3 : 31)
+				for (i = 0; i < ARRAY_SIZE(diff); ++i) {
+					c1 = s1[pos];
+					c2 = b2[pos];
+					s1[pos] = diff[i];
+					if (i & 1)
+						b2[pos] = diff[i];
+					r = __ref_stricmp(s1, b2, len, ':');
+					EXPECT_EQ(tfw_cstricmpspn(s1, b2, len,
+								  ':'), r);
+					s1[pos] = c1;
+					b2[pos] = c2;
+				}
+		}
+}
+
+/*
+ * Micro-benchmark of case-insensitive comparison against strncasecmp() of
+ * the kernel library.
+ */
+TEST(tfw_cstricmp, benchmark)
+{
+	static const int lens[] = { 8, 16, 32, 64, 256, 1024 };
+	static char b1[1024], b2[1024];
+	unsigned long t0, t1, t2;
+	int i, l, r1 = 0, r2 = 0;
+
+	for (l = 0; l < ARRAY_SIZE(lens); ++l) {
+		fill_mixed_case(b1, b2, lens[l]);
+
+		/* The barriers prevent hoisting of the calls out of loops. */
+		t0 = get_cycles();
+		for (i = 0; i < 10000; ++i) {
+			r1 |= strncasecmp(b1, b2, lens[l]);
+			barrier();
+		}
+		t1 = get_cycles();
+		for (i = 0; i < 10000; ++i) {
+			r2 |= tfw_cstricmp(b1, b2, lens[l]);
+			barrier();
+		}
+		t2 = get_cycles();
+
+		TEST_LOG("stricmp %4d bytes: strncasecmp %lu, tfw_cstricmp %lu"
+			 " cycles\n", lens[l], (t1 - t0) / 10000,
+			 (t2 - t1) / 10000);
+	}
+	EXPECT_ZERO(r1);
+	EXPECT_ZERO(r2);
+}
+
 TEST_SUITE(tfw_str)
 {
 	TEST_SETUP(create_str_pool);
@@ -552,4 +770,13 @@ TEST_SUITE(tfw_str)
 	TEST_RUN(tfw_str_eq_cstr_off, plain);
 	TEST_RUN(tfw_str_eq_cstr_pos, compound);
 	TEST_RUN(tfw_str_eq_cstr_off, compound);
+
+	TEST_RUN(tfw_memspn, alpha_matches_bitmap);
+	TEST_RUN(tfw_memspn, spans_all_lengths_and_alignments);
+	TEST_RUN(tfw_memchreol, finds_eol);
+	TEST_RUN(tfw_strspn, plain_and_compound);
+
+	TEST_RUN(tfw_cstricmp, matches_scalar);
+	TEST_RUN(tfw_cstricmpspn, matches_scalar);
+	TEST_RUN(tfw_cstricmp, benchmark);
 }
@@ -0,0 +1,187 @@
+/**
+ *		Tempesta FW
+ *
+ * HTTP parser throughput benchmark.
+ *
+ * Each corpus file contains one or more pipelined requests or responses
+ * (a file starting with "HTTP/" is treated as responses). The file is parsed
+ * many times with the data split into chunks of several sizes, which
+ * emulates messages received in one SKB, in MSS-sized SKBs and so on, and
+ * parsing speed in bytes per CPU cycle and messages per second is reported.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <getopt.h>
+#include <time.h>
+
+#include "http_parser_env.h"
+
+/* Bytes parsed for each file and chunk size by default. */
+#define BENCH_BYTES		(32 << 20)
+#define BENCH_CHUNKS_MAX	16
+
+static size_t bench_bytes = BENCH_BYTES;
+/* Zero chunk size stands for the whole file in one chunk. */
+static size_t chunks[BENCH_CHUNKS_MAX] = { 0, 1460, 64, 1 };
+static int chunks_n = 4;
+
+static unsigned char *
+read_file(const char *name, size_t *len)
+{
+	FILE *f;
+	long n;
+	unsigned char *data = NULL;
+
+	f = fopen(name, "r");
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) || (n = ftell(f)) <= 0)
+		goto out;
+	rewind(f);
+
+	data = malloc(n);
+	if (data && fread(data, n, 1, f) != 1) {
+		free(data);
+		data = NULL;
+	}
+	*len = n;
+out:
+	fclose(f);
+	return data;
+}
+
+static double
+ts_diff(const struct timespec *t0, const struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void
+bench_file(const char *name)
+{
+	int i, r, type;
+	size_t len, it, iters;
+	unsigned int msgs;
+	unsigned long c0, c1;
+	struct timespec t0, t1;
+	unsigned char *data;
+	double sec;
+
+	data = read_file(name, &len);
+	if (!data) {
+		fprintf(stderr, "cannot read %s\n", name);
+		return;
+	}
+	type = (len > 5 && !memcmp(data, "HTTP/", 5))
+	       ? Conn_HttpSrv
+	       : Conn_HttpClnt;
+
+	/* Validate the corpus before measurements. */
+	r = tfw_env_parse(type, data, len, len, &msgs);
+	if (r != TFW_PASS || !msgs) {
+		fprintf(stderr, "%s: cannot parse, r=%d\n", name, r);
+		goto out;
+	}
+
+	iters = bench_bytes / len ? : 1;
+	for (i = 0; i < chunks_n; ++i) {
+		size_t chunk = chunks[i] ? : len;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		c0 = __builtin_ia32_rdtsc();
+
+		for (it = 0; it < iters; ++it)
+			r = tfw_env_parse(type, data, len, chunk, &msgs);
+
+		c1 = __builtin_ia32_rdtsc();
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		sec = ts_diff(&t0, &t1);
+
+		if (chunks[i])
+			printf("%-32s %8zu", name, chunks[i]);
+		else
+			printf("%-32s %8s", name, "whole");
+		if (r != TFW_PASS) {
+			printf(" cannot parse, r=%d\n", r);
+			continue;
+		}
+		printf(" %12.0f %10.1f %9.3f\n",
+		       iters * msgs / sec,
+		       iters * len / sec / (1 << 20),
+		       (double)iters * len / (c1 - c0));
+	}
+out:
+	free(data);
+}
+
+static int
+parse_chunks(char *arg)
+{
+	char *s;
+
+	for (chunks_n = 0, s = strtok(arg, ","); s; s = strtok(NULL, ",")) {
+		if (chunks_n == BENCH_CHUNKS_MAX)
+			return -EINVAL;
+		chunks[chunks_n++] = strtoul(s, NULL, 10);
+	}
+
+	return chunks_n ? 0 : -EINVAL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "c:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (parse_chunks(optarg))
+				goto usage;
+			break;
+		case 's':
+			bench_bytes = strtoul(optarg, NULL, 10) << 20;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind == argc)
+		goto usage;
+
+	if (tfw_env_init()) {
+		fprintf(stderr, "cannot initialize HTTP parser\n");
+		return 1;
+	}
+
+	printf("%-32s %8s %12s %10s %9s\n",
+	       "file", "chunk", "msgs/s", "MB/s", "B/cycle");
+	for (i = optind; i < argc; ++i)
+		bench_file(argv[i]);
+
+	return 0;
+usage:
+	printf("\nUsage: %s [-c chunks] [-s size] file...\n"
+	       "  -c chunks - comma separated chunk sizes to split data to,"
+	       " 0 is the whole\n"
+	       "              file (default 0,1460,64,1)\n"
+	       "  -s size   - megabytes to parse for each file and chunk"
+	       " size (default %d)\n"
+	       "  file      - requests or responses corpus\n\n",
+	       argv[0], BENCH_BYTES >> 20);
+	return 1;
+}
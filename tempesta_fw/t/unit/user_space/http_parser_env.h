@@ -0,0 +1,196 @@
+/**
+ *		Tempesta FW
+ *
+ * User-space environment for the HTTP parser.
+ *
+ * The parser, HTTP messages, strings and pools are compiled from the module
+ * sources with the kernel emulation headers from ktest. Sockets, connections
+ * and virtual hosts aren't used by the parser, so their headers are replaced
+ * by the minimal definitions below. The vectorized string functions live in
+ * separate translation unit, see the Makefile.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __HTTP_PARSER_ENV_H__
+#define __HTTP_PARSER_ENV_H__
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/kernel.h>
+
+/*
+ * ktest enables debug logging for builds with assertions, but the parser
+ * dumps each character in debug mode, so keep assertions only.
+ */
+#undef DEBUG
+
+/* sync_socket.h */
+#define __SS_SOCK_H__
+#include "ss_skb.h"
+
+typedef struct {
+	int			type;
+} SsProto;
+
+#include "gfsm.h"
+#include "msg.h"
+
+/* peer.h, addr.h, vhost.h */
+#define __PEER_H__
+#define __TFW_ADDR_H__
+#define __TFW_VHOST_H__
+
+typedef struct tfw_vhost_t TfwVhost;
+typedef struct tfw_location_t TfwLocation;
+
+/* connection.h */
+#define __TFW_CONNECTION_H__
+
+enum {
+	__Conn_Bits	= 0x8,
+	Conn_Clnt	= 0x1 << __Conn_Bits,
+	Conn_Srv	= 0x2 << __Conn_Bits,
+	Conn_HttpClnt	= Conn_Clnt | TFW_FSM_HTTP,
+	Conn_HttpSrv	= Conn_Srv | TFW_FSM_HTTP,
+};
+
+typedef struct {
+	SsProto			proto;
+	TfwMsg			*msg;
+} TfwConnection;
+
+#define TFW_CONN_TYPE(c)	((c)->proto.type)
+
+#include "pool.c"
+#include "str.c"
+#include "http_msg.c"
+#include "http_parser.c"
+
+/*
+ * SKB operations from ss_skb.c. HTTP messages are parsed in place and
+ * never rewritten, so only the message allocation is required.
+ */
+struct sk_buff *
+ss_skb_alloc_pages(size_t len)
+{
+	return NULL;
+}
+
+int
+ss_skb_get_room(SsSkbList *skb_list, struct sk_buff *skb, char *pspt,
+		unsigned int len, TfwStr *it)
+{
+	return -ENOMEM;
+}
+
+int
+ss_skb_cutoff_data(SsSkbList *skb_list, const TfwStr *hdr, int skip,
+		   int tail)
+{
+	return -ENOMEM;
+}
+
+static int
+tfw_env_init(void)
+{
+	int r;
+
+	r = tfw_pool_init();
+	if (r)
+		return r;
+
+	return tfw_http_msg_init();
+}
+
+/**
+ * Allocate HTTP message of connection @type. The parsed data is referenced
+ * by header strings along with an SKB, so queue an empty SKB standing for
+ * the data.
+ */
+static TfwHttpMsg *
+tfw_env_msg_alloc(int type)
+{
+	TfwHttpMsg *hm;
+	struct sk_buff *skb;
+
+	hm = tfw_http_msg_alloc(type);
+	if (!hm)
+		return NULL;
+
+	skb = alloc_skb(0, GFP_ATOMIC);
+	if (!skb) {
+		tfw_http_msg_free(hm);
+		return NULL;
+	}
+	ss_skb_queue_tail(&hm->msg.skb_list, skb);
+
+	return hm;
+}
+
+/**
+ * Parse pipelined messages of connection @type from @data of length @len.
+ * The data is passed to the parser by @chunk bytes as if it came in separate
+ * SKBs, and a new message is started right after the end of the previous one
+ * as tfw_http_req_process() does. The number of fully parsed messages is
+ * returned in @msgs.
+ *
+ * @return TFW_PASS if all the data is parsed as complete messages,
+ * TFW_POSTPONE if the last message is incomplete, TFW_BLOCK if a message
+ * is malformed and -ENOMEM on allocation failure.
+ */
+static int
+tfw_env_parse(int type, unsigned char *data, size_t len, size_t chunk,
+	      unsigned int *msgs)
+{
+	int r = TFW_PASS;
+	size_t n, off = 0;
+	TfwHttpMsg *hm = NULL;
+
+	*msgs = 0;
+	while (off < len) {
+		if (!hm) {
+			hm = tfw_env_msg_alloc(type);
+			if (!hm)
+				return -ENOMEM;
+		}
+
+		n = min(chunk, len - off);
+		r = (type & Conn_Clnt)
+		    ? tfw_http_parse_req(hm, data + off, n)
+		    : tfw_http_parse_resp(hm, data + off, n);
+		if (r == TFW_BLOCK)
+			break;
+
+		off += n;
+		if (r == TFW_PASS) {
+			off -= hm->parser.to_go;
+			++*msgs;
+			tfw_http_msg_free(hm);
+			hm = NULL;
+		}
+	}
+
+	tfw_http_msg_free(hm);
+
+	return r;
+}
+
+#endif /* __HTTP_PARSER_ENV_H__ */
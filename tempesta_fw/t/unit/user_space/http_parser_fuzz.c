@@ -0,0 +1,115 @@
+/**
+ *		Tempesta FW
+ *
+ * HTTP parser fuzzing target.
+ *
+ * The input is parsed as pipelined responses if it starts with "HTTP/" and
+ * as requests otherwise, so the benchmark corpus is usable as the seeds.
+ * Besides memory errors and assertions in the parser, the target checks that
+ * the result doesn't depend on how the data is split into SKBs: the input is
+ * parsed as a whole and byte by byte, which passes all the slow paths, and
+ * both the results must be the same.
+ *
+ * Build with -DLIBFUZZER for libFuzzer, otherwise the program parses files
+ * given in the command line or standard input if there are no arguments,
+ * which is suitable for AFL and for reproducing crashes.
+ *
+ * Copyright (C) 2016 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdint.h>
+
+#include "http_parser_env.h"
+
+/* Inputs are copied to exactly sized buffers to catch overreads. */
+#define FUZZ_MAX_LEN		(1 << 20)
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static bool init;
+	int type, r0, r1;
+	unsigned int m0, m1;
+	unsigned char *buf;
+
+	if (!size || size > FUZZ_MAX_LEN)
+		return 0;
+	if (!init) {
+		if (tfw_env_init())
+			abort();
+		init = true;
+	}
+
+	buf = malloc(size);
+	if (!buf)
+		return 0;
+	memcpy(buf, data, size);
+
+	type = (size > 5 && !memcmp(buf, "HTTP/", 5))
+	       ? Conn_HttpSrv
+	       : Conn_HttpClnt;
+	r0 = tfw_env_parse(type, buf, size, size, &m0);
+	r1 = tfw_env_parse(type, buf, size, 1, &m1);
+	if (r0 != r1 || m0 != m1) {
+		fprintf(stderr, "split changes parsing result:"
+			" whole r=%d msgs=%u, by byte r=%d msgs=%u\n",
+			r0, m0, r1, m1);
+		abort();
+	}
+
+	free(buf);
+
+	return 0;
+}
+
+#ifndef LIBFUZZER
+
+static int
+fuzz_file(FILE *f)
+{
+	size_t n;
+	static uint8_t data[FUZZ_MAX_LEN];
+
+	n = fread(data, 1, sizeof(data), f);
+	if (ferror(f))
+		return -EIO;
+
+	return LLVMFuzzerTestOneInput(data, n);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, r = 0;
+	FILE *f;
+
+	if (argc == 1)
+		return fuzz_file(stdin);
+
+	for (i = 1; i < argc && !r; ++i) {
+		f = fopen(argv[i], "r");
+		if (!f) {
+			fprintf(stderr, "cannot open %s\n", argv[i]);
+			return 1;
+		}
+		r = fuzz_file(f);
+		fclose(f);
+	}
+
+	return !!r;
+}
+
+#endif /* LIBFUZZER */
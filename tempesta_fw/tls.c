@@ -65,9 +65,16 @@ tfw_tls_conn_drop(TfwConnection *conn)
 {
 }
 
+/* TODO */
+static void
+tfw_tls_conn_release(TfwConnection *conn)
+{
+}
+
 static TfwConnHooks tls_conn_hooks = {
 	.conn_init	= tfw_tls_conn_init,
 	.conn_drop	= tfw_tls_conn_drop,
+	.conn_release	= tfw_tls_conn_release,
 	.conn_msg_alloc	= tfw_tls_conn_msg_alloc,
 };
 
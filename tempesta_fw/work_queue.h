@@ -50,6 +50,19 @@ void tfw_wq_destroy(TfwRBQueue *wq);
 int __tfw_wq_push(TfwRBQueue *wq, void *ptr, bool sync);
 int tfw_wq_pop(TfwRBQueue *wq, void *buf);
 
+/**
+ * Let the consumer on @cpu know that there are new items in the queue.
+ */
+static inline void
+tfw_wq_kick(int cpu, struct irq_work *work,
+	    void (*local_cpu_cb)(struct irq_work *))
+{
+	if (smp_processor_id() != cpu)
+		irq_work_queue_on(work, cpu);
+	else
+		local_cpu_cb(work);
+}
+
 static inline int
 tfw_wq_push(TfwRBQueue *wq, void *ptr, int cpu, struct irq_work *work,
 	    void (*local_cpu_cb)(struct irq_work *), bool sync)
@@ -58,10 +71,7 @@ tfw_wq_push(TfwRBQueue *wq, void *ptr, int cpu, struct irq_work *work,
 	if (unlikely(r))
 		return r;
 
-	if (smp_processor_id() != cpu)
-		irq_work_queue_on(work, cpu);
-	else
-		local_cpu_cb(work);
+	tfw_wq_kick(cpu, work, local_cpu_cb);
 
 	return 0;
 }